@@ -15,49 +15,71 @@
 #include "esp_qcloud_storage.h"
 #include "esp_qcloud_iothub.h"
 #include "esp_qcloud_prov.h"
+#include "data_template_light.h"
 
 #include "lightbulb.h"
 
 static const char *TAG = "app_main";
 
-/* Callback to handle commands received from the QCloud cloud */
-static esp_err_t light_get_param(const char *id, esp_qcloud_param_val_t *val)
+/* Handlers of the properties, each one is called only for its own property */
+static esp_err_t light_get_power_switch(const char *id, esp_qcloud_param_val_t *val)
 {
-    if (!strcmp(id, "power_switch")) {
-        val->b = lightbulb_get_switch();
-    } else if (!strcmp(id, "value")) {
-        val->i = lightbulb_get_value();
-    } else if (!strcmp(id, "hue")) {
-        val->i = lightbulb_get_hue();
-    } else if (!strcmp(id, "saturation")) {
-        val->i = lightbulb_get_saturation();
-    }
+    val->b = lightbulb_get_switch();
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Report id: %s, val: %d", id, val->i);
+static esp_err_t light_get_value(const char *id, esp_qcloud_param_val_t *val)
+{
+    val->i = lightbulb_get_value();
+    return ESP_OK;
+}
 
+static esp_err_t light_get_hue(const char *id, esp_qcloud_param_val_t *val)
+{
+    val->i = lightbulb_get_hue();
     return ESP_OK;
 }
 
-/* Callback to handle commands received from the QCloud cloud */
-static esp_err_t light_set_param(const char *id, const esp_qcloud_param_val_t *val)
+static esp_err_t light_get_saturation(const char *id, esp_qcloud_param_val_t *val)
+{
+    val->i = lightbulb_get_saturation();
+    return ESP_OK;
+}
+
+static esp_err_t light_set_power_switch(const char *id, const esp_qcloud_param_val_t *val)
+{
+    ESP_LOGI(TAG, "Received id: %s, val: %d", id, val->b);
+    esp_err_t err = lightbulb_set_switch(val->b);
+
+    /* Report driver changes to the cloud side, only the properties that changed are sent */
+    esp_qcloud_iothub_report_changed_property();
+    return err;
+}
+
+static esp_err_t light_set_value(const char *id, const esp_qcloud_param_val_t *val)
 {
-    esp_err_t err = ESP_FAIL;
     ESP_LOGI(TAG, "Received id: %s, val: %d", id, val->i);
+    esp_err_t err = lightbulb_set_value(val->i);
 
-    if (!strcmp(id, "power_switch")) {
-        err = lightbulb_set_switch(val->b);
-    } else if (!strcmp(id, "value")) {
-        err = lightbulb_set_value(val->i);
-    } else if (!strcmp(id, "hue")) {
-        err = lightbulb_set_hue(val->i);
-    } else if (!strcmp(id, "saturation")) {
-        err = lightbulb_set_saturation(val->i);
-    } else {
-        ESP_LOGW(TAG, "This parameter is not supported");
-    }
+    esp_qcloud_iothub_report_changed_property();
+    return err;
+}
 
-    /* Report driver changes to the cloud side */
-    esp_qcloud_iothub_report_all_property();
+static esp_err_t light_set_hue(const char *id, const esp_qcloud_param_val_t *val)
+{
+    ESP_LOGI(TAG, "Received id: %s, val: %d", id, val->i);
+    esp_err_t err = lightbulb_set_hue(val->i);
+
+    esp_qcloud_iothub_report_changed_property();
+    return err;
+}
+
+static esp_err_t light_set_saturation(const char *id, const esp_qcloud_param_val_t *val)
+{
+    ESP_LOGI(TAG, "Received id: %s, val: %d", id, val->i);
+    esp_err_t err = lightbulb_set_saturation(val->i);
+
+    esp_qcloud_iothub_report_changed_property();
     return err;
 }
 
@@ -67,10 +89,27 @@ static void event_handler(void *arg, esp_event_base_t event_base,
 {
     switch (event_id) {
         case QCLOUD_EVENT_IOTHUB_INIT_DONE:
-            esp_qcloud_iothub_report_device_info();
             ESP_LOGI(TAG, "QCloud Initialised");
             break;
 
+        case QCLOUD_EVENT_IOTHUB_CONNECTING:
+            ESP_LOGI(TAG, "Connecting to QCloud");
+            break;
+
+        case QCLOUD_EVENT_IOTHUB_CONNECTED:
+            /* The connection is set up in the background, report once it is up */
+            esp_qcloud_iothub_report_device_info();
+            ESP_LOGI(TAG, "QCloud connected");
+            break;
+
+        case QCLOUD_EVENT_IOTHUB_DISCONNECTED:
+            ESP_LOGW(TAG, "QCloud disconnected, local control keeps working");
+            break;
+
+        case QCLOUD_EVENT_IOTHUB_BACKOFF:
+            ESP_LOGI(TAG, "Reconnecting to QCloud in %"PRIu32" ms", *(uint32_t *)event_data);
+            break;
+
         case QCLOUD_EVENT_IOTHUB_BOUND_DEVICE:
 
 #ifdef CONFIG_LIGHT_PROVISIONING_SOFTAPCONFIG
@@ -283,13 +322,17 @@ void app_main()
     ESP_ERROR_CHECK(esp_qcloud_create_device());
     /**< Configure the version of the device, and use this information to determine whether to OTA */
     ESP_ERROR_CHECK(esp_qcloud_device_add_fw_version("0.0.1"));
-    /**< Register the properties of the device */
-    ESP_ERROR_CHECK(esp_qcloud_device_add_property("power_switch", QCLOUD_VAL_TYPE_BOOLEAN));
-    ESP_ERROR_CHECK(esp_qcloud_device_add_property("hue", QCLOUD_VAL_TYPE_INTEGER));
-    ESP_ERROR_CHECK(esp_qcloud_device_add_property("saturation", QCLOUD_VAL_TYPE_INTEGER));
-    ESP_ERROR_CHECK(esp_qcloud_device_add_property("value", QCLOUD_VAL_TYPE_INTEGER));
-    /**< The processing function of the communication between the device and the server */
-    ESP_ERROR_CHECK(esp_qcloud_device_add_property_cb(light_get_param, light_set_param));
+    /**< Add the properties described by data_template_light.json, generated at build time */
+    ESP_ERROR_CHECK(esp_qcloud_device_add_data_template(&data_template_light));
+    /**< Bind the processing function of each property */
+    ESP_ERROR_CHECK(esp_qcloud_device_add_property_handler("power_switch", QCLOUD_VAL_TYPE_BOOLEAN,
+                    light_get_power_switch, light_set_power_switch));
+    ESP_ERROR_CHECK(esp_qcloud_device_add_property_handler("hue", QCLOUD_VAL_TYPE_INTEGER,
+                    light_get_hue, light_set_hue));
+    ESP_ERROR_CHECK(esp_qcloud_device_add_property_handler("saturation", QCLOUD_VAL_TYPE_INTEGER,
+                    light_get_saturation, light_set_saturation));
+    ESP_ERROR_CHECK(esp_qcloud_device_add_property_handler("value", QCLOUD_VAL_TYPE_INTEGER,
+                    light_get_value, light_set_value));
     
     /**
      * @brief Initialize Wi-Fi.
@@ -0,0 +1,84 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Reconnect policy.
+ */
+typedef struct {
+    uint32_t base_ms;       /**< Shortest delay */
+    uint32_t cap_ms;        /**< Longest delay */
+    uint32_t stable_ms;     /**< A connection lasting this long resets the delay to `base_ms` */
+} esp_qcloud_backoff_config_t;
+
+/**
+ * @brief Reconnect state of a connection.
+ */
+typedef struct {
+    esp_qcloud_backoff_config_t config;
+    uint32_t delay_ms;      /**< Last delay, 0 after a reset */
+    uint32_t attempt;       /**< Delays returned since the last reset */
+    uint32_t connected_ms;  /**< When the connection was established */
+    bool connected;
+} esp_qcloud_backoff_t;
+
+/**
+ * @brief Initialize the reconnect state.
+ *
+ * @param[out] backoff Reconnect state.
+ * @param[in]  config  Reconnect policy.
+ */
+void esp_qcloud_backoff_init(esp_qcloud_backoff_t *backoff, const esp_qcloud_backoff_config_t *config);
+
+/**
+ * @brief Forget the previous delays, the next one starts from `base_ms` again.
+ *
+ * @param[in] backoff Reconnect state.
+ */
+void esp_qcloud_backoff_reset(esp_qcloud_backoff_t *backoff);
+
+/**
+ * @brief Record that the connection is established.
+ *
+ * @param[in] backoff Reconnect state.
+ * @param[in] now_ms  Current time in milliseconds, any monotonic clock.
+ */
+void esp_qcloud_backoff_connected(esp_qcloud_backoff_t *backoff, uint32_t now_ms);
+
+/**
+ * @brief Get the delay before the next connection attempt.
+ *
+ * @note Decorrelated jitter: the delay is drawn uniformly between `base_ms` and
+ *       three times the previous delay, then capped by `cap_ms`. Devices that
+ *       lose the connection at the same moment spread their attempts instead
+ *       of retrying in lockstep. If the connection lasted `stable_ms` the delay
+ *       restarts from `base_ms`, a connection dropping sooner keeps growing it.
+ *
+ * @param[in] backoff Reconnect state.
+ * @param[in] now_ms  Current time in milliseconds, same clock as esp_qcloud_backoff_connected().
+ * @return Delay in milliseconds
+ */
+uint32_t esp_qcloud_backoff_next(esp_qcloud_backoff_t *backoff, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
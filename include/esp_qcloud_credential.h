@@ -0,0 +1,85 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE   (32)    /**< SHA256 */
+
+/**
+ * @brief Keys derived from the device secret.
+ */
+typedef enum {
+    QCLOUD_CREDENTIAL_MQTT = 0, /**< HMAC-SHA256 keyed with the base64 decoded secret, signs the MQTT username */
+    QCLOUD_CREDENTIAL_LOG,      /**< HMAC-SHA1 keyed with the secret string, signs the log uploads */
+    QCLOUD_CREDENTIAL_MAX,
+} esp_qcloud_credential_key_t;
+
+/**
+ * @brief Prepare the keys of the device secret.
+ *
+ * @note The secret is decoded once and the inner and outer HMAC pads are
+ *       hashed once, signing then only hashes the message. Signing does not
+ *       modify the prepared state, so several tasks can sign at the same time.
+ *
+ * @param[in] device_secret Device secret, an empty string in certificate mode.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_ARG: the secret is not valid base64, only the log key is prepared
+ */
+esp_err_t esp_qcloud_credential_init(const char *device_secret);
+
+/**
+ * @brief Sign data with a prepared key.
+ *
+ * @param[in]  key         Key to sign with.
+ * @param[in]  data        Data to sign.
+ * @param[in]  size        Size of the data.
+ * @param[out] digest      Signature, at least QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE bytes.
+ * @param[out] digest_size Size of the signature, may be NULL.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_STATE: the key is not prepared
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_credential_sign(esp_qcloud_credential_key_t key, const void *data, size_t size,
+                                     uint8_t *digest, size_t *digest_size);
+
+/**
+ * @brief Sign data with a prepared key, the signature is written as lowercase hex.
+ *
+ * @param[in]  key      Key to sign with.
+ * @param[in]  data     Data to sign.
+ * @param[in]  size     Size of the data.
+ * @param[out] hex      Signature terminated by '\0'.
+ * @param[in]  hex_size Size of `hex`, at least twice the digest plus one.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_SIZE: `hex` is too small
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_credential_sign_hex(esp_qcloud_credential_key_t key, const void *data, size_t size,
+                                         char *hex, size_t hex_size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -0,0 +1,107 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_qcloud_iothub.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Description of a property or a parameter in the data template.
+ *
+ * @note The tables are generated by `qcloud_data_template_generate()` in
+ *       project_include.cmake from the JSON exported by the QCloud console.
+ */
+typedef struct {
+    const char *id;                     /**< Identifier */
+    uint32_t hash;                      /**< esp_qcloud_hash_str() of the identifier */
+    esp_qcloud_param_val_type_t type;   /**< Value type */
+    bool writable;                      /**< The mode is "rw", the cloud can control it */
+    double min;                         /**< Minimum of a number, minimum length of a string */
+    double max;                         /**< Maximum of a number, maximum length of a string */
+    const int32_t *enum_value;          /**< Valid values of an enum */
+    uint16_t enum_num;                  /**< Number of the valid values */
+} esp_qcloud_property_schema_t;
+
+/**
+ * @brief Description of an action in the data template.
+ */
+typedef struct {
+    const char *id;
+    uint32_t hash;
+    const esp_qcloud_property_schema_t *input;
+    uint16_t input_num;
+    const esp_qcloud_property_schema_t *output;
+    uint16_t output_num;
+} esp_qcloud_action_schema_t;
+
+/**
+ * @brief Description of an event in the data template.
+ */
+typedef struct {
+    const char *id;
+    uint32_t hash;
+    esp_qcloud_event_type_t type;
+    const esp_qcloud_property_schema_t *param;
+    uint16_t param_num;
+} esp_qcloud_event_schema_t;
+
+/**
+ * @brief Data template of a product.
+ *
+ * @note `property_slot` is the open addressed index of the properties built at
+ *       compile time, a slot holds the position in `property` plus one and the
+ *       lookup starts from `hash & property_mask`.
+ */
+typedef struct {
+    const char *product_id;
+    const esp_qcloud_property_schema_t *property;
+    uint16_t property_num;
+    const uint16_t *property_slot;
+    uint16_t property_mask;
+    const esp_qcloud_action_schema_t *action;
+    uint16_t action_num;
+    const esp_qcloud_event_schema_t *event;
+    uint16_t event_num;
+} esp_qcloud_data_template_t;
+
+/**
+ * @brief Add all the properties described by the data template.
+ *
+ * @note The ids and the index are used from flash. Values set by the cloud are
+ *       checked against the types, ranges and enums of the template before the
+ *       set callback is called. Handlers can still be bound with
+ *       esp_qcloud_device_add_property_handler() or esp_qcloud_device_add_property_cb().
+ *
+ * @param[in] data_template Data template, must stay valid forever.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_STATE: properties have already been added
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_device_add_data_template(const esp_qcloud_data_template_t *data_template);
+
+/**
+ * @brief Get the data template added by esp_qcloud_device_add_data_template().
+ *
+ * @return Pointer to the data template, NULL if no template is added.
+ */
+const esp_qcloud_data_template_t *esp_qcloud_device_get_data_template(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
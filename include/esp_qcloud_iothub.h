@@ -20,6 +20,7 @@
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <sdkconfig.h>
 
 #include "esp_qcloud_mem.h"
 #include "esp_qcloud_utils.h"
@@ -58,6 +59,10 @@ typedef enum {
     QCLOUD_EVENT_IOTHUB_BIND_EXCEPTION,   /**< QCloud bind exception */
     QCLOUD_EVENT_IOTHUB_RECEIVE_STATUS,   /**< QCloud receive status message */
     QCLOUD_EVENT_LOG_FLASH_FULL,          /**< QCloud log storage full */
+    QCLOUD_EVENT_IOTHUB_CONNECTING,       /**< QCloud connection attempt started */
+    QCLOUD_EVENT_IOTHUB_CONNECTED,        /**< QCloud connected */
+    QCLOUD_EVENT_IOTHUB_DISCONNECTED,     /**< QCloud connection lost */
+    QCLOUD_EVENT_IOTHUB_BACKOFF,          /**< QCloud waits before reconnecting, the data is the delay in ms as uint32_t */
 } esp_qcloud_iothub_event_t;
 
 /**
@@ -121,7 +126,6 @@ typedef enum {
 typedef struct esp_qcloud_param {
     const char *id;
     esp_qcloud_param_val_t value;
-    SLIST_ENTRY(esp_qcloud_param) next;    //!< next command in the list
 } esp_qcloud_param_t;
 
 typedef struct esp_qcloud_method_extra {
@@ -133,10 +137,42 @@ typedef struct esp_qcloud_method_extra {
     uint32_t code;           /**< Exist only in action_reply and control reply*/
 } esp_qcloud_method_extra_val_t;
 
+/**
+ * @brief Counters of the report scheduler.
+ */
+typedef struct {
+    uint32_t posted;    /**< Reports handed to the scheduler */
+    uint32_t merged;    /**< Reports merged into a report that was still pending */
+    uint32_t dropped;   /**< Property updates that did not fit the pending report and reports failed to publish */
+    uint32_t sent;      /**< Reports published by the scheduler */
+    uint32_t unchanged; /**< Reports of the changed properties not published, no property changed */
+} esp_qcloud_iothub_report_stats_t;
+
+/**
+ * @brief Occupancy of the pool of reports, events and action replies.
+ */
+typedef struct {
+    uint32_t size;      /**< Number of the methods in the pool */
+    uint32_t used;      /**< Methods of the pool in use */
+    uint32_t peak;      /**< Maximum of `used` */
+    uint32_t acquired;  /**< Methods created */
+    uint32_t fallback;  /**< Methods allocated from the heap because the pool was empty */
+} esp_qcloud_iothub_pool_stats_t;
+
+/**
+ * @brief A report, event or action reply, created with a single allocation.
+ *
+ * @note The params are kept in the order they are added. The strings added by
+ *       esp_qcloud_iothub_param_add_string() and the event id are copied into `arena`.
+ */
 typedef struct esp_qcloud_method {
     esp_qcloud_method_type_t method_type;
-    esp_qcloud_method_extra_val_t *extra_val;
-    SLIST_HEAD(method_param_list_, esp_qcloud_param) method_param_list;
+    esp_qcloud_method_extra_val_t *extra_val;  /**< Points to `extra` */
+    esp_qcloud_method_extra_val_t extra;
+    uint16_t param_num;
+    esp_qcloud_param_t param[CONFIG_QCLOUD_METHOD_PARAM_MAX];
+    uint16_t arena_len;                        /**< Bytes of the arena in use */
+    char arena[CONFIG_QCLOUD_METHOD_ARENA_SIZE];
 } esp_qcloud_method_t;
 
 /**
@@ -267,6 +303,39 @@ const char *esp_qcloud_get_private_key(void);
  */
 esp_err_t esp_qcloud_device_add_property(const char *id, esp_qcloud_param_val_type_t type);
 
+/**
+ * @brief Add a property with its own handlers.
+ *
+ * @note The property is looked up by a hash of the id, the handlers are called without
+ *       comparing the id against every property. A NULL handler falls back to the one
+ *       added by esp_qcloud_device_add_property_cb(). Adding an existing property updates
+ *       its type and handlers.
+ *
+ * @param[in] id property identifier.
+ * @param[in] type property type, the value passed to set_cb is converted to this type.
+ * @param[in] get_cb Get param interface of this property.
+ * @param[in] set_cb Set param interface of this property.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_device_add_property_handler(const char *id, esp_qcloud_param_val_type_t type,
+        const esp_qcloud_get_param_t get_cb, const esp_qcloud_set_param_t set_cb);
+
+/**
+ * @brief Set the minimum change of a float property that needs to be reported.
+ *
+ * @note Used by esp_qcloud_iothub_report_changed_property(), the default is 1e-4.
+ *
+ * @param[in] id property identifier.
+ * @param[in] epsilon Minimum change, must not be negative.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: the property is not added
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_device_set_property_epsilon(const char *id, float epsilon);
+
 /**
  * @brief Set local properties.
  *
@@ -300,6 +369,9 @@ esp_err_t esp_qcloud_handle_get_param(const cJSON *request_data, cJSON *reply_da
 /**
  * @brief Initialize Qcloud and establish MQTT service.
  *
+ * @note Returns without waiting for the connection, follow it with the
+ *       QCLOUD_EVENT_IOTHUB_CONNECTING/CONNECTED/DISCONNECTED/BACKOFF events.
+ *
  * @return
  *     - ESP_OK: succeed
  *     - others: fail
@@ -309,6 +381,9 @@ esp_err_t esp_qcloud_iothub_init(void);
 /**
  * @brief Run Qcloud service and register related parameters.
  *
+ * @note Does not block, binding with a stored token, getting the log level and
+ *       reporting all the properties are done once the cloud is connected.
+ *
  * @return
  *     - ESP_OK: succeed
  *     - others: fail
@@ -367,9 +442,43 @@ esp_err_t esp_qcloud_iothub_report_device_info(void);
  */
 esp_err_t esp_qcloud_iothub_report_all_property(void);
 
+/**
+ * @brief Report the properties that changed since the last acknowledged report.
+ *
+ * @note The value of each property is compared with the one the cloud acknowledged
+ *       in the last report_reply, nothing is published if no property changed.
+ *
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_iothub_report_changed_property(void);
+
+/**
+ * @brief Get the counters of the report scheduler.
+ *
+ * @param[out] stats Counters.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_SUPPORTED: CONFIG_QCLOUD_REPORT_SCHEDULER is disabled
+ */
+esp_err_t esp_qcloud_iothub_get_report_stats(esp_qcloud_iothub_report_stats_t *stats);
+
+/**
+ * @brief Get the occupancy of the pool of reports, events and action replies.
+ *
+ * @param[out] stats Counters.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_ARG: stats is NULL
+ */
+esp_err_t esp_qcloud_iothub_get_pool_stats(esp_qcloud_iothub_pool_stats_t *stats);
+
 /**
  * @brief Get Qcloud service status.
  *
+ * @note Follows the MQTT connection, false while reconnecting.
+ *
  * @return true Connect
  * @return false Disconnect
  */
@@ -397,6 +506,7 @@ esp_err_t esp_qcloud_iothub_ota_enable(void);
  * @param[in] value Parameter value.
  * @return
  *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the method is full
  *     - others: fail
  */
 esp_err_t esp_qcloud_iothub_param_add_int(esp_qcloud_method_t *method, char *id, int value);
@@ -409,6 +519,7 @@ esp_err_t esp_qcloud_iothub_param_add_int(esp_qcloud_method_t *method, char *id,
  * @param[in] value Parameter value.
  * @return
  *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the method is full
  *     - others: fail
  */
 esp_err_t esp_qcloud_iothub_param_add_float(esp_qcloud_method_t *method, char *id, float value);
@@ -416,11 +527,14 @@ esp_err_t esp_qcloud_iothub_param_add_float(esp_qcloud_method_t *method, char *i
 /**
  * @brief Add char type data to the handle method.
  *
+ * @note The string is copied into the arena of the method.
+ *
  * @param[in] method Method handle.
  * @param[in] id Parameter id.
  * @param[in] value Parameter value.
  * @return
  *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the method is full
  *     - others: fail
  */
 esp_err_t esp_qcloud_iothub_param_add_string(esp_qcloud_method_t *method, char *id, char *value);
@@ -433,6 +547,7 @@ esp_err_t esp_qcloud_iothub_param_add_string(esp_qcloud_method_t *method, char *
  * @param[in] value Parameter value.
  * @return
  *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the method is full
  *     - others: fail
  */
 esp_err_t esp_qcloud_iothub_param_add_bool(esp_qcloud_method_t *method, char *id, bool value);
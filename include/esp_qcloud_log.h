@@ -70,6 +70,16 @@ typedef struct {
     char data[0];               /**< Log data */
 } esp_qcloud_log_queue_t;
 
+/**
+ * @brief Counters of the log rings
+ */
+typedef struct {
+    uint32_t ring_size;         /**< Size of the rings of all the cores */
+    uint32_t ring_used_peak;    /**< Most bytes used at once in a ring */
+    uint32_t written;           /**< Lines written to the rings */
+    uint32_t dropped;           /**< Lines only printed to the uart as the ring was full */
+} esp_qcloud_log_stats_t;
+
 /**
  * @brief  Get the configuration of the log during wireless debugging
  *
@@ -92,6 +102,48 @@ esp_err_t esp_qcloud_log_get_config(esp_qcloud_log_config_t *config);
  */
 esp_err_t esp_qcloud_log_set_config(const esp_qcloud_log_config_t *config);
 
+/**
+ * @brief  Set the levels of the logs of one tag, they take the place of the
+ *         configuration for this tag
+ *
+ * @note   Lines above the highest level of the configuration and all the tags
+ *         are rejected before they are formatted. esp_log_level_set() still
+ *         filters the tag first.
+ *
+ * @param  tag    Tag of the logs, up to 31 characters
+ * @param  config Levels of the tag, NULL to follow the configuration again
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG: the tag is longer
+ *     - ESP_ERR_NO_MEM: the levels of 8 tags are set already
+ *     - ESP_ERR_NOT_SUPPORTED: log is not initialized
+ */
+esp_err_t esp_qcloud_log_set_tag_config(const char *tag, const esp_qcloud_log_config_t *config);
+
+/**
+ * @brief  Get the levels of the logs of one tag
+ *
+ * @param  tag    Tag of the logs
+ * @param  config Levels of the tag
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_FOUND: the tag follows the configuration
+ */
+esp_err_t esp_qcloud_log_get_tag_config(const char *tag, esp_qcloud_log_config_t *config);
+
+/**
+ * @brief  Get the counters of the log rings
+ *
+ * @param  stats Counters
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG
+ */
+esp_err_t esp_qcloud_log_get_stats(esp_qcloud_log_stats_t *stats);
+
 /**
  * @brief Init log mdebug
  *        - Set log mdebug configuration
@@ -111,17 +163,141 @@ esp_err_t esp_qcloud_log_init(const esp_qcloud_log_config_t *config);
  */
 esp_err_t esp_qcloud_log_deinit(void);
 
+/**
+ * @brief Counters of the log uploads
+ */
+typedef struct {
+    uint32_t requests;          /**< HTTP requests accepted by the server */
+    uint32_t failed;            /**< HTTP requests failed, their lines are dropped */
+    uint32_t lines;             /**< Lines uploaded */
+    uint32_t dropped;           /**< Lines dropped while both batches were busy */
+    uint32_t bytes;             /**< Size of the uploaded batches */
+    uint32_t sent_bytes;        /**< Size of the request bodies, smaller than `bytes` when compressed */
+    uint32_t latency_avg_ms;    /**< Average time of an HTTP request */
+    uint32_t latency_max_ms;    /**< Longest time of an HTTP request */
+} esp_qcloud_log_iothub_stats_t;
+
 /**
  * @brief  Send log information to Tencent Cloud server
  *
- * @param  config The configuration of the log
+ * @note   The line is added to a batch, which is signed once and uploaded by a
+ *         task of its own when CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE is reached
+ *         or CONFIG_QCLOUD_LOG_UPLOAD_INTERVAL_MS after its first line.
+ *
+ * @param  data     Log line
+ * @param  size     Size of the log line
+ * @param  level    Level of the log line
+ * @param  log_time Time of the log line
  *
  * @return
  *     - ESP_OK
- *     - ESP_FAIL
+ *     - ESP_ERR_NOT_SUPPORTED: iothub is not connected
+ *     - ESP_ERR_NO_MEM: both batches are busy, the line is dropped
  */
 esp_err_t esp_qcloud_log_iothub_write(const char *data, size_t size, esp_log_level_t level, const struct tm *log_time);
 
+/**
+ * @brief  Get the counters of the log uploads
+ *
+ * @param  stats Counters
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG
+ */
+esp_err_t esp_qcloud_log_iothub_get_stats(esp_qcloud_log_iothub_stats_t *stats);
+
+/**
+ * @brief Counters of the log in flash
+ *
+ * @note The flash cache is disabled while the flash is programmed or erased.
+ */
+typedef struct {
+    uint32_t records;               /**< Records written */
+    uint32_t flushes;               /**< Flushes of the staging buffer */
+    uint32_t programs;              /**< Flash programs, including the segment headers */
+    uint32_t program_bytes;         /**< Bytes programmed */
+    uint32_t program_time_us;       /**< Time spent programming */
+    uint32_t program_time_max_us;   /**< Longest program */
+    uint32_t erases;                /**< Segments erased */
+    uint32_t erase_time_us;         /**< Time spent erasing */
+    uint32_t stage_bytes;           /**< Bytes of the records flushed from the staging buffer */
+    uint32_t flush_bytes;           /**< Bytes they took in flash, fewer when compressed */
+    uint32_t compress_time_us;      /**< Time spent compressing them */
+    uint32_t foreign_skipped;       /**< Binary records of another firmware skipped by the reads */
+} esp_qcloud_log_flash_stats_t;
+
+/**
+ * @brief  Get the counters of the log in flash
+ *
+ * @param  stats Counters
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG
+ */
+esp_err_t esp_qcloud_log_flash_get_stats(esp_qcloud_log_flash_stats_t *stats);
+
+/**
+ * @brief Index of a segment of the log in flash
+ */
+typedef struct {
+    uint32_t seq;                               /**< Segments are written by increasing seq */
+    uint32_t time_min;                          /**< Unix time of the oldest record, UINT32_MAX if no record */
+    uint32_t time_max;                          /**< Unix time of the newest record */
+    uint16_t level_num[ESP_LOG_VERBOSE + 1];    /**< Records of each level, saturated */
+} esp_qcloud_log_flash_index_t;
+
+/**
+ * @brief Records to read from the log in flash, and where the read stopped
+ *
+ * @note Zero the whole structure before the first read, then set the filter.
+ */
+typedef struct {
+    uint32_t time_start;    /**< Unix time of the first record, inclusive */
+    uint32_t time_end;      /**< Unix time after the last record, 0 for no end */
+    esp_log_level_t level;  /**< Records of this level or more severe */
+    uint32_t seq;           /**< Position of the next read, private */
+    uint32_t offset;
+    uint16_t block_offset;
+    bool in_line;
+} esp_qcloud_log_flash_range_t;
+
+/**
+ * @brief  Get the index of the segments of the log in flash, from the oldest one
+ *
+ * @param  index Index of the segments
+ * @param  num   Size of `index` as input, segments copied as output
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG
+ *     - ESP_FAIL: the log in flash is not initialized
+ */
+esp_err_t esp_qcloud_log_flash_get_index(esp_qcloud_log_flash_index_t *index, size_t *num);
+
+/**
+ * @brief  Read the records of a time range and a level from the log in flash
+ *
+ * @note   The read does not consume the log, the position of
+ *         esp_qcloud_log_flash_read() is kept. Segments without a matching
+ *         record are skipped by their index. Records are copied whole, in the
+ *         same form as esp_qcloud_log_flash_read(), call again until
+ *         ESP_ERR_NOT_FOUND. Records written later are found by the next call.
+ *
+ * @param  range Filter and position
+ * @param  data  Buffer of the records
+ * @param  size  Size of the buffer as input, larger than a time prefix (22 bytes),
+ *               bytes copied as output
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_FOUND: no more record
+ *     - ESP_ERR_INVALID_ARG
+ *     - ESP_FAIL: the log in flash is not initialized
+ */
+esp_err_t esp_qcloud_log_flash_read_range(esp_qcloud_log_flash_range_t *range, char *data, size_t *size);
+
 /**
  * @brief Read memory data in flash
  *
@@ -15,6 +15,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include <esp_err.h>
 
@@ -36,6 +38,75 @@ typedef struct {
     char *server_cert;    /**< Server Certificate in NULL terminate PEM format */
 } esp_qcloud_mqtt_config_t;
 
+/**
+ * @brief Classes of the outbound messages, a lower value is published first.
+ */
+typedef enum {
+    QCLOUD_MQTT_PRIO_CONTROL = 0, /**< Replies to control and action requests */
+    QCLOUD_MQTT_PRIO_EVENT,       /**< Events and OTA progress */
+    QCLOUD_MQTT_PRIO_REPORT,      /**< Property reports */
+    QCLOUD_MQTT_PRIO_LOG,         /**< Log upload */
+    QCLOUD_MQTT_PRIO_MAX,
+} esp_qcloud_mqtt_prio_t;
+
+/** ESP QCloud MQTT Publish completion callback prototype
+ *
+ * Called from the MQTT task once the broker acknowledged the message, or from
+ * the publish task if the message could not be delivered.
+ *
+ * @param[in] msg_id Message id assigned by esp-mqtt, -1 if the message never reached esp-mqtt
+ * @param[in] result ESP_OK if acknowledged, ESP_ERR_TIMEOUT if not acknowledged in time, ESP_FAIL otherwise
+ * @param[in] priv_data The private data passed when publishing
+ */
+typedef void (*esp_qcloud_mqtt_publish_cb_t)(int msg_id, esp_err_t result, void *priv_data);
+
+/**
+ * @brief Counters of the publish queue.
+ */
+typedef struct {
+    uint32_t submitted;                        /**< Messages accepted into the queue */
+    uint32_t rejected;                         /**< Messages rejected because the queue of the class was full */
+    uint32_t published;                        /**< Messages acknowledged by the broker */
+    uint32_t failed;                           /**< Messages refused by esp-mqtt, expired or timed out */
+    uint32_t queued[QCLOUD_MQTT_PRIO_MAX];     /**< Messages waiting in the queue of each class */
+    uint32_t inflight;                         /**< Messages handed to esp-mqtt and not acknowledged */
+    uint32_t queue_latency_avg_ms;             /**< Time from submission until handed to esp-mqtt */
+    uint32_t queue_latency_max_ms;
+    uint32_t ack_latency_avg_ms;               /**< Time from submission until acknowledged */
+    uint32_t ack_latency_max_ms;
+} esp_qcloud_mqtt_publish_stats_t;
+
+/**
+ * @brief Counters of the connections and the subscriptions.
+ */
+typedef struct {
+    uint32_t connected;                        /**< Times connected to the broker */
+    uint32_t session_resumed;                  /**< Connections that resumed the broker session */
+    uint32_t subscribe_packets;                /**< SUBSCRIBE packets sent */
+    uint32_t subscribe_topics;                 /**< Topic filters sent in the SUBSCRIBE packets */
+    uint32_t ready_ms;                         /**< Time from the last CONNACK until all the SUBACKs */
+    uint32_t ready_max_ms;
+} esp_qcloud_mqtt_connect_stats_t;
+
+/**
+ * @brief States of the connection to the broker.
+ */
+typedef enum {
+    QCLOUD_MQTT_STATE_CONNECTING = 0, /**< A connection attempt starts */
+    QCLOUD_MQTT_STATE_CONNECTED,      /**< Connected, the subscriptions are being sent */
+    QCLOUD_MQTT_STATE_DISCONNECTED,   /**< An established connection is lost */
+    QCLOUD_MQTT_STATE_BACKOFF,        /**< Waiting before the next connection attempt */
+} esp_qcloud_mqtt_state_t;
+
+/** ESP QCloud MQTT connection state callback prototype
+ *
+ * Called from the MQTT task when the state of the connection to the broker changes.
+ *
+ * @param[in] state New state
+ * @param[in] backoff_ms Delay before the next attempt for QCLOUD_MQTT_STATE_BACKOFF, 0 otherwise
+ */
+typedef void (*esp_qcloud_mqtt_state_cb_t)(esp_qcloud_mqtt_state_t state, uint32_t backoff_ms);
+
 /** ESP QCloud MQTT Subscribe callback prototype
  *
  * @param[in] topic Topic on which the message was received
@@ -59,12 +130,24 @@ esp_err_t esp_qcloud_mqtt_init(esp_qcloud_mqtt_config_t *config);
  * Starts the connection attempts to the MQTT broker as per the configuration
  * provided during initializing.
  * This should ideally be called after successful network connection.
+ * Returns once connected and the topics subscribed before are acknowledged.
+ * The topics are sent in one SUBSCRIBE from ESP-IDF v5.1, one per topic before.
  *
  * @return ESP_OK on success.
  * @return error in case of any error.
  */
 esp_err_t esp_qcloud_mqtt_connect(void);
 
+/** MQTT Connect without waiting
+ *
+ * Same as esp_qcloud_mqtt_connect() but returns as soon as the connection
+ * attempts are started. Follow the progress with esp_qcloud_mqtt_register_state_cb().
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_qcloud_mqtt_connect_async(void);
+
 /** MQTT Disconnect
  *
  * Disconnects from the MQTT broker.
@@ -75,6 +158,8 @@ esp_err_t esp_qcloud_mqtt_connect(void);
 esp_err_t esp_qcloud_mqtt_disconnect(void);
 
 /** Publish MQTT Message
+ *
+ * Same as esp_qcloud_mqtt_publish_async() in the report class without a callback.
  *
  * @param[in] topic The MQTT topic on which the message should be published.
  * @param[in] data Data to be published
@@ -85,7 +170,64 @@ esp_err_t esp_qcloud_mqtt_disconnect(void);
  */
 esp_err_t esp_qcloud_mqtt_publish(const char *topic, void *data, size_t data_len);
 
+/** Queue an MQTT Message for publishing
+ *
+ * The topic and the data are copied, the message is handed to esp-mqtt at QoS 1
+ * by the publish task. The call never waits for the network.
+ *
+ * @param[in] topic The MQTT topic on which the message should be published.
+ * @param[in] data Data to be published
+ * @param[in] data_len Length of the data
+ * @param[in] prio Class of the message
+ * @param[in] cb Optional callback invoked when the message is acknowledged or dropped
+ * @param[in] priv_data Optional private data to be passed to the callback
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NO_MEM if the queue of the class is full.
+ * @return error in case of any error.
+ */
+esp_err_t esp_qcloud_mqtt_publish_async(const char *topic, const void *data, size_t data_len,
+                                        esp_qcloud_mqtt_prio_t prio, esp_qcloud_mqtt_publish_cb_t cb, void *priv_data);
+
+/** Get the counters of the publish queue
+ *
+ * @param[out] stats Counters
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_qcloud_mqtt_get_publish_stats(esp_qcloud_mqtt_publish_stats_t *stats);
+
+/** Get the counters of the connections and the subscriptions
+ *
+ * @param[out] stats Counters
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_qcloud_mqtt_get_connect_stats(esp_qcloud_mqtt_connect_stats_t *stats);
+
+/** Register a connection state callback
+ *
+ * @param[in] cb The callback to be invoked when the connection state changes.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_qcloud_mqtt_register_state_cb(esp_qcloud_mqtt_state_cb_t cb);
+
+/** Get the connection state
+ *
+ * @return true if connected to the broker.
+ */
+bool esp_qcloud_mqtt_is_connected(void);
+
 /** Subscribe to MQTT topic
+ *
+ * The topic may contain the MQTT wildcards '+' and '#'. A message is passed to
+ * every subscription it matches, subscribing to the same topic again replaces
+ * the callback. Topics subscribed while disconnected are sent together in one
+ * SUBSCRIBE once connected, as are all the topics after a reconnection.
  *
  * @param[in] topic The topic to be subscribed to.
  * @param[in] cb The callback to be invoked when a message is received on the given topic.
@@ -20,6 +20,7 @@
 #include "freertos/FreeRTOS.h"
 
 #include <esp_err.h>
+#include <esp_system.h>
 
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0))
 #include <esp_random.h>
@@ -142,6 +143,16 @@ int esp_qcloud_reboot_total_count(void);
  */
 bool esp_qcloud_reboot_is_exception(bool erase_coredump);
 
+/**
+ * @brief Get the reason of the last reset.
+ *
+ * @param[out] name Name of the reason, e.g. "panic", NULL if not needed
+ *
+ * @return
+ *     - reason
+ */
+esp_reset_reason_t esp_qcloud_reboot_reason(const char **name);
+
 /** Initialize time synchronization
  *
  * This API initializes SNTP for time synchronization.
@@ -179,6 +190,17 @@ esp_err_t esp_qcloud_timesync_wait(uint32_t wait_ms);
  */
 void esp_qcloud_print_system_info(uint32_t interval_ms);
 
+/** Hash a string with 32-bit FNV-1a
+ *
+ * Used to index the property, action and topic tables, not suitable for security purposes.
+ *
+ * @param[in] str String to hash, does not need to be '\0' terminated.
+ * @param[in] len Length of the string.
+ *
+ * @return hash value
+ */
+uint32_t esp_qcloud_hash_str(const char *str, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
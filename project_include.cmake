@@ -0,0 +1,33 @@
+# Path of the generator, read by qcloud_data_template_generate()
+idf_build_set_property(QCLOUD_DATA_TEMPLATE_GEN ${CMAKE_CURRENT_LIST_DIR}/tools/data_template/data_template_gen.py)
+
+# qcloud_data_template_generate(<template> [NAME <name>])
+#
+# Generate `const esp_qcloud_data_template_t <name>` from the data template JSON
+# exported by the QCloud console and add it to the calling component. Include
+# "<name>.h" and pass it to esp_qcloud_device_add_data_template(). The name is
+# the file name of the template by default.
+function(qcloud_data_template_generate template)
+    cmake_parse_arguments(_ "" "NAME" "" ${ARGN})
+
+    get_filename_component(template ${template} ABSOLUTE BASE_DIR ${COMPONENT_DIR})
+
+    if(__NAME)
+        set(name ${__NAME})
+    else()
+        get_filename_component(name ${template} NAME_WE)
+    endif()
+
+    idf_build_get_property(python PYTHON)
+    idf_build_get_property(generator QCLOUD_DATA_TEMPLATE_GEN)
+    set(output_dir ${CMAKE_CURRENT_BINARY_DIR}/data_template)
+
+    add_custom_command(OUTPUT ${output_dir}/${name}.c ${output_dir}/${name}.h
+                       COMMAND ${python} ${generator} --name ${name} --output-dir ${output_dir} ${template}
+                       DEPENDS ${template} ${generator}
+                       COMMENT "Generating data template ${name}"
+                       VERBATIM)
+
+    target_sources(${COMPONENT_LIB} PRIVATE ${output_dir}/${name}.c)
+    target_include_directories(${COMPONENT_LIB} PRIVATE ${output_dir})
+endfunction()
@@ -12,9 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <time.h>
 #include <sys/param.h>
 #include "argtable3/argtable3.h"
 #include "mbedtls/base64.h"
+#include "mbedtls/md.h"
 
 #include "esp_system.h"
 #include "esp_ota_ops.h"
@@ -25,11 +27,19 @@
 #include "spi_flash_mmap.h"
 #endif
 #include "esp_flash.h"
+#include "esp_timer.h"
 
 #include "esp_qcloud_log.h"
 #include "esp_qcloud_console.h"
+#include "esp_qcloud_iothub.h"
+#include "esp_qcloud_mqtt.h"
+#include "esp_qcloud_credential.h"
 
 #define CONFIG_QCLOUD_LOG_MAX_SIZE 1024
+#define SIGN_BENCH_ROUNDS          200
+#define LOG_BENCH_ROUNDS           1024
+#define LOG_BENCH_BATCH            32    /**< Lines between two yields, the log task drains the ring */
+#define LOG_BENCH_TAG              "log_bench"
 
 static const char *TAG = "esp_qcloud_commands";
 
@@ -46,9 +56,22 @@ static struct {
     struct arg_str *mode;
     struct arg_lit *status;
     struct arg_lit *read;
+    struct arg_lit *reset;
+    struct arg_lit *bench;
+    struct arg_lit *query;
+    struct arg_str *from;
+    struct arg_str *to;
     struct arg_end *end;
 } log_args;
 
+static struct {
+    struct arg_lit *pool;
+    struct arg_lit *report;
+    struct arg_lit *mqtt;
+    struct arg_lit *sign;
+    struct arg_end *end;
+} iothub_args;
+
 /**
  * @brief  A function which implements version command.
  */
@@ -88,6 +111,142 @@ static void register_version()
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+/**
+ * @brief  Average time of a debug log call in ns, the yields are not counted.
+ */
+static uint32_t log_bench_round(void)
+{
+    int64_t elapsed_us = 0;
+
+    for (int i = 0; i < LOG_BENCH_ROUNDS; i += LOG_BENCH_BATCH) {
+        int64_t start = esp_timer_get_time();
+
+        for (int j = i; j < i + LOG_BENCH_BATCH; j++) {
+            ESP_LOGD(LOG_BENCH_TAG, "bench %d, %s", j, "log line");
+        }
+
+        elapsed_us += esp_timer_get_time() - start;
+        vTaskDelay(1);
+    }
+
+    return (uint32_t)(elapsed_us * 1000 / LOG_BENCH_ROUNDS);
+}
+
+/**
+ * @brief  Cost of the log calls that no sink takes, against a line formatted to the ring.
+ */
+static void log_bench(void)
+{
+    esp_qcloud_log_config_t log_config   = {0};
+    esp_qcloud_log_config_t bench_config = {0};
+    esp_qcloud_log_config_t tag_config   = {0};
+
+    esp_qcloud_log_get_config(&log_config);
+
+    /**< Filtered by esp_log before the pipeline, the floor of a log call */
+    esp_log_level_set(LOG_BENCH_TAG, ESP_LOG_INFO);
+    uint32_t esp_log_ns = log_bench_round();
+    esp_log_level_set(LOG_BENCH_TAG, ESP_LOG_VERBOSE);
+
+    /**< Above the highest level of all the sinks */
+    esp_qcloud_log_set_config(&bench_config);
+    uint32_t level_ns = log_bench_round();
+
+    /**< The local sink takes debug lines, but not the ones of this tag */
+    bench_config.log_level_local = ESP_LOG_DEBUG;
+    esp_qcloud_log_set_config(&bench_config);
+    esp_qcloud_log_set_tag_config(LOG_BENCH_TAG, &tag_config);
+    uint32_t tag_ns = log_bench_round();
+
+    /**< Taken by the local sink, measured and formatted to the ring */
+    esp_qcloud_log_set_tag_config(LOG_BENCH_TAG, NULL);
+    uint32_t ring_ns = log_bench_round();
+
+    esp_qcloud_log_set_config(&log_config);
+    esp_log_level_set(LOG_BENCH_TAG, ESP_LOG_INFO);
+
+    ESP_LOGI(TAG, "log call (ns), filtered by esp_log: %"PRIu32", rejected by level: %"PRIu32
+             ", rejected by tag: %"PRIu32", formatted to the ring: %"PRIu32"",
+             esp_log_ns, level_ns, tag_ns, ring_ns);
+}
+
+/**
+ * @brief  Print what is read from the log in flash
+ */
+static void log_flash_print(const char *data, size_t size)
+{
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+    /**< Binary records are printed in base64, one line per read */
+    size_t olen = 0;
+    uint8_t *b64_buf = ESP_QCLOUD_MALLOC((size + 2) / 3 * 4 + 1);
+    mbedtls_base64_encode(b64_buf, (size + 2) / 3 * 4 + 1, &olen, (uint8_t *)data, size);
+    printf("%s\n", b64_buf);
+    ESP_QCLOUD_FREE(b64_buf);
+#else
+    printf("%.*s", size, data);
+#endif
+    fflush(stdout);
+}
+
+/**
+ * @brief  Unix time of "HH:MM" today, or of a number of seconds
+ */
+static uint32_t log_time_parse(const char *str)
+{
+    struct tm tm = {0};
+    time_t now   = time(NULL);
+
+    if (!strchr(str, ':')) {
+        return strtoul(str, NULL, 10);
+    }
+
+    localtime_r(&now, &tm);
+    tm.tm_sec = 0;
+    sscanf(str, "%d:%d", &tm.tm_hour, &tm.tm_min);
+
+    return mktime(&tm);
+}
+
+/**
+ * @brief  Print the index of the log in flash and the records of a range
+ */
+static void log_flash_query(esp_log_level_t level)
+{
+    const char level_char[] = "NEWIDV";
+    esp_qcloud_log_flash_index_t index[CONFIG_QCLOUD_LOG_FLASH_SEGMENT_NUM];
+    size_t num = CONFIG_QCLOUD_LOG_FLASH_SEGMENT_NUM;
+
+    esp_qcloud_log_flash_get_index(index, &num);
+
+    for (int i = 0; i < num; ++i) {
+        char levels[64] = {0};
+
+        for (int j = ESP_LOG_ERROR, len = 0; j <= ESP_LOG_VERBOSE; ++j) {
+            len += snprintf(levels + len, sizeof(levels) - len, " %c: %u", level_char[j], index[i].level_num[j]);
+        }
+
+        ESP_LOGI(TAG, "segment, seq: %"PRIu32", time: %"PRIu32" - %"PRIu32",%s",
+                 index[i].seq, index[i].time_min, index[i].time_max, levels);
+    }
+
+    esp_qcloud_log_flash_range_t range = {
+        .time_start = log_args.from->count ? log_time_parse(log_args.from->sval[0]) : 0,
+        .time_end   = log_args.to->count ? log_time_parse(log_args.to->sval[0]) : 0,
+        .level      = level,
+    };
+    char *log_data = ESP_QCLOUD_MALLOC(CONFIG_QCLOUD_LOG_MAX_SIZE);
+
+    ESP_LOGI(TAG, "Records of level %c and above, time: %"PRIu32" - %"PRIu32"",
+             level_char[level], range.time_start, range.time_end);
+
+    for (size_t size = CONFIG_QCLOUD_LOG_MAX_SIZE; esp_qcloud_log_flash_read_range(&range, log_data, &size) == ESP_OK;
+            size = CONFIG_QCLOUD_LOG_MAX_SIZE) {
+        log_flash_print(log_data, size);
+    }
+
+    ESP_QCLOUD_FREE(log_data);
+}
+
 /**
  * @brief  A function which implements log command.
  */
@@ -103,6 +262,19 @@ static int log_func(int argc, char **argv)
 
     esp_qcloud_log_get_config(&log_config);
 
+    if (log_args.query->count) {
+        esp_log_level_t level = ESP_LOG_VERBOSE;
+
+        for (int log_level = 0; log_args.level->count && log_level < sizeof(level_str) / sizeof(char *); ++log_level) {
+            if (!strcasecmp(level_str[log_level], log_args.level->sval[0])) {
+                level = log_level;
+            }
+        }
+
+        log_flash_query(level);
+        return ESP_OK;
+    }
+
     for (int log_level = 0; log_args.level->count && log_level < sizeof(level_str) / sizeof(char *); ++log_level) {
         if (!strcasecmp(level_str[log_level], log_args.level->sval[0])) {
             const char *tag = log_args.tag->count ? log_args.tag->sval[0] : "*";
@@ -110,6 +282,11 @@ static int log_func(int argc, char **argv)
             if (!log_args.mode->count) {
                 esp_log_level_set(tag, log_level);
             } else {
+                /**< A tag gets levels of its own, starting from the configuration */
+                if (strcmp(tag, "*")) {
+                    esp_qcloud_log_get_tag_config(tag, &log_config);
+                }
+
                 if (!strcasecmp(log_args.mode->sval[0], "flash")) {
                     log_config.log_level_flash = log_level;
                 } else if (!strcasecmp(log_args.mode->sval[0], "uart")) {
@@ -120,16 +297,56 @@ static int log_func(int argc, char **argv)
                     log_config.log_level_iothub = log_level;
                 }
 
-                esp_qcloud_log_set_config(&log_config);
+                if (strcmp(tag, "*")) {
+                    esp_qcloud_log_set_tag_config(tag, &log_config);
+                } else {
+                    esp_qcloud_log_set_config(&log_config);
+                }
             }
         }
     }
 
+    if (log_args.reset->count && log_args.tag->count) {
+        esp_qcloud_log_set_tag_config(log_args.tag->sval[0], NULL);
+    }
+
+    if (log_args.bench->count) {
+        log_bench();
+    }
+
     if (log_args.status->count) { /**< Output enable type */
         ESP_LOGI(TAG, "uart log level: %s", level_str[log_config.log_level_uart]);
         ESP_LOGI(TAG, "flash log level: %s", level_str[log_config.log_level_flash]);
         ESP_LOGI(TAG, "local log level: %s", level_str[log_config.log_level_local]);
         ESP_LOGI(TAG, "iothub log level: %s", level_str[log_config.log_level_iothub]);
+
+        esp_qcloud_log_stats_t log_stats = {0};
+        esp_qcloud_log_get_stats(&log_stats);
+
+        ESP_LOGI(TAG, "log ring, size: %"PRIu32", used peak: %"PRIu32", written: %"PRIu32", dropped: %"PRIu32"",
+                 log_stats.ring_size, log_stats.ring_used_peak, log_stats.written, log_stats.dropped);
+
+        esp_qcloud_log_iothub_stats_t stats = {0};
+        esp_qcloud_log_iothub_get_stats(&stats);
+
+        ESP_LOGI(TAG, "iothub log upload, requests: %"PRIu32", failed: %"PRIu32", lines: %"PRIu32", lines/request: %"PRIu32", dropped: %"PRIu32"",
+                 stats.requests, stats.failed, stats.lines, stats.requests ? stats.lines / stats.requests : 0, stats.dropped);
+        ESP_LOGI(TAG, "iothub log upload, bytes: %"PRIu32", sent bytes: %"PRIu32", latency (ms) avg: %"PRIu32", max: %"PRIu32"",
+                 stats.bytes, stats.sent_bytes, stats.latency_avg_ms, stats.latency_max_ms);
+
+        esp_qcloud_log_flash_stats_t flash_stats = {0};
+        esp_qcloud_log_flash_get_stats(&flash_stats);
+
+        ESP_LOGI(TAG, "flash log, records: %"PRIu32", flushes: %"PRIu32", programs: %"PRIu32", bytes/program: %"PRIu32", erases: %"PRIu32"",
+                 flash_stats.records, flash_stats.flushes, flash_stats.programs,
+                 flash_stats.programs ? flash_stats.program_bytes / flash_stats.programs : 0, flash_stats.erases);
+        ESP_LOGI(TAG, "flash log, cache disabled (us) program: %"PRIu32", program max: %"PRIu32", erase: %"PRIu32"",
+                 flash_stats.program_time_us, flash_stats.program_time_max_us, flash_stats.erase_time_us);
+        ESP_LOGI(TAG, "flash log, compression ratio: %"PRIu32".%02"PRIu32", compress (us/KB): %"PRIu32"",
+                 flash_stats.flush_bytes ? flash_stats.stage_bytes / flash_stats.flush_bytes : 0,
+                 flash_stats.flush_bytes ? flash_stats.stage_bytes % flash_stats.flush_bytes * 100 / flash_stats.flush_bytes : 0,
+                 flash_stats.stage_bytes ? (uint32_t)((uint64_t)flash_stats.compress_time_us * 1024 / flash_stats.stage_bytes) : 0);
+        ESP_LOGI(TAG, "flash log, binary records of another firmware skipped: %"PRIu32"", flash_stats.foreign_skipped);
     }
 
     if (log_args.read->count) {  /**< read to the flash of log data */
@@ -141,11 +358,15 @@ static int log_func(int argc, char **argv)
         for (size_t size = MIN(CONFIG_QCLOUD_LOG_MAX_SIZE - 17, log_size);
                 size > 0 && esp_qcloud_log_flash_read(log_data, &size) == ESP_OK;
                 log_size -= size, size = MIN(CONFIG_QCLOUD_LOG_MAX_SIZE - 17, log_size)) {
-            printf("%.*s", size, log_data);
-            fflush(stdout);
+            log_flash_print(log_data, size);
         }
 
         ESP_QCLOUD_FREE(log_data);
+
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+        ESP_LOGI(TAG, "Save the base64 lines above to a file, then run: \n"
+                 "python $ESP_QCLOUD_PATH/tools/log_decoder/log_decoder.py -t b64 </path/to/saved/file> </path/to/program/elf/file>");
+#endif
     }
 
     return ESP_OK;
@@ -156,11 +377,16 @@ static int log_func(int argc, char **argv)
  */
 static void register_log()
 {
-    log_args.tag    = arg_str0("t", "tag", "<tag>", "Tag of the log entries to enable, '*' resets log level for all tags to the given value");
+    log_args.tag    = arg_str0("t", "tag", "<tag>", "Tag of the log entries to enable, '*' resets log level for all tags to the given value, with a mode the tag gets levels of its own");
     log_args.level  = arg_str0("l", "level", "<level>", "Selects log level to enable (NONE, ERR, WARN, INFO, DEBUG, VER)");
     log_args.mode   = arg_str0("m", "mode", "<mode('uart', 'flash', 'local' or 'iothub')>", "Selects log to mode ('uart', 'flash', 'local' or 'iothub')");
     log_args.status = arg_lit0("s", "status", "Configuration of output log");
     log_args.read   = arg_lit0("r", "read", "Read to the flash of log information");
+    log_args.reset  = arg_lit0("R", "reset", "The tag follows the levels of the modes set without a tag again");
+    log_args.bench  = arg_lit0("b", "bench", "Time of the log calls rejected by level or tag");
+    log_args.query  = arg_lit0("q", "query", "Index of the flash log and its records of the level and time range, without consuming them");
+    log_args.from   = arg_str0(NULL, "from", "<time>", "Start of the query, 'HH:MM' today or a unix time");
+    log_args.to     = arg_str0(NULL, "to", "<time>", "End of the query, 'HH:MM' today or a unix time");
     log_args.end    = arg_end(8);
 
     const esp_console_cmd_t cmd = {
@@ -296,6 +522,138 @@ static void register_heap()
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+/**
+ * @brief  Signatures per second of a key, setting up the HMAC for every
+ *         signature as done before versus the prepared key.
+ */
+static void iothub_sign_bench(const char *name, esp_qcloud_credential_key_t key, mbedtls_md_type_t md_type,
+                              const uint8_t *secret, size_t secret_len, size_t size)
+{
+    uint8_t digest[QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE] = {0};
+    uint8_t *data = ESP_QCLOUD_MALLOC(size);
+    memset(data, '#', size);
+
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < SIGN_BENCH_ROUNDS; i++) {
+        mbedtls_md_context_t sha_ctx;
+        mbedtls_md_init(&sha_ctx);
+        mbedtls_md_setup(&sha_ctx, mbedtls_md_info_from_type(md_type), 1);
+        mbedtls_md_hmac_starts(&sha_ctx, secret, secret_len);
+        mbedtls_md_hmac_update(&sha_ctx, data, size);
+        mbedtls_md_hmac_finish(&sha_ctx, digest);
+        mbedtls_md_free(&sha_ctx);
+    }
+
+    int64_t setup_us = esp_timer_get_time() - start;
+    start = esp_timer_get_time();
+
+    for (int i = 0; i < SIGN_BENCH_ROUNDS; i++) {
+        if (esp_qcloud_credential_sign(key, data, size, digest, NULL) != ESP_OK) {
+            ESP_LOGW(TAG, "%s key is not prepared", name);
+            ESP_QCLOUD_FREE(data);
+            return;
+        }
+    }
+
+    int64_t prepared_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "%s, %d bytes, signatures/s, setup per signature: %"PRIu32", prepared: %"PRIu32"",
+             name, (int)size, (uint32_t)(SIGN_BENCH_ROUNDS * 1000000LL / MAX(setup_us, 1)),
+             (uint32_t)(SIGN_BENCH_ROUNDS * 1000000LL / MAX(prepared_us, 1)));
+
+    ESP_QCLOUD_FREE(data);
+}
+
+/**
+ * @brief  A function which implements iothub command.
+ */
+static int iothub_func(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&iothub_args) != ESP_OK) {
+        arg_print_errors(stderr, iothub_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    if (iothub_args.pool->count) {
+        esp_qcloud_iothub_pool_stats_t stats = {0};
+        esp_qcloud_iothub_get_pool_stats(&stats);
+
+        ESP_LOGI(TAG, "method pool, size: %"PRIu32", used: %"PRIu32", peak: %"PRIu32", acquired: %"PRIu32", heap fallback: %"PRIu32"",
+                 stats.size, stats.used, stats.peak, stats.acquired, stats.fallback);
+    }
+
+    if (iothub_args.report->count) {
+        esp_qcloud_iothub_report_stats_t stats = {0};
+
+        if (esp_qcloud_iothub_get_report_stats(&stats) == ESP_OK) {
+            ESP_LOGI(TAG, "report scheduler, posted: %"PRIu32", merged: %"PRIu32", dropped: %"PRIu32", sent: %"PRIu32", unchanged: %"PRIu32"",
+                     stats.posted, stats.merged, stats.dropped, stats.sent, stats.unchanged);
+        } else {
+            ESP_LOGI(TAG, "report scheduler is disabled");
+        }
+    }
+
+    if (iothub_args.mqtt->count) {
+        esp_qcloud_mqtt_publish_stats_t stats = {0};
+        esp_qcloud_mqtt_get_publish_stats(&stats);
+
+        ESP_LOGI(TAG, "publish queue, submitted: %"PRIu32", rejected: %"PRIu32", published: %"PRIu32", failed: %"PRIu32", inflight: %"PRIu32"",
+                 stats.submitted, stats.rejected, stats.published, stats.failed, stats.inflight);
+        ESP_LOGI(TAG, "queued, control: %"PRIu32", event: %"PRIu32", report: %"PRIu32", log: %"PRIu32"",
+                 stats.queued[QCLOUD_MQTT_PRIO_CONTROL], stats.queued[QCLOUD_MQTT_PRIO_EVENT],
+                 stats.queued[QCLOUD_MQTT_PRIO_REPORT], stats.queued[QCLOUD_MQTT_PRIO_LOG]);
+        ESP_LOGI(TAG, "latency (ms), queue avg: %"PRIu32", queue max: %"PRIu32", ack avg: %"PRIu32", ack max: %"PRIu32"",
+                 stats.queue_latency_avg_ms, stats.queue_latency_max_ms, stats.ack_latency_avg_ms, stats.ack_latency_max_ms);
+
+        esp_qcloud_mqtt_connect_stats_t connect_stats = {0};
+        esp_qcloud_mqtt_get_connect_stats(&connect_stats);
+
+        ESP_LOGI(TAG, "connected: %"PRIu32", session resumed: %"PRIu32", subscribe packets: %"PRIu32", topics: %"PRIu32", ready (ms): %"PRIu32", ready max (ms): %"PRIu32"",
+                 connect_stats.connected, connect_stats.session_resumed, connect_stats.subscribe_packets, connect_stats.subscribe_topics,
+                 connect_stats.ready_ms, connect_stats.ready_max_ms);
+    }
+
+    if (iothub_args.sign->count && esp_qcloud_get_device_secret()) {
+        const char *secret = esp_qcloud_get_device_secret();
+        uint8_t psk[48] = {0};
+        size_t psk_len  = 0;
+
+        mbedtls_base64_decode(psk, sizeof(psk), &psk_len, (const uint8_t *)secret, strlen(secret));
+
+        iothub_sign_bench("hmac-sha256 username", QCLOUD_CREDENTIAL_MQTT, MBEDTLS_MD_SHA256, psk, psk_len, 64);
+
+        for (size_t size = 128; size <= 1024; size <<= 2) {
+            iothub_sign_bench("hmac-sha1 log", QCLOUD_CREDENTIAL_LOG, MBEDTLS_MD_SHA1,
+                              (const uint8_t *)secret, strlen(secret), size);
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief  Register iothub command.
+ */
+static void register_iothub()
+{
+    iothub_args.pool   = arg_lit0("p", "pool", "Occupancy of the pool of reports, events and action replies");
+    iothub_args.report = arg_lit0("r", "report", "Counters of the report scheduler");
+    iothub_args.mqtt   = arg_lit0("m", "mqtt", "Counters and latency of the MQTT publish queue and subscriptions");
+    iothub_args.sign   = arg_lit0("s", "sign", "Benchmark the signatures of the MQTT username and the log uploads");
+    iothub_args.end    = arg_end(4);
+
+    const esp_console_cmd_t cmd = {
+        .command = "iothub",
+        .help = "Get the statistics of iothub",
+        .hint = NULL,
+        .func = &iothub_func,
+        .argtable = &iothub_args,
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 /**
  * @brief  A function which implements coredump command.
  */
@@ -384,4 +742,5 @@ void esp_qcloud_commands_register_common()
     register_fallback();
     register_log();
     register_coredump();
+    register_iothub();
 }
@@ -13,11 +13,17 @@
 // limitations under the License.
 
 #include <string.h>
+#include <math.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include <esp_log.h>
 
 #include "esp_qcloud_iothub.h"
+#include "esp_qcloud_data_template.h"
 #include "esp_qcloud_utils.h"
+#include "esp_qcloud_device.h"
 
 #ifdef CONFIG_QCLOUD_MASS_MANUFACTURE
 #include "nvs.h"
@@ -39,12 +45,59 @@ typedef struct {
     };
 } esp_qcloud_profile_t;
 
+/**
+ * @brief A property registered by the application.
+ *
+ * @note `shadow` is the value last acknowledged by the cloud, `pending` is the
+ *       value sent in the report that is waiting for the report_reply.
+ */
+typedef struct esp_qcloud_property {
+    const char *id;
+    esp_qcloud_param_val_t value;    /**< Value read through the get callback */
+    esp_qcloud_param_val_t shadow;   /**< Value acknowledged by the cloud */
+    esp_qcloud_param_val_t pending;  /**< Value reported but not acknowledged */
+    float epsilon;                   /**< Minimum change of a float that needs to be reported */
+    bool shadow_valid;
+    bool pending_valid;
+    bool changed;                    /**< Collected by the current report */
+    uint32_t hash;                   /**< esp_qcloud_hash_str() of the id */
+    esp_qcloud_get_param_t get_cb;   /**< Handler of this property, NULL to use the common one */
+    esp_qcloud_set_param_t set_cb;
+    const esp_qcloud_property_schema_t *schema; /**< Description in the data template, NULL if added by hand */
+} esp_qcloud_property_t;
+
+typedef struct {
+    const char *id;
+    uint32_t hash;
+    esp_qcloud_action_cb_t action_cb;
+} esp_qcloud_action_item_t;
+
+/**
+ * @brief Open addressed index of a table, a slot holds the position in the table plus one.
+ */
+typedef struct {
+    uint16_t *slot;
+    uint16_t mask;    /**< Number of the slots minus one, the number is a power of 2 */
+    bool in_flash;    /**< The slots are generated with the data template and read only */
+} esp_qcloud_hash_index_t;
+
+#define QCLOUD_HASH_INDEX_MIN_SIZE   (8)
+
 static esp_qcloud_profile_t *g_device_profile = NULL;
 static esp_qcloud_set_param_t g_esp_qcloud_set_param = NULL;
 static esp_qcloud_get_param_t g_esp_qcloud_get_param = NULL;
 
-static SLIST_HEAD(param_list_, esp_qcloud_param) g_property_list;
-static SLIST_HEAD(action_list_, esp_qcloud_action) g_action_list;
+static esp_qcloud_property_t *g_property        = NULL;
+static size_t g_property_num                     = 0;
+static esp_qcloud_hash_index_t g_property_index  = {0};
+static SemaphoreHandle_t g_property_lock         = NULL;
+static char g_pending_token[QCLOUD_DEVICE_TOKEN_MAX_SIZE] = {0};
+
+static esp_qcloud_action_item_t *g_action        = NULL;
+static size_t g_action_num                       = 0;
+static esp_qcloud_hash_index_t g_action_index    = {0};
+
+static const esp_qcloud_data_template_t *g_data_template = NULL;
 
 #ifdef CONFIG_AUTH_MODE_CERT
 extern const uint8_t dev_cert_crt_start[] asm("_binary_dev_cert_crt_start");
@@ -214,40 +267,284 @@ const char *esp_qcloud_get_private_key()
     return g_device_profile->private_key;
 }
 
-esp_err_t esp_qcloud_device_add_property(const char *id, esp_qcloud_param_val_type_t type)
+static void esp_qcloud_hash_index_insert(esp_qcloud_hash_index_t *index, uint32_t hash, size_t pos)
+{
+    for (uint32_t i = hash & index->mask;; i = (i + 1) & index->mask) {
+        if (!index->slot[i]) {
+            index->slot[i] = pos + 1;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Make sure the index has room for `num` entries, keeping the load factor under 1/2.
+ *
+ * @note When `rebuild` is set the index was reallocated empty, all the entries need to be inserted again.
+ */
+static esp_err_t esp_qcloud_hash_index_reserve(esp_qcloud_hash_index_t *index, size_t num, bool *rebuild)
+{
+    size_t size = index->slot ? index->mask + 1 : 0;
+
+    *rebuild = false;
+
+    /**< The index generated with the data template can't be written, move it to RAM */
+    if (num * 2 <= size && !index->in_flash) {
+        return ESP_OK;
+    }
+
+    for (size = QCLOUD_HASH_INDEX_MIN_SIZE; size < num * 2; size <<= 1);
+
+    ESP_QCLOUD_ERROR_CHECK(size > UINT16_MAX, ESP_ERR_INVALID_SIZE, "Too many entries, num: %d", num);
+
+    uint16_t *slot = ESP_QCLOUD_CALLOC(size, sizeof(uint16_t));
+    ESP_QCLOUD_ERROR_CHECK(!slot, ESP_ERR_NO_MEM, "Allocate the hash index, size: %d", size);
+
+    if (!index->in_flash) {
+        ESP_QCLOUD_FREE(index->slot);
+    }
+
+    index->slot     = slot;
+    index->mask     = size - 1;
+    index->in_flash = false;
+    *rebuild        = true;
+
+    return ESP_OK;
+}
+
+static esp_qcloud_property_t *esp_qcloud_device_find_property(const char *id)
 {
-    esp_qcloud_param_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_param_t));
+    uint32_t hash = esp_qcloud_hash_str(id, strlen(id));
 
-    item->id = strdup(id);
-    item->value.type = type;
+    if (!g_property_index.slot) {
+        return NULL;
+    }
+
+    for (uint32_t i = hash & g_property_index.mask; g_property_index.slot[i]; i = (i + 1) & g_property_index.mask) {
+        esp_qcloud_property_t *property = g_property + g_property_index.slot[i] - 1;
+
+        if (property->hash == hash && !strcmp(property->id, id)) {
+            return property;
+        }
+    }
+
+    return NULL;
+}
+
+static esp_qcloud_action_item_t *esp_qcloud_device_find_action(const char *id)
+{
+    uint32_t hash = esp_qcloud_hash_str(id, strlen(id));
+
+    if (!g_action_index.slot) {
+        return NULL;
+    }
+
+    for (uint32_t i = hash & g_action_index.mask; g_action_index.slot[i]; i = (i + 1) & g_action_index.mask) {
+        esp_qcloud_action_item_t *action = g_action + g_action_index.slot[i] - 1;
+
+        if (action->hash == hash && !strcmp(action->id, id)) {
+            return action;
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_qcloud_device_add_property_handler(const char *id, esp_qcloud_param_val_type_t type,
+        const esp_qcloud_get_param_t get_cb, const esp_qcloud_set_param_t set_cb)
+{
+    ESP_QCLOUD_PARAM_CHECK(id);
+    ESP_QCLOUD_PARAM_CHECK(type > QCLOUD_VAL_TYPE_INVALID && type <= QCLOUD_VAL_TYPE_TIME);
+
+    esp_err_t err = ESP_OK;
+    bool rebuild  = false;
+
+    if (!g_property_lock) {
+        g_property_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
 
-    esp_qcloud_param_t *last = SLIST_FIRST(&g_property_list);
+    esp_qcloud_property_t *property = esp_qcloud_device_find_property(id);
+
+    /**< Adding an existing property only updates its type and handlers, the type of the template wins */
+    if (property) {
+        if (property->schema && property->schema->type != type) {
+            ESP_LOGW(TAG, "The type of %s is %d in the data template", id, property->schema->type);
+        } else {
+            property->value.type = property->shadow.type = property->pending.type = type;
+        }
 
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&g_property_list, item, next);
+        property->get_cb = get_cb;
+        property->set_cb = set_cb;
+        goto EXIT;
+    }
+
+    err = esp_qcloud_hash_index_reserve(&g_property_index, g_property_num + 1, &rebuild);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_hash_index_reserve", esp_err_to_name(err));
+
+    property = ESP_QCLOUD_REALLOC(g_property, (g_property_num + 1) * sizeof(esp_qcloud_property_t));
+    err      = property ? ESP_OK : ESP_ERR_NO_MEM;
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "Allocate the property table, num: %d", g_property_num + 1);
+    g_property = property;
+
+    property = g_property + g_property_num;
+    memset(property, 0, sizeof(esp_qcloud_property_t));
+    property->id           = strdup(id);
+    property->hash         = esp_qcloud_hash_str(id, strlen(id));
+    property->value.type   = type;
+    property->shadow.type  = type;
+    property->pending.type = type;
+    property->epsilon      = QCLOUD_PROPERTY_FLOAT_EPSILON;
+    property->get_cb       = get_cb;
+    property->set_cb       = set_cb;
+    g_property_num++;
+
+    if (rebuild) {
+        for (size_t i = 0; i < g_property_num; ++i) {
+            esp_qcloud_hash_index_insert(&g_property_index, g_property[i].hash, i);
+        }
     } else {
-        SLIST_INSERT_AFTER(last, item, next);
+        esp_qcloud_hash_index_insert(&g_property_index, property->hash, g_property_num - 1);
     }
 
+EXIT:
+    xSemaphoreGive(g_property_lock);
+    return err;
+}
+
+esp_err_t esp_qcloud_device_add_data_template(const esp_qcloud_data_template_t *data_template)
+{
+    ESP_QCLOUD_PARAM_CHECK(data_template);
+    ESP_QCLOUD_PARAM_CHECK(!data_template->property_num || data_template->property_slot);
+    ESP_QCLOUD_PARAM_CHECK(data_template->property_num * 2 <= data_template->property_mask + 1);
+
+    esp_err_t err = ESP_OK;
+
+    if (!g_property_lock) {
+        g_property_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    err = (g_property_num || g_data_template) ? ESP_ERR_INVALID_STATE : ESP_OK;
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "The data template must be added before any property");
+
+    /**< Only the runtime state lives in RAM, one allocation for the whole table */
+    if (data_template->property_num) {
+        g_property = ESP_QCLOUD_CALLOC(data_template->property_num, sizeof(esp_qcloud_property_t));
+        err = g_property ? ESP_OK : ESP_ERR_NO_MEM;
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "Allocate the property table, num: %d",
+                              data_template->property_num);
+    }
+
+    for (size_t i = 0; i < data_template->property_num; ++i) {
+        const esp_qcloud_property_schema_t *schema = data_template->property + i;
+        esp_qcloud_property_t *property = g_property + i;
+
+        property->id           = schema->id;
+        property->hash         = schema->hash;
+        property->value.type   = schema->type;
+        property->shadow.type  = schema->type;
+        property->pending.type = schema->type;
+        property->epsilon      = QCLOUD_PROPERTY_FLOAT_EPSILON;
+        property->schema       = schema;
+    }
+
+    g_property_num            = data_template->property_num;
+    g_property_index.slot     = (uint16_t *)data_template->property_slot;
+    g_property_index.mask     = data_template->property_mask;
+    g_property_index.in_flash = true;
+    g_data_template           = data_template;
+
+    ESP_LOGI(TAG, "Data template of %s added, property: %d, action: %d, event: %d",
+             data_template->product_id ? data_template->product_id : "",
+             data_template->property_num, data_template->action_num, data_template->event_num);
+
+EXIT:
+    xSemaphoreGive(g_property_lock);
+    return err;
+}
+
+const esp_qcloud_data_template_t *esp_qcloud_device_get_data_template(void)
+{
+    return g_data_template;
+}
+
+esp_err_t esp_qcloud_device_add_property(const char *id, esp_qcloud_param_val_type_t type)
+{
+    return esp_qcloud_device_add_property_handler(id, type, NULL, NULL);
+}
+
+esp_err_t esp_qcloud_device_set_property_epsilon(const char *id, float epsilon)
+{
+    ESP_QCLOUD_PARAM_CHECK(id);
+    ESP_QCLOUD_PARAM_CHECK(epsilon >= 0);
+
+    ESP_QCLOUD_ERROR_CHECK(!g_property_lock, ESP_ERR_NOT_FOUND, "The property is not added, id: %s", id);
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    esp_qcloud_property_t *property = esp_qcloud_device_find_property(id);
+
+    if (property) {
+        property->epsilon = epsilon;
+    }
+
+    xSemaphoreGive(g_property_lock);
+
+    ESP_QCLOUD_ERROR_CHECK(!property, ESP_ERR_NOT_FOUND, "The property is not added, id: %s", id);
+
     return ESP_OK;
 }
 
 esp_err_t esp_qcloud_device_add_action_cb(const char *action_id, const esp_qcloud_action_cb_t action_cb)
 {
-    esp_qcloud_action_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_action_t));
+    ESP_QCLOUD_PARAM_CHECK(action_id);
+    ESP_QCLOUD_PARAM_CHECK(action_cb);
+
+    esp_err_t err = ESP_OK;
+    bool rebuild  = false;
+
+    /**< The actions are looked up by the MQTT task, the table is guarded with the properties */
+    if (!g_property_lock) {
+        g_property_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    esp_qcloud_action_item_t *action = esp_qcloud_device_find_action(action_id);
+
+    if (action) {
+        action->action_cb = action_cb;
+        goto EXIT;
+    }
 
-    item->id = strdup(action_id);
-    item->action_cb = action_cb;
+    err = esp_qcloud_hash_index_reserve(&g_action_index, g_action_num + 1, &rebuild);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_hash_index_reserve", esp_err_to_name(err));
 
-    esp_qcloud_action_t *last = SLIST_FIRST(&g_action_list);
+    action = ESP_QCLOUD_REALLOC(g_action, (g_action_num + 1) * sizeof(esp_qcloud_action_item_t));
+    err    = action ? ESP_OK : ESP_ERR_NO_MEM;
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "Allocate the action table, num: %d", g_action_num + 1);
+    g_action = action;
 
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&g_action_list, item, next);
+    action            = g_action + g_action_num;
+    action->id        = strdup(action_id);
+    action->hash      = esp_qcloud_hash_str(action_id, strlen(action_id));
+    action->action_cb = action_cb;
+    g_action_num++;
+
+    if (rebuild) {
+        for (size_t i = 0; i < g_action_num; ++i) {
+            esp_qcloud_hash_index_insert(&g_action_index, g_action[i].hash, i);
+        }
     } else {
-        SLIST_INSERT_AFTER(last, item, next);
+        esp_qcloud_hash_index_insert(&g_action_index, action->hash, g_action_num - 1);
     }
 
-    return ESP_OK;
+EXIT:
+    xSemaphoreGive(g_property_lock);
+    return err;
 }
 
 esp_err_t esp_qcloud_device_add_property_cb(const esp_qcloud_get_param_t get_param_cb,
@@ -259,9 +556,77 @@ esp_err_t esp_qcloud_device_add_property_cb(const esp_qcloud_get_param_t get_par
     return ESP_OK;
 }
 
+static esp_err_t esp_qcloud_device_get_value(esp_qcloud_property_t *property)
+{
+    esp_qcloud_get_param_t get_cb = property->get_cb ? property->get_cb : g_esp_qcloud_get_param;
+
+    if (!get_cb) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return get_cb(property->id, &property->value);
+}
+
+/**
+ * @brief Check a value set by the cloud against the description in the data template.
+ */
+static esp_err_t esp_qcloud_device_check_value(const esp_qcloud_property_schema_t *schema, const cJSON *item)
+{
+    if (!schema->writable) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    switch (schema->type) {
+    case QCLOUD_VAL_TYPE_BOOLEAN:
+        if (cJSON_IsBool(item)) {
+            return ESP_OK;
+        }
+
+        return cJSON_IsNumber(item) && (item->valuedouble == 0 || item->valuedouble == 1)
+               ? ESP_OK : ESP_ERR_INVALID_ARG;
+
+    case QCLOUD_VAL_TYPE_INTEGER:
+    case QCLOUD_VAL_TYPE_FLOAT:
+    case QCLOUD_VAL_TYPE_TIME:
+        if (!cJSON_IsNumber(item)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        return item->valuedouble >= schema->min && item->valuedouble <= schema->max
+               ? ESP_OK : ESP_ERR_INVALID_ARG;
+
+    case QCLOUD_VAL_TYPE_ENUM:
+        if (!cJSON_IsNumber(item)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        for (size_t i = 0; i < schema->enum_num; ++i) {
+            if (item->valuedouble == schema->enum_value[i]) {
+                return ESP_OK;
+            }
+        }
+
+        return ESP_ERR_INVALID_ARG;
+
+    case QCLOUD_VAL_TYPE_STRING: {
+        if (!cJSON_IsString(item)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        size_t len = strlen(item->valuestring);
+        return len >= schema->min && len <= schema->max ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+
+    default:
+        return ESP_OK;
+    }
+}
+
 esp_err_t esp_qcloud_handle_set_param(const cJSON *request_params, cJSON *reply_data)
 {
-    esp_err_t err = ESP_FAIL;
+    esp_err_t err     = ESP_FAIL;   /**< Kept when no property is set */
+    esp_err_t invalid = ESP_OK;
+    bool set_failed   = false;
 
     for (cJSON *item = request_params->child; item; item = item->next) {
         esp_qcloud_param_val_t value = {0};
@@ -288,11 +653,45 @@ esp_err_t esp_qcloud_handle_set_param(const cJSON *request_params, cJSON *reply_
             break;
         }
 
-        err = g_esp_qcloud_set_param(item->string, &value);
-        ESP_QCLOUD_ERROR_BREAK(err != ESP_OK, "<%s> esp_qcloud_set_param, id: %s",
+        esp_qcloud_set_param_t set_cb = g_esp_qcloud_set_param;
+        esp_err_t ret = ESP_OK;
+
+        /**< Not held while set_cb runs, it may report the properties */
+        if (g_property_lock) {
+            xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+            esp_qcloud_property_t *property = esp_qcloud_device_find_property(item->string);
+
+            if (property) {
+                value.type = property->value.type;
+                set_cb     = property->set_cb ? property->set_cb : set_cb;
+                ret        = property->schema ? esp_qcloud_device_check_value(property->schema, item) : ESP_OK;
+            }
+
+            xSemaphoreGive(g_property_lock);
+        }
+
+        /**< Skip the invalid values, the others of the same control are still applied */
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> The value of %s does not match the data template",
+                     esp_err_to_name(ret), item->string);
+            invalid = ret;
+            continue;
+        }
+
+        ESP_QCLOUD_ERROR_CONTINUE(!set_cb, "No handler to set the property, id: %s", item->string);
+
+        err        = set_cb(item->string, &value);
+        set_failed = err != ESP_OK;
+        ESP_QCLOUD_ERROR_BREAK(set_failed, "<%s> esp_qcloud_set_param, id: %s",
                                esp_err_to_name(err), item->string);
     }
 
+    /**< Report the invalid value unless a set callback failed */
+    if (invalid != ESP_OK && !set_failed) {
+        return invalid;
+    }
+
     return err;
 }
 
@@ -300,10 +699,17 @@ esp_err_t esp_qcloud_handle_get_param(const cJSON *request_data, cJSON *reply_da
 {
     esp_err_t err = ESP_FAIL;
 
-    esp_qcloud_param_t *param;
-    SLIST_FOREACH(param, &g_property_list, next) {
-        /* Check if command starts with buf */
-        err = g_esp_qcloud_get_param(param->id, &param->value);
+    if (!g_property_lock) {
+        return err;
+    }
+
+    /**< The get callbacks run with the lock held, as they do for the reports */
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    for (size_t i = 0; i < g_property_num; ++i) {
+        esp_qcloud_property_t *param = g_property + i;
+
+        err = esp_qcloud_device_get_value(param);
         ESP_QCLOUD_ERROR_BREAK(err != ESP_OK, "esp_qcloud_get_param, id: %s", param->id);
 
         if (param->value.type == QCLOUD_VAL_TYPE_INTEGER) {
@@ -317,19 +723,212 @@ esp_err_t esp_qcloud_handle_get_param(const cJSON *request_data, cJSON *reply_da
         }
     }
 
+    xSemaphoreGive(g_property_lock);
+
     return err;
 }
 
-esp_err_t esp_qcloud_operate_action(esp_qcloud_method_t *action_handle, const char *action_id, char *params)
+void esp_qcloud_device_write_param(esp_qcloud_json_writer_t *writer, const char *id,
+                                   const esp_qcloud_param_val_t *value)
+{
+    switch (value->type) {
+    case QCLOUD_VAL_TYPE_INTEGER:
+    case QCLOUD_VAL_TYPE_ENUM:
+    case QCLOUD_VAL_TYPE_TIME:
+        esp_qcloud_json_add_int(writer, id, value->i);
+        break;
+
+    case QCLOUD_VAL_TYPE_BOOLEAN:
+        esp_qcloud_json_add_int(writer, id, value->b);
+        break;
+
+    case QCLOUD_VAL_TYPE_FLOAT:
+        esp_qcloud_json_add_float(writer, id, value->f);
+        break;
+
+    case QCLOUD_VAL_TYPE_STRING:
+        esp_qcloud_json_add_string(writer, id, value->s);
+        break;
+
+    case QCLOUD_VAL_TYPE_STRUCT:
+        if (value->s) {
+            esp_qcloud_json_add_raw(writer, id, value->s, strlen(value->s));
+        }
+
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void esp_qcloud_device_free_value(esp_qcloud_param_val_t *value)
 {
-    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (value->type == QCLOUD_VAL_TYPE_STRING || value->type == QCLOUD_VAL_TYPE_STRUCT) {
+        ESP_QCLOUD_FREE(value->s);
+    }
+}
+
+static void esp_qcloud_device_copy_value(esp_qcloud_param_val_t *dst, const esp_qcloud_param_val_t *src)
+{
+    esp_qcloud_device_free_value(dst);
+    *dst = *src;
+
+    /**< The string returned by the get callback belongs to the application */
+    if ((src->type == QCLOUD_VAL_TYPE_STRING || src->type == QCLOUD_VAL_TYPE_STRUCT) && src->s) {
+        dst->s = strdup(src->s);
+    }
+}
 
-    esp_qcloud_action_t *action;
-    SLIST_FOREACH(action, &g_action_list, next) {
-        if (!strcmp(action->id, action_id)) {
-            return action->action_cb(action_handle, params);
+static bool esp_qcloud_device_value_changed(const esp_qcloud_property_t *property)
+{
+    const esp_qcloud_param_val_t *value  = &property->value;
+    const esp_qcloud_param_val_t *shadow = &property->shadow;
+
+    switch (value->type) {
+    case QCLOUD_VAL_TYPE_BOOLEAN:
+        return value->b != shadow->b;
+
+    case QCLOUD_VAL_TYPE_INTEGER:
+    case QCLOUD_VAL_TYPE_ENUM:
+    case QCLOUD_VAL_TYPE_TIME:
+        return value->i != shadow->i;
+
+    case QCLOUD_VAL_TYPE_FLOAT:
+        return fabsf(value->f - shadow->f) > property->epsilon;
+
+    case QCLOUD_VAL_TYPE_STRING:
+    case QCLOUD_VAL_TYPE_STRUCT:
+        if (!value->s || !shadow->s) {
+            return value->s != shadow->s;
         }
+
+        return strcmp(value->s, shadow->s) != 0;
+
+    default:
+        return true;
     }
+}
+
+/**
+ * @brief Read all the properties and mark the ones to report, called with g_property_lock held.
+ */
+static size_t esp_qcloud_device_collect_property(bool all)
+{
+    esp_err_t err = ESP_OK;
+    size_t count  = 0;
+
+    for (size_t i = 0; i < g_property_num; ++i) {
+        esp_qcloud_property_t *property = g_property + i;
+        property->changed = false;
+
+        err = esp_qcloud_device_get_value(property);
+        ESP_QCLOUD_ERROR_CONTINUE(err != ESP_OK, "esp_qcloud_get_param, id: %s", property->id);
+
+        property->changed = all || !property->shadow_valid || esp_qcloud_device_value_changed(property);
+        count += property->changed;
+    }
+
+    return count;
+}
+
+esp_err_t esp_qcloud_device_write_changed_property(esp_qcloud_json_writer_t *writer, void *report)
+{
+    const esp_qcloud_device_report_t *device_report = (const esp_qcloud_device_report_t *)report;
+    size_t count = 0;
+
+    if (!g_property_lock) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    if (!esp_qcloud_device_collect_property(device_report->all)) {
+        xSemaphoreGive(g_property_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    for (size_t i = 0; i < g_property_num; ++i) {
+        esp_qcloud_property_t *property = g_property + i;
+
+        if (!property->changed) {
+            continue;
+        }
+
+        esp_qcloud_device_write_param(writer, property->id, &property->value);
+        esp_qcloud_device_copy_value(&property->pending, &property->value);
+        property->pending_valid = true;
+        property->changed       = false;
+        count++;
+    }
+
+    /**
+     * @brief Only the latest report is tracked, the values of an earlier report that
+     *        is still in flight are committed together with it.
+     */
+    if (count) {
+        strlcpy(g_pending_token, device_report->token, sizeof(g_pending_token));
+    }
+
+    xSemaphoreGive(g_property_lock);
+
+    return count ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void esp_qcloud_device_ack_property(const char *token, bool accepted)
+{
+    if (!g_property_lock || !token) {
+        return;
+    }
+
+    xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+    if (!g_pending_token[0] || strcmp(token, g_pending_token)) {
+        xSemaphoreGive(g_property_lock);
+        return;
+    }
+
+    for (size_t i = 0; i < g_property_num; ++i) {
+        esp_qcloud_property_t *property = g_property + i;
+
+        if (!property->pending_valid) {
+            continue;
+        }
+
+        if (accepted) {
+            esp_qcloud_device_free_value(&property->shadow);
+            property->shadow       = property->pending;
+            property->shadow_valid = true;
+            property->pending.s    = NULL;
+        } else {
+            esp_qcloud_device_free_value(&property->pending);
+        }
+
+        property->pending_valid = false;
+    }
+
+    g_pending_token[0] = '\0';
+
+    xSemaphoreGive(g_property_lock);
+}
+
+esp_err_t esp_qcloud_operate_action(esp_qcloud_method_t *action_handle, const char *action_id, char *params)
+{
+    esp_qcloud_action_cb_t action_cb = NULL;
+
+    if (g_property_lock) {
+        xSemaphoreTake(g_property_lock, portMAX_DELAY);
+
+        esp_qcloud_action_item_t *action = esp_qcloud_device_find_action(action_id);
+        action_cb = action ? action->action_cb : NULL;
+
+        xSemaphoreGive(g_property_lock);
+    }
+
+    if (action_cb) {
+        return action_cb(action_handle, params);
+    }
+
     ESP_LOGE(TAG, "The callback function of <%s> was not found, Please check <esp_qcloud_device_add_action_cb>", action_id);
-    return err;
+    return ESP_ERR_NOT_FOUND;
 }
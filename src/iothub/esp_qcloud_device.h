@@ -0,0 +1,71 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_qcloud_iothub.h"
+#include "esp_qcloud_json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define QCLOUD_DEVICE_TOKEN_MAX_SIZE    (DEVICE_NAME_MAX_SIZE + 8)  /**< "{DeviceName}-xxxxx" */
+#define QCLOUD_PROPERTY_FLOAT_EPSILON   (1e-4f)  /**< Default minimum change of a float property */
+
+/**
+ * @brief Write a parameter as a member of the current object.
+ *
+ * @param[in] writer JSON writer.
+ * @param[in] id     Parameter id.
+ * @param[in] value  Parameter value, the type decides the encoding.
+ */
+void esp_qcloud_device_write_param(esp_qcloud_json_writer_t *writer, const char *id,
+                                   const esp_qcloud_param_val_t *value);
+
+/**
+ * @brief Argument of esp_qcloud_device_write_changed_property().
+ */
+typedef struct {
+    const char *token;  /**< clientToken of the report */
+    bool all;           /**< Write every property, otherwise only the ones that differ
+                             from the value last acknowledged by the cloud */
+} esp_qcloud_device_report_t;
+
+/**
+ * @brief Read all the properties, write the ones that need to be reported and
+ *        keep them as pending until the report is acknowledged.
+ *
+ * @note The signature matches esp_qcloud_json_write_cb_t. The properties are read
+ *       and written under the same lock, a concurrent report can't take them in between.
+ *
+ * @param[in] writer JSON writer.
+ * @param[in] report The report, `esp_qcloud_device_report_t *`.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: no property to report
+ */
+esp_err_t esp_qcloud_device_write_changed_property(esp_qcloud_json_writer_t *writer, void *report);
+
+/**
+ * @brief Handle the report_reply of the cloud.
+ *
+ * @param[in] token    clientToken of the reply.
+ * @param[in] accepted The report is accepted, the pending values become the shadow.
+ */
+void esp_qcloud_device_ack_property(const char *token, bool accepted);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -22,9 +22,6 @@
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include "cJSON.h"
-#include "mbedtls/md.h"
-#include "mbedtls/base64.h"
-#include "mbedtls/error.h"
 
 #include <esp_qcloud_iothub.h>
 #include <esp_qcloud_utils.h>
@@ -33,6 +30,14 @@
 #include "esp_qcloud_log.h"
 #include "esp_qcloud_storage.h"
 #include "esp_qcloud_prov.h"
+#include "esp_qcloud_json.h"
+#include "esp_qcloud_device.h"
+#include "esp_qcloud_topic.h"
+#include "esp_qcloud_report.h"
+#include "esp_qcloud_method_pool.h"
+#include "esp_qcloud_journal.h"
+#include "esp_qcloud_credential.h"
+#include "esp_qcloud_ota.h"
 
 #define QCLOUD_IOTHUB_DEVICE_SDK_APPID             "21010406"
 #define QCLOUD_IOTHUB_MQTT_DIRECT_DOMAIN           "iotcloud.tencentdevices.com"
@@ -63,123 +68,143 @@ static const char *TAG = "esp_qcloud_iothub";
 static EventGroupHandle_t g_iothub_group = NULL;
 static bool g_qcloud_iothub_is_connected = false;
 static bool g_get_status_need_update     = false;
+static bool g_iothub_online_done         = false;
+static bool g_iothub_online_running      = false;
+static portMUX_TYPE g_iothub_online_lock = portMUX_INITIALIZER_UNLOCKED;
 
 bool esp_qcloud_iothub_is_connected()
 {
-    return g_qcloud_iothub_is_connected;
+    return g_qcloud_iothub_is_connected && esp_qcloud_mqtt_is_connected();
 }
 
-static esp_err_t esp_qcloud_iothub_subscribe(const char *topic, esp_qcloud_mqtt_subscribe_cb_t cb)
+static esp_err_t esp_qcloud_iothub_subscribe(esp_qcloud_topic_t topic, esp_qcloud_mqtt_subscribe_cb_t cb)
 {
-    esp_err_t err         = ESP_OK;
-    char *subscribe_topic = NULL;
+    esp_err_t err               = ESP_OK;
+    const char *subscribe_topic = esp_qcloud_topic_get(topic);
 
-    asprintf(&subscribe_topic, "$thing/down/%s/%s/%s",
-             topic, esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
     err = esp_qcloud_mqtt_subscribe(subscribe_topic, cb, NULL);
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> subscribe to %s", esp_err_to_name(err), subscribe_topic);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> subscribe to %s", esp_err_to_name(err), subscribe_topic);
 
     ESP_LOGI(TAG, "mqtt_subscribe, topic: %s", subscribe_topic);
 
-
-EXIT:
-    ESP_QCLOUD_FREE(subscribe_topic);
     return err;
 }
 
-static esp_err_t esp_qcloud_iothub_publish(const char *topic, const char *method, esp_qcloud_method_extra_val_t *extra_val, cJSON *data)
+static void esp_qcloud_iothub_make_token(char *token, size_t size)
 {
-    esp_err_t err       = ESP_FAIL;
-    char *publish_topic = NULL;
-    char *publish_data  = NULL;
-
-    asprintf(&publish_topic, "$thing/up/%s/%s/%s",
-             topic, esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
+    snprintf(token, size, "%s-%05"PRIu32, esp_qcloud_get_device_name(), esp_random() % 100000);
+}
 
-    cJSON *json_publish_data = cJSON_CreateObject();
-    cJSON_AddStringToObject(json_publish_data, "method", method);
+static esp_err_t esp_qcloud_iothub_publish(esp_qcloud_topic_t topic, const char *method, const esp_qcloud_method_extra_val_t *extra_val,
+        esp_qcloud_json_write_cb_t params_cb, void *params_arg)
+{
+    esp_err_t err = ESP_FAIL;
+    const char *publish_topic = esp_qcloud_topic_get(topic);
+    char *publish_data        = NULL;
+    char token[QCLOUD_DEVICE_TOKEN_MAX_SIZE] = {0};
+    esp_qcloud_json_writer_t writer = {0};
+    bool action_reply = extra_val && !strcmp(method, "action_reply");
+
+    /**
+     * @brief The payload is encoded in place, no cJSON tree is built. The buffer is
+     *        on the heap as this runs in the esp-mqtt task and in application tasks,
+     *        whose stacks are not sized for CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE.
+     */
+    publish_data = ESP_QCLOUD_MALLOC(CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE);
+    ESP_QCLOUD_ERROR_CHECK(!publish_data, ESP_ERR_NO_MEM, "Allocate the payload of %s", method);
+
+    esp_qcloud_json_writer_init(&writer, publish_data, CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE);
+    esp_qcloud_json_add_string(&writer, "method", method);
+
+    if (extra_val && extra_val->token) {
+        esp_qcloud_json_add_string(&writer, "clientToken", extra_val->token);
+    } else {
+        esp_qcloud_iothub_make_token(token, sizeof(token));
+        esp_qcloud_json_add_string(&writer, "clientToken", token);
+    }
 
-    char *token = NULL;
-#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
-    asprintf(&token, "%s-%05lu", esp_qcloud_get_device_name(), esp_random() % 100000);
-#else
-    asprintf(&token, "%s-%05u", esp_qcloud_get_device_name(), esp_random() % 100000);
-#endif
-    cJSON_AddStringToObject(json_publish_data, "clientToken", token);
-    ESP_QCLOUD_FREE(token);
+    if (action_reply) {
+        esp_qcloud_json_add_int(&writer, "code", extra_val->code);
+        esp_qcloud_json_add_string(&writer, "status", esp_err_to_name(extra_val->code));
+    }
 
-    if (data && data->child) {
-        cJSON_AddItemReferenceToObject(json_publish_data, "params", data);
+    if (extra_val && extra_val->timestamp && !strcmp(method, "report")) {
+        esp_qcloud_json_add_double(&writer, "timestamp", extra_val->timestamp);
+    } else if (extra_val && !strcmp(method, "event_post")) {
+        esp_qcloud_json_add_string(&writer, "type", extra_val->type);
+        esp_qcloud_json_add_string(&writer, "eventId", extra_val->id);
+        esp_qcloud_json_add_string(&writer, "version", extra_val->version);
+        esp_qcloud_json_add_double(&writer, "timestamp", extra_val->timestamp);
     }
 
-    if (extra_val) {
-        if (!strcmp(method, "report")) {
-            cJSON_AddNumberToObject(json_publish_data, "timestamp", extra_val->timestamp);
-        } else if (!strcmp(method, "event_post")) {
-            cJSON_AddStringToObject(json_publish_data, "type", extra_val->type);
-            cJSON_AddStringToObject(json_publish_data, "eventId", extra_val->id);
-            cJSON_AddStringToObject(json_publish_data, "version", extra_val->version);
-            cJSON_AddNumberToObject(json_publish_data, "timestamp", extra_val->timestamp);
-        }  else if (!strcmp(method, "action_reply")) {
-            cJSON_AddNumberToObject(json_publish_data, "code", extra_val->code);
-            cJSON_AddStringToObject(json_publish_data, "status", esp_err_to_name(extra_val->code));
-            cJSON_DeleteItemFromObject(json_publish_data, "clientToken");
-            cJSON_AddStringToObject(json_publish_data, "clientToken", extra_val->token);
-            if (data && data->child) {
-                cJSON_DeleteItemFromObject(json_publish_data, "params");
-                cJSON_AddItemReferenceToObject(json_publish_data, "response", data);
-            }
+    if (params_cb) {
+        err = esp_qcloud_json_add_object(&writer, action_reply ? "response" : "params", params_cb, params_arg);
+
+        /**< Nothing to publish, e.g. no property changed */
+        if (err == ESP_ERR_NOT_FOUND) {
+            goto EXIT;
         }
+
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "Write the params of %s", method);
     }
 
-    publish_data = cJSON_PrintUnformatted(json_publish_data);
-    ESP_LOGI(TAG, "publish_data:%s", publish_data);
-    cJSON_Delete(json_publish_data);
+    err = esp_qcloud_json_writer_finish(&writer);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "The payload of %s exceeds %d bytes, please increase CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE",
+                          method, CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE);
+
+    /**< Replies go before events, events before reports */
+    esp_qcloud_mqtt_prio_t prio = topic == QCLOUD_TOPIC_ACTION_UP ? QCLOUD_MQTT_PRIO_CONTROL
+                                  : topic == QCLOUD_TOPIC_EVENT_UP ? QCLOUD_MQTT_PRIO_EVENT : QCLOUD_MQTT_PRIO_REPORT;
+
+#ifdef CONFIG_QCLOUD_JOURNAL
+    /**
+     * @brief Reports and events are kept in flash while offline. Once anything is
+     *        journaled the new ones queue behind it so that the order is kept.
+     */
+    if ((topic == QCLOUD_TOPIC_EVENT_UP || !strcmp(method, "report"))
+            && (!esp_qcloud_mqtt_is_connected() || esp_qcloud_journal_pending())) {
+        err = esp_qcloud_journal_write(publish_topic, publish_data, writer.len, prio);
+
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "mqtt_journal, topic: %s, method: %s, data: %s", publish_topic, method, publish_data);
+            goto EXIT;
+        }
 
-    err = esp_qcloud_mqtt_publish(publish_topic, publish_data, strlen(publish_data));
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> Publish to %s, data: %s",
-                          esp_err_to_name(err), publish_topic,  publish_data);
+        ESP_LOGD(TAG, "<%s> esp_qcloud_journal_write, publish directly", esp_err_to_name(err));
+    }
+#endif
+
+    err = esp_qcloud_mqtt_publish_async(publish_topic, publish_data, writer.len, prio, NULL, NULL);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "Publish to %s, data: %s", publish_topic, publish_data);
 
     ESP_LOGI(TAG, "mqtt_publish, topic: %s, method: %s, data: %s", publish_topic, method, publish_data);
 
 EXIT:
-    ESP_QCLOUD_FREE(publish_topic);
     ESP_QCLOUD_FREE(publish_data);
-
-    return ESP_OK;
+    return err;
 }
 
-static esp_err_t esp_qcloud_iothub_reply(const char *method, const char *token, esp_err_t reply_code, cJSON *data)
+static esp_err_t esp_qcloud_iothub_reply(const char *method, const char *token, esp_err_t reply_code)
 {
     esp_err_t err = ESP_FAIL;
-    char *publish_topic = NULL;
-    char *publish_data = NULL;
+    const char *publish_topic = esp_qcloud_topic_get(QCLOUD_TOPIC_PROPERTY_UP);
+    char publish_data[256];
+    esp_qcloud_json_writer_t writer = {0};
 
-    asprintf(&publish_topic, "$thing/up/property/%s/%s", esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
+    esp_qcloud_json_writer_init(&writer, publish_data, sizeof(publish_data));
+    esp_qcloud_json_add_string(&writer, "method", method);
+    esp_qcloud_json_add_int(&writer, "code", reply_code);
+    esp_qcloud_json_add_string(&writer, "status", esp_err_to_name(reply_code));
+    esp_qcloud_json_add_string(&writer, "clientToken", token);
 
-    cJSON *json_publish_data = cJSON_CreateObject();
-    cJSON_AddStringToObject(json_publish_data, "method", method);
-    cJSON_AddNumberToObject(json_publish_data, "code", reply_code);
-    cJSON_AddStringToObject(json_publish_data, "status", esp_err_to_name(reply_code));
-    cJSON_AddStringToObject(json_publish_data, "clientToken", token);
-
-    if (data->child) {
-        cJSON_AddItemToObject(json_publish_data, "data", data);
-    }
+    err = esp_qcloud_json_writer_finish(&writer);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "The payload of %s is too long", method);
 
-    publish_data = cJSON_PrintUnformatted(json_publish_data);
-    cJSON_Delete(json_publish_data);
-
-    err = esp_qcloud_mqtt_publish(publish_topic, publish_data, strlen(publish_data));
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> publish, topic: $thing/up/property/%s/%s, data: %s",
-                          esp_err_to_name(err), esp_qcloud_get_product_id(), esp_qcloud_get_device_name(), publish_data);
+    err = esp_qcloud_mqtt_publish_async(publish_topic, publish_data, writer.len, QCLOUD_MQTT_PRIO_CONTROL, NULL, NULL);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "Publish to %s, data: %s", publish_topic, publish_data);
 
     ESP_LOGI(TAG, "mqtt_publish, topic: %s, data: %s", publish_topic, publish_data);
 
-EXIT:
-    ESP_QCLOUD_FREE(publish_topic);
-    ESP_QCLOUD_FREE(publish_data);
-
     return ESP_OK;
 }
 
@@ -198,45 +223,16 @@ static esp_err_t esp_qcloud_iothub_config(esp_qcloud_mqtt_config_t *mqtt_cfg)
 
     switch (esp_qcloud_get_auth_mode()) {
     case QCLOUD_AUTH_MODE_KEY: {
-        uint8_t digest[32] = {0};
-        uint8_t base64_psk[48] = {0};
-        size_t base64_len = 0;
-        mbedtls_md_context_t sha_ctx;
-
-        err = mbedtls_base64_decode(base64_psk, sizeof(base64_psk), &base64_len,
-                                    (uint8_t *)esp_qcloud_get_device_secret(), strlen(esp_qcloud_get_device_secret()));
-        ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_base64_decode");
-
-        mbedtls_md_init(&sha_ctx);
-        err = mbedtls_md_setup(&sha_ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
-        ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_setup");
-        err = mbedtls_md_hmac_starts(&sha_ctx, base64_psk, base64_len);
-        ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_starts");
-        err = mbedtls_md_hmac_update(&sha_ctx, (uint8_t *)mqtt_cfg->username, strlen(mqtt_cfg->username));
-        ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_update");
-        err = mbedtls_md_hmac_finish(&sha_ctx, digest);
-        ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_finish");
-
-        char *ptr_hd = mqtt_cfg->password = ESP_QCLOUD_CALLOC(1, 128);
-
-        for (int i = 0; i < sizeof(digest); i++) {
-            ptr_hd += sprintf(ptr_hd, "%02x", digest[i]);
-        }
+        char digest_str[QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE * 2 + 1] = {0};
 
-        strcat(mqtt_cfg->password, ";hmacsha256");
+        /**< Signed with the key prepared by esp_qcloud_credential_init() */
+        err = esp_qcloud_credential_sign_hex(QCLOUD_CREDENTIAL_MQTT, mqtt_cfg->username, strlen(mqtt_cfg->username),
+                                             digest_str, sizeof(digest_str));
+        ESP_QCLOUD_ERROR_BREAK(err != ESP_OK, "<%s> esp_qcloud_credential_sign_hex", esp_err_to_name(err));
 
+        asprintf(&mqtt_cfg->password, "%s;hmacsha256", digest_str);
         asprintf(&mqtt_cfg->host, "mqtt://%s.%s:%d", esp_qcloud_get_product_id(),
                  QCLOUD_IOTHUB_MQTT_DIRECT_DOMAIN, QCLOUD_IOTHUB_MQTT_SERVER_PORT_NOTLS);
-
-EXIT:
-
-        if (err != 0) {
-            char err_buf[128] = {0};
-            mbedtls_strerror(err, err_buf, sizeof(err_buf) - 1);
-            ESP_LOGW(TAG, "%s", err_buf);
-        }
-
-        mbedtls_md_free(&sha_ctx);
         break;
     }
 
@@ -279,7 +275,7 @@ static void esp_qcloud_iothub_property_callback(const char *topic, void *payload
     if (!strcmp(method, "control")) {
         cJSON *request_params = cJSON_GetObjectItem(request_data, "params");
         err = esp_qcloud_handle_set_param(request_params, reply_data);
-        esp_qcloud_iothub_reply("control_reply", client_token, err, reply_data);
+        esp_qcloud_iothub_reply("control_reply", client_token, err);
     } else if (!strcmp(method, "get_status_reply")) {
         const int result_code = cJSON_GetObjectItem(request_data, "code")->valueint;
         if (0 == result_code) {
@@ -294,6 +290,9 @@ static void esp_qcloud_iothub_property_callback(const char *topic, void *payload
             esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_RECEIVE_STATUS, reported_str, strlen(reported_str) + 1, portMAX_DELAY);
             ESP_QCLOUD_FREE(reported_str);
         }
+    } else if (!strcmp(method, "report_reply")) {
+        cJSON *code = cJSON_GetObjectItem(request_data, "code");
+        esp_qcloud_device_ack_property(client_token, code && code->valueint == 0);
     }
 
 EXIT:
@@ -305,23 +304,110 @@ static esp_err_t esp_qcloud_iothub_register_property()
 {
     esp_err_t err = ESP_FAIL;
 
-    err = esp_qcloud_iothub_subscribe("property", esp_qcloud_iothub_property_callback);
+    err = esp_qcloud_iothub_subscribe(QCLOUD_TOPIC_PROPERTY_DOWN, esp_qcloud_iothub_property_callback);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_subscribe");
 
     return err;
 }
 
-esp_err_t esp_qcloud_iothub_report_all_property(void)
+/**
+ * @brief Report the properties, ESP_ERR_NOT_FOUND if none changed
+ */
+static esp_err_t esp_qcloud_iothub_report_property(bool all)
 {
     esp_err_t err = ESP_FAIL;
-    cJSON *params_json = cJSON_CreateObject();
+    char token[QCLOUD_DEVICE_TOKEN_MAX_SIZE] = {0};
+    esp_qcloud_method_extra_val_t extra_val = {
+        .token = token,
+    };
+    esp_qcloud_device_report_t report = {
+        .token = token,
+        .all   = all,
+    };
+
+    /**< The token is needed to match the report_reply with the values reported */
+    esp_qcloud_iothub_make_token(token, sizeof(token));
+
+    err = esp_qcloud_iothub_publish(QCLOUD_TOPIC_PROPERTY_UP, "report", &extra_val,
+                                    esp_qcloud_device_write_changed_property, &report);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK && err != ESP_ERR_NOT_FOUND, err,
+                           "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
+
+    return err;
+}
+
+esp_err_t esp_qcloud_iothub_report_all_property(void)
+{
+    esp_err_t err = esp_qcloud_iothub_report_property(true);
+    return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
+esp_err_t esp_qcloud_iothub_report_changed_property(void)
+{
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+    return esp_qcloud_report_post_changed();
+#else
+    esp_err_t err = esp_qcloud_iothub_report_property(false);
+    return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+#endif
+}
+
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+
+typedef struct {
+    const esp_qcloud_param_t *params;
+    size_t count;
+} esp_qcloud_iothub_param_array_t;
+
+static esp_err_t esp_qcloud_iothub_write_param_array(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    const esp_qcloud_iothub_param_array_t *array = (esp_qcloud_iothub_param_array_t *)arg;
+
+    for (int i = 0; i < array->count; ++i) {
+        esp_qcloud_device_write_param(writer, array->params[i].id, &array->params[i].value);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t esp_qcloud_iothub_report_params(const esp_qcloud_param_t *params, size_t count, double timestamp)
+{
+    esp_qcloud_iothub_param_array_t array = {
+        .params = params,
+        .count  = count,
+    };
+    esp_qcloud_method_extra_val_t extra_val = {
+        .timestamp = timestamp,
+    };
+
+    return esp_qcloud_iothub_publish(QCLOUD_TOPIC_PROPERTY_UP, "report", &extra_val,
+                                     esp_qcloud_iothub_write_param_array, &array);
+}
+
+static esp_err_t esp_qcloud_iothub_report_changed_now(void)
+{
+    return esp_qcloud_iothub_report_property(false);
+}
+
+#endif /**< CONFIG_QCLOUD_REPORT_SCHEDULER */
+
+esp_err_t esp_qcloud_iothub_get_report_stats(esp_qcloud_iothub_report_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
 
-    err = esp_qcloud_handle_get_param(NULL, params_json);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_qcloud_register_get_params", esp_err_to_name(err));
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+    esp_qcloud_report_get_stats(stats);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
 
-    err = esp_qcloud_iothub_publish("property", "report", NULL, params_json);
-    cJSON_Delete(params_json);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_qcloud_register_get_params", esp_err_to_name(err));
+esp_err_t esp_qcloud_iothub_get_pool_stats(esp_qcloud_iothub_pool_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
+
+    esp_qcloud_method_pool_get_stats(stats);
 
     return ESP_OK;
 }
@@ -350,64 +436,36 @@ EXIT:
 
 static esp_err_t esp_qcloud_iothub_register_log()
 {
-    esp_err_t err         = ESP_OK;
-    char *publish_topic   = NULL;
-    char *publish_data    = NULL;
-    char *subscribe_topic = NULL;
+    esp_err_t err = ESP_FAIL;
 
-    asprintf(&subscribe_topic, "$log/operation/result/%s/%s",
-             esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
-    err = esp_qcloud_mqtt_subscribe(subscribe_topic, esp_qcloud_iothub_log_callback, NULL);
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> subscribe to %s", esp_err_to_name(err), subscribe_topic);
+    err = esp_qcloud_iothub_subscribe(QCLOUD_TOPIC_LOG_OPERATION_RESULT, esp_qcloud_iothub_log_callback);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_subscribe");
 
-    ESP_LOGI(TAG, "mqtt_subscribe, topic: %s", subscribe_topic);
+    return err;
+}
+
+static esp_err_t esp_qcloud_iothub_get_log_level()
+{
+    esp_err_t err               = ESP_OK;
+    char *publish_data          = NULL;
+    const char *publish_topic   = esp_qcloud_topic_get(QCLOUD_TOPIC_LOG_OPERATION);
 
-    asprintf(&publish_topic, "$log/operation/%s/%s",
-             esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
     asprintf(&publish_data, "{\"type\":\"get_log_level\",\"clientToken\": \"%s-%05lu\"}", esp_qcloud_get_product_id(), esp_random() % 100000);
 #else
     asprintf(&publish_data, "{\"type\":\"get_log_level\",\"clientToken\": \"%s-%05u\"}", esp_qcloud_get_product_id(), esp_random() % 100000);
 #endif
-    err = esp_qcloud_mqtt_publish(publish_topic, publish_data, strlen(publish_data));
+    err = esp_qcloud_mqtt_publish_async(publish_topic, publish_data, strlen(publish_data),
+                                        QCLOUD_MQTT_PRIO_LOG, NULL, NULL);
     ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> Publish to %s, data: %s",
                           esp_err_to_name(err), publish_topic,  publish_data);
     ESP_LOGI(TAG, "mqtt_publish, topic: %s, data: %s", publish_topic, publish_data);
 
 EXIT:
-    ESP_QCLOUD_FREE(publish_topic);
     ESP_QCLOUD_FREE(publish_data);
-    ESP_QCLOUD_FREE(subscribe_topic);
     return err;
 }
 
-esp_err_t esp_qcloud_iothub_init()
-{
-    esp_err_t err = ESP_FAIL;
-    esp_qcloud_mqtt_config_t mqtt_cfg = {0};
-
-    g_iothub_group = xEventGroupCreate();
-
-    err = esp_qcloud_iothub_config(&mqtt_cfg);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_get_config");
-
-    err = esp_qcloud_mqtt_init(&mqtt_cfg);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_init");
-
-    ESP_LOGD(TAG, "QCloud iothub mqtt config:");
-    ESP_LOGD(TAG, "qcloud_uri: %s", mqtt_cfg.host);
-    ESP_LOGD(TAG, "client_id: %s", mqtt_cfg.client_id);
-    ESP_LOGD(TAG, "username: %s", mqtt_cfg.username);
-    ESP_LOGD(TAG, "password: %s", mqtt_cfg.password);
-
-    err = esp_qcloud_mqtt_connect();
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_connect");
-
-    esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_INIT_DONE, NULL, 0, portMAX_DELAY);
-
-    return ESP_OK;
-}
-
 static void esp_qcloud_iothub_bond_callback(const char *topic, void *payload, size_t payload_len, void *priv_data)
 {
     ESP_LOGI(TAG, "bond_callback: topic: %s, payload: %.*s", topic, payload_len, (char *)payload);
@@ -450,24 +508,27 @@ static esp_err_t esp_qcloud_iothub_register_service()
 {
     esp_err_t err = ESP_FAIL;
 
-    err = esp_qcloud_iothub_subscribe("service", esp_qcloud_iothub_bond_callback);
+    err = esp_qcloud_iothub_subscribe(QCLOUD_TOPIC_SERVICE_DOWN, esp_qcloud_iothub_bond_callback);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_subscribe");
 
     return err;
 }
 
+static esp_err_t esp_qcloud_iothub_write_bind_token(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_json_add_string(writer, "token", (const char *)arg);
+    return ESP_OK;
+}
+
 esp_err_t esp_qcloud_iothub_bind(const char *token, bool block)
 {
     esp_err_t err = ESP_FAIL;
 
-    cJSON *data_json = cJSON_CreateObject();
-    cJSON_AddStringToObject(data_json, "token", token);
-
 #ifdef ESP_QCLOUD_IOTHUB_BIND_RETRY
 
     for (size_t i = 0; i < 3; i++) {
-        err = esp_qcloud_iothub_publish("service", "app_bind_token", NULL, data_json);
-        cJSON_Delete(data_json);
+        err = esp_qcloud_iothub_publish(QCLOUD_TOPIC_SERVICE_UP, "app_bind_token", NULL,
+                                        esp_qcloud_iothub_write_bind_token, (void *)token);
         ESP_QCLOUD_ERROR_BREAK(err != ESP_OK, "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
 
         if (xEventGroupWaitBits(g_iothub_group, IOTHUB_EVENT_BOND_RELAY, false, true, pdMS_TO_TICKS(3 * 1000))) {
@@ -476,8 +537,8 @@ esp_err_t esp_qcloud_iothub_bind(const char *token, bool block)
     }
 
 #else
-    err = esp_qcloud_iothub_publish("service", "app_bind_token", NULL, data_json);
-    cJSON_Delete(data_json);
+    err = esp_qcloud_iothub_publish(QCLOUD_TOPIC_SERVICE_UP, "app_bind_token", NULL,
+                                    esp_qcloud_iothub_write_bind_token, (void *)token);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
 #endif
 
@@ -497,20 +558,40 @@ esp_err_t esp_qcloud_iothub_bind(const char *token, bool block)
     return err;
 }
 
+static esp_err_t esp_qcloud_iothub_write_status_type(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_json_add_string(writer, "type", "report");
+    return ESP_OK;
+}
+
 esp_err_t esp_qcloud_iothub_get_status(esp_qcloud_method_type_t type, bool auto_update)
 {
     ESP_QCLOUD_ERROR_CHECK(type != QCLOUD_METHOD_TYPE_REPORT, ESP_ERR_NOT_SUPPORTED, "not support");
     esp_err_t err;
     g_get_status_need_update = auto_update;
-    cJSON *data_json = cJSON_CreateObject();
-    cJSON_AddStringToObject(data_json, "type", "report");
-    err = esp_qcloud_iothub_publish("property", "get_status", NULL, data_json);
-    cJSON_Delete(data_json);
+    err = esp_qcloud_iothub_publish(QCLOUD_TOPIC_PROPERTY_UP, "get_status", NULL, esp_qcloud_iothub_write_status_type, NULL);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
 
     return err;
 }
 
+static esp_err_t esp_qcloud_iothub_write_device_label(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    /*You can add custom information, which will be displayed in the expanded information section of the QCloud*/
+    esp_qcloud_json_add_string(writer, "manufacturer", "ESPRESSIF");
+    return ESP_OK;
+}
+
+static esp_err_t esp_qcloud_iothub_write_device_info(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_json_add_string(writer, "module_hardinfo", CONFIG_IDF_TARGET);
+    esp_qcloud_json_add_string(writer, "module_softinfo", esp_get_idf_version());
+    esp_qcloud_json_add_string(writer, "fw_ver", esp_qcloud_get_version());
+    esp_qcloud_json_add_string(writer, "mac", (const char *)arg);
+
+    return esp_qcloud_json_add_object(writer, "device_label", esp_qcloud_iothub_write_device_label, NULL);
+}
+
 esp_err_t esp_qcloud_iothub_report_device_info(void)
 {
     esp_err_t err    = ESP_FAIL;
@@ -520,23 +601,10 @@ esp_err_t esp_qcloud_iothub_report_device_info(void)
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_wifi_get_mac", esp_err_to_name(err));
 
     sprintf(mac_str, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    cJSON *data_json = cJSON_CreateObject();
-    cJSON *device_label = cJSON_CreateObject();
-    cJSON_AddStringToObject(data_json, "module_hardinfo", CONFIG_IDF_TARGET);
-    cJSON_AddStringToObject(data_json, "module_softinfo", esp_get_idf_version());
-    cJSON_AddStringToObject(data_json, "fw_ver", esp_qcloud_get_version());
-    cJSON_AddStringToObject(data_json, "mac", (const char *)&mac_str);
-
-    /*You can add custom information, which will be displayed in the expanded information section of the QCloud*/
-    cJSON_AddStringToObject(device_label, "manufacturer", "ESPRESSIF");
-    /*No need to delete when using <cJSON_AddItemToObject>*/
-    cJSON_AddItemToObject(data_json, "device_label", device_label);
 
-    err = esp_qcloud_iothub_publish("property", "report_info", NULL, data_json);
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
+    err = esp_qcloud_iothub_publish(QCLOUD_TOPIC_PROPERTY_UP, "report_info", NULL, esp_qcloud_iothub_write_device_info, mac_str);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_qcloud_iothub_publish", esp_err_to_name(err));
 
-EXIT:
-    cJSON_Delete(data_json);
     return err;
 }
 
@@ -567,7 +635,7 @@ static esp_err_t esp_qcloud_iothub_register_event()
 {
     esp_err_t err = ESP_FAIL;
 
-    err = esp_qcloud_iothub_subscribe("event", esp_qcloud_iothub_event_callback);
+    err = esp_qcloud_iothub_subscribe(QCLOUD_TOPIC_EVENT_DOWN, esp_qcloud_iothub_event_callback);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_subscribe");
 
     return err;
@@ -591,9 +659,11 @@ static void esp_qcloud_iothub_action_callback(const char *topic, void *payload,
 
     cJSON *params = cJSON_GetObjectItem(root_json, "params");
     ESP_QCLOUD_ERROR_GOTO(!params, EXIT, "The data format is wrong, the 'params' field is not included");
-    char *params_str = cJSON_PrintUnformatted(params);
 
     esp_qcloud_method_t *action = esp_qcloud_iothub_create_action();
+    ESP_QCLOUD_ERROR_GOTO(!action, EXIT, "esp_qcloud_iothub_create_action");
+
+    char *params_str = cJSON_PrintUnformatted(params);
     action->extra_val->token    = token;
     action->extra_val->code     = esp_qcloud_operate_action(action, action_id, params_str);
 
@@ -609,27 +679,21 @@ static esp_err_t esp_qcloud_iothub_register_action()
 {
     esp_err_t err = ESP_FAIL;
 
-    err = esp_qcloud_iothub_subscribe("action", esp_qcloud_iothub_action_callback);
+    err = esp_qcloud_iothub_subscribe(QCLOUD_TOPIC_ACTION_DOWN, esp_qcloud_iothub_action_callback);
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_subscribe");
 
     return err;
 }
 
-esp_err_t esp_qcloud_iothub_start()
+static esp_err_t esp_qcloud_iothub_register_topics()
 {
     esp_err_t err = ESP_FAIL;
-    char token[AUTH_TOKEN_MAX_SIZE + 1] = {0};
 
     err = esp_qcloud_iothub_register_service();
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_service");
 
-    if (esp_qcloud_storage_get("token", token, AUTH_TOKEN_MAX_SIZE) == ESP_OK) {
-        esp_qcloud_iothub_bind(token, true);
-        esp_qcloud_storage_erase("token");
-    }
-
     err = esp_qcloud_iothub_register_log();
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_report_property");
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_log");
 
     err = esp_qcloud_iothub_register_property();
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_property");
@@ -640,10 +704,157 @@ esp_err_t esp_qcloud_iothub_start()
     err = esp_qcloud_iothub_register_action();
     ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_action");
 
+    err = esp_qcloud_iothub_register_ota();
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_ota");
+
+    return ESP_OK;
+}
+
+static void esp_qcloud_iothub_online_task(void *arg)
+{
+    esp_err_t err = ESP_OK;
+    char token[AUTH_TOKEN_MAX_SIZE + 1] = {0};
+
+    if (esp_qcloud_storage_get("token", token, AUTH_TOKEN_MAX_SIZE) == ESP_OK) {
+        esp_qcloud_iothub_bind(token, true);
+        esp_qcloud_storage_erase("token");
+    }
+
+    err = esp_qcloud_iothub_get_log_level();
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_iothub_get_log_level", esp_err_to_name(err));
+
     err = esp_qcloud_iothub_report_all_property();
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_report_property");
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_iothub_report_all_property", esp_err_to_name(err));
 
+EXIT:
+    portENTER_CRITICAL(&g_iothub_online_lock);
+    g_iothub_online_done = (err == ESP_OK);
+    g_iothub_online_running = false;
+    portEXIT_CRITICAL(&g_iothub_online_lock);
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief The first requests after start need replies from the cloud, run them
+ *        in a task of their own once connected instead of blocking the caller
+ *        or the MQTT task. Tried again on the next connection if they fail.
+ */
+static void esp_qcloud_iothub_online_kick(void)
+{
+    bool create = false;
+
+    portENTER_CRITICAL(&g_iothub_online_lock);
+
+    if (g_qcloud_iothub_is_connected && !g_iothub_online_done && !g_iothub_online_running
+            && esp_qcloud_mqtt_is_connected()) {
+        g_iothub_online_running = true;
+        create = true;
+    }
+
+    portEXIT_CRITICAL(&g_iothub_online_lock);
+
+    if (create && xTaskCreate(esp_qcloud_iothub_online_task, "iothub_online", 4 * 1024,
+                              NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the iothub online task");
+        portENTER_CRITICAL(&g_iothub_online_lock);
+        g_iothub_online_running = false;
+        portEXIT_CRITICAL(&g_iothub_online_lock);
+    }
+}
+
+static void esp_qcloud_iothub_state_cb(esp_qcloud_mqtt_state_t state, uint32_t backoff_ms)
+{
+    switch (state) {
+        case QCLOUD_MQTT_STATE_CONNECTING:
+            esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_CONNECTING, NULL, 0, portMAX_DELAY);
+            break;
+
+        case QCLOUD_MQTT_STATE_CONNECTED:
+            esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_CONNECTED, NULL, 0, portMAX_DELAY);
+            esp_qcloud_iothub_online_kick();
+            break;
+
+        case QCLOUD_MQTT_STATE_DISCONNECTED:
+            esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_DISCONNECTED, NULL, 0, portMAX_DELAY);
+            break;
+
+        case QCLOUD_MQTT_STATE_BACKOFF:
+            esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_BACKOFF, &backoff_ms, sizeof(backoff_ms), portMAX_DELAY);
+            break;
+
+        default:
+            break;
+    }
+}
+
+esp_err_t esp_qcloud_iothub_init()
+{
+    esp_err_t err = ESP_FAIL;
+    esp_qcloud_mqtt_config_t mqtt_cfg = {0};
+
+    g_iothub_group = xEventGroupCreate();
+
+    /**
+     * @brief The topic names only depend on the device profile, build them once
+     *        here so that the publish and subscribe paths do no formatting.
+     */
+    err = esp_qcloud_topic_init(esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_topic_init");
+
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+    err = esp_qcloud_report_init(esp_qcloud_iothub_report_params, esp_qcloud_iothub_report_changed_now);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_report_init");
+#endif
+
+#ifdef CONFIG_QCLOUD_JOURNAL
+    /**< Without the journal partition reports are dropped while offline as before */
+    err = esp_qcloud_journal_init();
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK && err != ESP_ERR_NOT_FOUND, err, "esp_qcloud_journal_init");
+#endif
+
+    /**< The secret is decoded and its HMAC pads are hashed once for the MQTT password and the log uploads */
+    if (esp_qcloud_get_device_secret()) {
+        err = esp_qcloud_credential_init(esp_qcloud_get_device_secret());
+        ESP_QCLOUD_ERROR_CHECK(err != ESP_OK && esp_qcloud_get_auth_mode() == QCLOUD_AUTH_MODE_KEY,
+                               err, "esp_qcloud_credential_init");
+    }
+
+    err = esp_qcloud_iothub_config(&mqtt_cfg);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_get_config");
+
+    err = esp_qcloud_mqtt_init(&mqtt_cfg);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_init");
+
+    /**
+     * @brief Subscribed before connecting, so that all the topics are sent in
+     *        one SUBSCRIBE as soon as the connection is up.
+     */
+    err = esp_qcloud_iothub_register_topics();
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_iothub_register_topics");
+
+    err = esp_qcloud_mqtt_register_state_cb(esp_qcloud_iothub_state_cb);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_register_state_cb");
+
+    ESP_LOGD(TAG, "QCloud iothub mqtt config:");
+    ESP_LOGD(TAG, "qcloud_uri: %s", mqtt_cfg.host);
+    ESP_LOGD(TAG, "client_id: %s", mqtt_cfg.client_id);
+    ESP_LOGD(TAG, "username: %s", mqtt_cfg.username);
+    ESP_LOGD(TAG, "password: %s", mqtt_cfg.password);
+
+    /**< Local control keeps working while the cloud comes up */
+    err = esp_qcloud_mqtt_connect_async();
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_mqtt_connect_async");
+
+    esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_IOTHUB_INIT_DONE, NULL, 0, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_iothub_start()
+{
     g_qcloud_iothub_is_connected = true;
+    esp_qcloud_iothub_online_kick();
 
     return ESP_OK;
 }
@@ -655,88 +866,112 @@ esp_err_t esp_qcloud_iothub_stop()
     return ESP_OK;
 }
 
-esp_err_t esp_qcloud_iothub_param_add_int(esp_qcloud_method_t *method, char *id, int value)
+static esp_err_t esp_qcloud_iothub_param_add(esp_qcloud_method_t *method, const char *id,
+        const esp_qcloud_param_val_t *value)
 {
-    ESP_QCLOUD_ERROR_CHECK(!method || !id, ESP_FAIL, "method or id is a null pointer");
+    ESP_QCLOUD_ERROR_CHECK(method->param_num >= CONFIG_QCLOUD_METHOD_PARAM_MAX, ESP_ERR_NO_MEM,
+                           "The method is full, drop param: %s", id);
 
-    esp_qcloud_param_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_param_t));
-    item->id = id;
-    item->value.i = (int)value;
-    item->value.type = QCLOUD_VAL_TYPE_INTEGER;
+    esp_qcloud_param_t *item = method->param + method->param_num++;
+    item->id    = id;
+    item->value = *value;
 
-    esp_qcloud_param_t *last = SLIST_FIRST(&method->method_param_list);
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&method->method_param_list, item, next);
-    } else {
-        SLIST_INSERT_AFTER(last, item, next);
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy a string into the arena of the method.
+ */
+static char *esp_qcloud_iothub_arena_strdup(esp_qcloud_method_t *method, const char *str)
+{
+    size_t size = strlen(str) + 1;
+
+    if (method->arena_len + size > sizeof(method->arena)) {
+        return NULL;
     }
 
-    return ESP_OK;
+    char *dup = method->arena + method->arena_len;
+    memcpy(dup, str, size);
+    method->arena_len += size;
+
+    return dup;
 }
 
-esp_err_t esp_qcloud_iothub_param_add_float(esp_qcloud_method_t *method, char *id, float value)
+esp_err_t esp_qcloud_iothub_param_add_int(esp_qcloud_method_t *method, char *id, int value)
 {
     ESP_QCLOUD_ERROR_CHECK(!method || !id, ESP_FAIL, "method or id is a null pointer");
 
-    esp_qcloud_param_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_param_t));
-    item->id = id;
-    item->value.f = (float)value;
-    item->value.type = QCLOUD_VAL_TYPE_FLOAT;
+    esp_qcloud_param_val_t val = {
+        .type = QCLOUD_VAL_TYPE_INTEGER,
+        .i    = value,
+    };
 
-    esp_qcloud_param_t *last = SLIST_FIRST(&method->method_param_list);
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&method->method_param_list, item, next);
-    } else {
-        SLIST_INSERT_AFTER(last, item, next);
-    }
+    return esp_qcloud_iothub_param_add(method, id, &val);
+}
 
-    return ESP_OK;
+esp_err_t esp_qcloud_iothub_param_add_float(esp_qcloud_method_t *method, char *id, float value)
+{
+    ESP_QCLOUD_ERROR_CHECK(!method || !id, ESP_FAIL, "method or id is a null pointer");
+
+    esp_qcloud_param_val_t val = {
+        .type = QCLOUD_VAL_TYPE_FLOAT,
+        .f    = value,
+    };
+
+    return esp_qcloud_iothub_param_add(method, id, &val);
 }
 
 esp_err_t esp_qcloud_iothub_param_add_string(esp_qcloud_method_t *method, char *id, char *value)
 {
     ESP_QCLOUD_ERROR_CHECK(!method || !id, ESP_FAIL, "method or id is a null pointer");
 
-    esp_qcloud_param_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_param_t));
-    item->id = id;
-    item->value.s = strdup(value);
-    item->value.type = QCLOUD_VAL_TYPE_STRING;
+    esp_qcloud_param_val_t val = {
+        .type = QCLOUD_VAL_TYPE_STRING,
+        .s    = NULL,
+    };
 
-    esp_qcloud_param_t *last = SLIST_FIRST(&method->method_param_list);
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&method->method_param_list, item, next);
-    } else {
-        SLIST_INSERT_AFTER(last, item, next);
+    if (value) {
+        val.s = esp_qcloud_iothub_arena_strdup(method, value);
+        ESP_QCLOUD_ERROR_CHECK(!val.s, ESP_ERR_NO_MEM, "The arena of the method is full, drop param: %s", id);
     }
 
-    return ESP_OK;
+    return esp_qcloud_iothub_param_add(method, id, &val);
 }
 
 esp_err_t esp_qcloud_iothub_param_add_bool(esp_qcloud_method_t *method, char *id, bool value)
 {
     ESP_QCLOUD_ERROR_CHECK(!method || !id, ESP_FAIL, "method or id is a null pointer");
 
-    esp_qcloud_param_t *item = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_param_t));
-    item->id = id;
-    item->value.b = value;
-    item->value.type = QCLOUD_VAL_TYPE_BOOLEAN;
+    esp_qcloud_param_val_t val = {
+        .type = QCLOUD_VAL_TYPE_BOOLEAN,
+        .b    = value,
+    };
 
-    esp_qcloud_param_t *last = SLIST_FIRST(&method->method_param_list);
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&method->method_param_list, item, next);
-    } else {
-        SLIST_INSERT_AFTER(last, item, next);
+    return esp_qcloud_iothub_param_add(method, id, &val);
+}
+
+static esp_qcloud_method_t *esp_qcloud_iothub_create_method(esp_qcloud_method_type_t type)
+{
+    esp_qcloud_method_t *method = esp_qcloud_method_pool_acquire();
+
+    if (!method) {
+        ESP_LOGE(TAG, "Allocate the method, size: %d", sizeof(esp_qcloud_method_t));
+        return NULL;
     }
 
-    return ESP_OK;
+    method->method_type = type;
+    method->extra_val   = &method->extra;
+
+    return method;
 }
 
 esp_qcloud_method_t *esp_qcloud_iothub_create_report(void)
 {
-    esp_qcloud_method_t *report  = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_t));
-    report->method_type          = QCLOUD_METHOD_TYPE_REPORT;
-    report->extra_val            = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_extra_val_t));
-    report->extra_val->timestamp = esp_log_timestamp();
+    esp_qcloud_method_t *report = esp_qcloud_iothub_create_method(QCLOUD_METHOD_TYPE_REPORT);
+
+    if (report) {
+        report->extra_val->timestamp = esp_log_timestamp();
+    }
 
     return report;
 }
@@ -745,39 +980,27 @@ esp_qcloud_method_t *esp_qcloud_iothub_create_event(const char *eventId, esp_qcl
 {
     static char *event_type_str_list[6] = {"info", "alert", "fault"};
 
-    esp_qcloud_method_t *event  = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_t));
-    event->method_type          = QCLOUD_METHOD_TYPE_EVENT;
-    event->extra_val            = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_extra_val_t));
-    event->extra_val->id        = strdup(eventId);
-    event->extra_val->version   = EVENT_VERSION;
-    event->extra_val->type      = event_type_str_list[type - 1];
+    esp_qcloud_method_t *event = esp_qcloud_iothub_create_method(QCLOUD_METHOD_TYPE_EVENT);
+
+    if (event) {
+        event->extra_val->id      = esp_qcloud_iothub_arena_strdup(event, eventId);
+        event->extra_val->version = EVENT_VERSION;
+        event->extra_val->type    = event_type_str_list[type - 1];
+    }
 
     return event;
 }
 
 esp_qcloud_method_t *esp_qcloud_iothub_create_action(void)
 {
-    esp_qcloud_method_t *action = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_t));
-    action->method_type         = QCLOUD_METHOD_TYPE_ACTION_REPLY;
-    action->extra_val           = ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_extra_val_t));
-
-    return action;
+    return esp_qcloud_iothub_create_method(QCLOUD_METHOD_TYPE_ACTION_REPLY);
 }
 
 esp_err_t esp_qcloud_iothub_destroy_report(esp_qcloud_method_t *report)
 {
     ESP_QCLOUD_ERROR_CHECK(!report, ESP_FAIL, "report is a null pointer");
 
-    while (!SLIST_EMPTY(&report->method_param_list)) {
-        esp_qcloud_param_t *item = SLIST_FIRST(&report->method_param_list);
-        SLIST_REMOVE_HEAD(&report->method_param_list, next);
-        if (item->value.type == QCLOUD_VAL_TYPE_STRING) {
-            ESP_QCLOUD_FREE(item->value.s);
-        }
-        ESP_QCLOUD_FREE(item);
-    }
-    ESP_QCLOUD_FREE(report->extra_val);
-    ESP_QCLOUD_FREE(report);
+    esp_qcloud_method_pool_release(report);
 
     return ESP_OK;
 }
@@ -786,17 +1009,7 @@ esp_err_t esp_qcloud_iothub_destroy_event(esp_qcloud_method_t *event)
 {
     ESP_QCLOUD_ERROR_CHECK(!event, ESP_FAIL, "event is a null pointer");
 
-    while (!SLIST_EMPTY(&event->method_param_list)) {
-        esp_qcloud_param_t *item = SLIST_FIRST(&event->method_param_list);
-        SLIST_REMOVE_HEAD(&event->method_param_list, next);
-        if (item->value.type == QCLOUD_VAL_TYPE_STRING) {
-            ESP_QCLOUD_FREE(item->value.s);
-        }
-        ESP_QCLOUD_FREE(item);
-    }
-    ESP_QCLOUD_FREE(event->extra_val->id);
-    ESP_QCLOUD_FREE(event->extra_val);
-    ESP_QCLOUD_FREE(event);
+    esp_qcloud_method_pool_release(event);
 
     return ESP_OK;
 }
@@ -805,69 +1018,62 @@ esp_err_t esp_qcloud_iothub_destroy_action(esp_qcloud_method_t *action)
 {
     ESP_QCLOUD_ERROR_CHECK(!action, ESP_FAIL, "action is a null pointer");
 
-    while (!SLIST_EMPTY(&action->method_param_list)) {
-        esp_qcloud_param_t *item = SLIST_FIRST(&action->method_param_list);
-        SLIST_REMOVE_HEAD(&action->method_param_list, next);
-        if (item->value.type == QCLOUD_VAL_TYPE_STRING) {
-            ESP_QCLOUD_FREE(item->value.s);
-        }
-        ESP_QCLOUD_FREE(item);
-    }
-    ESP_QCLOUD_FREE(action->extra_val);
-    ESP_QCLOUD_FREE(action);
+    esp_qcloud_method_pool_release(action);
 
     return ESP_OK;
 }
 
-static esp_err_t esp_qcloud_get_topic_and_method_name(char **topic_name, char **method_name, esp_qcloud_method_type_t type)
+static esp_err_t esp_qcloud_get_topic_and_method_name(esp_qcloud_topic_t *topic, const char **method_name, esp_qcloud_method_type_t type)
 {
-    static char *topic_name_list[TOPIC_METHOD_NAME_MAX_SIZE] = {"event", "action", "service", "property"};
-    static char *method_name_list[TOPIC_METHOD_NAME_MAX_SIZE] = {"event_post", "action_reply", "", "report"};
-    if (type == QCLOUD_METHOD_TYPE_INVALID || type >= QCLOUD_METHOD_TYPE_MAX_INVALID || topic_name == NULL || method_name == NULL) {
+    static const char *method_name_list[TOPIC_METHOD_NAME_MAX_SIZE] = {"event_post", "action_reply", "", "report"};
+    if (type == QCLOUD_METHOD_TYPE_INVALID || type >= QCLOUD_METHOD_TYPE_MAX_INVALID || topic == NULL || method_name == NULL) {
         return ESP_FAIL;
     } else if (type == QCLOUD_METHOD_TYPE_EVENT) {
-        *topic_name = topic_name_list[0];
+        *topic = QCLOUD_TOPIC_EVENT_UP;
     } else if (type == QCLOUD_METHOD_TYPE_ACTION_REPLY) {
-        *topic_name = topic_name_list[1];
+        *topic = QCLOUD_TOPIC_ACTION_UP;
     } else if (type == QCLOUD_METHOD_TYPE_APP_BIND_TOKEN) {
         return ESP_ERR_NOT_SUPPORTED;
     } else {
-        *topic_name = topic_name_list[3];
+        *topic = QCLOUD_TOPIC_PROPERTY_UP;
     }
     *method_name = method_name_list[type - 1];
 
     return ESP_OK;
 }
 
+static esp_err_t esp_qcloud_iothub_write_method_param(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_method_t *method = (esp_qcloud_method_t *)arg;
+
+    for (int i = 0; i < method->param_num; ++i) {
+        ESP_LOGD(TAG, "esp_qcloud_iothub_post_method %s", method->param[i].id);
+        esp_qcloud_device_write_param(writer, method->param[i].id, &method->param[i].value);
+    }
+
+    return ESP_OK;
+}
+
 esp_err_t esp_qcloud_iothub_post_method(esp_qcloud_method_t *method)
 {
     ESP_QCLOUD_ERROR_CHECK(!method, ESP_FAIL, "method is a null pointer");
 
-    esp_qcloud_param_t *param;
-    esp_err_t err      = ESP_FAIL;
-    char *topic_name   = NULL;
-    char *method_name  = NULL;
-    cJSON *params_json = cJSON_CreateObject();
-
-    SLIST_FOREACH(param, &method->method_param_list, next) {
-        ESP_LOGD(TAG, "esp_qcloud_iothub_post_method %s", param->id);
-        if (param->value.type == QCLOUD_VAL_TYPE_INTEGER) {
-            cJSON_AddNumberToObject(params_json, param->id, param->value.i);
-        } else if (param->value.type == QCLOUD_VAL_TYPE_BOOLEAN) {
-            cJSON_AddNumberToObject(params_json, param->id, param->value.b);
-        } else if (param->value.type == QCLOUD_VAL_TYPE_STRING) {
-            cJSON_AddStringToObject(params_json, param->id, param->value.s);
-        } else if (param->value.type == QCLOUD_VAL_TYPE_FLOAT) {
-            cJSON_AddNumberToObject(params_json, param->id, param->value.f);
-        }
+    esp_err_t err            = ESP_FAIL;
+    esp_qcloud_topic_t topic = QCLOUD_TOPIC_MAX;
+    const char *method_name  = NULL;
+
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+
+    /**< Reports are merged and rate limited by the scheduler task */
+    if (method->method_type == QCLOUD_METHOD_TYPE_REPORT) {
+        return esp_qcloud_report_post(method);
     }
 
-    err = esp_qcloud_get_topic_and_method_name((char **)&topic_name, (char **)&method_name, method->method_type);
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "get topic or method name fail");
+#endif
 
-    err = esp_qcloud_iothub_publish(topic_name, method_name, method->extra_val, params_json);
+    err = esp_qcloud_get_topic_and_method_name(&topic, &method_name, method->method_type);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "get topic or method name fail");
 
-EXIT:
-    cJSON_Delete(params_json);
-    return err;
+    return esp_qcloud_iothub_publish(topic, method_name, method->extra_val,
+                                     esp_qcloud_iothub_write_method_param, method);
 }
@@ -0,0 +1,747 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <esp_log.h>
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+#include "esp_qcloud_utils.h"
+#include "esp_qcloud_journal.h"
+
+#ifdef CONFIG_QCLOUD_JOURNAL
+
+#define QCLOUD_JOURNAL_SECTOR_SIZE      (4096)
+#define QCLOUD_JOURNAL_SECTOR_MAGIC     (0x4C4E4A51)  /**< "QJNL" */
+#define QCLOUD_JOURNAL_RECORD_MAGIC     (0x4A52)
+#define QCLOUD_JOURNAL_STATE_WRITTEN    (0xFF)
+#define QCLOUD_JOURNAL_STATE_CONSUMED   (0x00)        /**< Bits are only cleared, no erase needed */
+#define QCLOUD_JOURNAL_TASK_STACK       (3 * 1024)
+#define QCLOUD_JOURNAL_TASK_PRIO        (4)
+#define QCLOUD_JOURNAL_QUEUE_DEPTH      (8)
+#define QCLOUD_JOURNAL_RETRY_MS         (1000)
+#define QCLOUD_JOURNAL_RETRY_MAX        (5)           /**< A record failing this many times is dropped */
+
+/**
+ * @brief Header at the start of every sector.
+ *
+ * @note Sectors are used round robin, so each one is erased once per lap of the
+ *       journal. The sector with the largest seq is the one being written.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} esp_qcloud_journal_sector_t;
+
+/**
+ * @brief Header of a record, followed by the topic and the payload, padded to 4 bytes.
+ *
+ * @note The header is written after the topic and the payload, a record with a
+ *       valid magic is complete.
+ */
+typedef struct {
+    uint16_t magic;
+    uint8_t state;       /**< QCLOUD_JOURNAL_STATE_WRITTEN until replayed */
+    uint8_t prio;        /**< esp_qcloud_mqtt_prio_t */
+    uint16_t topic_len;
+    uint16_t data_len;
+    uint32_t timestamp;  /**< time() when the message was journaled */
+    uint32_t crc;        /**< CRC32 of the topic and the payload */
+} esp_qcloud_journal_record_t;
+
+typedef struct {
+    uint16_t sector;
+    uint16_t offset;
+} esp_qcloud_journal_pos_t;
+
+/**
+ * @brief A message queued by esp_qcloud_journal_write() for the journal task.
+ */
+typedef struct {
+    esp_qcloud_mqtt_prio_t prio;
+    uint32_t timestamp;
+    size_t data_len;
+    char *topic;         /**< Stored after the payload */
+    uint8_t data[0];
+} esp_qcloud_journal_message_t;
+
+static const char *TAG = "esp_qcloud_journal";
+
+static const esp_partition_t *g_journal_part   = NULL;
+static QueueHandle_t g_journal_queue           = NULL;
+static TaskHandle_t g_journal_task             = NULL;
+static size_t g_queued_num                     = 0;  /**< Messages in g_journal_queue, updated atomically */
+static volatile esp_err_t g_journal_ack_result = ESP_OK;
+static volatile uint32_t g_journal_ack_seq     = 0;  /**< Set by esp_qcloud_journal_published() */
+
+/**< Only accessed by the journal task, which is the only one using the partition */
+static uint16_t g_sector_num = 0;
+static uint32_t g_sector_seq = 0;
+static size_t g_pending_num  = 0;
+static esp_qcloud_journal_pos_t g_write_pos = {0};  /**< Where the next record is written */
+static esp_qcloud_journal_pos_t g_read_pos  = {0};  /**< Next record to replay, equal to g_write_pos when none */
+
+/**< The record being replayed */
+static bool g_replay_busy       = false;  /**< Published, waiting for esp_qcloud_journal_published() */
+static uint32_t g_replay_seq    = 0;      /**< Attempt published last */
+static uint8_t g_replay_retries = 0;
+static size_t g_replay_num      = 0;
+static TickType_t g_replay_tick = 0;      /**< The next attempt is not published before this tick */
+static esp_qcloud_journal_pos_t g_replay_pos       = {0};
+static esp_qcloud_journal_record_t g_replay_record = {0};
+
+static size_t esp_qcloud_journal_record_size(const esp_qcloud_journal_record_t *record)
+{
+    return (sizeof(esp_qcloud_journal_record_t) + record->topic_len + record->data_len + 3) & ~3;
+}
+
+static size_t esp_qcloud_journal_addr(esp_qcloud_journal_pos_t pos)
+{
+    return pos.sector * QCLOUD_JOURNAL_SECTOR_SIZE + pos.offset;
+}
+
+static esp_err_t esp_qcloud_journal_read_record(esp_qcloud_journal_pos_t pos, esp_qcloud_journal_record_t *record)
+{
+    if (pos.offset + sizeof(esp_qcloud_journal_record_t) > QCLOUD_JOURNAL_SECTOR_SIZE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t err = esp_partition_read(g_journal_part, esp_qcloud_journal_addr(pos), record, sizeof(*record));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_partition_read", esp_err_to_name(err));
+
+    if (record->magic != QCLOUD_JOURNAL_RECORD_MAGIC
+            || pos.offset + esp_qcloud_journal_record_size(record) > QCLOUD_JOURNAL_SECTOR_SIZE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The topic and the payload of the record match its CRC
+ */
+static bool esp_qcloud_journal_record_is_valid(esp_qcloud_journal_pos_t pos, const esp_qcloud_journal_record_t *record)
+{
+    uint8_t buf[64];
+    uint32_t crc  = 0;
+    size_t addr   = esp_qcloud_journal_addr(pos) + sizeof(esp_qcloud_journal_record_t);
+    size_t remain = record->topic_len + record->data_len;
+
+    for (size_t size = 0; remain > 0; addr += size, remain -= size) {
+        size = MIN(remain, sizeof(buf));
+
+        if (esp_partition_read(g_journal_part, addr, buf, size) != ESP_OK) {
+            return false;
+        }
+
+        crc = esp_rom_crc32_le(crc, buf, size);
+    }
+
+    return crc == record->crc;
+}
+
+/**
+ * @brief The bytes from `pos` on can be programmed
+ */
+static bool esp_qcloud_journal_is_erased(esp_qcloud_journal_pos_t pos)
+{
+    uint32_t tail[8] = {0};
+    size_t tail_size = MIN(sizeof(tail), QCLOUD_JOURNAL_SECTOR_SIZE - MIN(pos.offset, QCLOUD_JOURNAL_SECTOR_SIZE));
+
+    if (tail_size && esp_partition_read(g_journal_part, esp_qcloud_journal_addr(pos), tail, tail_size) != ESP_OK) {
+        return false;
+    }
+
+    for (int i = 0; i < tail_size / sizeof(uint32_t); ++i) {
+        if (tail[i] != UINT32_MAX) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static esp_err_t esp_qcloud_journal_read_sector(uint16_t sector, esp_qcloud_journal_sector_t *header)
+{
+    esp_err_t err = esp_partition_read(g_journal_part, sector * QCLOUD_JOURNAL_SECTOR_SIZE, header, sizeof(*header));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_partition_read", esp_err_to_name(err));
+
+    return header->magic == QCLOUD_JOURNAL_SECTOR_MAGIC ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t esp_qcloud_journal_open_sector(uint16_t sector)
+{
+    esp_err_t err = ESP_OK;
+    esp_qcloud_journal_sector_t header = {
+        .magic = QCLOUD_JOURNAL_SECTOR_MAGIC,
+        .seq   = g_sector_seq + 1,
+    };
+
+    err = esp_partition_erase_range(g_journal_part, sector * QCLOUD_JOURNAL_SECTOR_SIZE, QCLOUD_JOURNAL_SECTOR_SIZE);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_partition_erase_range, sector: %d", esp_err_to_name(err), sector);
+
+    err = esp_partition_write(g_journal_part, sector * QCLOUD_JOURNAL_SECTOR_SIZE, &header, sizeof(header));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> esp_partition_write, sector: %d", esp_err_to_name(err), sector);
+
+    g_sector_seq       = header.seq;
+    g_write_pos.sector = sector;
+    g_write_pos.offset = sizeof(esp_qcloud_journal_sector_t);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Find the sector being written and the oldest record not replayed yet.
+ */
+static esp_err_t esp_qcloud_journal_scan(void)
+{
+    esp_qcloud_journal_sector_t header = {0};
+    esp_qcloud_journal_record_t record = {0};
+    int newest = -1;
+    int oldest = -1;
+    uint32_t oldest_seq = UINT32_MAX;
+    bool read_found     = false;
+
+    for (int sector = 0; sector < g_sector_num; ++sector) {
+        if (esp_qcloud_journal_read_sector(sector, &header) != ESP_OK) {
+            continue;
+        }
+
+        if (newest < 0 || header.seq > g_sector_seq) {
+            newest       = sector;
+            g_sector_seq = header.seq;
+        }
+
+        if (header.seq < oldest_seq) {
+            oldest     = sector;
+            oldest_seq = header.seq;
+        }
+    }
+
+    if (newest < 0) {
+        esp_err_t err = esp_qcloud_journal_open_sector(0);
+        g_read_pos    = g_write_pos;
+        return err;
+    }
+
+    /**< Walk the records from the oldest sector to the newest one */
+    for (int i = 0, sector = oldest; i < g_sector_num; ++i, sector = (sector + 1) % g_sector_num) {
+        esp_qcloud_journal_pos_t pos = {
+            .sector = sector,
+            .offset = sizeof(esp_qcloud_journal_sector_t),
+        };
+        esp_qcloud_journal_pos_t last = pos;
+
+        if (esp_qcloud_journal_read_sector(sector, &header) != ESP_OK) {
+            continue;
+        }
+
+        for (; esp_qcloud_journal_read_record(pos, &record) == ESP_OK;
+                pos.offset += esp_qcloud_journal_record_size(&record)) {
+            last = pos;
+
+            if (record.state != QCLOUD_JOURNAL_STATE_WRITTEN) {
+                continue;
+            }
+
+            if (!read_found) {
+                g_read_pos = pos;
+                read_found = true;
+            }
+
+            g_pending_num++;
+        }
+
+        if (sector == newest) {
+            g_write_pos = pos;
+
+            /**
+             * @brief Only the last record is checked, the ones before it were complete
+             *        when it was written. Data programmed before a header that was not
+             *        written cannot be programmed again, the sector is closed.
+             */
+            if ((last.offset != pos.offset && esp_qcloud_journal_read_record(last, &record) == ESP_OK
+                    && !esp_qcloud_journal_record_is_valid(last, &record))
+                    || !esp_qcloud_journal_is_erased(pos)) {
+                ESP_LOGW(TAG, "The last record is incomplete, close the sector, sector: %d, offset: %d",
+                         pos.sector, pos.offset);
+                g_write_pos.offset = QCLOUD_JOURNAL_SECTOR_SIZE;
+            }
+
+            break;
+        }
+    }
+
+    if (!read_found) {
+        g_read_pos = g_write_pos;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Move g_read_pos to the next record waiting for replay.
+ */
+static esp_err_t esp_qcloud_journal_seek(esp_qcloud_journal_record_t *record)
+{
+    for (int i = 0; i <= g_sector_num;) {
+        if (g_read_pos.sector == g_write_pos.sector && g_read_pos.offset >= g_write_pos.offset) {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        if (esp_qcloud_journal_read_record(g_read_pos, record) != ESP_OK) {
+            if (g_read_pos.sector == g_write_pos.sector) {
+                return ESP_ERR_NOT_FOUND;
+            }
+
+            g_read_pos.sector = (g_read_pos.sector + 1) % g_sector_num;
+            g_read_pos.offset = sizeof(esp_qcloud_journal_sector_t);
+            ++i;
+            continue;
+        }
+
+        if (record->state == QCLOUD_JOURNAL_STATE_WRITTEN) {
+            return ESP_OK;
+        }
+
+        g_read_pos.offset += esp_qcloud_journal_record_size(record);
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Drop the records not replayed from the sector about to be reused.
+ */
+static void esp_qcloud_journal_drop_sector(uint16_t sector)
+{
+    esp_qcloud_journal_record_t record = {0};
+    size_t dropped = 0;
+
+    for (; g_read_pos.sector == sector && esp_qcloud_journal_seek(&record) == ESP_OK
+            && g_read_pos.sector == sector; g_read_pos.offset += esp_qcloud_journal_record_size(&record)) {
+        dropped++;
+    }
+
+    g_pending_num -= MIN(dropped, g_pending_num);
+    g_read_pos.sector = (sector + 1) % g_sector_num;
+    g_read_pos.offset = sizeof(esp_qcloud_journal_sector_t);
+
+    if (dropped) {
+        ESP_LOGW(TAG, "The journal is full, drop %d messages", dropped);
+    }
+}
+
+/**
+ * @brief Append a record, only called by the journal task.
+ */
+static esp_err_t esp_qcloud_journal_append(const esp_qcloud_journal_message_t *message)
+{
+    esp_err_t err = ESP_OK;
+    esp_qcloud_journal_record_t record = {
+        .magic     = QCLOUD_JOURNAL_RECORD_MAGIC,
+        .state     = QCLOUD_JOURNAL_STATE_WRITTEN,
+        .prio      = message->prio,
+        .topic_len = strlen(message->topic),
+        .data_len  = message->data_len,
+        .timestamp = message->timestamp,
+    };
+    size_t record_size = esp_qcloud_journal_record_size(&record);
+
+    record.crc = esp_rom_crc32_le(0, (const uint8_t *)message->topic, record.topic_len);
+    record.crc = esp_rom_crc32_le(record.crc, message->data, record.data_len);
+
+    if (g_write_pos.offset + record_size > QCLOUD_JOURNAL_SECTOR_SIZE) {
+        uint16_t next = (g_write_pos.sector + 1) % g_sector_num;
+
+        if (g_pending_num && g_read_pos.sector == next) {
+            esp_qcloud_journal_drop_sector(next);
+        }
+
+        err = esp_qcloud_journal_open_sector(next);
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_journal_open_sector", esp_err_to_name(err));
+    }
+
+    size_t addr = esp_qcloud_journal_addr(g_write_pos);
+
+    err = esp_partition_write(g_journal_part, addr + sizeof(record), message->topic, record.topic_len);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_write", esp_err_to_name(err));
+
+    err = esp_partition_write(g_journal_part, addr + sizeof(record) + record.topic_len, message->data, record.data_len);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_write", esp_err_to_name(err));
+
+    err = esp_partition_write(g_journal_part, addr, &record, sizeof(record));
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_write", esp_err_to_name(err));
+
+    if (!g_pending_num) {
+        g_read_pos = g_write_pos;
+    }
+
+    g_write_pos.offset += record_size;
+    g_pending_num++;
+
+    ESP_LOGD(TAG, "Journaled, topic: %s, size: %d, pending: %d", message->topic, message->data_len, g_pending_num);
+
+EXIT:
+    /**
+     * @brief The write position moves past the partial record, to the end of the
+     *        sector: a scan stops at a record without its header, so nothing
+     *        written after it in this sector could be found after a reset.
+     */
+    if (err != ESP_OK) {
+        g_write_pos.offset = QCLOUD_JOURNAL_SECTOR_SIZE;
+    }
+
+    return err;
+}
+
+esp_err_t esp_qcloud_journal_write(const char *topic, const void *data, size_t size, esp_qcloud_mqtt_prio_t prio)
+{
+    ESP_QCLOUD_PARAM_CHECK(topic);
+    ESP_QCLOUD_PARAM_CHECK(data);
+
+    /**< No journal partition, quietly publish as before */
+    if (!g_journal_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t topic_size = strlen(topic) + 1;
+    esp_qcloud_journal_record_t record = {
+        .topic_len = topic_size - 1,
+        .data_len  = size,
+    };
+
+    ESP_QCLOUD_ERROR_CHECK(esp_qcloud_journal_record_size(&record) > QCLOUD_JOURNAL_SECTOR_SIZE - sizeof(esp_qcloud_journal_sector_t),
+                           ESP_ERR_INVALID_SIZE, "The message is too large to be journaled, size: %d", size);
+
+    esp_qcloud_journal_message_t *message = ESP_QCLOUD_MALLOC(sizeof(esp_qcloud_journal_message_t) + size + topic_size);
+    ESP_QCLOUD_ERROR_CHECK(!message, ESP_ERR_NO_MEM, "Allocate the message, size: %d", size);
+
+    message->prio      = prio;
+    message->timestamp = time(NULL);
+    message->data_len  = size;
+    message->topic     = (char *)message->data + size;
+    memcpy(message->data, data, size);
+    memcpy(message->topic, topic, topic_size);
+
+    /**< Counted before it is queued, so that new messages queue behind it */
+    __sync_fetch_and_add(&g_queued_num, 1);
+
+    if (xQueueSend(g_journal_queue, &message, 0) != pdTRUE) {
+        __sync_fetch_and_sub(&g_queued_num, 1);
+        ESP_QCLOUD_FREE(message);
+        ESP_LOGW(TAG, "The journal queue is full, topic: %s", topic);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xTaskNotifyGive(g_journal_task);
+
+    return ESP_OK;
+}
+
+bool esp_qcloud_journal_pending(void)
+{
+    return g_pending_num > 0 || g_queued_num > 0;
+}
+
+static void esp_qcloud_journal_published(int msg_id, esp_err_t result, void *priv_data)
+{
+    ESP_LOGD(TAG, "Replay completed, msg_id: %d, err: %s", msg_id, esp_err_to_name(result));
+
+    g_journal_ack_result = result;
+    g_journal_ack_seq    = (uintptr_t)priv_data;
+    xTaskNotifyGive(g_journal_task);
+}
+
+/**
+ * @brief Hand the record at `pos` to the publish queue, the result comes with
+ *        esp_qcloud_journal_published().
+ */
+static esp_err_t esp_qcloud_journal_publish_record(esp_qcloud_journal_pos_t pos, const esp_qcloud_journal_record_t *record)
+{
+    esp_err_t err = ESP_OK;
+    size_t addr   = esp_qcloud_journal_addr(pos) + sizeof(esp_qcloud_journal_record_t);
+    char *buf     = ESP_QCLOUD_MALLOC(record->topic_len + 1 + record->data_len);
+    ESP_QCLOUD_ERROR_CHECK(!buf, ESP_ERR_NO_MEM, "Allocate the replay buffer");
+
+    char *topic = buf;
+    char *data  = buf + record->topic_len + 1;
+
+    err = esp_partition_read(g_journal_part, addr, topic, record->topic_len);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_read", esp_err_to_name(err));
+
+    err = esp_partition_read(g_journal_part, addr + record->topic_len, data, record->data_len);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_read", esp_err_to_name(err));
+
+    topic[record->topic_len] = '\0';
+
+    uint32_t crc = esp_rom_crc32_le(0, (uint8_t *)topic, record->topic_len);
+    crc = esp_rom_crc32_le(crc, (uint8_t *)data, record->data_len);
+    err = crc != record->crc ? ESP_ERR_INVALID_CRC : ESP_OK;
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "CRC mismatch, sector: %d, offset: %d", pos.sector, pos.offset);
+
+    err = esp_qcloud_mqtt_publish_async(topic, data, record->data_len, record->prio,
+                                        esp_qcloud_journal_published, (void *)(uintptr_t)(g_replay_seq + 1));
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_mqtt_publish_async", esp_err_to_name(err));
+
+    g_replay_seq++;
+
+    ESP_LOGD(TAG, "Replay, topic: %s, age: %lds, attempt: %d", topic,
+             (long)(time(NULL) - record->timestamp), g_replay_retries + 1);
+
+EXIT:
+    ESP_QCLOUD_FREE(buf);
+    return err;
+}
+
+/**
+ * @brief Mark the record being replayed as consumed, unless a writer dropped
+ *        its sector in the meantime.
+ */
+static void esp_qcloud_journal_consume(void)
+{
+    if (g_read_pos.sector == g_replay_pos.sector && g_read_pos.offset == g_replay_pos.offset) {
+        uint8_t state = QCLOUD_JOURNAL_STATE_CONSUMED;
+        esp_partition_write(g_journal_part, esp_qcloud_journal_addr(g_replay_pos)
+                            + offsetof(esp_qcloud_journal_record_t, state), &state, sizeof(state));
+        g_read_pos.offset += esp_qcloud_journal_record_size(&g_replay_record);
+        g_pending_num -= MIN(1, g_pending_num);
+    }
+
+    g_replay_retries = 0;
+}
+
+/**
+ * @brief A replay of the record failed, retry it later with a growing delay
+ *        or drop it after QCLOUD_JOURNAL_RETRY_MAX attempts.
+ */
+static void esp_qcloud_journal_retry(esp_err_t err)
+{
+    if (++g_replay_retries >= QCLOUD_JOURNAL_RETRY_MAX) {
+        ESP_LOGW(TAG, "<%s> Drop the record after %d attempts, sector: %d, offset: %d", esp_err_to_name(err),
+                 g_replay_retries, g_replay_pos.sector, g_replay_pos.offset);
+        esp_qcloud_journal_consume();
+        return;
+    }
+
+    g_replay_tick = xTaskGetTickCount() + pdMS_TO_TICKS(QCLOUD_JOURNAL_RETRY_MS << (g_replay_retries - 1));
+}
+
+/**
+ * @brief Move the replay on by one step.
+ *
+ * @return How long the journal task may sleep before the next step
+ */
+static TickType_t esp_qcloud_journal_replay(void)
+{
+    esp_err_t err = ESP_OK;
+
+    if (g_replay_busy) {
+        /**< Woken up by esp_qcloud_journal_published() */
+        if (g_journal_ack_seq != g_replay_seq) {
+            return portMAX_DELAY;
+        }
+
+        g_replay_busy = false;
+        err = g_journal_ack_result;
+
+#if (ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0))
+        /**
+         * @brief Before IDF v4.4 a message timing out stays in the outbox of
+         *        esp-mqtt, which resends it under the same msg_id. Publishing
+         *        the record again would duplicate it.
+         */
+        if (err == ESP_ERR_TIMEOUT) {
+            ESP_LOGW(TAG, "No PUBACK yet, leave the record to the outbox, sector: %d, offset: %d",
+                     g_replay_pos.sector, g_replay_pos.offset);
+            err = ESP_OK;
+        }
+#endif
+
+        if (err != ESP_OK) {
+            esp_qcloud_journal_retry(err);
+        } else {
+            esp_qcloud_journal_consume();
+            g_replay_num++;
+            g_replay_tick = xTaskGetTickCount() + pdMS_TO_TICKS(1000 / CONFIG_QCLOUD_JOURNAL_REPLAY_RATE);
+        }
+    }
+
+    /**< Woken up by esp_qcloud_journal_state_cb() */
+    if (!esp_qcloud_mqtt_is_connected()) {
+        return portMAX_DELAY;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+
+    if ((int32_t)(g_replay_tick - now) > 0) {
+        return g_replay_tick - now;
+    }
+
+    if (esp_qcloud_journal_seek(&g_replay_record) != ESP_OK) {
+        if (g_replay_num) {
+            ESP_LOGI(TAG, "Replayed %d messages", g_replay_num);
+            g_replay_num = 0;
+        }
+
+        return portMAX_DELAY;
+    }
+
+    /**< The retries count for one record only */
+    if (g_read_pos.sector != g_replay_pos.sector || g_read_pos.offset != g_replay_pos.offset) {
+        g_replay_pos     = g_read_pos;
+        g_replay_retries = 0;
+    }
+
+    err = esp_qcloud_journal_publish_record(g_replay_pos, &g_replay_record);
+
+    if (err == ESP_OK) {
+        g_replay_busy = true;
+        return portMAX_DELAY;
+    }
+
+    if (err == ESP_ERR_INVALID_CRC) {
+        ESP_LOGW(TAG, "Drop the corrupted record, sector: %d, offset: %d", g_replay_pos.sector, g_replay_pos.offset);
+        esp_qcloud_journal_consume();
+        return 0;
+    }
+
+    /**< The publish queue is full, the record is not at fault */
+    if (err == ESP_ERR_NO_MEM) {
+        g_replay_tick = now + pdMS_TO_TICKS(QCLOUD_JOURNAL_RETRY_MS);
+    } else {
+        esp_qcloud_journal_retry(err);
+    }
+
+    return g_replay_tick - now;
+}
+
+/**
+ * @brief Append the queued messages and replay the journal.
+ *
+ * @note The flash is only written by this task, an erase stalls the caller
+ *       for tens of milliseconds and must not block the publishers.
+ */
+static void esp_qcloud_journal_task(void *arg)
+{
+    TickType_t wait_ticks = portMAX_DELAY;
+
+    for (;;) {
+        esp_qcloud_journal_message_t *message = NULL;
+
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+
+        while (xQueueReceive(g_journal_queue, &message, 0) == pdTRUE) {
+            esp_err_t err = esp_qcloud_journal_append(message);
+
+            /**< Not journaled, publish it directly as before */
+            if (err != ESP_OK) {
+                err = esp_qcloud_mqtt_publish_async(message->topic, message->data, message->data_len,
+                                                    message->prio, NULL, NULL);
+
+                if (err != ESP_OK) {
+                    ESP_LOGW(TAG, "<%s> Drop the message, topic: %s", esp_err_to_name(err), message->topic);
+                }
+            }
+
+            __sync_fetch_and_sub(&g_queued_num, 1);
+            ESP_QCLOUD_FREE(message);
+        }
+
+        wait_ticks = esp_qcloud_journal_replay();
+    }
+
+    vTaskDelete(NULL);
+}
+
+static void esp_qcloud_journal_state_cb(esp_qcloud_mqtt_state_t state, uint32_t backoff_ms)
+{
+    if (state == QCLOUD_MQTT_STATE_CONNECTED && esp_qcloud_journal_pending()) {
+        xTaskNotifyGive(g_journal_task);
+    }
+}
+
+esp_err_t esp_qcloud_journal_init(void)
+{
+    if (g_journal_task) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    esp_qcloud_journal_message_t *message = NULL;
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                  CONFIG_QCLOUD_JOURNAL_PARTITION_LABEL);
+    ESP_QCLOUD_ERROR_CHECK(!part, ESP_ERR_NOT_FOUND, "Partition not found, label: %s", CONFIG_QCLOUD_JOURNAL_PARTITION_LABEL);
+
+    size_t sector_num = MIN(part->size, CONFIG_QCLOUD_JOURNAL_RETENTION_SIZE * 1024) / QCLOUD_JOURNAL_SECTOR_SIZE;
+    ESP_QCLOUD_ERROR_CHECK(sector_num < 2, ESP_ERR_INVALID_SIZE, "The journal needs at least 2 sectors");
+
+    err = ESP_ERR_NO_MEM;
+    g_journal_queue = xQueueCreate(QCLOUD_JOURNAL_QUEUE_DEPTH, sizeof(esp_qcloud_journal_message_t *));
+    ESP_QCLOUD_ERROR_GOTO(!g_journal_queue, EXIT, "Create the journal queue");
+
+    g_journal_part = part;
+    g_sector_num   = sector_num;
+
+    err = esp_qcloud_journal_scan();
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_qcloud_journal_scan", esp_err_to_name(err));
+
+    err = ESP_ERR_NO_MEM;
+    BaseType_t ret = xTaskCreate(esp_qcloud_journal_task, "qcloud_journal", QCLOUD_JOURNAL_TASK_STACK,
+                                 NULL, QCLOUD_JOURNAL_TASK_PRIO, &g_journal_task);
+    ESP_QCLOUD_ERROR_GOTO(ret != pdPASS, EXIT, "Create the journal task");
+
+    err = esp_qcloud_mqtt_register_state_cb(esp_qcloud_journal_state_cb);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "esp_qcloud_mqtt_register_state_cb");
+
+    ESP_LOGI(TAG, "Journal initialized, sectors: %d, pending: %d", g_sector_num, g_pending_num);
+
+    return ESP_OK;
+
+EXIT:
+
+    if (g_journal_task) {
+        vTaskDelete(g_journal_task);
+        g_journal_task = NULL;
+    }
+
+    if (g_journal_queue) {
+        while (xQueueReceive(g_journal_queue, &message, 0) == pdTRUE) {
+            ESP_QCLOUD_FREE(message);
+        }
+
+        vQueueDelete(g_journal_queue);
+        g_journal_queue = NULL;
+    }
+
+    g_journal_part = NULL;
+    g_queued_num   = 0;
+    g_sector_num   = 0;
+    g_sector_seq   = 0;
+    g_pending_num  = 0;
+    memset(&g_write_pos, 0, sizeof(g_write_pos));
+    memset(&g_read_pos, 0, sizeof(g_read_pos));
+
+    return err;
+}
+
+#endif /**< CONFIG_QCLOUD_JOURNAL */
@@ -0,0 +1,66 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_qcloud_iothub.h"
+#include "esp_qcloud_mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Scan the journal partition and create the replay task.
+ *
+ * @note The journal is replayed every time MQTT connects. A record is published
+ *       again after a failure, up to a few times before it is dropped.
+ *
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: the journal partition does not exist
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_journal_init(void);
+
+/**
+ * @brief Queue a message to be appended to the journal.
+ *
+ * @note The flash is written by the journal task, so this does not block on
+ *       an erase. When the journal is full the oldest sector is dropped.
+ *
+ * @param[in] topic Topic of the message.
+ * @param[in] data  Payload of the message.
+ * @param[in] size  Size of the payload.
+ * @param[in] prio  Class the message is published in when replayed.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the queue of the journal task is full
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_journal_write(const char *topic, const void *data, size_t size, esp_qcloud_mqtt_prio_t prio);
+
+/**
+ * @brief Whether messages are waiting in the journal.
+ *
+ * @note New messages are journaled too while this is true, so that they are
+ *       published after the older ones.
+ *
+ * @return true if messages are waiting for replay
+ */
+bool esp_qcloud_journal_pending(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
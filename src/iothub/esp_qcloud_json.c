@@ -0,0 +1,241 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "esp_qcloud_json.h"
+
+static void json_write(esp_qcloud_json_writer_t *writer, const char *data, size_t len)
+{
+    if (writer->overflow) {
+        return;
+    }
+
+    /**< Always keep one byte for the '\0' */
+    if (writer->len + len >= writer->size) {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+}
+
+static void json_write_char(esp_qcloud_json_writer_t *writer, char c)
+{
+    json_write(writer, &c, 1);
+}
+
+static void json_write_string(esp_qcloud_json_writer_t *writer, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *start = str;
+
+    json_write_char(writer, '"');
+
+    for (; *str; ++str) {
+        char escape[6] = {'\\', 0};
+        size_t escape_len = 2;
+
+        switch (*str) {
+        case '"':
+        case '\\':
+            escape[1] = *str;
+            break;
+
+        case '\b':
+            escape[1] = 'b';
+            break;
+
+        case '\f':
+            escape[1] = 'f';
+            break;
+
+        case '\n':
+            escape[1] = 'n';
+            break;
+
+        case '\r':
+            escape[1] = 'r';
+            break;
+
+        case '\t':
+            escape[1] = 't';
+            break;
+
+        default:
+            if ((uint8_t)*str >= 0x20) {
+                continue;
+            }
+
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hex[(uint8_t)*str >> 4];
+            escape[5] = hex[(uint8_t)*str & 0x0f];
+            escape_len = 6;
+            break;
+        }
+
+        /**< Flush the plain characters before the one that needs escaping */
+        json_write(writer, start, str - start);
+        json_write(writer, escape, escape_len);
+        start = str + 1;
+    }
+
+    json_write(writer, start, str - start);
+    json_write_char(writer, '"');
+}
+
+static void json_write_key(esp_qcloud_json_writer_t *writer, const char *key)
+{
+    uint16_t depth_bit = 1 << writer->depth;
+
+    if (writer->not_first & depth_bit) {
+        json_write_char(writer, ',');
+    }
+
+    writer->not_first |= depth_bit;
+
+    if (key) {
+        json_write_string(writer, key);
+        json_write_char(writer, ':');
+    }
+}
+
+void esp_qcloud_json_writer_init(esp_qcloud_json_writer_t *writer, char *buf, size_t size)
+{
+    writer->buf       = buf;
+    writer->size      = size;
+    writer->len       = 0;
+    writer->depth     = 0;
+    writer->not_first = 0;
+    writer->overflow  = !buf || !size;
+
+    json_write_char(writer, '{');
+}
+
+esp_err_t esp_qcloud_json_writer_finish(esp_qcloud_json_writer_t *writer)
+{
+    json_write_char(writer, '}');
+
+    if (writer->overflow) {
+        if (writer->size) {
+            writer->buf[0] = '\0';
+        }
+
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    writer->buf[writer->len] = '\0';
+
+    return writer->depth ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+void esp_qcloud_json_object_start(esp_qcloud_json_writer_t *writer, const char *key)
+{
+    if (writer->depth + 1 >= QCLOUD_JSON_DEPTH_MAX) {
+        writer->overflow = true;
+        return;
+    }
+
+    json_write_key(writer, key);
+    json_write_char(writer, '{');
+
+    writer->depth++;
+    writer->not_first &= ~(1 << writer->depth);
+}
+
+void esp_qcloud_json_object_end(esp_qcloud_json_writer_t *writer)
+{
+    if (!writer->depth) {
+        writer->overflow = true;
+        return;
+    }
+
+    writer->depth--;
+    json_write_char(writer, '}');
+}
+
+void esp_qcloud_json_add_string(esp_qcloud_json_writer_t *writer, const char *key, const char *value)
+{
+    json_write_key(writer, key);
+    json_write_string(writer, value ? value : "");
+}
+
+void esp_qcloud_json_add_int(esp_qcloud_json_writer_t *writer, const char *key, int64_t value)
+{
+    char number[24] = {0};
+    int len = snprintf(number, sizeof(number), "%" PRId64, value);
+
+    json_write_key(writer, key);
+    json_write(writer, number, len);
+}
+
+static void json_write_number(esp_qcloud_json_writer_t *writer, const char *key, double value, int precision)
+{
+    char number[32] = {0};
+    int len = 0;
+
+    /**< Same as cJSON, NaN and infinity are not valid JSON numbers */
+    if (isnan(value) || isinf(value)) {
+        len = snprintf(number, sizeof(number), "null");
+    } else {
+        len = snprintf(number, sizeof(number), "%.*g", precision, value);
+    }
+
+    json_write_key(writer, key);
+    json_write(writer, number, len);
+}
+
+void esp_qcloud_json_add_float(esp_qcloud_json_writer_t *writer, const char *key, float value)
+{
+    json_write_number(writer, key, value, 7);
+}
+
+void esp_qcloud_json_add_double(esp_qcloud_json_writer_t *writer, const char *key, double value)
+{
+    json_write_number(writer, key, value, 15);
+}
+
+void esp_qcloud_json_add_raw(esp_qcloud_json_writer_t *writer, const char *key, const char *raw, size_t len)
+{
+    json_write_key(writer, key);
+    json_write(writer, raw, len);
+}
+
+esp_err_t esp_qcloud_json_add_object(esp_qcloud_json_writer_t *writer, const char *key,
+                                     esp_qcloud_json_write_cb_t cb, void *arg)
+{
+    size_t mark_len       = writer->len;
+    uint16_t mark_members = writer->not_first;
+
+    esp_qcloud_json_object_start(writer, key);
+    esp_err_t err = cb(writer, arg);
+
+    /**< Roll back to the state before the key was written */
+    if (!(writer->not_first & (1 << writer->depth)) && !writer->overflow) {
+        writer->depth--;
+        writer->len       = mark_len;
+        writer->not_first = mark_members;
+        return err;
+    }
+
+    esp_qcloud_json_object_end(writer);
+
+    return err;
+}
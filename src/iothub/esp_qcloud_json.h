@@ -0,0 +1,113 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define QCLOUD_JSON_DEPTH_MAX   (16)  /**< Maximum nesting depth of objects */
+
+/**
+ * @brief Streaming JSON writer working on a caller supplied buffer.
+ *
+ * @note The writer never allocates memory. When the buffer is too small the
+ *       writer is marked as overflowed and every following call is ignored,
+ *       the error is reported by esp_qcloud_json_writer_finish().
+ */
+typedef struct {
+    char *buf;          /**< Output buffer */
+    size_t size;        /**< Size of the output buffer */
+    size_t len;         /**< Length of the data written, not including '\0' */
+    uint8_t depth;      /**< Current nesting depth */
+    uint16_t not_first; /**< Bit n set if the object at depth n already has a member */
+    bool overflow;      /**< The buffer is too small or the nesting is too deep */
+} esp_qcloud_json_writer_t;
+
+/**
+ * @brief Callback used to write the members of a nested object.
+ *
+ * @param[in] writer Writer positioned inside the nested object.
+ * @param[in] arg    Private data of the caller.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+typedef esp_err_t (*esp_qcloud_json_write_cb_t)(esp_qcloud_json_writer_t *writer, void *arg);
+
+/**
+ * @brief Initialize the writer and open the root object.
+ *
+ * @param[out] writer Writer handle.
+ * @param[in]  buf    Output buffer.
+ * @param[in]  size   Size of the output buffer.
+ */
+void esp_qcloud_json_writer_init(esp_qcloud_json_writer_t *writer, char *buf, size_t size);
+
+/**
+ * @brief Close the root object and terminate the string.
+ *
+ * @param[in] writer Writer handle.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_SIZE: the buffer is too small
+ *     - ESP_ERR_INVALID_STATE: the objects are not balanced
+ */
+esp_err_t esp_qcloud_json_writer_finish(esp_qcloud_json_writer_t *writer);
+
+void esp_qcloud_json_object_start(esp_qcloud_json_writer_t *writer, const char *key);
+void esp_qcloud_json_object_end(esp_qcloud_json_writer_t *writer);
+
+void esp_qcloud_json_add_string(esp_qcloud_json_writer_t *writer, const char *key, const char *value);
+void esp_qcloud_json_add_int(esp_qcloud_json_writer_t *writer, const char *key, int64_t value);
+void esp_qcloud_json_add_float(esp_qcloud_json_writer_t *writer, const char *key, float value);
+void esp_qcloud_json_add_double(esp_qcloud_json_writer_t *writer, const char *key, double value);
+
+/**
+ * @brief Add a member whose value is already encoded JSON text.
+ *
+ * @param[in] writer Writer handle.
+ * @param[in] key    Member name.
+ * @param[in] raw    Encoded JSON value, copied as it is.
+ * @param[in] len    Length of the encoded value.
+ */
+void esp_qcloud_json_add_raw(esp_qcloud_json_writer_t *writer, const char *key, const char *raw, size_t len);
+
+/**
+ * @brief Add a nested object whose members are written by a callback.
+ *
+ * @note The member is dropped again if the callback does not write anything,
+ *       an empty object is never sent.
+ *
+ * @param[in] writer Writer handle.
+ * @param[in] key    Member name.
+ * @param[in] cb     Callback writing the members of the object.
+ * @param[in] arg    Private data passed to the callback.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: the error returned by the callback
+ */
+esp_err_t esp_qcloud_json_add_object(esp_qcloud_json_writer_t *writer, const char *key,
+                                     esp_qcloud_json_write_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -0,0 +1,111 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_qcloud_method_pool.h"
+
+/**
+ * @brief Methods are taken from and given back to the top of `g_free_slot`,
+ *        both are O(1) and only hold the spinlock for a few instructions.
+ */
+#if CONFIG_QCLOUD_METHOD_POOL_SIZE > 0
+static esp_qcloud_method_t g_method_pool[CONFIG_QCLOUD_METHOD_POOL_SIZE];
+static uint8_t g_free_slot[CONFIG_QCLOUD_METHOD_POOL_SIZE];
+static size_t g_free_num  = 0;
+static bool g_pool_inited = false;
+#endif /**< CONFIG_QCLOUD_METHOD_POOL_SIZE > 0 */
+
+static portMUX_TYPE g_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_qcloud_iothub_pool_stats_t g_pool_stats = {
+    .size = CONFIG_QCLOUD_METHOD_POOL_SIZE,
+};
+
+static const char *TAG = "esp_qcloud_method_pool";
+
+esp_qcloud_method_t *esp_qcloud_method_pool_acquire(void)
+{
+    esp_qcloud_method_t *method = NULL;
+
+    portENTER_CRITICAL(&g_pool_lock);
+
+#if CONFIG_QCLOUD_METHOD_POOL_SIZE > 0
+
+    if (!g_pool_inited) {
+        for (size_t i = 0; i < CONFIG_QCLOUD_METHOD_POOL_SIZE; ++i) {
+            g_free_slot[i] = CONFIG_QCLOUD_METHOD_POOL_SIZE - 1 - i;
+        }
+
+        g_free_num    = CONFIG_QCLOUD_METHOD_POOL_SIZE;
+        g_pool_inited = true;
+    }
+
+    if (g_free_num) {
+        method = g_method_pool + g_free_slot[--g_free_num];
+        g_pool_stats.used++;
+        g_pool_stats.peak = MAX(g_pool_stats.peak, g_pool_stats.used);
+    }
+
+#endif /**< CONFIG_QCLOUD_METHOD_POOL_SIZE > 0 */
+
+    g_pool_stats.acquired++;
+    g_pool_stats.fallback += !method;
+
+    portEXIT_CRITICAL(&g_pool_lock);
+
+    if (!method) {
+        return ESP_QCLOUD_CALLOC(1, sizeof(esp_qcloud_method_t));
+    }
+
+    /**< Only the header needs to be cleared, params and arena are used up to their counts */
+    method->method_type = QCLOUD_METHOD_TYPE_INVALID;
+    method->extra_val   = NULL;
+    method->param_num   = 0;
+    method->arena_len   = 0;
+    memset(&method->extra, 0, sizeof(method->extra));
+
+    return method;
+}
+
+void esp_qcloud_method_pool_release(esp_qcloud_method_t *method)
+{
+    if (!method) {
+        return;
+    }
+
+#if CONFIG_QCLOUD_METHOD_POOL_SIZE > 0
+
+    if (method >= g_method_pool && method < g_method_pool + CONFIG_QCLOUD_METHOD_POOL_SIZE) {
+        portENTER_CRITICAL(&g_pool_lock);
+        g_free_slot[g_free_num++] = method - g_method_pool;
+        g_pool_stats.used--;
+        portEXIT_CRITICAL(&g_pool_lock);
+        return;
+    }
+
+#endif /**< CONFIG_QCLOUD_METHOD_POOL_SIZE > 0 */
+
+    ESP_QCLOUD_FREE(method);
+}
+
+void esp_qcloud_method_pool_get_stats(esp_qcloud_iothub_pool_stats_t *stats)
+{
+    portENTER_CRITICAL(&g_pool_lock);
+    *stats = g_pool_stats;
+    portEXIT_CRITICAL(&g_pool_lock);
+}
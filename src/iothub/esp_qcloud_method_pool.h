@@ -0,0 +1,48 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_qcloud_iothub.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Take a cleared method from the pool.
+ *
+ * @note Falls back to the heap when the pool is empty.
+ *
+ * @return Pointer to the method, NULL if the heap is exhausted too.
+ */
+esp_qcloud_method_t *esp_qcloud_method_pool_acquire(void);
+
+/**
+ * @brief Give a method back to the pool, or free it if it came from the heap.
+ *
+ * @param[in] method Method returned by esp_qcloud_method_pool_acquire().
+ */
+void esp_qcloud_method_pool_release(esp_qcloud_method_t *method);
+
+/**
+ * @brief Get the occupancy of the pool.
+ *
+ * @param[out] stats Counters.
+ */
+void esp_qcloud_method_pool_get_stats(esp_qcloud_iothub_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
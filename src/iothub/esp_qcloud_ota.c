@@ -28,6 +28,8 @@
 #include "esp_qcloud_utils.h"
 #include "esp_qcloud_iothub.h"
 #include "esp_qcloud_mqtt.h"
+#include "esp_qcloud_topic.h"
+#include "esp_qcloud_ota.h"
 
 #ifdef CONFIG_QCLOUD_USE_HTTPS_UPDATE
 #include "esp_crt_bundle.h"
@@ -38,6 +40,8 @@
 
 static const char *TAG = "esp_qcloud_ota";
 
+static bool g_ota_enabled = false;
+
 typedef enum {
     QCLOUD_OTA_REPORT_FAIL            = -1,
     QCLOUD_OTA_REPORT_NONE            = 0,
@@ -60,10 +64,10 @@ typedef struct {
 
 static esp_err_t esp_qcloud_ota_report_status(esp_qcloud_ota_info_t *ota_info, esp_qcloud_ota_report_type_t type, const char *result_msg)
 {
-    esp_err_t err       = ESP_FAIL;
-    char *publish_topic = NULL;
-    char *publish_data  = NULL;
-    const char *result_code = "0";
+    esp_err_t err             = ESP_FAIL;
+    const char *publish_topic = esp_qcloud_topic_get(QCLOUD_TOPIC_OTA_REPORT);
+    char *publish_data        = NULL;
+    const char *result_code   = "0";
     result_msg = result_msg ? result_msg : "";
 
     cJSON *json_publish_data = cJSON_CreateObject();
@@ -105,17 +109,14 @@ static esp_err_t esp_qcloud_ota_report_status(esp_qcloud_ota_info_t *ota_info, e
 
     cJSON_Delete(json_publish_data);
 
-    asprintf(&publish_topic, "$ota/report/%s/%s",
-             esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
-
-    err = esp_qcloud_mqtt_publish(publish_topic, publish_data, strlen(publish_data));
+    err = esp_qcloud_mqtt_publish_async(publish_topic, publish_data, strlen(publish_data),
+                                        QCLOUD_MQTT_PRIO_EVENT, NULL, NULL);
     ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> Publish to %s, data: %s",
                           esp_err_to_name(err), publish_topic,  publish_data);
 
     ESP_LOGI(TAG, "mqtt_publish, topic: %s, data: %s", publish_topic, publish_data);
 
 EXIT:
-    ESP_QCLOUD_FREE(publish_topic);
     ESP_QCLOUD_FREE(publish_data);
 
     return err;
@@ -262,6 +263,11 @@ static void esp_qcloud_iothub_ota_callback(const char *topic, void *payload, siz
 {
     ESP_LOGI(TAG, "ota_callback, topic: %s, payload: %.*s", topic, payload_len, (char *)payload);
 
+    if (!g_ota_enabled) {
+        ESP_LOGW(TAG, "OTA is not enabled, please call esp_qcloud_iothub_ota_enable()");
+        return;
+    }
+
     cJSON *request_data = cJSON_Parse(payload);
     ESP_QCLOUD_ERROR_GOTO(!request_data, EXIT, "The data format is wrong and cannot be parsed");
 
@@ -302,37 +308,42 @@ EXIT:
     cJSON_Delete(request_data);
 }
 
-esp_err_t esp_qcloud_iothub_ota_enable()
+esp_err_t esp_qcloud_iothub_register_ota(void)
 {
-    esp_err_t err         = ESP_OK;
-    char *publish_topic   = NULL;
-    char *publish_data    = NULL;
-    char *subscribe_topic = NULL;
+    esp_err_t err               = ESP_OK;
+    const char *subscribe_topic = esp_qcloud_topic_get(QCLOUD_TOPIC_OTA_UPDATE);
 
     /**
      * @brief subscribed server firmware upgrade news
      */
-    asprintf(&subscribe_topic, "$ota/update/%s/%s",
-             esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
     err = esp_qcloud_mqtt_subscribe(subscribe_topic, esp_qcloud_iothub_ota_callback, NULL);
-    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> subscribe to %s", esp_err_to_name(err), subscribe_topic);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "<%s> subscribe to %s", esp_err_to_name(err), subscribe_topic);
 
     ESP_LOGI(TAG, "mqtt_subscribe, topic: %s", subscribe_topic);
 
+    return err;
+}
+
+esp_err_t esp_qcloud_iothub_ota_enable()
+{
+    esp_err_t err               = ESP_OK;
+    char *publish_data          = NULL;
+    const char *publish_topic   = esp_qcloud_topic_get(QCLOUD_TOPIC_OTA_REPORT);
+
+    /**< The topic is subscribed by esp_qcloud_iothub_init() with the others */
+    g_ota_enabled = true;
+
     /**
      * @brief The device reports the current version number
      */
-    asprintf(&publish_topic, "$ota/report/%s/%s",
-             esp_qcloud_get_product_id(), esp_qcloud_get_device_name());
     asprintf(&publish_data, "{\"type\":\"report_version\",\"report\":{\"version\":\"%s\"}}", esp_qcloud_get_version());
-    err = esp_qcloud_mqtt_publish(publish_topic, publish_data, strlen(publish_data));
+    err = esp_qcloud_mqtt_publish_async(publish_topic, publish_data, strlen(publish_data),
+                                        QCLOUD_MQTT_PRIO_EVENT, NULL, NULL);
     ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> Publish to %s, data: %s",
                           esp_err_to_name(err), publish_topic,  publish_data);
     ESP_LOGI(TAG, "mqtt_publish, topic: %s, data: %s", publish_topic, publish_data);
 
 EXIT:
-    ESP_QCLOUD_FREE(publish_topic);
     ESP_QCLOUD_FREE(publish_data);
-    ESP_QCLOUD_FREE(subscribe_topic);
     return err;
 }
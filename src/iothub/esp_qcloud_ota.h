@@ -0,0 +1,38 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Subscribe to the OTA topic.
+ *
+ * @note Called with the other topics before the MQTT connection, so that it is
+ *       sent in the same SUBSCRIBE. Updates are ignored until
+ *       esp_qcloud_iothub_ota_enable() is called.
+ *
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_iothub_register_ota(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
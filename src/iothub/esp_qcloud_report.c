@@ -0,0 +1,322 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+
+#include "esp_qcloud_utils.h"
+#include "esp_qcloud_report.h"
+
+#ifdef CONFIG_QCLOUD_REPORT_SCHEDULER
+
+#define QCLOUD_REPORT_TASK_STACK    (3 * 1024)
+#define QCLOUD_REPORT_TASK_PRIO     (5)
+#define QCLOUD_REPORT_TOKEN_UNIT    (1000)  /**< One report in the token bucket, in milli-tokens */
+
+static const char *TAG = "esp_qcloud_report";
+
+static TaskHandle_t g_report_task      = NULL;
+static SemaphoreHandle_t g_report_lock = NULL;
+static esp_qcloud_report_params_cb_t g_params_cb   = NULL;
+static esp_qcloud_report_changed_cb_t g_changed_cb = NULL;
+
+/**< Pending report, guarded by g_report_lock */
+static esp_qcloud_param_t g_pending_param[CONFIG_QCLOUD_REPORT_PARAM_MAX];
+static size_t g_pending_count = 0;
+static bool g_pending_changed = false;
+static double g_pending_timestamp = 0;     /**< Newest timestamp of the merged reports */
+
+/**< Guarded by g_report_lock */
+static esp_qcloud_iothub_report_stats_t g_report_stats = {0};
+
+/**< Token bucket, only used by the scheduler task */
+static uint32_t g_bucket_tokens = CONFIG_QCLOUD_REPORT_RATE_LIMIT * QCLOUD_REPORT_TOKEN_UNIT;
+static TickType_t g_bucket_tick = 0;
+
+static void esp_qcloud_report_free_param(esp_qcloud_param_t *param)
+{
+    char *id = (char *)param->id;
+
+    if (param->value.type == QCLOUD_VAL_TYPE_STRING || param->value.type == QCLOUD_VAL_TYPE_STRUCT) {
+        ESP_QCLOUD_FREE(param->value.s);
+    }
+
+    ESP_QCLOUD_FREE(id);
+}
+
+/**
+ * @brief Block until the bucket holds a whole token, then take it.
+ */
+static void esp_qcloud_report_take_token(void)
+{
+    const uint32_t capacity = CONFIG_QCLOUD_REPORT_RATE_LIMIT * QCLOUD_REPORT_TOKEN_UNIT;
+
+    for (;;) {
+        TickType_t now      = xTaskGetTickCount();
+        uint32_t elapsed_ms = (now - g_bucket_tick) * portTICK_PERIOD_MS;
+        g_bucket_tick       = now;
+
+        /**< The bucket refills CONFIG_QCLOUD_REPORT_RATE_LIMIT tokens per second */
+        g_bucket_tokens += MIN(elapsed_ms, 1000) * CONFIG_QCLOUD_REPORT_RATE_LIMIT;
+        g_bucket_tokens  = MIN(g_bucket_tokens, capacity);
+
+        if (g_bucket_tokens >= QCLOUD_REPORT_TOKEN_UNIT) {
+            g_bucket_tokens -= QCLOUD_REPORT_TOKEN_UNIT;
+            return;
+        }
+
+        uint32_t wait_ms = (QCLOUD_REPORT_TOKEN_UNIT - g_bucket_tokens) / CONFIG_QCLOUD_REPORT_RATE_LIMIT;
+        vTaskDelay(pdMS_TO_TICKS(wait_ms) + 1);
+    }
+}
+
+/**
+ * @brief Put back a token that was not used.
+ */
+static void esp_qcloud_report_give_token(void)
+{
+    g_bucket_tokens = MIN(g_bucket_tokens + QCLOUD_REPORT_TOKEN_UNIT,
+                          CONFIG_QCLOUD_REPORT_RATE_LIMIT * QCLOUD_REPORT_TOKEN_UNIT);
+}
+
+/**
+ * @brief Count a report published by the task.
+ */
+static void esp_qcloud_report_count(esp_err_t err)
+{
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+
+    if (err == ESP_OK) {
+        g_report_stats.sent++;
+    } else if (err == ESP_ERR_NOT_FOUND) {
+        g_report_stats.unchanged++;
+    } else {
+        g_report_stats.dropped++;
+    }
+
+    xSemaphoreGive(g_report_lock);
+}
+
+static void esp_qcloud_report_flush(void)
+{
+    esp_err_t err = ESP_OK;
+    esp_qcloud_param_t params[CONFIG_QCLOUD_REPORT_PARAM_MAX];
+    size_t count     = 0;
+    bool changed     = false;
+    double timestamp = 0;
+
+    /**< Updates posted from here on are part of this flush */
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+    changed = g_pending_count || g_pending_changed;
+    xSemaphoreGive(g_report_lock);
+
+    if (!changed) {
+        return;
+    }
+
+    /**< Updates keep merging while the task waits for a token */
+    esp_qcloud_report_take_token();
+
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+    count     = g_pending_count;
+    changed   = g_pending_changed;
+    timestamp = g_pending_timestamp;
+    memcpy(params, g_pending_param, count * sizeof(esp_qcloud_param_t));
+    g_pending_count     = 0;
+    g_pending_changed   = false;
+    g_pending_timestamp = 0;
+    xSemaphoreGive(g_report_lock);
+
+    if (count) {
+        err = g_params_cb(params, count, timestamp);
+        esp_qcloud_report_count(err);
+
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> Publish the merged report", esp_err_to_name(err));
+        }
+
+        for (int i = 0; i < count; ++i) {
+            esp_qcloud_report_free_param(params + i);
+        }
+    }
+
+    if (changed) {
+        /**< The token taken above is used by the merged report */
+        if (count) {
+            esp_qcloud_report_take_token();
+        }
+
+        err = g_changed_cb();
+        esp_qcloud_report_count(err);
+
+        /**< Nothing was published, the token is left for the next report */
+        if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGD(TAG, "No property changed");
+            esp_qcloud_report_give_token();
+        } else if (err != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> Publish the changed properties", esp_err_to_name(err));
+        }
+    }
+}
+
+static void esp_qcloud_report_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /**< Let the updates posted within the window merge into one report */
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_QCLOUD_REPORT_WINDOW_MS));
+
+        esp_qcloud_report_flush();
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_qcloud_report_init(esp_qcloud_report_params_cb_t params_cb, esp_qcloud_report_changed_cb_t changed_cb)
+{
+    ESP_QCLOUD_PARAM_CHECK(params_cb);
+    ESP_QCLOUD_PARAM_CHECK(changed_cb);
+
+    if (g_report_task) {
+        return ESP_OK;
+    }
+
+    g_params_cb   = params_cb;
+    g_changed_cb  = changed_cb;
+    g_report_lock = xSemaphoreCreateMutex();
+    ESP_QCLOUD_ERROR_CHECK(!g_report_lock, ESP_ERR_NO_MEM, "Create the report lock");
+
+    g_bucket_tick = xTaskGetTickCount();
+
+    BaseType_t ret = xTaskCreate(esp_qcloud_report_task, "qcloud_report", QCLOUD_REPORT_TASK_STACK,
+                                 NULL, QCLOUD_REPORT_TASK_PRIO, &g_report_task);
+    ESP_QCLOUD_ERROR_CHECK(ret != pdPASS, ESP_ERR_NO_MEM, "Create the report task");
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_report_post(const esp_qcloud_method_t *report)
+{
+    ESP_QCLOUD_PARAM_CHECK(report);
+    ESP_QCLOUD_ERROR_CHECK(!g_report_task, ESP_ERR_INVALID_STATE, "The report scheduler is not initialized");
+
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+
+    g_report_stats.posted++;
+
+    if (g_pending_count || g_pending_changed) {
+        g_report_stats.merged++;
+    }
+
+    if (report->extra_val && report->extra_val->timestamp > g_pending_timestamp) {
+        g_pending_timestamp = report->extra_val->timestamp;
+    }
+
+    for (int n = 0; n < report->param_num; ++n) {
+        const esp_qcloud_param_t *param = report->param + n;
+        esp_qcloud_param_t *pending     = NULL;
+
+        for (int i = 0; i < g_pending_count; ++i) {
+            if (!strcmp(g_pending_param[i].id, param->id)) {
+                pending = g_pending_param + i;
+                break;
+            }
+        }
+
+        if (pending) {
+            /**< The id is kept, only the value is replaced */
+            if (pending->value.type == QCLOUD_VAL_TYPE_STRING || pending->value.type == QCLOUD_VAL_TYPE_STRUCT) {
+                ESP_QCLOUD_FREE(pending->value.s);
+            }
+        } else if (g_pending_count < CONFIG_QCLOUD_REPORT_PARAM_MAX) {
+            pending     = g_pending_param + g_pending_count++;
+            pending->id = strdup(param->id);
+        } else {
+            g_report_stats.dropped++;
+            err = ESP_ERR_NO_MEM;
+            ESP_LOGW(TAG, "The pending report is full, drop property: %s", param->id);
+            continue;
+        }
+
+        pending->value = param->value;
+
+        bool copy_string = (param->value.type == QCLOUD_VAL_TYPE_STRING || param->value.type == QCLOUD_VAL_TYPE_STRUCT)
+                           && param->value.s;
+
+        if (copy_string) {
+            pending->value.s = strdup(param->value.s);
+        }
+
+        /**< Out of memory, the property is removed from the pending report */
+        if (!pending->id || (copy_string && !pending->value.s)) {
+            esp_qcloud_report_free_param(pending);
+            *pending = g_pending_param[--g_pending_count];
+            g_report_stats.dropped++;
+            err = ESP_ERR_NO_MEM;
+            ESP_LOGW(TAG, "Allocate the pending report, drop property: %s", param->id);
+        }
+    }
+
+    xSemaphoreGive(g_report_lock);
+
+    xTaskNotifyGive(g_report_task);
+
+    return err;
+}
+
+esp_err_t esp_qcloud_report_post_changed(void)
+{
+    ESP_QCLOUD_ERROR_CHECK(!g_report_task, ESP_ERR_INVALID_STATE, "The report scheduler is not initialized");
+
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+
+    g_report_stats.posted++;
+
+    if (g_pending_count || g_pending_changed) {
+        g_report_stats.merged++;
+    }
+
+    g_pending_changed = true;
+
+    xSemaphoreGive(g_report_lock);
+
+    xTaskNotifyGive(g_report_task);
+
+    return ESP_OK;
+}
+
+void esp_qcloud_report_get_stats(esp_qcloud_iothub_report_stats_t *stats)
+{
+    if (!g_report_lock) {
+        *stats = g_report_stats;
+        return;
+    }
+
+    xSemaphoreTake(g_report_lock, portMAX_DELAY);
+    *stats = g_report_stats;
+    xSemaphoreGive(g_report_lock);
+}
+
+#endif /**< CONFIG_QCLOUD_REPORT_SCHEDULER */
@@ -0,0 +1,88 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_qcloud_iothub.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Publish the merged properties as one report.
+ *
+ * @param[in] params    Merged properties.
+ * @param[in] count     Number of the properties.
+ * @param[in] timestamp Newest timestamp of the merged reports, 0 if none had one.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+typedef esp_err_t (*esp_qcloud_report_params_cb_t)(const esp_qcloud_param_t *params, size_t count, double timestamp);
+
+/**
+ * @brief Publish the properties that changed since the last acknowledged report.
+ *
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: no property changed, nothing was published
+ *     - others: fail
+ */
+typedef esp_err_t (*esp_qcloud_report_changed_cb_t)(void);
+
+/**
+ * @brief Create the report scheduler task.
+ *
+ * @param[in] params_cb  Called by the task to publish the merged properties.
+ * @param[in] changed_cb Called by the task when a changed report is requested.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_report_init(esp_qcloud_report_params_cb_t params_cb, esp_qcloud_report_changed_cb_t changed_cb);
+
+/**
+ * @brief Merge the properties of a report into the pending report.
+ *
+ * @note The value posted last wins and the newest timestamp is kept, the report
+ *       handle can be destroyed once the call returns.
+ *
+ * @param[in] report Report handle.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: the pending report is full or out of memory, some properties are dropped
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_report_post(const esp_qcloud_method_t *report);
+
+/**
+ * @brief Request a report of the changed properties with the next flush.
+ *
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_report_post_changed(void);
+
+/**
+ * @brief Get the counters of the scheduler.
+ *
+ * @param[out] stats Counters.
+ */
+void esp_qcloud_report_get_stats(esp_qcloud_iothub_report_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
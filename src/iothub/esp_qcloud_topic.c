@@ -0,0 +1,94 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "esp_qcloud_mem.h"
+#include "esp_qcloud_utils.h"
+#include "esp_qcloud_topic.h"
+
+static const char *TAG = "esp_qcloud_topic";
+
+/**
+ * @brief Prefix of each topic, the suffix is always "{ProductID}/{DeviceName}"
+ */
+static const char *const g_topic_prefix[QCLOUD_TOPIC_MAX] = {
+    [QCLOUD_TOPIC_PROPERTY_UP]          = "$thing/up/property/",
+    [QCLOUD_TOPIC_PROPERTY_DOWN]        = "$thing/down/property/",
+    [QCLOUD_TOPIC_EVENT_UP]             = "$thing/up/event/",
+    [QCLOUD_TOPIC_EVENT_DOWN]           = "$thing/down/event/",
+    [QCLOUD_TOPIC_ACTION_UP]            = "$thing/up/action/",
+    [QCLOUD_TOPIC_ACTION_DOWN]          = "$thing/down/action/",
+    [QCLOUD_TOPIC_SERVICE_UP]           = "$thing/up/service/",
+    [QCLOUD_TOPIC_SERVICE_DOWN]         = "$thing/down/service/",
+    [QCLOUD_TOPIC_OTA_REPORT]           = "$ota/report/",
+    [QCLOUD_TOPIC_OTA_UPDATE]           = "$ota/update/",
+    [QCLOUD_TOPIC_LOG_OPERATION]        = "$log/operation/",
+    [QCLOUD_TOPIC_LOG_OPERATION_RESULT] = "$log/operation/result/",
+};
+
+static char *g_topic_buf                      = NULL;
+static const char *g_topic[QCLOUD_TOPIC_MAX]  = {NULL};
+static uint16_t g_topic_len[QCLOUD_TOPIC_MAX] = {0};
+
+esp_err_t esp_qcloud_topic_init(const char *product_id, const char *device_name)
+{
+    ESP_QCLOUD_PARAM_CHECK(product_id);
+    ESP_QCLOUD_PARAM_CHECK(device_name);
+
+    size_t suffix_len = strlen(product_id) + 1 + strlen(device_name);
+    size_t total_size = 0;
+
+    for (int i = 0; i < QCLOUD_TOPIC_MAX; ++i) {
+        total_size += strlen(g_topic_prefix[i]) + suffix_len + 1;
+    }
+
+    char *buf = ESP_QCLOUD_MALLOC(total_size);
+    ESP_QCLOUD_ERROR_CHECK(!buf, ESP_ERR_NO_MEM, "Allocate the topic table, size: %d", total_size);
+
+    esp_qcloud_topic_deinit();
+    g_topic_buf = buf;
+
+    for (int i = 0; i < QCLOUD_TOPIC_MAX; ++i) {
+        int len = sprintf(buf, "%s%s/%s", g_topic_prefix[i], product_id, device_name);
+
+        g_topic[i]     = buf;
+        g_topic_len[i] = len;
+        buf += len + 1;
+
+        ESP_LOGD(TAG, "topic[%d]: %s", i, g_topic[i]);
+    }
+
+    return ESP_OK;
+}
+
+void esp_qcloud_topic_deinit(void)
+{
+    memset(g_topic, 0, sizeof(g_topic));
+    memset(g_topic_len, 0, sizeof(g_topic_len));
+    ESP_QCLOUD_FREE(g_topic_buf);
+}
+
+const char *esp_qcloud_topic_get(esp_qcloud_topic_t topic)
+{
+    return (topic < QCLOUD_TOPIC_MAX) ? g_topic[topic] : NULL;
+}
+
+size_t esp_qcloud_topic_get_len(esp_qcloud_topic_t topic)
+{
+    return (topic < QCLOUD_TOPIC_MAX) ? g_topic_len[topic] : 0;
+}
@@ -0,0 +1,83 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Topics used by the device, the full names are built once by esp_qcloud_topic_init().
+ */
+typedef enum {
+    QCLOUD_TOPIC_PROPERTY_UP = 0,       /**< $thing/up/property/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_PROPERTY_DOWN,         /**< $thing/down/property/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_EVENT_UP,              /**< $thing/up/event/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_EVENT_DOWN,            /**< $thing/down/event/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_ACTION_UP,             /**< $thing/up/action/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_ACTION_DOWN,           /**< $thing/down/action/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_SERVICE_UP,            /**< $thing/up/service/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_SERVICE_DOWN,          /**< $thing/down/service/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_OTA_REPORT,            /**< $ota/report/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_OTA_UPDATE,            /**< $ota/update/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_LOG_OPERATION,         /**< $log/operation/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_LOG_OPERATION_RESULT,  /**< $log/operation/result/{ProductID}/{DeviceName} */
+    QCLOUD_TOPIC_MAX,
+} esp_qcloud_topic_t;
+
+/**
+ * @brief Build the full names of all the topics.
+ *
+ * @note All names are stored in a single allocation, calling it again
+ *       releases the previous table.
+ *
+ * @param[in] product_id  Product ID.
+ * @param[in] device_name Device name.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_topic_init(const char *product_id, const char *device_name);
+
+/**
+ * @brief Release the topic table.
+ */
+void esp_qcloud_topic_deinit(void);
+
+/**
+ * @brief Get the full name of a topic.
+ *
+ * @param[in] topic Topic index.
+ * @return
+ *     - NULL: the table is not built or the index is invalid
+ *     - others: name of the topic, valid until esp_qcloud_topic_deinit()
+ */
+const char *esp_qcloud_topic_get(esp_qcloud_topic_t topic);
+
+/**
+ * @brief Get the length of the full name of a topic.
+ *
+ * @param[in] topic Topic index.
+ * @return Length of the name without '\0', 0 if the table is not built
+ */
+size_t esp_qcloud_topic_get_len(esp_qcloud_topic_t topic);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -12,37 +12,62 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/param.h>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/queue.h>
 
 #include "esp_wifi.h"
 #include "esp_console.h"
+#include "esp_idf_version.h"
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
 
 #include "esp_qcloud_log.h"
 #include "esp_qcloud_log_flash.h"
+#include "esp_qcloud_log_ring.h"
+#include "esp_qcloud_log_binary.h"
+#include "esp_qcloud_log_retain.h"
 #include "esp_qcloud_storage.h"
+#include "esp_qcloud_iothub.h"
 
 #define MDEBUG_LOG_STORE_KEY               "log_config"
-#define MDEBUG_LOG_QUEUE_SIZE              (30)
 #define MDEBUG_LOG_TIMEOUT_MS              (30 * 1000)
-#define MDEBUG_LOG_QUEUE_BUFFER_MAX_SIZE   (10 * 1024)
 
 #define CONFIG_QCLOUD_TASK_DEFAULT_PRIOTY   6
 #define CONFIG_QCLOUD_TASK_PINNED_TO_CORE   0
 #define CONFIG_QCLOUD_LOG_MAX_SIZE          1024  /**< Set log length size */
+#define QCLOUD_LOG_TAG_MAX_NUM              8     /**< Tags with levels of their own */
+#define QCLOUD_LOG_TAG_MAX_SIZE             32    /**< Longest tag, '\0' included */
+
+/**
+ * @brief Levels of the sinks for the logs of one tag
+ */
+typedef struct {
+    char tag[QCLOUD_LOG_TAG_MAX_SIZE];  /**< Read by the producers without a lock, rewritten only while inactive */
+    volatile bool active;
+    esp_qcloud_log_config_t config;
+} esp_qcloud_log_tag_config_t;
 
 static const char *TAG  = "esp_qcloud_log";
-static QueueHandle_t g_log_queue              = NULL;
+static TaskHandle_t g_log_task               = NULL;
 static bool g_log_init_flag                  = false;
 static esp_qcloud_log_config_t *g_log_config = NULL;
-
-typedef struct log_info {
-    struct tm time;
-    esp_log_level_t level;
-    size_t size;
-    char *data;
-} log_info_t;
+static volatile esp_log_level_t g_log_level_max = ESP_LOG_VERBOSE; /**< Highest level taken by any sink */
+static esp_qcloud_log_tag_config_t g_log_tag_config[QCLOUD_LOG_TAG_MAX_NUM] = {0};
+static volatile size_t g_log_tag_num         = 0;
+static portMUX_TYPE g_log_tag_lock           = portMUX_INITIALIZER_UNLOCKED;
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+static char g_log_text[CONFIG_QCLOUD_LOG_MAX_SIZE + 1]; /**< Binary records formatted by the log task */
+#endif
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+static bool g_log_retain_upload              = false; /**< The records kept over a crash wait for the connection */
+static char g_log_reset_line[128];                    /**< Reset reason, written after the records kept */
+static size_t g_log_reset_line_size          = 0;
+#endif
 
 esp_err_t esp_qcloud_log_get_config(esp_qcloud_log_config_t *config)
 {
@@ -53,6 +78,28 @@ esp_err_t esp_qcloud_log_get_config(esp_qcloud_log_config_t *config)
     return ESP_OK;
 }
 
+static esp_log_level_t esp_qcloud_log_config_level(const esp_qcloud_log_config_t *config)
+{
+    return MAX(MAX(config->log_level_uart, config->log_level_flash),
+               MAX(config->log_level_iothub, config->log_level_local));
+}
+
+/**
+ * @brief Work out the level above which the lines are rejected before anything else
+ */
+static void esp_qcloud_log_update_level(void)
+{
+    esp_log_level_t level = esp_qcloud_log_config_level(g_log_config);
+
+    for (size_t i = 0; i < g_log_tag_num; ++i) {
+        if (g_log_tag_config[i].active) {
+            level = MAX(level, esp_qcloud_log_config_level(&g_log_tag_config[i].config));
+        }
+    }
+
+    g_log_level_max = level;
+}
+
 esp_err_t esp_qcloud_log_set_config(const esp_qcloud_log_config_t *config)
 {
     ESP_QCLOUD_PARAM_CHECK(config);
@@ -60,105 +107,508 @@ esp_err_t esp_qcloud_log_set_config(const esp_qcloud_log_config_t *config)
 
     esp_err_t ret = ESP_OK;
 
+    /**< Raised first and lowered last, a line is never rejected by a stale level */
+    g_log_level_max = ESP_LOG_VERBOSE;
     memcpy(g_log_config, config, sizeof(esp_qcloud_log_config_t));
+    esp_qcloud_log_update_level();
 
     return ret;
 }
 
-static ssize_t esp_qcloud_log_vprintf(const char *fmt, va_list vp)
+esp_err_t esp_qcloud_log_get_tag_config(const char *tag, esp_qcloud_log_config_t *config)
 {
-    size_t log_size = 0;
-    log_info_t *log_info = ESP_QCLOUD_LOG_MALLOC(sizeof(log_info_t));
-    time_t now = 0;
-
-    time(&now);
-    localtime_r(&now, &log_info->time);
-    log_info->size  = log_size = vasprintf(&log_info->data, fmt, vp);
-    log_info->level = ESP_LOG_NONE;
+    ESP_QCLOUD_PARAM_CHECK(tag);
+    ESP_QCLOUD_PARAM_CHECK(config);
 
-    /**
-     * @brief Remove the header and tail that appear in the string in the log
-     *
-     */
-    if (log_info->size == 0 ) {
-        ESP_QCLOUD_LOG_FREE(log_info->data);
-        ESP_QCLOUD_LOG_FREE(log_info);
-        return 0;
+    for (size_t i = 0; i < g_log_tag_num; ++i) {
+        if (g_log_tag_config[i].active && !strcmp(g_log_tag_config[i].tag, tag)) {
+            memcpy(config, &g_log_tag_config[i].config, sizeof(esp_qcloud_log_config_t));
+            return ESP_OK;
+        }
     }
 
-    if (log_info->size > 7) {
-        uint8_t log_level_index = (log_info->data[0] == '\033') ? 7 : 0;
+    return ESP_ERR_NOT_FOUND;
+}
 
-        switch (log_info->data[log_level_index]) {
-        case 'E':
-            log_info->level = ESP_LOG_ERROR;
-            break;
+esp_err_t esp_qcloud_log_set_tag_config(const char *tag, const esp_qcloud_log_config_t *config)
+{
+    ESP_QCLOUD_PARAM_CHECK(tag);
+    ESP_QCLOUD_PARAM_CHECK(strlen(tag) < QCLOUD_LOG_TAG_MAX_SIZE);
+    ESP_QCLOUD_ERROR_CHECK(!g_log_init_flag, ESP_ERR_NOT_SUPPORTED, "log debugging is not initialized");
 
-        case 'W':
-            log_info->level = ESP_LOG_WARN;
-            break;
+    esp_qcloud_log_tag_config_t *tag_config = NULL;
+    esp_qcloud_log_tag_config_t *free_config = NULL;
 
-        case 'I':
-            log_info->level = ESP_LOG_INFO;
+    for (size_t i = 0; i < g_log_tag_num; ++i) {
+        if (!strcmp(g_log_tag_config[i].tag, tag)) {
+            tag_config = g_log_tag_config + i;
             break;
+        }
 
-        case 'D':
-            log_info->level = ESP_LOG_DEBUG;
-            break;
+        if (!free_config && !g_log_tag_config[i].active) {
+            free_config = g_log_tag_config + i;
+        }
+    }
 
-        case 'V':
-            log_info->level = ESP_LOG_VERBOSE;
-            break;
+    if (!config) {
+        if (tag_config) {
+            tag_config->active = false;
+            esp_qcloud_log_update_level();
+        }
 
-        default:
-            break;
+        return ESP_OK;
+    }
+
+    /**< The slot of a tag set back to the configuration is taken before a new one */
+    if (!tag_config && free_config) {
+        tag_config = free_config;
+        strlcpy(tag_config->tag, tag, sizeof(tag_config->tag));
+    } else if (!tag_config) {
+        ESP_QCLOUD_ERROR_CHECK(g_log_tag_num >= QCLOUD_LOG_TAG_MAX_NUM, ESP_ERR_NO_MEM,
+                               "levels of %d tags are set already", QCLOUD_LOG_TAG_MAX_NUM);
+
+        /**< The entry is complete before the producers can see it */
+        portENTER_CRITICAL(&g_log_tag_lock);
+        tag_config = g_log_tag_config + g_log_tag_num;
+        strlcpy(tag_config->tag, tag, sizeof(tag_config->tag));
+        tag_config->active = false;
+        g_log_tag_num++;
+        portEXIT_CRITICAL(&g_log_tag_lock);
+    }
+
+    g_log_level_max = ESP_LOG_VERBOSE;
+
+    portENTER_CRITICAL(&g_log_tag_lock);
+    memcpy(&tag_config->config, config, sizeof(esp_qcloud_log_config_t));
+    tag_config->active = true;
+    portEXIT_CRITICAL(&g_log_tag_lock);
+
+    esp_qcloud_log_update_level();
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Levels that apply to a line, ESP_LOGx passes the tag right after the timestamp
+ */
+static const esp_qcloud_log_config_t *esp_qcloud_log_config(const char *fmt, va_list vp)
+{
+    if (!g_log_tag_num) {
+        return g_log_config;
+    }
+
+    /**< "<level> (%lu) %s: " once the color is skipped */
+    if (fmt[0] == '\033' && strnlen(fmt, 8) > 7) {
+        fmt += 7;
+    }
+
+    if (fmt[0] == '\0' || strncmp(fmt + 1, " (%", 3) || !(fmt = strchr(fmt + 4, ')'))
+            || strncmp(fmt, ") %s", 4)) {
+        return g_log_config;
+    }
+
+    va_list args;
+    va_copy(args, vp);
+    va_arg(args, uint32_t);
+    const char *tag = va_arg(args, const char *);
+    va_end(args);
+
+    for (size_t i = 0; tag && i < g_log_tag_num; ++i) {
+        if (g_log_tag_config[i].active && !strcmp(g_log_tag_config[i].tag, tag)) {
+            return &g_log_tag_config[i].config;
         }
     }
 
-    if (log_info->level <= g_log_config->log_level_uart) {
-        vprintf(fmt, vp); /**< Write log data to uart */
+    return g_log_config;
+}
+
+/**
+ * @brief Sinks of the log task that take a line of this level
+ */
+static uint8_t esp_qcloud_log_sinks(const esp_qcloud_log_config_t *config, esp_log_level_t level)
+{
+    uint8_t sinks = 0;
+
+    if (config->log_level_flash != ESP_LOG_NONE && level <= config->log_level_flash) {
+        sinks |= QCLOUD_LOG_SINK_FLASH;
     }
 
-    if (!g_log_queue || xQueueSend(g_log_queue, &log_info, 0) == pdFALSE) {
-        ESP_QCLOUD_LOG_FREE(log_info->data);
-        ESP_QCLOUD_LOG_FREE(log_info);
+    if (config->log_level_iothub != ESP_LOG_NONE && level <= config->log_level_iothub) {
+        sinks |= QCLOUD_LOG_SINK_IOTHUB;
+    }
+
+    if (config->log_level_local != ESP_LOG_NONE && level <= config->log_level_local) {
+        sinks |= QCLOUD_LOG_SINK_LOCAL;
+    }
+
+    return sinks;
+}
+
+/**
+ * @brief The level is the letter that starts the format of ESP_LOGx, after the color if any
+ */
+static esp_log_level_t esp_qcloud_log_level(const char *fmt)
+{
+    if (fmt[0] == '\033' && strnlen(fmt, 8) > 7) {
+        fmt += 7;
+    }
+
+    switch (fmt[0]) {
+    case 'E':
+        return ESP_LOG_ERROR;
+
+    case 'W':
+        return ESP_LOG_WARN;
+
+    case 'I':
+        return ESP_LOG_INFO;
+
+    case 'D':
+        return ESP_LOG_DEBUG;
+
+    case 'V':
+        return ESP_LOG_VERBOSE;
+
+    default:
+        return ESP_LOG_NONE;
+    }
+}
+
+static void esp_qcloud_log_commit(esp_qcloud_log_record_t *record)
+{
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+    /**< Copied before the log task can consume it */
+    esp_qcloud_log_retain_write(record);
+#endif
+
+    esp_qcloud_log_ring_commit(record);
+
+    if (g_log_task) {
+        if (xPortInIsrContext()) {
+            vTaskNotifyGiveFromISR(g_log_task, NULL);
+        } else {
+            xTaskNotifyGive(g_log_task);
+        }
+    }
+}
+
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+/**
+ * @brief Keep the address of the format and a copy of the arguments, the
+ *        format must be in flash to outlive the call.
+ *
+ * @return Length printed to the uart, -1 if the line must be kept as text
+ */
+static int esp_qcloud_log_vprintf_binary(const char *fmt, va_list vp, esp_log_level_t level, bool uart, uint8_t sinks)
+{
+    size_t size = esp_ptr_in_drom(fmt) ? esp_qcloud_log_binary_size(fmt, vp) : 0;
+    int log_size = 0;
+    va_list args;
+
+    if (!size || size > CONFIG_QCLOUD_LOG_MAX_SIZE) {
+        return -1;
+    }
+
+    if (uart) {
+        va_copy(args, vp);
+        log_size = vprintf(fmt, args); /**< Write log data to uart */
+        va_end(args);
+    }
+
+    /**< The record is not text, its '\0' is not used */
+    esp_qcloud_log_record_t *record = esp_qcloud_log_ring_reserve(size - 1, level);
+
+    if (record) {
+        esp_qcloud_log_binary_encode((esp_qcloud_log_binary_t *)record->data, level, fmt, vp);
+        record->binary = true;
+        record->sinks  = sinks;
+        esp_qcloud_log_commit(record);
     }
 
     return log_size;
 }
+#endif /**< CONFIG_QCLOUD_LOG_BINARY */
+
+/**
+ * @brief Format the line in place in the ring of the current core, without
+ *        touching the heap. The size is measured first on a copy of the list.
+ *
+ * @note  Lines no sink takes are rejected before anything is measured, first
+ *        against the highest level of all the sinks and tags, then against
+ *        the levels of their tag.
+ */
+static int esp_qcloud_log_vprintf(const char *fmt, va_list vp)
+{
+    esp_log_level_t level = esp_qcloud_log_level(fmt);
+    esp_qcloud_log_record_t *record = NULL;
+    va_list args;
+
+    if (level > g_log_level_max) {
+        return 0;
+    }
+
+    const esp_qcloud_log_config_t *config = esp_qcloud_log_config(fmt, vp);
+    bool uart     = level <= config->log_level_uart;
+    uint8_t sinks = esp_qcloud_log_sinks(config, level);
+
+    if (!sinks) {
+        if (!uart) {
+            return 0;
+        }
+
+        /**< Only the uart takes it, the ring is skipped */
+        va_copy(args, vp);
+        int log_size = vprintf(fmt, args);
+        va_end(args);
+
+        return log_size;
+    }
+
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+    int binary_size = esp_qcloud_log_vprintf_binary(fmt, vp, level, uart, sinks);
+
+    if (binary_size >= 0) {
+        return binary_size;
+    }
+#endif /**< CONFIG_QCLOUD_LOG_BINARY */
+
+    va_copy(args, vp);
+    int log_size = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (log_size <= 0) {
+        return log_size;
+    }
+
+    /**< Longer lines are truncated */
+    record = esp_qcloud_log_ring_reserve(MIN(log_size, CONFIG_QCLOUD_LOG_MAX_SIZE), level);
+
+    if (!record) {
+        /**< The ring is full and the line is counted as dropped, the uart still gets it */
+        if (uart) {
+            va_copy(args, vp);
+            vprintf(fmt, args);
+            va_end(args);
+        }
+
+        return log_size;
+    }
+
+    va_copy(args, vp);
+    vsnprintf(record->data, record->size + 1, fmt, args);
+    va_end(args);
+
+    if (uart) {
+        fwrite(record->data, 1, record->size, stdout); /**< Write log data to uart */
+    }
+
+    record->sinks = sinks;
+    esp_qcloud_log_commit(record);
+
+    return log_size;
+}
+
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+static bool esp_qcloud_log_reset_is_crash(esp_reset_reason_t reason)
+{
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT
+           || reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT;
+}
+
+/**
+ * @brief Write the records kept over the reset that did not reach the flash,
+ *        followed by a line with the reset reason. After a crash the records
+ *        are kept until they are uploaded.
+ */
+static esp_err_t esp_qcloud_log_retain_restore(void)
+{
+    esp_qcloud_log_retained_t record = {0};
+    const char *reason_name = NULL;
+    size_t num     = 0;
+    size_t written = 0;
+    bool upload    = false;
+
+    esp_err_t err = esp_qcloud_log_retain_init(&num);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_log_retain_init");
+
+    if (!num) {
+        return ESP_OK;
+    }
+
+    bool crash = esp_qcloud_log_reset_is_crash(esp_qcloud_reboot_reason(&reason_name));
+
+    for (size_t i = 0; esp_qcloud_log_retain_get(i, &record) == ESP_OK; ++i) {
+        upload |= record.sinks & QCLOUD_LOG_SINK_IOTHUB;
+
+        if (!record.flashed && (record.sinks & QCLOUD_LOG_SINK_FLASH)) {
+            esp_qcloud_log_flash_write(record.data, record.size, record.level, record.time, record.binary);
+            written++;
+        }
+    }
+
+    g_log_reset_line_size = snprintf(g_log_reset_line, sizeof(g_log_reset_line),
+                                     "%c (%"PRIu32") %s: reset reason: %s, lines kept: %zu, written after the reset: %zu\n",
+                                     crash ? 'E' : 'W', esp_log_timestamp(), TAG, reason_name, num, written);
+    g_log_reset_line_size = MIN(g_log_reset_line_size, sizeof(g_log_reset_line) - 1);
+
+    /**< Dated as the last record kept, the reset followed it */
+    if (written || crash) {
+        esp_qcloud_log_flash_write(g_log_reset_line, g_log_reset_line_size,
+                                   crash ? ESP_LOG_ERROR : ESP_LOG_WARN, record.time, false);
+    }
+
+    ESP_LOGW(TAG, "Reset reason: %s, lines kept: %zu, written to the flash: %zu", reason_name, num, written);
+
+    g_log_retain_upload = crash && upload;
+
+    if (!g_log_retain_upload) {
+        esp_qcloud_log_retain_free();
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Upload the records kept over a crash and the reset reason, called
+ *        by the log task once connected
+ */
+static void esp_qcloud_log_retain_upload(void)
+{
+    esp_qcloud_log_retained_t record = {0};
+    struct tm log_time = {0};
+    time_t record_time = 0;
+
+    for (size_t i = 0; esp_qcloud_log_retain_get(i, &record) == ESP_OK; ++i) {
+        const char *data = record.data;
+        size_t size      = record.size;
+
+        record_time = record.time;
+        localtime_r(&record_time, &log_time);
+
+        if (!(record.sinks & QCLOUD_LOG_SINK_IOTHUB)) {
+            continue;
+        }
+
+        if (record.binary) {
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+            size = esp_qcloud_log_binary_format(g_log_text, sizeof(g_log_text), (esp_qcloud_log_binary_t *)record.data);
+            data = g_log_text;
+#else
+            continue;
+#endif /**< CONFIG_QCLOUD_LOG_BINARY */
+        }
+
+        esp_qcloud_log_iothub_write(data, size, record.level, &log_time);
+    }
+
+    esp_qcloud_log_iothub_write(g_log_reset_line, g_log_reset_line_size, ESP_LOG_ERROR, &log_time);
+
+    esp_qcloud_log_retain_free();
+    g_log_retain_upload = false;
+}
+#endif /**< CONFIG_QCLOUD_LOG_RETAIN */
 
 static void esp_qcloud_log_send_task(void *arg)
 {
-    log_info_t *log_info = NULL;
+    esp_qcloud_log_record_t *record = NULL;
 
     for (; g_log_config;) {
-        if (xQueueReceive(g_log_queue, &log_info, pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS)) != pdPASS) {
-            continue;
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+        if (g_log_retain_upload && esp_qcloud_iothub_is_connected()) {
+            esp_qcloud_log_retain_upload();
         }
+#endif
+
+        record = esp_qcloud_log_ring_peek();
+
+        if (!record) {
+            /**< Staged records are programmed once the log goes quiet */
+            if (!esp_qcloud_log_flash_staged_size()) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS));
+            } else if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_QCLOUD_LOG_FLASH_FLUSH_MS))) {
+                esp_qcloud_log_flash_flush();
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+                /**< All the records consumed are in the flash */
+                esp_qcloud_log_retain_set_flashed(esp_qcloud_log_ring_pending_seq());
+#endif
+            }
 
+            continue;
+        }
 
-        if (g_log_config->log_level_flash != ESP_LOG_NONE
-                && log_info->level <= g_log_config->log_level_flash) {
-            esp_qcloud_log_flash_write(log_info->data, log_info->size, log_info->level, &log_info->time); /**< Write log data to flash */
+        /**< Records carry the boot time in ms, the calendar time is worked out here */
+        struct tm log_time = {0};
+        time_t now = time(NULL) - (esp_log_timestamp() - record->timestamp) / 1000;
+        localtime_r(&now, &log_time);
+
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+        esp_qcloud_log_retain_set_time(record->timestamp, now);
+#endif
+
+        const char *log_data = record->data;
+        size_t log_size      = record->size;
+
+#ifdef CONFIG_QCLOUD_LOG_BINARY
+        if (record->binary) {
+            esp_qcloud_log_binary_t *binary = (esp_qcloud_log_binary_t *)record->data;
+            binary->time = (uint32_t)now;
+
+            if (record->sinks & QCLOUD_LOG_SINK_FLASH) {
+                esp_qcloud_log_flash_write(record->data, sizeof(esp_qcloud_log_binary_t) + binary->args_size,
+                                           record->level, binary->time, true); /**< Write the binary record to flash */
+            }
+
+            /**< Only formatted when a sink needs the text */
+            if (record->sinks & (QCLOUD_LOG_SINK_IOTHUB | QCLOUD_LOG_SINK_LOCAL)) {
+                log_size = esp_qcloud_log_binary_format(g_log_text, sizeof(g_log_text), binary);
+                log_data = g_log_text;
+            }
+        } else
+#endif /**< CONFIG_QCLOUD_LOG_BINARY */
+        if (record->sinks & QCLOUD_LOG_SINK_FLASH) {
+            esp_qcloud_log_flash_write(log_data, log_size, record->level, (uint32_t)now, false); /**< Write log data to flash */
         }
 
-        if (g_log_config->log_level_iothub != ESP_LOG_NONE
-                && log_info->level <= g_log_config->log_level_iothub) {
-            esp_qcloud_log_iothub_write(log_info->data, log_info->size, log_info->level, &log_info->time); /**< Write log data to iothub */
+        if (record->sinks & QCLOUD_LOG_SINK_IOTHUB) {
+            esp_qcloud_log_iothub_write(log_data, log_size, record->level, &log_time); /**< Write log data to iothub */
         }
 
-        if (g_log_config->log_level_local != ESP_LOG_NONE
-                && log_info->level <= g_log_config->log_level_local) {
+        if (record->sinks & QCLOUD_LOG_SINK_LOCAL) {
             // esp_qcloud_debug_local_write(log_data, log_size);  /**< Write log data to local */
         }
 
-        ESP_QCLOUD_LOG_FREE(log_info->data);
-        ESP_QCLOUD_LOG_FREE(log_info);
+        esp_qcloud_log_ring_release(record);
+
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+        /**
+         * @brief Nothing staged, the records consumed are in the flash. Those before
+         *        the oldest one still in the rings, reserved or committed on either
+         *        core, have all been consumed.
+         */
+        if (!esp_qcloud_log_flash_staged_size()) {
+            esp_qcloud_log_retain_set_flashed(esp_qcloud_log_ring_pending_seq());
+        }
+#endif
     }
 
     vTaskDelete(NULL);
 }
 
+esp_err_t esp_qcloud_log_get_stats(esp_qcloud_log_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
+
+    esp_qcloud_log_ring_stats_t ring_stats = {0};
+    esp_qcloud_log_ring_get_stats(&ring_stats);
+
+    stats->ring_size      = ring_stats.size;
+    stats->ring_used_peak = ring_stats.used_peak;
+    stats->written        = ring_stats.written;
+    stats->dropped        = ring_stats.dropped;
+
+    return ESP_OK;
+}
+
 esp_err_t esp_qcloud_log_init(const esp_qcloud_log_config_t *config)
 {
     if (g_log_init_flag) {
@@ -168,18 +618,24 @@ esp_err_t esp_qcloud_log_init(const esp_qcloud_log_config_t *config)
     g_log_config = ESP_QCLOUD_LOG_CALLOC(1, sizeof(esp_qcloud_log_config_t));
     ESP_QCLOUD_ERROR_CHECK(!g_log_config, ESP_ERR_NO_MEM, "");
     memcpy(g_log_config, config, sizeof(esp_qcloud_log_config_t));
+    esp_qcloud_log_update_level();
 
     esp_qcloud_log_flash_init();
 
-    /**< Register espnow log redirect function */
-    esp_log_set_vprintf(esp_qcloud_log_vprintf);
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+    /**< Before the first record overwrites the ring of the last boot */
+    esp_qcloud_log_retain_restore();
+#endif
 
-    g_log_queue = xQueueCreate(MDEBUG_LOG_QUEUE_SIZE, sizeof(esp_qcloud_log_queue_t *));
-    ESP_QCLOUD_ERROR_CHECK(!g_log_queue, ESP_FAIL, "g_log_queue create fail");
+    esp_err_t err = esp_qcloud_log_ring_init(CONFIG_QCLOUD_LOG_RING_SIZE);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_log_ring_init");
 
     xTaskCreatePinnedToCore(esp_qcloud_log_send_task, "qcloud_log_send", 3 * 1024,
                             NULL, CONFIG_QCLOUD_TASK_DEFAULT_PRIOTY - 2,
-                            NULL, CONFIG_QCLOUD_TASK_PINNED_TO_CORE);
+                            &g_log_task, CONFIG_QCLOUD_TASK_PINNED_TO_CORE);
+
+    /**< Register espnow log redirect function */
+    esp_log_set_vprintf(esp_qcloud_log_vprintf);
 
 
     ESP_LOGI(TAG, "log initialized successfully");
@@ -195,14 +651,13 @@ esp_err_t esp_qcloud_log_deinit()
         return ESP_FAIL;
     }
 
-    for (log_info_t *log_data = NULL;
-            xQueueReceive(g_log_queue, &log_data, 0);) {
-        ESP_QCLOUD_LOG_FREE(log_data);
-        ESP_QCLOUD_LOG_FREE(log_data->data);
-    }
-
     esp_qcloud_log_flash_deinit();
 
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+    esp_qcloud_log_retain_free();
+    g_log_retain_upload = false;
+#endif
+
     g_log_init_flag = false;
     ESP_QCLOUD_LOG_FREE(g_log_config);
 
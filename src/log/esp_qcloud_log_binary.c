@@ -0,0 +1,449 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/param.h>
+
+#include "esp_idf_version.h"
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+#include "esp_app_desc.h"
+#else
+#include "esp_ota_ops.h"
+#endif
+
+#include "esp_qcloud_log_binary.h"
+
+typedef enum {
+    QCLOUD_LOG_ARG_NONE,        /**< "%%" */
+    QCLOUD_LOG_ARG_INT,
+    QCLOUD_LOG_ARG_LONG,
+    QCLOUD_LOG_ARG_LLONG,
+    QCLOUD_LOG_ARG_SIZE,
+    QCLOUD_LOG_ARG_INTMAX,
+    QCLOUD_LOG_ARG_PTRDIFF,
+    QCLOUD_LOG_ARG_DOUBLE,
+    QCLOUD_LOG_ARG_STRING,
+    QCLOUD_LOG_ARG_POINTER,
+    QCLOUD_LOG_ARG_INVALID,     /**< "%n", long double and unknown conversions */
+} esp_qcloud_log_arg_t;
+
+typedef struct {
+    const char *start;          /**< The '%' */
+    size_t len;                 /**< Length up to the conversion included */
+    bool width_star;
+    bool precision_star;
+    int precision;              /**< -1 if not given */
+    esp_qcloud_log_arg_t arg;
+} esp_qcloud_log_spec_t;
+
+/**
+ * @brief Find the next conversion of a format.
+ *
+ * @return The character following the conversion, NULL if there is none left
+ */
+static const char *esp_qcloud_log_spec_next(const char *fmt, esp_qcloud_log_spec_t *spec)
+{
+    const char *p = strchr(fmt, '%');
+
+    if (!p) {
+        return NULL;
+    }
+
+    memset(spec, 0, sizeof(esp_qcloud_log_spec_t));
+    spec->start     = p++;
+    spec->precision = -1;
+
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
+    }
+
+    if (*p == '*') {
+        spec->width_star = true;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    if (*p == '.') {
+        p++;
+
+        if (*p == '*') {
+            spec->precision_star = true;
+            p++;
+        } else {
+            for (spec->precision = 0; *p >= '0' && *p <= '9'; p++) {
+                spec->precision = spec->precision * 10 + *p - '0';
+            }
+        }
+    }
+
+    esp_qcloud_log_arg_t integer = QCLOUD_LOG_ARG_INT;
+
+    switch (*p) {
+        case 'h':
+            p += (p[1] == 'h') ? 2 : 1;
+            break;
+
+        case 'l':
+            integer = (p[1] == 'l') ? QCLOUD_LOG_ARG_LLONG : QCLOUD_LOG_ARG_LONG;
+            p += (p[1] == 'l') ? 2 : 1;
+            break;
+
+        case 'z':
+            integer = QCLOUD_LOG_ARG_SIZE;
+            p++;
+            break;
+
+        case 'j':
+            integer = QCLOUD_LOG_ARG_INTMAX;
+            p++;
+            break;
+
+        case 't':
+            integer = QCLOUD_LOG_ARG_PTRDIFF;
+            p++;
+            break;
+
+        case 'L':
+            integer = QCLOUD_LOG_ARG_INVALID;
+            p++;
+            break;
+
+        default:
+            break;
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+            spec->arg = integer;
+            break;
+
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec->arg = (integer == QCLOUD_LOG_ARG_INVALID) ? QCLOUD_LOG_ARG_INVALID : QCLOUD_LOG_ARG_DOUBLE;
+            break;
+
+        case 's':
+            spec->arg = QCLOUD_LOG_ARG_STRING;
+            break;
+
+        case 'p':
+            spec->arg = QCLOUD_LOG_ARG_POINTER;
+            break;
+
+        case '%':
+            spec->arg = QCLOUD_LOG_ARG_NONE;
+            break;
+
+        default:
+            spec->arg = QCLOUD_LOG_ARG_INVALID;
+            return NULL;
+    }
+
+    spec->len = p + 1 - spec->start;
+
+    return p + 1;
+}
+
+static void esp_qcloud_log_put(uint8_t **out, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i, value >>= 8) {
+        *(*out)++ = (uint8_t)value;
+    }
+}
+
+static uint64_t esp_qcloud_log_get(const uint8_t **in, size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        value |= (uint64_t)(*(*in)++) << (i * 8);
+    }
+
+    return value;
+}
+
+/**
+ * @brief Walk the conversions, write the arguments if `out` is not NULL.
+ *
+ * @return Size of the arguments, 0 if one of them cannot be captured
+ */
+static size_t esp_qcloud_log_binary_walk(const char *fmt, va_list vp, uint8_t *out)
+{
+    esp_qcloud_log_spec_t spec = {.arg = QCLOUD_LOG_ARG_NONE};
+    uint8_t *p   = out;
+    size_t size  = 0;
+
+    /* An empty list still needs a non zero size */
+    for (size = 1; (fmt = esp_qcloud_log_spec_next(fmt, &spec)) != NULL;) {
+        int precision = spec.precision;
+
+        if (spec.width_star) {
+            int width = va_arg(vp, int);
+            size += 4;
+
+            if (out) {
+                esp_qcloud_log_put(&p, (uint32_t)width, 4);
+            }
+        }
+
+        if (spec.precision_star) {
+            precision = va_arg(vp, int);
+            size += 4;
+
+            if (out) {
+                esp_qcloud_log_put(&p, (uint32_t)precision, 4);
+            }
+        }
+
+        uint64_t value = 0;
+        size_t value_size = 4;
+
+        switch (spec.arg) {
+            case QCLOUD_LOG_ARG_NONE:
+                value_size = 0;
+                break;
+
+            case QCLOUD_LOG_ARG_INT:
+                value = (uint32_t)va_arg(vp, int);
+                break;
+
+            case QCLOUD_LOG_ARG_LONG:
+                value = (uint32_t)va_arg(vp, long);
+                break;
+
+            case QCLOUD_LOG_ARG_SIZE:
+                value = (uint32_t)va_arg(vp, size_t);
+                break;
+
+            case QCLOUD_LOG_ARG_PTRDIFF:
+                value = (uint32_t)va_arg(vp, ptrdiff_t);
+                break;
+
+            case QCLOUD_LOG_ARG_POINTER:
+                value = (uint32_t)(uintptr_t)va_arg(vp, void *);
+                break;
+
+            case QCLOUD_LOG_ARG_LLONG:
+                value = (uint64_t)va_arg(vp, long long);
+                value_size = 8;
+                break;
+
+            case QCLOUD_LOG_ARG_INTMAX:
+                value = (uint64_t)va_arg(vp, intmax_t);
+                value_size = 8;
+                break;
+
+            case QCLOUD_LOG_ARG_DOUBLE: {
+                double number = va_arg(vp, double);
+                memcpy(&value, &number, sizeof(value));
+                value_size = 8;
+                break;
+            }
+
+            case QCLOUD_LOG_ARG_STRING: {
+                const char *str = va_arg(vp, const char *);
+                size_t max_len  = QCLOUD_LOG_BINARY_STRING_MAX;
+
+                if (!str) {
+                    str = "(null)";
+                }
+
+                /* "%.*s" is commonly used on data that is not terminated */
+                if (precision >= 0 && (size_t)precision < max_len) {
+                    max_len = precision;
+                }
+
+                size_t len = strnlen(str, max_len);
+                size += len + 1;
+
+                if (out) {
+                    memcpy(p, str, len);
+                    p[len] = '\0';
+                    p += len + 1;
+                }
+
+                value_size = 0;
+                break;
+            }
+
+            default:
+                return 0;
+        }
+
+        size += value_size;
+
+        if (out) {
+            esp_qcloud_log_put(&p, value, value_size);
+        }
+    }
+
+    /* A stray '%' at the end is not a conversion */
+    return spec.arg == QCLOUD_LOG_ARG_INVALID ? 0 : size;
+}
+
+size_t esp_qcloud_log_binary_size(const char *fmt, va_list vp)
+{
+    va_list copy;
+    va_copy(copy, vp);
+    size_t size = esp_qcloud_log_binary_walk(fmt, copy, NULL);
+    va_end(copy);
+
+    if (!size || size > UINT16_MAX) {
+        return 0;
+    }
+
+    return sizeof(esp_qcloud_log_binary_t) + size;
+}
+
+void esp_qcloud_log_binary_encode(esp_qcloud_log_binary_t *binary, uint8_t level, const char *fmt, va_list vp)
+{
+    va_list copy;
+    va_copy(copy, vp);
+    binary->magic     = QCLOUD_LOG_BINARY_MAGIC;
+    binary->level     = level;
+    binary->fmt       = (uint32_t)(uintptr_t)fmt;
+    binary->time      = 0;
+    binary->args_size = esp_qcloud_log_binary_walk(fmt, copy, binary->args);
+    va_end(copy);
+}
+
+size_t esp_qcloud_log_binary_format(char *buf, size_t size, const esp_qcloud_log_binary_t *binary)
+{
+    const char *fmt = (const char *)(uintptr_t)binary->fmt;
+    const uint8_t *p   = binary->args;
+    const uint8_t *end = binary->args + binary->args_size;
+    esp_qcloud_log_spec_t spec;
+    size_t len = 0;
+
+    if (!size) {
+        return 0;
+    }
+
+    buf[0] = '\0';
+
+    for (const char *next; len < size - 1; fmt = next) {
+        next = esp_qcloud_log_spec_next(fmt, &spec);
+        size_t text_len = (next ? spec.start : fmt + strlen(fmt)) - fmt;
+
+        text_len = MIN(text_len, size - 1 - len);
+        memcpy(buf + len, fmt, text_len);
+        len += text_len;
+        buf[len] = '\0';
+
+        if (!next || p > end) {
+            break;
+        }
+
+        /* Rebuild the conversion with the '*' replaced by the captured values */
+        char conv[32];
+        int conv_len = 0;
+        const char *s = spec.start;
+        const char *s_end = spec.start + spec.len;
+
+        for (; s < s_end && conv_len < (int)sizeof(conv) - 16; ++s) {
+            if (*s != '*') {
+                conv[conv_len++] = *s;
+                continue;
+            }
+
+            int value = (int32_t)esp_qcloud_log_get(&p, 4);
+
+            if (s[-1] == '.' && value < 0) {
+                conv_len--;  /**< A negative precision is taken as omitted */
+            } else {
+                conv_len += sprintf(conv + conv_len, "%d", value);
+            }
+        }
+
+        conv[conv_len] = '\0';
+
+        char *dst  = buf + len;
+        size_t dst_size = size - len;
+        int ret = 0;
+
+        switch (spec.arg) {
+            case QCLOUD_LOG_ARG_NONE:
+                ret = snprintf(dst, dst_size, "%%");
+                break;
+
+            case QCLOUD_LOG_ARG_INT:
+                ret = snprintf(dst, dst_size, conv, (int)esp_qcloud_log_get(&p, 4));
+                break;
+
+            case QCLOUD_LOG_ARG_LONG:
+                ret = snprintf(dst, dst_size, conv, (long)(int32_t)esp_qcloud_log_get(&p, 4));
+                break;
+
+            case QCLOUD_LOG_ARG_SIZE:
+                ret = snprintf(dst, dst_size, conv, (size_t)esp_qcloud_log_get(&p, 4));
+                break;
+
+            case QCLOUD_LOG_ARG_PTRDIFF:
+                ret = snprintf(dst, dst_size, conv, (ptrdiff_t)(int32_t)esp_qcloud_log_get(&p, 4));
+                break;
+
+            case QCLOUD_LOG_ARG_POINTER:
+                ret = snprintf(dst, dst_size, conv, (void *)(uintptr_t)esp_qcloud_log_get(&p, 4));
+                break;
+
+            case QCLOUD_LOG_ARG_LLONG:
+                ret = snprintf(dst, dst_size, conv, (long long)esp_qcloud_log_get(&p, 8));
+                break;
+
+            case QCLOUD_LOG_ARG_INTMAX:
+                ret = snprintf(dst, dst_size, conv, (intmax_t)esp_qcloud_log_get(&p, 8));
+                break;
+
+            case QCLOUD_LOG_ARG_DOUBLE: {
+                uint64_t value = esp_qcloud_log_get(&p, 8);
+                double number;
+                memcpy(&number, &value, sizeof(number));
+                ret = snprintf(dst, dst_size, conv, number);
+                break;
+            }
+
+            case QCLOUD_LOG_ARG_STRING: {
+                const char *str = (const char *)p;
+                p += strnlen(str, end - p) + 1;
+                ret = snprintf(dst, dst_size, conv, str);
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if (ret > 0) {
+            len += MIN((size_t)ret, dst_size - 1);
+        }
+    }
+
+    return len;
+}
+
+const uint8_t *esp_qcloud_log_binary_image(void)
+{
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+    return esp_app_get_description()->app_elf_sha256;
+#else
+    return esp_ota_get_app_description()->app_elf_sha256;
+#endif
+}
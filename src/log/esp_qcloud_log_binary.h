@@ -0,0 +1,90 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define QCLOUD_LOG_BINARY_MAGIC         (0x00)  /**< Starts a binary record, never found in log text */
+#define QCLOUD_LOG_BINARY_STRING_MAX    (256)   /**< Longer string arguments are truncated */
+#define QCLOUD_LOG_BINARY_IMAGE_SIZE    (8)     /**< Bytes of the ELF SHA256 kept with the records */
+
+/**
+ * @brief A log line kept as its format and arguments, formatted only when needed.
+ *
+ * @note The same layout is written to the flash, tools/log_decoder turns it
+ *       back into text with the ELF of the firmware. The arguments are in the
+ *       order of the conversions, little endian:
+ *       - '*' width or precision, integers up to 32 bits, pointers: 4 bytes
+ *       - `ll` and `j` integers, floating point: 8 bytes
+ *       - strings: the characters followed by '\0'
+ */
+typedef struct {
+    uint8_t magic;          /**< QCLOUD_LOG_BINARY_MAGIC */
+    uint8_t level;          /**< esp_log_level_t */
+    uint16_t args_size;     /**< Size of `args` */
+    uint32_t fmt;           /**< Address of the format string in the firmware */
+    uint32_t time;          /**< Unix time in seconds, set when the record is consumed */
+    uint8_t args[];
+} esp_qcloud_log_binary_t;
+
+/**
+ * @brief Size of the binary record of a line.
+ *
+ * @param[in] fmt Format, must stay valid for the life of the firmware.
+ * @param[in] vp  Arguments, not consumed.
+ * @return Size of the record, 0 if the format has a conversion that cannot be captured
+ */
+size_t esp_qcloud_log_binary_size(const char *fmt, va_list vp);
+
+/**
+ * @brief Capture a line as a binary record.
+ *
+ * @param[out] binary Record, of the size returned by esp_qcloud_log_binary_size().
+ * @param[in]  level  Level of the line.
+ * @param[in]  fmt    Format, must stay valid for the life of the firmware.
+ * @param[in]  vp     Arguments, not consumed.
+ */
+void esp_qcloud_log_binary_encode(esp_qcloud_log_binary_t *binary, uint8_t level, const char *fmt, va_list vp);
+
+/**
+ * @brief Format a binary record into text.
+ *
+ * @param[out] buf    Text, always terminated by '\0'.
+ * @param[in]  size   Size of `buf`.
+ * @param[in]  binary Record.
+ * @return Length of the text, truncated to `size - 1`
+ */
+size_t esp_qcloud_log_binary_format(char *buf, size_t size, const esp_qcloud_log_binary_t *binary);
+
+/**
+ * @brief Identify the running firmware, the one the `fmt` of its records point into.
+ *
+ * @note Kept in the headers of the flash segments and of the retained ring,
+ *       the binary records written by another firmware are not formatted.
+ *
+ * @return The first QCLOUD_LOG_BINARY_IMAGE_SIZE bytes of the SHA256 of the ELF
+ */
+const uint8_t *esp_qcloud_log_binary_image(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
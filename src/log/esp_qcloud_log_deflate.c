@@ -0,0 +1,219 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_qcloud_log_deflate.h"
+
+#define DEFLATE_HASH_BITS       (10)
+#define DEFLATE_MIN_MATCH       (3)
+#define DEFLATE_MAX_MATCH       (258)
+#define DEFLATE_WINDOW_SIZE     (32768)
+#define DEFLATE_END_OF_BLOCK    (256)
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint32_t bits;
+    uint32_t count;
+    bool overflow;
+} deflate_writer_t;
+
+static const uint16_t g_length_base[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t g_length_extra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t g_dist_base[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t g_dist_extra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/**
+ * @brief Bits are packed starting from the least significant bit of each byte.
+ */
+static void deflate_put_bits(deflate_writer_t *writer, uint32_t value, uint32_t count)
+{
+    writer->bits  |= value << writer->count;
+    writer->count += count;
+
+    while (writer->count >= 8) {
+        if (writer->pos < writer->size) {
+            writer->data[writer->pos++] = writer->bits & 0xff;
+        } else {
+            writer->overflow = true;
+        }
+
+        writer->bits  >>= 8;
+        writer->count -= 8;
+    }
+}
+
+/**
+ * @brief Huffman codes are stored starting from their most significant bit.
+ */
+static void deflate_put_code(deflate_writer_t *writer, uint32_t code, uint32_t len)
+{
+    uint32_t reversed = 0;
+
+    for (int i = 0; i < len; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+
+    deflate_put_bits(writer, reversed, len);
+}
+
+static void deflate_put_symbol(deflate_writer_t *writer, uint32_t symbol)
+{
+    if (symbol < 144) {
+        deflate_put_code(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        deflate_put_code(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        deflate_put_code(writer, symbol - 256, 7);
+    } else {
+        deflate_put_code(writer, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void deflate_put_match(deflate_writer_t *writer, uint32_t length, uint32_t dist)
+{
+    int i = sizeof(g_length_base) / sizeof(g_length_base[0]) - 1;
+
+    while (g_length_base[i] > length) {
+        i--;
+    }
+
+    deflate_put_symbol(writer, 257 + i);
+    deflate_put_bits(writer, length - g_length_base[i], g_length_extra[i]);
+
+    i = sizeof(g_dist_base) / sizeof(g_dist_base[0]) - 1;
+
+    while (g_dist_base[i] > dist) {
+        i--;
+    }
+
+    deflate_put_code(writer, i, 5);
+    deflate_put_bits(writer, dist - g_dist_base[i], g_dist_extra[i]);
+}
+
+static inline uint32_t deflate_hash(const uint8_t *data)
+{
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 2654435761U) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static uint32_t deflate_adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+
+    while (size) {
+        size_t chunk = size < 5552 ? size : 5552;   /**< Largest run without overflowing 32 bits */
+        size -= chunk;
+
+        while (chunk--) {
+            a += *data++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+size_t esp_qcloud_log_deflate(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+    /**< Position plus one of the last occurrence of each hash, 0 if none */
+    uint32_t *head = calloc(1 << DEFLATE_HASH_BITS, sizeof(uint32_t));
+    deflate_writer_t writer = {
+        .data = dst,
+        .size = dst_size,
+    };
+
+    if (!head) {
+        return 0;
+    }
+
+    deflate_put_bits(&writer, 0x78, 8);             /**< CM 8, CINFO 7: deflate with a 32 KB window */
+    deflate_put_bits(&writer, 0x01, 8);             /**< FLEVEL 0, FCHECK makes the header a multiple of 31 */
+    deflate_put_bits(&writer, 1, 1);                /**< BFINAL */
+    deflate_put_bits(&writer, 1, 2);                /**< BTYPE 01: fixed Huffman codes */
+
+    for (size_t i = 0; i < src_size && !writer.overflow;) {
+        size_t length = 0;
+        size_t dist   = 0;
+
+        if (i + DEFLATE_MIN_MATCH <= src_size) {
+            uint32_t hash  = deflate_hash(src + i);
+            size_t match   = head[hash];
+            size_t max_len = src_size - i < DEFLATE_MAX_MATCH ? src_size - i : DEFLATE_MAX_MATCH;
+
+            head[hash] = i + 1;
+
+            if (match && i - (match - 1) <= DEFLATE_WINDOW_SIZE) {
+                const uint8_t *candidate = src + match - 1;
+
+                while (length < max_len && candidate[length] == src[i + length]) {
+                    length++;
+                }
+
+                dist = i - (match - 1);
+            }
+        }
+
+        if (length < DEFLATE_MIN_MATCH) {
+            deflate_put_symbol(&writer, src[i++]);
+            continue;
+        }
+
+        deflate_put_match(&writer, length, dist);
+
+        /**< Index the positions inside the match so that later repeats find them */
+        for (size_t end = i + length; ++i < end;) {
+            if (i + DEFLATE_MIN_MATCH <= src_size) {
+                head[deflate_hash(src + i)] = i + 1;
+            }
+        }
+    }
+
+    free(head);
+
+    deflate_put_symbol(&writer, DEFLATE_END_OF_BLOCK);
+    deflate_put_bits(&writer, 0, (8 - writer.count) & 7);
+
+    uint32_t adler = deflate_adler32(src, src_size);
+
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        deflate_put_bits(&writer, (adler >> shift) & 0xff, 8);
+    }
+
+    return writer.overflow ? 0 : writer.pos;
+}
@@ -0,0 +1,44 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Compress data into a zlib stream (RFC 1950).
+ *
+ * @note The stream holds a single block with the fixed Huffman codes of
+ *       RFC 1951, matches are searched through a small hash table of the last
+ *       position of each 3 byte prefix. Log text compresses to about a quarter
+ *       with 4 KB of working memory, instead of the hundreds of KB of a full
+ *       deflate implementation. Any inflater decodes it.
+ *
+ * @param[in]  src      Data to compress.
+ * @param[in]  src_size Size of the data.
+ * @param[out] dst      Compressed stream.
+ * @param[in]  dst_size Size of `dst`.
+ * @return Size of the compressed stream, 0 if it does not fit in `dst` or out of memory
+ */
+size_t esp_qcloud_log_deflate(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
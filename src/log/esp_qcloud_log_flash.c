@@ -12,40 +12,135 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <sys/param.h>
-#include <errno.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include "esp_wifi.h"
 #include "esp_console.h"
 #include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
 #include "esp_qcloud_iothub.h"
 #include "esp_qcloud_log.h"
+#include "esp_qcloud_log_flash.h"
+#include "esp_qcloud_log_binary.h"
+#include "esp_qcloud_log_lz.h"
+#include "esp_qcloud_log_ring.h"
+#include "esp_qcloud_log_retain.h"
 #include "esp_qcloud_storage.h"
 
-#define LOG_FLASH_FILE_MAX_NUM      2                                 /**< Create several files */
+#define LOG_FLASH_FILE_MAX_NUM      CONFIG_QCLOUD_LOG_FLASH_SEGMENT_NUM  /**< Segments, one is erased at a time */
 #define LOG_FLASH_FILE_MAX_SIZE     CONFIG_QCLOUD_LOG_FILE_MAX_SIZE   /**< File storage size */
-#define LOG_FLASH_STORE_KEY         "log_info"
+#define LOG_FLASH_SEGMENT_SIZE      (LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM)
+#define LOG_FLASH_SEGMENT_MAGIC     (0x334C4451)  /**< "QDL3", "QDL2" before the image, "QDLG" before the index */
+#define LOG_FLASH_RECORD_MAGIC      (0x4C52)
+#define LOG_FLASH_TIME_PREFIX_SIZE  (22)          /**< "[%Y-%m-%d %H:%M:%S] " */
+#define LOG_FLASH_STORE_KEY         "log_cursor"
+#define LOG_FLASH_STORE_KEY_OLD     "log_info"    /**< Sizes of the files, before the records */
 #define LOG_FLASH_STORE_NAMESPACE   "log_info"
 
 /**
- * @brief Create files configuration
+ * @brief What a segment holds, to find the records of a time range or a level
+ *        without reading them.
+ *
+ * @note The times are the smallest and the largest rather than the first and
+ *       the last, the clock may be set back while a segment is written.
  */
 typedef struct {
-    size_t size; /**< Files size */
-    int offset;  /**< Set file pointer offset */
-    uint32_t addr;
-} flash_log_info_t;
+    uint32_t time_min;                          /**< UINT32_MAX if no record */
+    uint32_t time_max;
+    uint16_t level_num[ESP_LOG_VERBOSE + 1];    /**< Records of each level, saturated */
+    uint32_t crc;                               /**< CRC32 of the fields above */
+} log_flash_index_t;
+
+/**
+ * @brief Header at the start of every segment (file).
+ *
+ * @note Segments are used round robin, the one with the largest seq is being
+ *       written. The size lets tools walk a dump of the partition. The index
+ *       is left erased and programmed once the segment is closed, the index
+ *       of the segment being written is only kept in RAM.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t size;      /**< Size of the segment, header included */
+    uint8_t image[QCLOUD_LOG_BINARY_IMAGE_SIZE];    /**< esp_qcloud_log_binary_image() of the firmware that opened it */
+    log_flash_index_t index;
+} log_flash_segment_t;
+
+/**
+ * @brief Header of a record, followed by the data, padded to 4 bytes.
+ *
+ * @note The header is written after the data, a record with a valid magic and
+ *       CRC is complete. Text records hold a part of a line or whole lines,
+ *       binary ones an esp_qcloud_log_binary_t. A block holds the records of
+ *       a flush of the staging buffer compressed by esp_qcloud_log_lz, its
+ *       level and time are the most severe and the oldest of its records.
+ */
+typedef struct {
+    uint16_t magic;
+    uint8_t level;      /**< esp_log_level_t */
+    uint8_t flags;      /**< LOG_FLASH_RECORD_BINARY, LOG_FLASH_RECORD_BLOCK */
+    uint16_t size;      /**< Size of the data */
+    uint16_t block_size;/**< Size of the records of a block, 0 otherwise */
+    uint32_t time;      /**< Unix time in seconds */
+    uint32_t crc;       /**< CRC32 of the data */
+} log_flash_record_t;
+
+#define LOG_FLASH_RECORD_BINARY     (1 << 0)
+#define LOG_FLASH_RECORD_BLOCK      (1 << 1)
+
+/**
+ * @brief Where the next read starts, the only thing kept in NVS
+ */
+typedef struct {
+    uint32_t seq;           /**< Segment, by sequence so a reused segment is noticed */
+    uint16_t offset;        /**< Record in the segment */
+    uint16_t data_offset;   /**< Part of the time prefix and the data already read */
+    bool prefixed;          /**< The record starts a line, it is read after its time */
+    uint16_t block_offset;  /**< Record in the block at `offset` */
+} log_flash_cursor_t;
 
-static int g_log_index                       = 0;
-static flash_log_info_t *g_log_info          = NULL;
-static bool g_esp_qcloud_log_flash_init_flag = false;
 static const esp_partition_t *g_log_part     = NULL;
+static bool g_esp_qcloud_log_flash_init_flag = false;
+static SemaphoreHandle_t g_log_flash_lock    = NULL;
 static const char *TAG                       = "esp_qcloud_log_flash";
 
+/**< Guarded by g_log_flash_lock */
+static uint32_t g_segment_seq[LOG_FLASH_FILE_MAX_NUM] = {0};  /**< 0 if the segment holds no valid header */
+static bool g_segment_foreign[LOG_FLASH_FILE_MAX_NUM] = {0};  /**< Opened by another firmware */
+static log_flash_index_t g_segment_index[LOG_FLASH_FILE_MAX_NUM] = {0};
+static int g_write_segment                   = 0;
+static size_t g_write_offset                 = 0;
+static log_flash_cursor_t g_read_cursor      = {0};
+static bool g_read_line_start                = true;
+
+/**< Records staged in RAM, programmed together at g_stage_offset of the write segment */
+static uint8_t *g_stage                      = NULL;
+static size_t g_stage_size                   = 0;
+static size_t g_stage_offset                 = 0;
+static TickType_t g_stage_tick               = 0;   /**< When the oldest staged record was added */
+static esp_qcloud_log_flash_stats_t g_log_flash_stats = {0};
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+static esp_qcloud_log_lz_t g_lz                 = {0};
+static uint8_t *g_block                         = NULL;   /**< A compressed block, being written or read */
+static uint8_t *g_block_raw                     = NULL;   /**< The records of the block last read */
+static uint32_t g_block_seq                     = 0;      /**< Segment and offset of the block in g_block_raw */
+static size_t g_block_offset                    = 0;
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
 esp_err_t log_info_storage_init()
 {
     esp_err_t err = nvs_flash_init_partition(CONFIG_QCLOUD_LOG_PARTITION_LABEL_NVS);
@@ -127,6 +222,564 @@ esp_err_t log_info_storage_erase(const char *key)
     return err;
 }
 
+static size_t log_flash_record_size(const log_flash_record_t *record)
+{
+    return (sizeof(log_flash_record_t) + record->size + 3) & ~3;
+}
+
+static size_t log_flash_addr(int segment, size_t offset)
+{
+    return CONFIG_QCLOUD_LOG_PARTITION_OFFSET + segment * LOG_FLASH_SEGMENT_SIZE + offset;
+}
+
+static int log_flash_segment_find(uint32_t seq)
+{
+    for (int i = 0; seq && i < LOG_FLASH_FILE_MAX_NUM; ++i) {
+        if (g_segment_seq[i] == seq) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Oldest segment written after `seq`, -1 if there is none
+ */
+static int log_flash_segment_next(uint32_t seq)
+{
+    int next = -1;
+
+    for (int i = 0; i < LOG_FLASH_FILE_MAX_NUM; ++i) {
+        if (g_segment_seq[i] > seq && (next < 0 || g_segment_seq[i] < g_segment_seq[next])) {
+            next = i;
+        }
+    }
+
+    return next;
+}
+
+static esp_err_t log_flash_read_record(int segment, size_t offset, log_flash_record_t *record)
+{
+    if (offset + sizeof(log_flash_record_t) > LOG_FLASH_SEGMENT_SIZE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t err = esp_partition_read(g_log_part, log_flash_addr(segment, offset), record, sizeof(log_flash_record_t));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_read");
+
+    if (record->magic != LOG_FLASH_RECORD_MAGIC || offset + log_flash_record_size(record) > LOG_FLASH_SEGMENT_SIZE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Check the CRC of a record, the data is read in small pieces
+ */
+static bool log_flash_record_is_valid(int segment, size_t offset, const log_flash_record_t *record)
+{
+    uint8_t buf[64];
+    uint32_t crc = 0;
+
+    for (size_t i = 0, size = 0; i < record->size; i += size) {
+        size = MIN(sizeof(buf), record->size - i);
+
+        if (esp_partition_read(g_log_part, log_flash_addr(segment, offset + sizeof(log_flash_record_t) + i), buf, size) != ESP_OK) {
+            return false;
+        }
+
+        crc = esp_rom_crc32_le(crc, buf, size);
+    }
+
+    return crc == record->crc;
+}
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+/**
+ * @brief Records of a block, kept decompressed for the next reads of the block
+ */
+static const uint8_t *log_flash_block_load(int segment, size_t offset, const log_flash_record_t *record)
+{
+    if (g_block_seq == g_segment_seq[segment] && g_block_offset == offset) {
+        return g_block_raw;
+    }
+
+    /**< Written with a larger staging buffer */
+    if (record->size > CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE || record->block_size > CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE) {
+        return NULL;
+    }
+
+    if (esp_partition_read(g_log_part, log_flash_addr(segment, offset + sizeof(log_flash_record_t)), g_block, record->size) != ESP_OK
+            || esp_rom_crc32_le(0, g_block, record->size) != record->crc
+            || esp_qcloud_log_lz_decompress(g_block, record->size, g_block_raw, record->block_size) != record->block_size) {
+        ESP_LOGW(TAG, "Skip a corrupted log block, segment: %d, offset: %d", segment, offset);
+        return NULL;
+    }
+
+    g_block_seq    = g_segment_seq[segment];
+    g_block_offset = offset;
+
+    return g_block_raw;
+}
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+/**
+ * @brief Record at a position of a segment, the records of a block are read
+ *        from the block decompressed in RAM
+ *
+ * @param[out] data The data of a record of a block, NULL for a record read from the flash
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_NOT_FOUND: no record left in the segment
+ */
+static esp_err_t log_flash_record_get(int segment, uint32_t *offset, uint16_t *block_offset,
+                                      log_flash_record_t *record, const uint8_t **data)
+{
+    for (*data = NULL;; *offset += log_flash_record_size(record), *block_offset = 0) {
+        if ((segment == g_write_segment && *offset >= g_write_offset)
+                || log_flash_read_record(segment, *offset, record) != ESP_OK) {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        if (!(record->flags & LOG_FLASH_RECORD_BLOCK)) {
+            return ESP_OK;
+        }
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+        const uint8_t *block = log_flash_block_load(segment, *offset, record);
+        log_flash_record_t inner = {0};
+
+        if (block && *block_offset + sizeof(inner) <= record->block_size) {
+            memcpy(&inner, block + *block_offset, sizeof(inner));
+
+            if (inner.magic == LOG_FLASH_RECORD_MAGIC && *block_offset + sizeof(inner) + inner.size <= record->block_size) {
+                *record = inner;
+                *data   = block + *block_offset + sizeof(inner);
+                return ESP_OK;
+            }
+        }
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+        /**< The end of the block, or a block that cannot be read */
+    }
+}
+
+/**
+ * @brief Position of the record after the one returned by log_flash_record_get()
+ */
+static void log_flash_record_skip(uint32_t *offset, uint16_t *block_offset,
+                                  const log_flash_record_t *record, const uint8_t *data)
+{
+    if (data) {
+        *block_offset += log_flash_record_size(record);
+    } else {
+        *offset += log_flash_record_size(record);
+    }
+}
+
+static void log_flash_index_reset(log_flash_index_t *index)
+{
+    memset(index, 0, sizeof(log_flash_index_t));
+    index->time_min = UINT32_MAX;
+}
+
+static void log_flash_index_add(log_flash_index_t *index, const log_flash_record_t *record)
+{
+    uint8_t level = MIN(record->level, ESP_LOG_VERBOSE);
+
+    index->time_min = MIN(index->time_min, record->time);
+    index->time_max = MAX(index->time_max, record->time);
+    index->level_num[level] += index->level_num[level] < UINT16_MAX;
+}
+
+/**
+ * @brief The segment may hold records between `time_start` and `time_end` up to `level`
+ */
+static bool log_flash_index_match(const log_flash_index_t *index, uint32_t time_start,
+                                  uint32_t time_end, esp_log_level_t level)
+{
+    if (index->time_max < time_start || (time_end && index->time_min >= time_end)) {
+        return false;
+    }
+
+    for (int i = 0; i <= MIN(level, ESP_LOG_VERBOSE); ++i) {
+        if (index->level_num[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Build the index of a segment from the headers of its records
+ *
+ * @return Offset after the last record
+ */
+static size_t log_flash_index_build(int segment, size_t *last)
+{
+    log_flash_record_t record = {0};
+    size_t offset = sizeof(log_flash_segment_t);
+
+    log_flash_index_reset(&g_segment_index[segment]);
+
+    for (; log_flash_read_record(segment, offset, &record) == ESP_OK; offset += log_flash_record_size(&record)) {
+        *last = offset;
+
+        if (!(record.flags & LOG_FLASH_RECORD_BLOCK)) {
+            log_flash_index_add(&g_segment_index[segment], &record);
+            continue;
+        }
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+        const uint8_t *block = log_flash_block_load(segment, offset, &record);
+        log_flash_record_t inner = {0};
+
+        for (size_t i = 0; block && i + sizeof(inner) <= record.block_size; i += log_flash_record_size(&inner)) {
+            memcpy(&inner, block + i, sizeof(inner));
+
+            if (inner.magic != LOG_FLASH_RECORD_MAGIC) {
+                break;
+            }
+
+            log_flash_index_add(&g_segment_index[segment], &inner);
+        }
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+    }
+
+    return offset;
+}
+
+
+/**
+ * @brief Program the flash, the time is counted as spent with the flash cache disabled
+ */
+static esp_err_t log_flash_program(size_t addr, const void *data, size_t size)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_write(g_log_part, addr, data, size);
+    uint32_t elapsed_us = esp_timer_get_time() - start;
+
+    g_log_flash_stats.programs++;
+    g_log_flash_stats.program_bytes += size;
+    g_log_flash_stats.program_time_us += elapsed_us;
+    g_log_flash_stats.program_time_max_us = MAX(g_log_flash_stats.program_time_max_us, elapsed_us);
+
+    return err;
+}
+
+static esp_err_t log_flash_erase(size_t addr, size_t size)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(g_log_part, addr, size);
+
+    g_log_flash_stats.erases++;
+    g_log_flash_stats.erase_time_us += esp_timer_get_time() - start;
+
+    return err;
+}
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+/**
+ * @brief Compress the staged records into a block in g_block
+ *
+ * @return Size of the block, 0 if the records do not shrink
+ */
+static size_t log_flash_block_compress(void)
+{
+    log_flash_record_t block = {
+        .magic      = LOG_FLASH_RECORD_MAGIC,
+        .level      = ESP_LOG_VERBOSE,
+        .flags      = LOG_FLASH_RECORD_BLOCK,
+        .block_size = g_stage_size,
+        .time       = UINT32_MAX,
+    };
+
+    for (size_t offset = 0; offset < g_stage_size;) {
+        const log_flash_record_t *record = (log_flash_record_t *)(g_stage + offset);
+
+        block.level = MIN(block.level, record->level);
+        block.time  = MIN(block.time, record->time);
+        offset += log_flash_record_size(record);
+    }
+
+    /**< The block, padded, must be smaller than the records */
+    int64_t start = esp_timer_get_time();
+    size_t size   = g_stage_size < sizeof(block) + 4 ? 0 :
+                    esp_qcloud_log_lz_compress(&g_lz, g_stage, g_stage_size, g_block + sizeof(block),
+                                               g_stage_size - sizeof(block) - 4);
+    g_log_flash_stats.compress_time_us += esp_timer_get_time() - start;
+
+    if (!size) {
+        return 0;
+    }
+
+    block.size = size;
+    block.crc  = esp_rom_crc32_le(0, g_block + sizeof(block), size);
+    memcpy(g_block, &block, sizeof(block));
+    memset(g_block + sizeof(block) + size, 0xff, log_flash_record_size(&block) - sizeof(block) - size);
+
+    return log_flash_record_size(&block);
+}
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+/**
+ * @brief Program the staged records in one write.
+ *
+ * @note The records of a flush are not written header last, a cut program
+ *       leaves a record whose CRC fails and the scan closes the segment.
+ */
+static esp_err_t log_flash_stage_flush(void)
+{
+    if (!g_stage_size) {
+        return ESP_OK;
+    }
+
+    const uint8_t *data = g_stage;
+    size_t size = g_stage_size;
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+    size_t block_size = log_flash_block_compress();
+
+    if (block_size) {
+        data = g_block;
+        size = block_size;
+    }
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+    esp_err_t err = log_flash_program(log_flash_addr(g_write_segment, g_stage_offset), data, size);
+
+    g_log_flash_stats.flushes++;
+    g_log_flash_stats.stage_bytes += g_stage_size;
+    g_log_flash_stats.flush_bytes += size;
+    g_stage_offset += size;
+    g_write_offset  = g_stage_offset;
+    g_stage_size    = 0;
+
+    /**< Skip the rest of a segment that failed to be written */
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> esp_partition_write, segment: %d", esp_err_to_name(err), g_write_segment);
+        g_write_offset = g_stage_offset = LOG_FLASH_SEGMENT_SIZE;
+    }
+
+    return err;
+}
+
+/**
+ * @brief Program the index of a segment that is no longer written
+ */
+static esp_err_t log_flash_index_write(int segment)
+{
+    log_flash_index_t index = {0};
+    size_t addr = log_flash_addr(segment, offsetof(log_flash_segment_t, index));
+
+    esp_err_t err = esp_partition_read(g_log_part, addr, &index, sizeof(index));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_read");
+
+    /**< Written before a reset that came ahead of the next segment */
+    for (int i = 0; i < sizeof(index) / sizeof(uint32_t); ++i) {
+        if (((uint32_t *)&index)[i] != UINT32_MAX) {
+            return ESP_OK;
+        }
+    }
+
+    index     = g_segment_index[segment];
+    index.crc = esp_rom_crc32_le(0, (uint8_t *)&index, offsetof(log_flash_index_t, crc));
+
+    return log_flash_program(addr, &index, sizeof(index));
+}
+
+static void log_flash_shutdown_handler(void)
+{
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+    /**< Read before the flush, the records released by then are staged or programmed */
+    uint32_t pending_seq = esp_qcloud_log_ring_pending_seq();
+
+    /**< The restore after the restart must not write them again */
+    if (esp_qcloud_log_flash_flush() == ESP_OK) {
+        esp_qcloud_log_retain_set_flashed(pending_seq);
+    }
+#else
+    esp_qcloud_log_flash_flush();
+#endif
+}
+
+static esp_err_t log_flash_segment_open(int segment)
+{
+    esp_err_t err = ESP_OK;
+    uint32_t seq  = 0;
+
+    for (int i = 0; i < LOG_FLASH_FILE_MAX_NUM; ++i) {
+        seq = MAX(seq, g_segment_seq[i]);
+    }
+
+    log_flash_segment_t header = {
+        .magic = LOG_FLASH_SEGMENT_MAGIC,
+        .seq   = seq + 1,
+        .size  = LOG_FLASH_SEGMENT_SIZE,
+    };
+
+    memcpy(header.image, esp_qcloud_log_binary_image(), sizeof(header.image));
+
+    if (g_segment_seq[g_write_segment] && segment != g_write_segment
+            && log_flash_index_write(g_write_segment) != ESP_OK) {
+        ESP_LOGW(TAG, "The index is not written, segment: %d", g_write_segment);
+    }
+
+    g_segment_seq[segment] = 0;
+    log_flash_index_reset(&g_segment_index[segment]);
+
+    err = log_flash_erase(log_flash_addr(segment, 0), LOG_FLASH_SEGMENT_SIZE);
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_erase_range, segment: %d", segment);
+
+    /**< The index stays erased */
+    err = log_flash_program(log_flash_addr(segment, 0), &header, offsetof(log_flash_segment_t, index));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_write, segment: %d", segment);
+
+    g_segment_seq[segment]     = header.seq;
+    g_segment_foreign[segment] = false;
+    g_write_segment            = segment;
+    g_write_offset         = sizeof(log_flash_segment_t);
+    g_stage_offset         = g_write_offset;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Find the segment being written and the end of its records.
+ *
+ * @note A record cut by a reset, or anything written after the last record,
+ *       closes the segment, the next write opens a new one.
+ */
+static esp_err_t log_flash_scan(void)
+{
+    log_flash_segment_t header = {0};
+    log_flash_record_t record  = {0};
+    int newest = -1;
+
+    for (int i = 0; i < LOG_FLASH_FILE_MAX_NUM; ++i) {
+        esp_err_t err = esp_partition_read(g_log_part, log_flash_addr(i, 0), &header, sizeof(header));
+        ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_read");
+
+        bool valid = header.magic == LOG_FLASH_SEGMENT_MAGIC && header.size == LOG_FLASH_SEGMENT_SIZE
+                     && header.seq && header.seq != UINT32_MAX;
+        g_segment_seq[i] = valid ? header.seq : 0;
+        g_segment_index[i] = header.index;
+        g_segment_foreign[i] = memcmp(header.image, esp_qcloud_log_binary_image(), sizeof(header.image)) != 0;
+
+        if (valid && (newest < 0 || header.seq > g_segment_seq[newest])) {
+            newest = i;
+        }
+    }
+
+    if (newest < 0) {
+        ESP_LOGI(TAG, "No log segment found, format the log partition");
+        return log_flash_segment_open(0);
+    }
+
+    /**< Segments closed by a reset before their index was written are read once */
+    for (int i = 0; i < LOG_FLASH_FILE_MAX_NUM; ++i) {
+        size_t last = 0;
+
+        if (i == newest || !g_segment_seq[i]
+                || g_segment_index[i].crc == esp_rom_crc32_le(0, (uint8_t *)&g_segment_index[i], offsetof(log_flash_index_t, crc))) {
+            continue;
+        }
+
+        log_flash_index_build(i, &last);
+        log_flash_index_write(i);
+    }
+
+    size_t last   = 0;
+    size_t offset = log_flash_index_build(newest, &last);
+
+    g_write_segment = newest;
+    g_write_offset  = offset;
+
+    /**< Only the last record is checked, the ones before it were complete when it was written */
+    if (last && log_flash_read_record(newest, last, &record) == ESP_OK
+            && !log_flash_record_is_valid(newest, last, &record)) {
+        ESP_LOGW(TAG, "The last log record is incomplete, segment: %d, offset: %d", newest, last);
+        g_write_offset = LOG_FLASH_SEGMENT_SIZE;
+    }
+
+    /**< A record whose header was not written yet, or a cut flush */
+    uint32_t tail[8] = {0};
+    size_t tail_size = MIN(sizeof(tail), LOG_FLASH_SEGMENT_SIZE - MIN(g_write_offset, LOG_FLASH_SEGMENT_SIZE));
+
+    if (tail_size && esp_partition_read(g_log_part, log_flash_addr(newest, g_write_offset), tail, tail_size) == ESP_OK) {
+        for (int i = 0; i < tail_size / sizeof(uint32_t); ++i) {
+            if (tail[i] != UINT32_MAX) {
+                g_write_offset = LOG_FLASH_SEGMENT_SIZE;
+                break;
+            }
+        }
+    }
+
+    /**< The binary records of this firmware go to a segment of their own */
+    if (g_segment_foreign[newest] && g_write_offset < LOG_FLASH_SEGMENT_SIZE) {
+        ESP_LOGI(TAG, "The segment was opened by another firmware, close it, segment: %d", newest);
+        g_write_offset = LOG_FLASH_SEGMENT_SIZE;
+    }
+
+    g_stage_offset = g_write_offset;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Bytes of records not read yet
+ */
+static size_t log_flash_unread_size(void)
+{
+    size_t size  = 0;
+    int segment  = log_flash_segment_find(g_read_cursor.seq);
+    size_t start = g_read_cursor.offset;
+
+    if (segment < 0) {
+        segment = log_flash_segment_next(g_read_cursor.seq);
+        start   = sizeof(log_flash_segment_t);
+    }
+
+    for (; segment >= 0; segment = log_flash_segment_next(g_segment_seq[segment]), start = sizeof(log_flash_segment_t)) {
+        size_t end = (segment == g_write_segment) ? MIN(g_write_offset, LOG_FLASH_SEGMENT_SIZE) : LOG_FLASH_SEGMENT_SIZE;
+        size += end > start ? end - start : 0;
+    }
+
+    return size;
+}
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+/**
+ * @brief Bytes of records not read yet once decompressed, the headers of the
+ *        records are read, not the data of the blocks
+ */
+static size_t log_flash_unread_raw_size(void)
+{
+    log_flash_record_t record = {0};
+    size_t size   = g_stage_size;
+    int segment   = log_flash_segment_find(g_read_cursor.seq);
+    size_t offset = g_read_cursor.offset;
+
+    if (segment < 0) {
+        segment = log_flash_segment_next(g_read_cursor.seq);
+        offset  = sizeof(log_flash_segment_t);
+    }
+
+    for (; segment >= 0; segment = log_flash_segment_next(g_segment_seq[segment]), offset = sizeof(log_flash_segment_t)) {
+        for (; !(segment == g_write_segment && offset >= g_stage_offset)
+                && log_flash_read_record(segment, offset, &record) == ESP_OK; offset += log_flash_record_size(&record)) {
+            size += (record.flags & LOG_FLASH_RECORD_BLOCK) ? record.block_size : log_flash_record_size(&record);
+        }
+    }
+
+    return size;
+}
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
 esp_err_t esp_qcloud_log_flash_init()
 {
     if (g_esp_qcloud_log_flash_init_flag) {
@@ -149,32 +802,49 @@ esp_err_t esp_qcloud_log_flash_init()
     ESP_QCLOUD_ERROR_CHECK(g_log_part->size < LOG_FLASH_FILE_MAX_SIZE, ESP_ERR_NOT_SUPPORTED,
                            "Log file (%d Byte) size must be smaller than partition size (%"PRIu32" Byte).",
                            LOG_FLASH_FILE_MAX_SIZE, g_log_part->size);
-    ESP_QCLOUD_ERROR_CHECK(LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM % 4096 != 0, ESP_ERR_NOT_SUPPORTED,
+    ESP_QCLOUD_ERROR_CHECK(LOG_FLASH_SEGMENT_SIZE % 4096 != 0 || LOG_FLASH_SEGMENT_SIZE < 4096, ESP_ERR_NOT_SUPPORTED,
                            "The size of the log partition must be an integer of %d KB.", LOG_FLASH_FILE_MAX_NUM * 4);
 
-    g_log_info = log_info_storage_get(LOG_FLASH_STORE_KEY);
+    if (!g_log_flash_lock) {
+        g_log_flash_lock = xSemaphoreCreateMutex();
+        ESP_QCLOUD_ERROR_CHECK(!g_log_flash_lock, ESP_ERR_NO_MEM, "xSemaphoreCreateMutex");
+
+        g_stage = ESP_QCLOUD_LOG_MALLOC(CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE);
+        ESP_QCLOUD_ERROR_CHECK(!g_stage, ESP_ERR_NO_MEM, "Allocate the staging buffer");
 
-    if (!g_log_info) {
-        g_log_info = ESP_QCLOUD_LOG_CALLOC(LOG_FLASH_FILE_MAX_NUM, sizeof(flash_log_info_t));
-        err = esp_partition_erase_range(g_log_part, CONFIG_QCLOUD_LOG_PARTITION_OFFSET, LOG_FLASH_FILE_MAX_SIZE);
-        ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_erase_range");
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+        g_block     = ESP_QCLOUD_LOG_MALLOC(CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE);
+        g_block_raw = ESP_QCLOUD_LOG_MALLOC(CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE);
+        ESP_QCLOUD_ERROR_CHECK(!g_block || !g_block_raw, ESP_ERR_NO_MEM, "Allocate the block buffers");
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+        /**< esp_restart() flushes the staged records, a panic loses them */
+        esp_register_shutdown_handler(log_flash_shutdown_handler);
     }
 
-    /**< Create two files */
-    for (size_t i = 0, min_size = LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM; i < LOG_FLASH_FILE_MAX_NUM; i++) {
-        (g_log_info + i)->addr = CONFIG_QCLOUD_LOG_PARTITION_OFFSET + LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM * i;
+    /**< The sizes of the files kept before the records are meaningless now */
+    void *old_info = log_info_storage_get(LOG_FLASH_STORE_KEY_OLD);
 
-        /**< Whether file is full */
-        if ((g_log_info + i)->size < LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM && (g_log_info + i)->size < min_size) {
-            min_size = (g_log_info + i)->size;
-            g_log_index  = i;  /**< File index */
-        }
+    if (old_info) {
+        ESP_QCLOUD_LOG_FREE(old_info);
+        log_info_storage_erase(LOG_FLASH_STORE_KEY_OLD);
+    }
+
+    err = log_flash_scan();
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "log_flash_scan");
+
+    log_flash_cursor_t *cursor = log_info_storage_get(LOG_FLASH_STORE_KEY);
+
+    if (cursor) {
+        g_read_cursor = *cursor;
+        ESP_QCLOUD_LOG_FREE(cursor);
     }
 
     g_esp_qcloud_log_flash_init_flag = true;
     ESP_LOGI(TAG, "LOG flash initialized successfully");
-    ESP_LOGI(TAG, "Log save partition subtype: label: %s, addr:0x%"PRIx32", offset: %d, size: %"PRIu32"",
-             CONFIG_QCLOUD_LOG_PARTITION_LABEL_DATA, g_log_part->address, CONFIG_QCLOUD_LOG_PARTITION_OFFSET, g_log_part->size);
+    ESP_LOGI(TAG, "Log save partition subtype: label: %s, addr:0x%"PRIx32", offset: %d, size: %"PRIu32", write segment: %d, offset: %d",
+             CONFIG_QCLOUD_LOG_PARTITION_LABEL_DATA, g_log_part->address, CONFIG_QCLOUD_LOG_PARTITION_OFFSET, g_log_part->size,
+             g_write_segment, g_write_offset);
 
     return ESP_OK;
 }
@@ -185,6 +855,7 @@ esp_err_t esp_qcloud_log_flash_deinit()
         return ESP_FAIL;
     }
 
+    esp_qcloud_log_flash_flush();
     g_esp_qcloud_log_flash_init_flag = false;
 
     ESP_LOGD(TAG, "Log flash de-initialized successfully");
@@ -192,122 +863,385 @@ esp_err_t esp_qcloud_log_flash_deinit()
     return ESP_OK;
 }
 
-esp_err_t esp_qcloud_log_flash_write(const char *data, size_t size, esp_log_level_t level, struct tm *log_time)
+esp_err_t esp_qcloud_log_flash_write(const void *data, size_t size, esp_log_level_t level, uint32_t log_time, bool binary)
 {
-    esp_err_t err              = ESP_OK;
-    static bool flag_timestamp = true;
+    esp_err_t err = ESP_OK;
+    log_flash_record_t record = {
+        .magic = LOG_FLASH_RECORD_MAGIC,
+        .level = level,
+        .flags = binary ? LOG_FLASH_RECORD_BINARY : 0,
+        .size  = size,
+        .time  = log_time,
+    };
+    size_t record_size = log_flash_record_size(&record);
 
     ESP_QCLOUD_PARAM_CHECK(data);
-    ESP_QCLOUD_PARAM_CHECK(size > 0);
+    ESP_QCLOUD_PARAM_CHECK(size > 0 && size <= UINT16_MAX);
+    ESP_QCLOUD_ERROR_CHECK(record_size > LOG_FLASH_SEGMENT_SIZE - sizeof(log_flash_segment_t),
+                           ESP_ERR_INVALID_SIZE, "The log is too large, size: %d", size);
 
     if (!g_esp_qcloud_log_flash_init_flag) {
         return ESP_FAIL;
     }
 
+    record.crc = esp_rom_crc32_le(0, data, size);
+
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+
     /**
-     * @brief Get the address of the pointer to the next file and clear the file to be written
-     * and clear offset size.
+     * @brief Open the next segment, the oldest one is erased with the records not read yet.
      */
-    if ((g_log_info + g_log_index)->size + size > LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM) {
-        g_log_index = (g_log_index + 1) % LOG_FLASH_FILE_MAX_NUM;
-        (g_log_info + g_log_index)->size   = 0;
-        (g_log_info + g_log_index)->offset = 0;
+    if (g_write_offset + record_size > LOG_FLASH_SEGMENT_SIZE) {
+        log_flash_stage_flush();
+    }
+
+    /**< The staged records take less room once compressed */
+    if (g_write_offset + record_size > LOG_FLASH_SEGMENT_SIZE) {
+        err = log_flash_segment_open((g_write_segment + 1) % LOG_FLASH_FILE_MAX_NUM);
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "log_flash_segment_open");
+    }
+
+    ESP_QCLOUD_LOG_PRINTF("log_flash_write, segment: %d, offset: %d, size: %d\n",
+                          g_write_segment, g_write_offset, size);
+
+    g_log_flash_stats.records++;
+    log_flash_index_add(&g_segment_index[g_write_segment], &record);
+
+    if (record_size > CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE) {
+        /**< Too large to be staged, the header last, a record with a magic is complete */
+        log_flash_stage_flush();
 
-        err = esp_partition_erase_range(g_log_part, (g_log_info + g_log_index)->addr, LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM);
-        ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_erase_range, addr: %"PRIu32"", (g_log_info + g_log_index)->addr);
+        err = log_flash_program(log_flash_addr(g_write_segment, g_write_offset + sizeof(record)), data, size);
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "esp_partition_write");
+
+        err = log_flash_program(log_flash_addr(g_write_segment, g_write_offset), &record, sizeof(record));
+        ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "esp_partition_write");
+
+        g_write_offset += record_size;
+        g_stage_offset  = g_write_offset;
+        goto EXIT;
     }
 
+    if (g_stage_size + record_size > CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE) {
+        log_flash_stage_flush();
+    }
+
+    if (!g_stage_size) {
+        g_stage_tick = xTaskGetTickCount();
+    }
+
+    /**< The padding stays erased */
+    memcpy(g_stage + g_stage_size, &record, sizeof(record));
+    memcpy(g_stage + g_stage_size + sizeof(record), data, size);
+    memset(g_stage + g_stage_size + sizeof(record) + size, 0xff, record_size - sizeof(record) - size);
+    g_stage_size   += record_size;
+    g_write_offset += record_size;
+
+    /**< Errors are kept, the staged records of a steady trickle do not wait for a full buffer */
+    if (level == ESP_LOG_ERROR || g_stage_size == CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE
+            || xTaskGetTickCount() - g_stage_tick >= pdMS_TO_TICKS(CONFIG_QCLOUD_LOG_FLASH_FLUSH_MS)) {
+        err = log_flash_stage_flush();
+    }
+
+EXIT:
+    /**< Skip the rest of a segment that failed to be written */
+    if (err != ESP_OK) {
+        g_write_offset = g_stage_offset = LOG_FLASH_SEGMENT_SIZE;
+    }
+
+    size_t unread_size = log_flash_unread_size();
+
+    xSemaphoreGive(g_log_flash_lock);
+
     static uint32_t s_event_send_tick = 0;
 
-    if (esp_qcloud_log_flash_size() > LOG_FLASH_FILE_MAX_SIZE / LOG_FLASH_FILE_MAX_NUM
+    /**< The segment of the oldest unread record is the next one to be erased */
+    if (unread_size > (LOG_FLASH_FILE_MAX_NUM - 1) * LOG_FLASH_SEGMENT_SIZE
             && (xTaskGetTickCount() - s_event_send_tick > 30000 || !s_event_send_tick)) {
         s_event_send_tick = xTaskGetTickCount();
         esp_event_post(QCLOUD_EVENT, QCLOUD_EVENT_LOG_FLASH_FULL, NULL, 0, portMAX_DELAY);
     }
 
-    ESP_QCLOUD_LOG_PRINTF("esp_partition_write, addr: %d, offset: %d, log_index: %d, size: %d\n",
-                          (g_log_info + g_log_index)->addr, (g_log_info + g_log_index)->size, g_log_index, size);
+    return err;
+}
 
-    if (flag_timestamp) {
-        flag_timestamp = false;
+/**
+ * @brief Text of the records from the cursor, the time is added at the start of the lines.
+ *        Binary records are copied as they are, they carry their own time.
+ */
+esp_err_t esp_qcloud_log_flash_read(char *data, size_t *size)
+{
+    log_flash_record_t record = {0};
+    size_t read_size = 0;
+    ESP_QCLOUD_PARAM_CHECK(data);
+    ESP_QCLOUD_PARAM_CHECK(size && *size > 0);
 
-        /**< Get the current timestamp */
-        char strtime_buf[32] = {0};
-        strftime(strtime_buf, sizeof(strtime_buf), "[%Y-%m-%d %H:%M:%S] ", log_time);
+    if (!g_esp_qcloud_log_flash_init_flag) {
+        *size = 0;
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+
+    /**< The staged records are read from the flash like the others */
+    log_flash_stage_flush();
+
+    log_flash_cursor_t cursor = g_read_cursor;
+    int segment = log_flash_segment_find(cursor.seq);
+    uint32_t offset       = cursor.offset;
+    uint16_t block_offset = cursor.block_offset;
+    const uint8_t *block_data = NULL;
 
-        /**
-         * @brief Change the write file address, then wirte timestamp data
-         */
-        err = esp_partition_write(g_log_part, (g_log_info + g_log_index)->addr + (g_log_info + g_log_index)->size, strtime_buf, strlen(strtime_buf));
-        ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_write");
-        (g_log_info + g_log_index)->size += strlen(strtime_buf);
+    while (read_size < *size) {
+        /**< The segment of the cursor was reused, the records left in it are lost */
+        if (segment < 0 || log_flash_record_get(segment, &offset, &block_offset, &record, &block_data) != ESP_OK) {
+            if (segment == g_write_segment || (segment = log_flash_segment_next(cursor.seq)) < 0) {
+                break;
+            }
+
+            /**< Saved even when the segment has no record yet */
+            cursor.seq          = g_segment_seq[segment];
+            cursor.offset       = offset       = sizeof(log_flash_segment_t);
+            cursor.block_offset = block_offset = 0;
+            cursor.data_offset  = 0;
+            continue;
+        }
+
+        /**< Moved to the next block or past a corrupted one */
+        if (offset != cursor.offset || block_offset != cursor.block_offset) {
+            cursor.offset       = offset;
+            cursor.block_offset = block_offset;
+            cursor.data_offset  = 0;
+        }
+
+        size_t addr = log_flash_addr(segment, offset + sizeof(record));
+        bool text   = !(record.flags & LOG_FLASH_RECORD_BINARY);
+
+        /**< Its format is an address in another firmware, it cannot be decoded with this one */
+        if (!text && g_segment_foreign[segment]) {
+            g_log_flash_stats.foreign_skipped++;
+            log_flash_record_skip(&offset, &block_offset, &record, block_data);
+            continue;
+        }
+
+        if (cursor.data_offset == 0) {
+            /**< Records that fit are checked, the others are read in parts, blocks are checked as a whole */
+            if (!block_data && record.size <= *size - read_size
+                    && !log_flash_record_is_valid(segment, offset, &record)) {
+                ESP_LOGW(TAG, "Skip a corrupted log record, segment: %d, offset: %"PRIu32, segment, offset);
+                offset += log_flash_record_size(&record);
+                continue;
+            }
+
+            cursor.prefixed = text && g_read_line_start;
+        }
+
+        size_t prefix_size = cursor.prefixed ? LOG_FLASH_TIME_PREFIX_SIZE : 0;
+
+        if (cursor.data_offset < prefix_size) {
+            char prefix[LOG_FLASH_TIME_PREFIX_SIZE + 1] = {0};
+            struct tm log_time = {0};
+            time_t now = record.time;
+            localtime_r(&now, &log_time);
+            strftime(prefix, sizeof(prefix), "[%Y-%m-%d %H:%M:%S] ", &log_time);
+
+            size_t copy_size = MIN(*size - read_size, prefix_size - cursor.data_offset);
+            memcpy(data + read_size, prefix + cursor.data_offset, copy_size);
+            read_size += copy_size;
+            cursor.data_offset += copy_size;
+            continue;
+        }
+
+        size_t data_offset = cursor.data_offset - prefix_size;
+        size_t data_size   = MIN(*size - read_size, record.size - data_offset);
+
+        if (block_data) {
+            memcpy(data + read_size, block_data + data_offset, data_size);
+        } else if (esp_partition_read(g_log_part, addr + data_offset, data + read_size, data_size) != ESP_OK) {
+            ESP_LOGW(TAG, "esp_partition_read, segment: %d, offset: %"PRIu32, segment, offset);
+            break;
+        }
+
+        read_size += data_size;
+        cursor.data_offset += data_size;
+
+        if (data_offset + data_size == record.size) {
+            if (text) {
+                g_read_line_start = data[read_size - 1] == '\n';
+            }
+
+            log_flash_record_skip(&offset, &block_offset, &record, block_data);
+            cursor.offset       = offset;
+            cursor.block_offset = block_offset;
+            cursor.data_offset  = 0;
+        }
     }
 
-    /**
-     * @brief Change the write file address, then wirte log data after the timestamp.
-     *
-     * @note First need to get the length of the timestamp, then write the log data after the timestamp
-     */
-    err = esp_partition_write(g_log_part, (g_log_info + g_log_index)->addr + (g_log_info + g_log_index)->size, data, size);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_write");
-    (g_log_info + g_log_index)->size += size;
+    /**< Saved once per read instead of once per record */
+    if (memcmp(&cursor, &g_read_cursor, sizeof(cursor))) {
+        g_read_cursor = cursor;
+        log_info_storage_set(LOG_FLASH_STORE_KEY, &g_read_cursor, sizeof(g_read_cursor));
+    }
 
-    /**
-     * @brief Here in order to read the data address written by the file,Get where the data address is written.
-     *
-     */
-    log_info_storage_set(LOG_FLASH_STORE_KEY, g_log_info, sizeof(flash_log_info_t) * LOG_FLASH_FILE_MAX_NUM);
+    xSemaphoreGive(g_log_flash_lock);
 
-    if (data[size - 1] == '\n') {
-        flag_timestamp = true;
+    *size = read_size;
+    return read_size > 0 ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Copy a record as esp_qcloud_log_flash_read() does, with the time
+ *        prefix if it starts a line
+ */
+static size_t log_flash_copy_record(int segment, size_t offset, const log_flash_record_t *record,
+                                    const uint8_t *block_data, bool prefixed, char *data, size_t size)
+{
+    size_t copy_size = 0;
+
+    if (prefixed) {
+        struct tm log_time = {0};
+        time_t now = record->time;
+        localtime_r(&now, &log_time);
+        strftime(data, LOG_FLASH_TIME_PREFIX_SIZE + 1, "[%Y-%m-%d %H:%M:%S] ", &log_time);
+        copy_size = LOG_FLASH_TIME_PREFIX_SIZE;
     }
 
-    return ESP_OK;
+    size_t data_size = MIN(size - copy_size, record->size);
+
+    if (block_data) {
+        memcpy(data + copy_size, block_data, data_size);
+    } else if (esp_partition_read(g_log_part, log_flash_addr(segment, offset + sizeof(log_flash_record_t)),
+                                  data + copy_size, data_size) != ESP_OK) {
+        return 0;
+    }
+
+    return copy_size + data_size;
 }
 
-esp_err_t esp_qcloud_log_flash_read(char *data, size_t *size)
+esp_err_t esp_qcloud_log_flash_read_range(esp_qcloud_log_flash_range_t *range, char *data, size_t *size)
 {
-    esp_err_t err    = ESP_OK;
+    log_flash_record_t record = {0};
+    const uint8_t *block_data = NULL;
     size_t read_size = 0;
+
+    ESP_QCLOUD_PARAM_CHECK(range);
     ESP_QCLOUD_PARAM_CHECK(data);
-    ESP_QCLOUD_PARAM_CHECK(size && *size > 0);
+    ESP_QCLOUD_PARAM_CHECK(size && *size > LOG_FLASH_TIME_PREFIX_SIZE);
 
     if (!g_esp_qcloud_log_flash_init_flag) {
         *size = 0;
         return ESP_FAIL;
     }
 
-    /**
-     * @brief First find Target file index address, then read the this files data
-     *
-     * @note The file address read is different from the file address written, so that the same address
-     * can be prevented from being written and read.
-     */
-    for (int i = 0; i < LOG_FLASH_FILE_MAX_NUM && *size > read_size; ++i, data += read_size) {
-        flash_log_info_t *log_info = g_log_info + (g_log_index + 1 + i) % LOG_FLASH_FILE_MAX_NUM;
-        ssize_t data_size = MIN(*size - read_size, log_info->size - log_info->offset);
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+
+    log_flash_stage_flush();
 
-        if (data_size > 0) {
-            err = esp_partition_read(g_log_part, log_info->addr + log_info->offset, data, data_size);
+    /**< Not found at the start, or when the segment was reused since the last call */
+    int segment = log_flash_segment_find(range->seq);
 
-            if (err != ESP_OK) {
-                ESP_LOGW(TAG, "<%s> fread packet, ret: %d, *size: %d, read_size: %d, log_info->offset: %d, log_info->size: %d, index: %d",
-                         strerror(errno), err, *size, read_size, log_info->offset, log_info->size, i);
-                log_info->offset = log_info->size = 0;
+    while (read_size < *size) {
+        if (segment < 0) {
+            /**< Segments without a matching record are skipped by their index */
+            for (segment = log_flash_segment_next(range->seq);
+                    segment >= 0 && !log_flash_index_match(&g_segment_index[segment], range->time_start,
+                                                           range->time_end, range->level);
+                    segment = log_flash_segment_next(g_segment_seq[segment])) {
+            }
+
+            if (segment < 0) {
                 break;
             }
 
-            read_size += data_size;
-            log_info->offset += data_size;
-            ESP_QCLOUD_LOG_PRINTF("esp_partition_read, data_size: %d, read_size: %d, log_info->offset: %d, log_info->size: %d, ret: %d, index: %d, data: %.*s\n",
-                                  data_size, read_size, log_info->offset, log_info->size, err, i, data_size, data);
+            range->seq          = g_segment_seq[segment];
+            range->offset       = sizeof(log_flash_segment_t);
+            range->block_offset = 0;
+        }
+
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+        /**< Blocks without a record of the level, or after the range, are not decompressed */
+        if (!range->block_offset && !(segment == g_write_segment && range->offset >= g_write_offset)
+                && log_flash_read_record(segment, range->offset, &record) == ESP_OK
+                && (record.flags & LOG_FLASH_RECORD_BLOCK)
+                && (record.level > range->level || (range->time_end && record.time >= range->time_end))) {
+            range->offset += log_flash_record_size(&record);
+            continue;
+        }
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+
+        /**< The position stays at the end of the segment until a next one matches */
+        if (log_flash_record_get(segment, &range->offset, &range->block_offset, &record, &block_data) != ESP_OK) {
+            segment = -1;
+            continue;
+        }
+
+        bool text = !(record.flags & LOG_FLASH_RECORD_BINARY);
 
-            log_info_storage_set(LOG_FLASH_STORE_KEY, g_log_info, sizeof(flash_log_info_t) * LOG_FLASH_FILE_MAX_NUM);
+        if (!text && g_segment_foreign[segment]) {
+            g_log_flash_stats.foreign_skipped++;
+            log_flash_record_skip(&range->offset, &range->block_offset, &record, block_data);
+            continue;
         }
+
+        if (record.level > range->level || record.time < range->time_start
+                || (range->time_end && record.time >= range->time_end)) {
+            log_flash_record_skip(&range->offset, &range->block_offset, &record, block_data);
+            continue;
+        }
+
+        size_t record_size = record.size + (text && !range->in_line ? LOG_FLASH_TIME_PREFIX_SIZE : 0);
+
+        /**< Only a record larger than the buffer is cut */
+        if (read_size && record_size > *size - read_size) {
+            break;
+        }
+
+        if (block_data || log_flash_record_is_valid(segment, range->offset, &record)) {
+            size_t copy_size = log_flash_copy_record(segment, range->offset, &record, block_data,
+                                                     text && !range->in_line, data + read_size, *size - read_size);
+
+            if (text && copy_size) {
+                range->in_line = data[read_size + copy_size - 1] != '\n';
+            }
+
+            read_size += copy_size;
+        }
+
+        log_flash_record_skip(&range->offset, &range->block_offset, &record, block_data);
     }
 
+    xSemaphoreGive(g_log_flash_lock);
+
     *size = read_size;
-    return read_size > 0 ? ESP_OK : ESP_FAIL;
+    return read_size > 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_qcloud_log_flash_get_index(esp_qcloud_log_flash_index_t *index, size_t *num)
+{
+    ESP_QCLOUD_PARAM_CHECK(index);
+    ESP_QCLOUD_PARAM_CHECK(num);
+
+    if (!g_esp_qcloud_log_flash_init_flag) {
+        *num = 0;
+        return ESP_FAIL;
+    }
+
+    size_t count = 0;
+
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+
+    for (int segment = log_flash_segment_next(0); segment >= 0 && count < *num;
+            segment = log_flash_segment_next(g_segment_seq[segment]), ++count) {
+        index[count].seq      = g_segment_seq[segment];
+        index[count].time_min = g_segment_index[segment].time_min;
+        index[count].time_max = g_segment_index[segment].time_max;
+        memcpy(index[count].level_num, g_segment_index[segment].level_num, sizeof(index[count].level_num));
+    }
+
+    xSemaphoreGive(g_log_flash_lock);
+
+    *num = count;
+    return ESP_OK;
 }
 
 esp_err_t esp_qcloud_log_flash_erase()
@@ -318,13 +1252,29 @@ esp_err_t esp_qcloud_log_flash_erase()
 
     esp_err_t err = ESP_OK;
 
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+
     err = log_info_storage_erase(LOG_FLASH_STORE_KEY);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "log_info_storage_erase");
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND, EXIT, "log_info_storage_erase");
 
-    err = esp_partition_erase_range(g_log_part, CONFIG_QCLOUD_LOG_PARTITION_OFFSET, LOG_FLASH_FILE_MAX_SIZE);
-    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_partition_erase_range");
+    err = log_flash_erase(CONFIG_QCLOUD_LOG_PARTITION_OFFSET, LOG_FLASH_FILE_MAX_SIZE);
+    ESP_QCLOUD_ERROR_GOTO(err != ESP_OK, EXIT, "esp_partition_erase_range");
 
-    return ESP_OK;
+    g_stage_size = 0;
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+    g_block_seq = 0;
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+    memset(g_segment_seq, 0, sizeof(g_segment_seq));
+    memset(g_segment_index, 0, sizeof(g_segment_index));
+    memset(&g_read_cursor, 0, sizeof(g_read_cursor));
+    g_read_line_start = true;
+
+    err = log_flash_segment_open(0);
+
+EXIT:
+    xSemaphoreGive(g_log_flash_lock);
+
+    return err;
 }
 
 size_t esp_qcloud_log_flash_size()
@@ -333,13 +1283,41 @@ size_t esp_qcloud_log_flash_size()
         return 0;
     }
 
-    size_t size = 0;
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+#ifdef CONFIG_QCLOUD_LOG_FLASH_COMPRESS
+    size_t size = log_flash_unread_raw_size();
+#else
+    size_t size = log_flash_unread_size();
+#endif /**< CONFIG_QCLOUD_LOG_FLASH_COMPRESS */
+    xSemaphoreGive(g_log_flash_lock);
 
-    for (size_t i = 0; i < LOG_FLASH_FILE_MAX_NUM; i++) {
-        if ((g_log_info + i)->size >= (g_log_info + i)->offset) {
-            size += (g_log_info + i)->size - (g_log_info + i)->offset;
-        }
+    /**< Each text record may get a time prefix in place of its header */
+    return size + size / sizeof(log_flash_record_t) * (LOG_FLASH_TIME_PREFIX_SIZE - sizeof(log_flash_record_t));
+}
+
+esp_err_t esp_qcloud_log_flash_flush(void)
+{
+    if (!g_esp_qcloud_log_flash_init_flag) {
+        return ESP_FAIL;
     }
 
-    return size;
+    xSemaphoreTake(g_log_flash_lock, portMAX_DELAY);
+    esp_err_t err = log_flash_stage_flush();
+    xSemaphoreGive(g_log_flash_lock);
+
+    return err;
+}
+
+size_t esp_qcloud_log_flash_staged_size(void)
+{
+    return g_stage_size;
+}
+
+esp_err_t esp_qcloud_log_flash_get_stats(esp_qcloud_log_flash_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
+
+    memcpy(stats, &g_log_flash_stats, sizeof(esp_qcloud_log_flash_stats_t));
+
+    return ESP_OK;
 }
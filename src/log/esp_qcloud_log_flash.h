@@ -21,9 +21,9 @@ extern "C" {
 
 /**
  * @brief Initesp_qcloud_log_flash
- *      Create Several files under the spiffs folder,open the file.Open the
- *      file for the storage of the next step data.paramters MDEBUG_FLASH_FILE_MAX_NUM
- *      if files sizes change.
+ *      Scan the segments of the log partition to find where the records end,
+ *      a partition without valid segments is formatted. The read cursor is
+ *      loaded from NVS.
  *
  * @return
  *      - MDF-OK
@@ -73,17 +73,39 @@ esp_err_t esp_qcloud_log_flash_erase();
 size_t esp_qcloud_log_flash_size();
 
 /**
- * @brief Write memory data in flash
+ * @brief Append a record to the log in flash
  *
- * @note Don't include timestamp in interface input data
+ * @note The record carries its level and time, the time is added to the start
+ *       of the lines when the log is read. No NVS is written.
  *
- * @param data  Data from the flash's spiffs files in the log
- * @param size  Size from the flash's spiffs files in the log
+ * @param data     Text of the log, or an esp_qcloud_log_binary_t
+ * @param size     Size of the data
+ * @param level    Level of the log
+ * @param log_time Unix time of the log
+ * @param binary   The data is an esp_qcloud_log_binary_t
  *
  * @return
  *      - ESP_OK
+ *      - ESP_ERR_INVALID_SIZE: the data is larger than a segment
+ */
+esp_err_t esp_qcloud_log_flash_write(const void *data, size_t size, esp_log_level_t level, uint32_t log_time, bool binary);
+
+/**
+ * @brief Program the records staged in RAM
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_FAIL: the log in flash is not initialized
+ */
+esp_err_t esp_qcloud_log_flash_flush(void);
+
+/**
+ * @brief Size of the records staged in RAM
+ *
+ * @return
+ *      - size
  */
-esp_err_t esp_qcloud_log_flash_write(const char *data, size_t size, esp_log_level_t level, struct tm *log_time);
+size_t esp_qcloud_log_flash_staged_size(void);
 
 #ifdef __cplusplus
 }
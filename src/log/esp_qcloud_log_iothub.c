@@ -12,133 +12,347 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
-#include <esp_ota_ops.h>
-#include <esp_partition.h>
-#include <esp_https_ota.h>
-#include <esp_wifi_types.h>
-#include <esp_wifi.h>
-
-#include "cJSON.h"
+#include <esp_idf_version.h>
+#include <esp_timer.h>
+#include <esp_http_client.h>
 
 #include "esp_qcloud_iothub.h"
 #include "esp_qcloud_mqtt.h"
 #include "esp_qcloud_log.h"
+#include "esp_qcloud_credential.h"
+#include "esp_qcloud_log_deflate.h"
 
-#include "mbedtls/md.h"
-#include "mbedtls/base64.h"
-#include "mbedtls/error.h"
-
-#define LOG_UPLOAD_SERVER_URL "http://devicelog.iot.cloud.tencent.com/cgi-bin/report-log"
-#define MAX_HTTP_OUTPUT_BUFFER 128
+#define LOG_UPLOAD_TASK_STACK   (4 * 1024)
+#define LOG_UPLOAD_TASK_PRIO    (3)
 
 static const char *TAG = "esp_qcloud_log_iothub";
+
+/**
+ * @brief A batch is one header followed by lines, each line carries its own
+ *        level and time. A batch of one line is the format of a single line.
+ */
 typedef struct {
     char signature[40];
     char ctrl_bytes[4];
     char product_id[10];
     char device_name[48];
     char timestamp[10];
+} esp_qcloud_log_iothub_header_t;
+
+typedef struct {
     char log_level[3];
     char log_time[21];
     char data[];
-} esp_qcloud_log_iothub_t;
+} esp_qcloud_log_iothub_line_t;
 
-esp_err_t esp_qcloud_log_iothub_write(const char *data, size_t size, esp_log_level_t log_level, const struct tm *log_time)
-{
-    ESP_QCLOUD_PARAM_CHECK(data);
-    ESP_QCLOUD_PARAM_CHECK(size);
+typedef struct {
+    char *data;
+    size_t size;
+    uint32_t lines;
+    TickType_t first_tick;          /**< When the first line was added */
+} esp_qcloud_log_batch_t;
 
-    if (!esp_qcloud_iothub_is_connected()) {
-        return ESP_ERR_NOT_SUPPORTED;
-    }
+/**
+ * @brief Lines are added to the active batch while the other one is uploaded.
+ */
+static esp_qcloud_log_batch_t g_log_batch[2];
+static uint8_t g_batch_active         = 0;
+static bool g_batch_sending           = false;
+static SemaphoreHandle_t g_batch_lock = NULL;
+static TaskHandle_t g_upload_task     = NULL;
+static esp_err_t g_upload_init_err    = ESP_OK;
+static uint32_t g_latency_sum_ms      = 0;
+static esp_qcloud_log_iothub_stats_t g_upload_stats = {0};
 
-    esp_err_t err = ESP_OK;
-    char timestamp[22] = {0};
-    char *level_str[] = {"DIS", "ERR", "WRN", "INF", "DBG"};
-    mbedtls_md_context_t sha_ctx;
-    char *response_data = NULL;
-    size_t log_size = sizeof(esp_qcloud_log_iothub_t) + size;
-    esp_qcloud_log_iothub_t *log_data = ESP_QCLOUD_LOG_MALLOC(log_size + 1);
-
-    /**
-     * @brief Construct iothub log data
-     */
-    memset(log_data, '#', sizeof(esp_qcloud_log_iothub_t));
-    log_data->ctrl_bytes[0] = 'P';
-    memcpy(log_data->product_id, esp_qcloud_get_product_id(), strlen(esp_qcloud_get_product_id()));
-    memcpy(log_data->device_name, esp_qcloud_get_device_name(), strlen(esp_qcloud_get_device_name()));
-#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
-    sprintf(timestamp, "%010llu", mktime((struct tm *)log_time));
-#else
-    sprintf(timestamp, "%010lu", mktime((struct tm *)log_time));
+#ifdef CONFIG_QCLOUD_LOG_UPLOAD_DEFLATE
+static uint8_t *g_deflate_buf         = NULL;
 #endif
-    memcpy(log_data->timestamp, timestamp, sizeof(log_data->timestamp));
-    sprintf(log_data->log_level, "%s", level_str[log_level]);
-    strftime(timestamp, sizeof(timestamp), "|%F %T|", log_time);
-    memcpy(log_data->log_time, timestamp, sizeof(log_data->log_time));
-
-    memcpy(log_data->data, data, size);
-    log_data->data[size] = 0;
-
-    uint8_t digest[20] = {0};
-    char digest_str[41] = {0};
-    mbedtls_md_init(&sha_ctx);
-    err = mbedtls_md_setup(&sha_ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), 1);
-    ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_setup");
-    err = mbedtls_md_hmac_starts(&sha_ctx, (const uint8_t *)esp_qcloud_get_device_secret(), strlen(esp_qcloud_get_device_secret()));
-    ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_starts");
-    err = mbedtls_md_hmac_update(&sha_ctx, (uint8_t *)log_data->ctrl_bytes, log_size - sizeof(log_data->signature));
-    ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_update");
-    err = mbedtls_md_hmac_finish(&sha_ctx, digest);
-    ESP_QCLOUD_ERROR_GOTO(err != 0, EXIT, "mbedtls_md_hmac_finish");
-
-    for (int i = 0; i < sizeof(digest); i++) {
-        sprintf(digest_str + i * 2, "%02x", digest[i]);
+
+/**
+ * @brief Hand the active batch to the upload task, called with the lock held.
+ */
+static bool esp_qcloud_log_batch_swap(void)
+{
+    if (g_batch_sending) {
+        return false;
     }
 
-    memcpy(log_data->signature, digest_str, sizeof(log_data->signature));
+    g_batch_sending = true;
+    g_batch_active ^= 1;
+    g_log_batch[g_batch_active].size  = 0;
+    g_log_batch[g_batch_active].lines = 0;
 
-    /**
-     * @brief Send log data to iothub
-     */
+    return true;
+}
+
+static esp_err_t esp_qcloud_log_iothub_upload(esp_qcloud_log_batch_t *batch)
+{
     static esp_http_client_handle_t s_http_client = NULL;
 
+    esp_err_t err = ESP_OK;
+    esp_qcloud_log_iothub_header_t *header = (esp_qcloud_log_iothub_header_t *)batch->data;
+    char digest_str[QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE * 2 + 1] = {0};
+    const char *body = batch->data;
+    size_t body_size = batch->size;
+
+    /**< One signature for the whole batch instead of one per line */
+    err = esp_qcloud_credential_sign_hex(QCLOUD_CREDENTIAL_LOG, header->ctrl_bytes, batch->size - sizeof(header->signature),
+                                         digest_str, sizeof(digest_str));
+    ESP_QCLOUD_ERROR_CHECK(err != ESP_OK, err, "esp_qcloud_credential_sign_hex");
+    memcpy(header->signature, digest_str, sizeof(header->signature));
+
     if (!s_http_client) {
         esp_http_client_config_t config = {
-            .url    = LOG_UPLOAD_SERVER_URL,
+            .url    = CONFIG_QCLOUD_LOG_UPLOAD_URL,
             .method =  HTTP_METHOD_POST,
         };
 
+        /**< Kept between the batches, the connection is reused while the server keeps it alive */
         s_http_client = esp_http_client_init(&config);
+        ESP_QCLOUD_ERROR_CHECK(!s_http_client, ESP_FAIL, "esp_http_client_init");
     }
 
-    ESP_QCLOUD_LOG_PRINTF("Log HTTP stream writer data: %s\n", (char *)log_data);
-    esp_http_client_set_post_field(s_http_client, (char *)log_data, log_size);
+#ifdef CONFIG_QCLOUD_LOG_UPLOAD_DEFLATE
+    /**< Sent as is when it does not get smaller, the stream stops at the size of the batch */
+    size_t deflate_size = esp_qcloud_log_deflate((uint8_t *)batch->data, batch->size,
+                          g_deflate_buf, MIN(batch->size, CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE));
 
+    if (deflate_size && deflate_size < batch->size) {
+        body      = (char *)g_deflate_buf;
+        body_size = deflate_size;
+        esp_http_client_set_header(s_http_client, "Content-Encoding", "deflate");
+    } else {
+        esp_http_client_delete_header(s_http_client, "Content-Encoding");
+    }
+#endif
+
+    ESP_QCLOUD_LOG_PRINTF("Log HTTP stream writer, lines: %"PRIu32", size: %zu, body size: %zu\n",
+                          batch->lines, batch->size, body_size);
+    esp_http_client_set_post_field(s_http_client, body, body_size);
+
+    int64_t start_us = esp_timer_get_time();
     err = esp_http_client_perform(s_http_client);
+    uint32_t latency_ms = (esp_timer_get_time() - start_us) / 1000;
+    int status_code = esp_http_client_get_status_code(s_http_client);
+
+    xSemaphoreTake(g_batch_lock, portMAX_DELAY);
 
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "<%s> HTTP POST request failed", esp_err_to_name(err));
+    if (err == ESP_OK && status_code == 200) {
+        g_upload_stats.requests++;
+        g_upload_stats.lines      += batch->lines;
+        g_upload_stats.bytes      += batch->size;
+        g_upload_stats.sent_bytes += body_size;
+        g_upload_stats.latency_max_ms = MAX(g_upload_stats.latency_max_ms, latency_ms);
+        g_latency_sum_ms += latency_ms;
+    } else {
+        g_upload_stats.failed++;
+    }
+
+    xSemaphoreGive(g_batch_lock);
+
+    if (err != ESP_OK || status_code != 200) {
+        ESP_LOGW(TAG, "<%s> HTTP POST request failed, status: %d, lines dropped: %"PRIu32,
+                 esp_err_to_name(err), status_code, batch->lines);
         esp_http_client_close(s_http_client);
         esp_http_client_cleanup(s_http_client);
         s_http_client = NULL;
-        goto EXIT;
+        return err != ESP_OK ? err : ESP_FAIL;
     }
 
-    response_data = ESP_QCLOUD_LOG_CALLOC(1, MAX_HTTP_OUTPUT_BUFFER);
-    int response_len = esp_http_client_read_response(s_http_client, response_data, MAX_HTTP_OUTPUT_BUFFER);
-    ESP_QCLOUD_ERROR_GOTO(response_len < 0, EXIT, "Error read data, err_str: %s", strerror(errno));
+    return ESP_OK;
+}
+
+static void esp_qcloud_log_upload_task(void *arg)
+{
+    for (;;) {
+        TickType_t wait_ticks = portMAX_DELAY;
+
+        xSemaphoreTake(g_batch_lock, portMAX_DELAY);
 
-    ESP_QCLOUD_LOG_PRINTF("Log HTTP stream reader data: %s\n", response_data);
+        esp_qcloud_log_batch_t *active = &g_log_batch[g_batch_active];
+
+        /**< A batch that is not full is sent once its first line waited long enough */
+        if (!g_batch_sending && active->lines) {
+            TickType_t elapsed = xTaskGetTickCount() - active->first_tick;
+
+            if (elapsed >= pdMS_TO_TICKS(CONFIG_QCLOUD_LOG_UPLOAD_INTERVAL_MS)) {
+                esp_qcloud_log_batch_swap();
+            } else {
+                wait_ticks = pdMS_TO_TICKS(CONFIG_QCLOUD_LOG_UPLOAD_INTERVAL_MS) - elapsed;
+            }
+        }
+
+        bool sending = g_batch_sending;
+        xSemaphoreGive(g_batch_lock);
+
+        if (!sending) {
+            ulTaskNotifyTake(pdTRUE, wait_ticks);
+            continue;
+        }
+
+        /**< The active batch does not change until g_batch_sending is cleared */
+        esp_qcloud_log_batch_t *batch = &g_log_batch[!g_batch_active];
+        esp_qcloud_log_iothub_upload(batch);
+
+        xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+        batch->size     = 0;
+        batch->lines    = 0;
+        g_batch_sending = false;
+        xSemaphoreGive(g_batch_lock);
+    }
+
+    vTaskDelete(NULL);
+}
+
+static esp_err_t esp_qcloud_log_iothub_init(void)
+{
+    g_batch_lock = xSemaphoreCreateMutex();
+    ESP_QCLOUD_ERROR_CHECK(!g_batch_lock, ESP_ERR_NO_MEM, "xSemaphoreCreateMutex");
+
+    for (int i = 0; i < 2; i++) {
+        g_log_batch[i].data = ESP_QCLOUD_LOG_MALLOC(CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE);
+        ESP_QCLOUD_ERROR_GOTO(!g_log_batch[i].data, EXIT, "Allocate the log batch");
+    }
+
+#ifdef CONFIG_QCLOUD_LOG_UPLOAD_DEFLATE
+    g_deflate_buf = ESP_QCLOUD_LOG_MALLOC(CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE);
+    ESP_QCLOUD_ERROR_GOTO(!g_deflate_buf, EXIT, "Allocate the deflate buffer");
+#endif
+
+    /**< The log send task only appends, the network I/O is done here */
+    if (xTaskCreate(esp_qcloud_log_upload_task, "qcloud_log_upload", LOG_UPLOAD_TASK_STACK,
+                    NULL, LOG_UPLOAD_TASK_PRIO, &g_upload_task) == pdPASS) {
+        return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "Create the log upload task");
 
 EXIT:
-    mbedtls_md_free(&sha_ctx);
-    ESP_QCLOUD_LOG_FREE(log_data);
-    ESP_QCLOUD_LOG_FREE(response_data);
-    return err;
+
+    for (int i = 0; i < 2; i++) {
+        ESP_QCLOUD_LOG_FREE(g_log_batch[i].data);
+        g_log_batch[i].data = NULL;
+    }
+
+#ifdef CONFIG_QCLOUD_LOG_UPLOAD_DEFLATE
+    ESP_QCLOUD_LOG_FREE(g_deflate_buf);
+    g_deflate_buf = NULL;
+#endif
+
+    vSemaphoreDelete(g_batch_lock);
+    g_batch_lock = NULL;
+
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_qcloud_log_iothub_write(const char *data, size_t size, esp_log_level_t log_level, const struct tm *log_time)
+{
+    ESP_QCLOUD_PARAM_CHECK(data);
+    ESP_QCLOUD_PARAM_CHECK(size);
+
+    if (!esp_qcloud_iothub_is_connected()) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /**
+     * @brief Only called from the log send task, the batches are allocated on
+     *        first use. Not retried after a failure, its warning would be
+     *        written here again.
+     */
+    if (!g_upload_task) {
+        if (g_upload_init_err == ESP_OK) {
+            g_upload_init_err = esp_qcloud_log_iothub_init();
+        }
+
+        if (g_upload_init_err != ESP_OK) {
+            return g_upload_init_err;
+        }
+    }
+
+    const char *level_str[] = {"DIS", "ERR", "WRN", "INF", "DBG", "VRB"};
+    const size_t line_max = CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE - sizeof(esp_qcloud_log_iothub_header_t)
+                            - sizeof(esp_qcloud_log_iothub_line_t);
+    size = MIN(size, line_max);
+    size_t line_size = sizeof(esp_qcloud_log_iothub_line_t) + size;
+    bool notify = false;
+
+    xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+
+    esp_qcloud_log_batch_t *batch = &g_log_batch[g_batch_active];
+
+    if (batch->size + line_size > CONFIG_QCLOUD_LOG_UPLOAD_BATCH_SIZE) {
+        /**< Logging never waits for the network, the line is dropped if both batches are busy */
+        if (!esp_qcloud_log_batch_swap()) {
+            g_upload_stats.dropped++;
+            xSemaphoreGive(g_batch_lock);
+            return ESP_ERR_NO_MEM;
+        }
+
+        batch  = &g_log_batch[g_batch_active];
+        notify = true;
+    }
+
+    if (!batch->lines) {
+        esp_qcloud_log_iothub_header_t *header = (esp_qcloud_log_iothub_header_t *)batch->data;
+        char timestamp[11] = {0};
+
+        memset(header, '#', sizeof(esp_qcloud_log_iothub_header_t));
+        header->ctrl_bytes[0] = 'P';
+        memcpy(header->product_id, esp_qcloud_get_product_id(), strlen(esp_qcloud_get_product_id()));
+        memcpy(header->device_name, esp_qcloud_get_device_name(), strlen(esp_qcloud_get_device_name()));
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+        sprintf(timestamp, "%010llu", mktime((struct tm *)log_time));
+#else
+        sprintf(timestamp, "%010lu", mktime((struct tm *)log_time));
+#endif
+        memcpy(header->timestamp, timestamp, sizeof(header->timestamp));
+
+        batch->size       = sizeof(esp_qcloud_log_iothub_header_t);
+        batch->first_tick = xTaskGetTickCount();
+        notify = true;  /**< Starts the wait for the upload interval */
+    }
+
+    esp_qcloud_log_iothub_line_t *line = (esp_qcloud_log_iothub_line_t *)(batch->data + batch->size);
+    char log_time_str[22] = {0};
+
+    memcpy(line->log_level, level_str[MIN(log_level, ESP_LOG_VERBOSE)], sizeof(line->log_level));
+    strftime(log_time_str, sizeof(log_time_str), "|%F %T|", log_time);
+    memcpy(line->log_time, log_time_str, sizeof(line->log_time));
+    memcpy(line->data, data, size);
+
+    batch->size += line_size;
+    batch->lines++;
+
+    xSemaphoreGive(g_batch_lock);
+
+    if (notify) {
+        xTaskNotifyGive(g_upload_task);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_log_iothub_get_stats(esp_qcloud_log_iothub_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
+
+    if (!g_batch_lock) {
+        memset(stats, 0, sizeof(esp_qcloud_log_iothub_stats_t));
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+    *stats = g_upload_stats;
+    stats->latency_avg_ms = g_upload_stats.requests ? g_latency_sum_ms / g_upload_stats.requests : 0;
+    xSemaphoreGive(g_batch_lock);
+
+    return ESP_OK;
 }
@@ -0,0 +1,155 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/param.h>
+
+#include "esp_qcloud_log_lz.h"
+
+#define LZ_MATCH_MIN        (3)
+#define LZ_MATCH_SHORT_MAX  (LZ_MATCH_MIN + 14)     /**< Length field 0 - 14 */
+#define LZ_MATCH_MAX        (LZ_MATCH_SHORT_MAX + 1 + 255)
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t value = p[0] | p[1] << 8 | p[2] << 16;
+    return (value * 2654435761U) >> (32 - QCLOUD_LOG_LZ_HASH_BITS);
+}
+
+size_t esp_qcloud_log_lz_compress(esp_qcloud_log_lz_t *lz, const uint8_t *src, size_t src_size,
+                                  uint8_t *dst, size_t dst_size)
+{
+    size_t out  = 0;
+    size_t flag = 0;    /**< Position of the current flag byte */
+    int item    = 8;    /**< Items under the current flag byte */
+
+    if (src_size > QCLOUD_LOG_LZ_WINDOW_SIZE) {
+        return 0;
+    }
+
+    memset(lz->hash, 0, sizeof(lz->hash));
+
+    for (size_t pos = 0; pos < src_size;) {
+        size_t match_size = 0;
+        size_t match_pos  = 0;
+
+        if (item == 8) {
+            if (out + 1 > dst_size) {
+                return 0;
+            }
+
+            flag      = out++;
+            dst[flag] = 0;
+            item      = 0;
+        }
+
+        if (pos + LZ_MATCH_MIN <= src_size) {
+            uint32_t hash = lz_hash(src + pos);
+
+            if (lz->hash[hash]) {
+                match_pos = lz->hash[hash] - 1;
+
+                for (size_t max = MIN(src_size - pos, LZ_MATCH_MAX);
+                        match_size < max && src[match_pos + match_size] == src[pos + match_size]; ++match_size) {
+                }
+            }
+
+            lz->hash[hash] = pos + 1;
+        }
+
+        if (match_size < LZ_MATCH_MIN) {
+            if (out + 1 > dst_size) {
+                return 0;
+            }
+
+            dst[out++] = src[pos++];
+        } else {
+            size_t offset = pos - match_pos - 1;
+
+            if (out + 3 > dst_size) {
+                return 0;
+            }
+
+            dst[flag] |= 1 << item;
+            dst[out++] = offset & 0xff;
+
+            if (match_size <= LZ_MATCH_SHORT_MAX) {
+                dst[out++] = (offset >> 8) << 4 | (match_size - LZ_MATCH_MIN);
+            } else {
+                dst[out++] = (offset >> 8) << 4 | 0x0f;
+                dst[out++] = match_size - LZ_MATCH_SHORT_MAX - 1;
+            }
+
+            /**< The positions inside the match are found by the next lines */
+            for (size_t end = pos + match_size, i = pos + 1; i < end && i + LZ_MATCH_MIN <= src_size; ++i) {
+                lz->hash[lz_hash(src + i)] = i + 1;
+            }
+
+            pos += match_size;
+        }
+
+        ++item;
+    }
+
+    return out;
+}
+
+size_t esp_qcloud_log_lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+    size_t out = 0;
+
+    for (size_t pos = 0; pos < src_size;) {
+        uint8_t flag = src[pos++];
+
+        for (int item = 0; item < 8 && pos < src_size; ++item) {
+            if (!(flag & (1 << item))) {
+                if (out >= dst_size) {
+                    return 0;
+                }
+
+                dst[out++] = src[pos++];
+                continue;
+            }
+
+            if (pos + 2 > src_size) {
+                return 0;
+            }
+
+            size_t offset = (src[pos] | (src[pos + 1] >> 4) << 8) + 1;
+            size_t size   = (src[pos + 1] & 0x0f) + LZ_MATCH_MIN;
+            pos += 2;
+
+            if (size == LZ_MATCH_SHORT_MAX + 1) {
+                if (pos >= src_size) {
+                    return 0;
+                }
+
+                size += src[pos++];
+            }
+
+            if (offset > out || out + size > dst_size) {
+                return 0;
+            }
+
+            /**< Byte by byte, a match may overlap what it copies */
+            for (size_t i = 0; i < size; ++i, ++out) {
+                dst[out] = dst[out - offset];
+            }
+        }
+    }
+
+    return out;
+}
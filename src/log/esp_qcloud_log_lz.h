@@ -0,0 +1,67 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define QCLOUD_LOG_LZ_WINDOW_SIZE   (4096)  /**< Largest block, matches are searched in the whole block */
+#define QCLOUD_LOG_LZ_HASH_BITS     (9)
+
+/**
+ * @brief State of the compressor, the only memory it uses.
+ *
+ * @note The format is byte aligned LZSS: a flag byte, LSB first, tells
+ *       whether each of the next 8 items is a literal byte or a match of
+ *       2 bytes, `offset - 1` in 12 bits and `length - 3` in 4 bits. A length
+ *       field of 15 is followed by a byte, the length is 18 plus that byte.
+ *       tools/log_decoder/log_decoder.py reads the same format.
+ */
+typedef struct {
+    uint16_t hash[1 << QCLOUD_LOG_LZ_HASH_BITS];    /**< Last position + 1 of each hash of 3 bytes */
+} esp_qcloud_log_lz_t;
+
+/**
+ * @brief Compress a block.
+ *
+ * @param[in]  lz       State of the compressor.
+ * @param[in]  src      Block, up to QCLOUD_LOG_LZ_WINDOW_SIZE bytes.
+ * @param[in]  src_size Size of the block.
+ * @param[out] dst      Compressed block.
+ * @param[in]  dst_size Size of `dst`.
+ * @return Size of the compressed block, 0 if it does not fit in `dst`
+ */
+size_t esp_qcloud_log_lz_compress(esp_qcloud_log_lz_t *lz, const uint8_t *src, size_t src_size,
+                                  uint8_t *dst, size_t dst_size);
+
+/**
+ * @brief Decompress a block.
+ *
+ * @param[in]  src      Compressed block.
+ * @param[in]  src_size Size of the compressed block.
+ * @param[out] dst      Block.
+ * @param[in]  dst_size Size of `dst`.
+ * @return Size of the block, 0 if the compressed block is malformed or does not fit in `dst`
+ */
+size_t esp_qcloud_log_lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
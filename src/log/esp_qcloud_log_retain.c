@@ -0,0 +1,312 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "esp_rom_crc.h"
+#include "esp_qcloud_log.h"
+#include "esp_qcloud_log_retain.h"
+#include "esp_qcloud_log_binary.h"
+
+#ifdef CONFIG_QCLOUD_LOG_RETAIN
+
+#define LOG_RETAIN_MAGIC            (0x32544552)    /**< "RET2", "RETN" before the image */
+#define LOG_RETAIN_RECORD_MAGIC     (0x5452)
+#define LOG_RETAIN_ALIGN            (4)
+#define LOG_RETAIN_DATA_MAX         (CONFIG_QCLOUD_LOG_RETAIN_SIZE / 4)   /**< Longer lines are cut */
+
+/**
+ * @brief Written in turn to the two copies, a reset while one is written
+ *        leaves the other one valid.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t size;              /**< CONFIG_QCLOUD_LOG_RETAIN_SIZE, the ring is dropped when it changes */
+    uint32_t generation;        /**< The valid copy of the largest one is used */
+    int32_t time_offset;        /**< Unix time at boot, as the log task works it out */
+    uint32_t flashed_seq;       /**< The records before it are in the flash */
+    uint8_t image[QCLOUD_LOG_BINARY_IMAGE_SIZE];    /**< esp_qcloud_log_binary_image() of the firmware that wrote it */
+    uint32_t crc;
+} log_retain_header_t;
+
+/**
+ * @brief The ring is not read while it is written, a record is found by its
+ *        magic and CRC and put in order by its `seq` at the next boot.
+ */
+typedef struct {
+    uint16_t magic;             /**< LOG_RETAIN_RECORD_MAGIC */
+    uint16_t size;              /**< Size of the data */
+    uint32_t seq;               /**< `seq` of the ring record */
+    uint32_t timestamp;         /**< esp_log_timestamp() when written, ms since boot */
+    uint8_t level : 3;
+    uint8_t binary : 1;
+    uint8_t sinks : 4;
+    uint8_t reserved[3];
+    uint32_t crc;               /**< Of the header up to `crc` and of the data */
+    char data[];
+} log_retain_record_t;
+
+typedef struct {
+    log_retain_header_t header[2];
+    uint8_t buf[CONFIG_QCLOUD_LOG_RETAIN_SIZE];
+} log_retain_t;
+
+static const char *TAG = "esp_qcloud_log_retain";
+
+/**< Not cleared at boot, RTC memory keeps it over a panic, a watchdog and esp_restart() */
+static RTC_NOINIT_ATTR log_retain_t g_retain;
+
+static uint32_t g_retain_head       = 0;
+static portMUX_TYPE g_retain_lock   = portMUX_INITIALIZER_UNLOCKED;
+static log_retain_header_t g_retain_header;     /**< Last header written */
+
+static char *g_kept                 = NULL;     /**< Copy of the ring of the last boot */
+static uint16_t *g_kept_offset      = NULL;     /**< Its records by `seq` */
+static size_t g_kept_num            = 0;
+static log_retain_header_t g_kept_header;
+
+static inline uint32_t log_retain_span(size_t size)
+{
+    return (sizeof(log_retain_record_t) + size + LOG_RETAIN_ALIGN - 1) & ~(LOG_RETAIN_ALIGN - 1);
+}
+
+static uint32_t log_retain_record_crc(const log_retain_record_t *record)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(log_retain_record_t, crc));
+    return esp_rom_crc32_le(crc, (const uint8_t *)record->data, record->size);
+}
+
+/**
+ * @brief Called in the critical section after the init, the log task and the
+ *        shutdown handler both write it.
+ */
+static void log_retain_header_write(void)
+{
+    g_retain_header.generation++;
+    g_retain_header.crc = esp_rom_crc32_le(0, (uint8_t *)&g_retain_header, offsetof(log_retain_header_t, crc));
+    g_retain.header[g_retain_header.generation & 1] = g_retain_header;
+}
+
+static const log_retain_header_t *log_retain_header_valid(void)
+{
+    const log_retain_header_t *valid = NULL;
+
+    for (int i = 0; i < 2; ++i) {
+        const log_retain_header_t *header = &g_retain.header[i];
+
+        if (header->magic != LOG_RETAIN_MAGIC || header->size != CONFIG_QCLOUD_LOG_RETAIN_SIZE
+                || esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(log_retain_header_t, crc)) != header->crc) {
+            continue;
+        }
+
+        if (!valid || (int32_t)(header->generation - valid->generation) > 0) {
+            valid = header;
+        }
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Copy the valid records to the heap, in the order they were written
+ */
+static esp_err_t log_retain_load(const log_retain_header_t *header)
+{
+    g_kept        = ESP_QCLOUD_LOG_MALLOC(sizeof(g_retain.buf));
+    g_kept_offset = ESP_QCLOUD_LOG_MALLOC(sizeof(g_retain.buf) / sizeof(log_retain_record_t) * sizeof(uint16_t));
+
+    if (!g_kept || !g_kept_offset) {
+        esp_qcloud_log_retain_free();
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(g_kept, g_retain.buf, sizeof(g_retain.buf));
+    g_kept_header = *header;
+
+    /**< Binary records keep the address of their format in the firmware that wrote them */
+    bool foreign    = memcmp(header->image, esp_qcloud_log_binary_image(), sizeof(header->image)) != 0;
+    size_t dropped  = 0;
+
+    for (uint32_t offset = 0; offset + sizeof(log_retain_record_t) <= sizeof(g_retain.buf);) {
+        const log_retain_record_t *record = (log_retain_record_t *)(g_kept + offset);
+
+        /**< Cut or overwritten records fail their CRC, the scan goes on word by word */
+        if (record->magic != LOG_RETAIN_RECORD_MAGIC || record->size > LOG_RETAIN_DATA_MAX
+                || offset + sizeof(log_retain_record_t) + record->size > sizeof(g_retain.buf)
+                || log_retain_record_crc(record) != record->crc) {
+            offset += LOG_RETAIN_ALIGN;
+            continue;
+        }
+
+        if (foreign && record->binary) {
+            dropped++;
+            offset += log_retain_span(record->size);
+            continue;
+        }
+
+        /**< The records before the last wrap are found after the newer ones */
+        size_t i = g_kept_num++;
+
+        for (; i > 0 && (int32_t)(((log_retain_record_t *)(g_kept + g_kept_offset[i - 1]))->seq - record->seq) > 0; --i) {
+            g_kept_offset[i] = g_kept_offset[i - 1];
+        }
+
+        g_kept_offset[i] = offset;
+        offset += log_retain_span(record->size);
+    }
+
+    if (dropped) {
+        ESP_LOGW(TAG, "Drop the binary records of another firmware, num: %d", dropped);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_log_retain_init(size_t *num)
+{
+    ESP_QCLOUD_PARAM_CHECK(num);
+
+    esp_err_t err = ESP_OK;
+    const log_retain_header_t *header = log_retain_header_valid();
+
+    esp_qcloud_log_retain_free();
+
+    /**< The memory is random after a power on and fails the checks */
+    if (header) {
+        err = log_retain_load(header);
+    }
+
+    *num = g_kept_num;
+
+    memset(&g_retain, 0, sizeof(g_retain));
+    memset(&g_retain_header, 0, sizeof(g_retain_header));
+    g_retain_header.magic = LOG_RETAIN_MAGIC;
+    g_retain_header.size  = CONFIG_QCLOUD_LOG_RETAIN_SIZE;
+    memcpy(g_retain_header.image, esp_qcloud_log_binary_image(), sizeof(g_retain_header.image));
+    log_retain_header_write();
+    g_retain_head = 0;
+
+    return err;
+}
+
+esp_err_t esp_qcloud_log_retain_get(size_t index, esp_qcloud_log_retained_t *record)
+{
+    ESP_QCLOUD_PARAM_CHECK(record);
+
+    if (index >= g_kept_num) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    log_retain_record_t *kept = (log_retain_record_t *)(g_kept + g_kept_offset[index]);
+
+    record->time    = g_kept_header.time_offset + kept->timestamp / 1000;
+    record->size    = kept->size;
+    record->level   = kept->level;
+    record->binary  = kept->binary;
+    record->sinks   = kept->sinks;
+    record->flashed = (int32_t)(kept->seq - g_kept_header.flashed_seq) < 0;
+    record->data    = kept->data;
+
+    /**< The time of a binary record is set when it is consumed, it was not */
+    if (kept->binary && kept->size >= sizeof(esp_qcloud_log_binary_t)) {
+        ((esp_qcloud_log_binary_t *)kept->data)->time = record->time;
+    }
+
+    return ESP_OK;
+}
+
+void esp_qcloud_log_retain_free(void)
+{
+    ESP_QCLOUD_LOG_FREE(g_kept);
+    ESP_QCLOUD_LOG_FREE(g_kept_offset);
+    g_kept        = NULL;
+    g_kept_offset = NULL;
+    g_kept_num    = 0;
+}
+
+void esp_qcloud_log_retain_write(const esp_qcloud_log_record_t *record)
+{
+    /**< A binary record takes the byte of the '\0' of a text */
+    size_t size = record->binary ? record->size + 1 : record->size;
+
+    if (size > LOG_RETAIN_DATA_MAX) {
+        if (record->binary) {
+            return;
+        }
+
+        size = LOG_RETAIN_DATA_MAX;
+    }
+
+    uint32_t span = log_retain_span(size);
+
+    portENTER_CRITICAL_SAFE(&g_retain_lock);
+
+    /**< A record is never split, the older records left at the end are still read */
+    if (g_retain_head + span > sizeof(g_retain.buf)) {
+        g_retain_head = 0;
+    }
+
+    log_retain_record_t *retained = (log_retain_record_t *)(g_retain.buf + g_retain_head);
+    g_retain_head += span;
+
+    portEXIT_CRITICAL_SAFE(&g_retain_lock);
+
+    /**< A reset before the CRC is written drops this record only */
+    retained->magic     = LOG_RETAIN_RECORD_MAGIC;
+    retained->size      = size;
+    retained->seq       = record->seq;
+    retained->timestamp = record->timestamp;
+    retained->level     = record->level;
+    retained->binary    = record->binary;
+    retained->sinks     = record->sinks;
+    memset(retained->reserved, 0, sizeof(retained->reserved));
+    memcpy(retained->data, record->data, size);
+    retained->crc = log_retain_record_crc(retained);
+}
+
+void esp_qcloud_log_retain_set_time(uint32_t timestamp, time_t now)
+{
+    int32_t time_offset = now - timestamp / 1000;
+
+    /**< Both times are rounded down, a change of one second is not one */
+    portENTER_CRITICAL_SAFE(&g_retain_lock);
+
+    if (abs(time_offset - g_retain_header.time_offset) > 1) {
+        g_retain_header.time_offset = time_offset;
+        log_retain_header_write();
+    }
+
+    portEXIT_CRITICAL_SAFE(&g_retain_lock);
+}
+
+void esp_qcloud_log_retain_set_flashed(uint32_t seq)
+{
+    portENTER_CRITICAL_SAFE(&g_retain_lock);
+
+    if (seq != g_retain_header.flashed_seq) {
+        g_retain_header.flashed_seq = seq;
+        log_retain_header_write();
+    }
+
+    portEXIT_CRITICAL_SAFE(&g_retain_lock);
+}
+
+#endif /**< CONFIG_QCLOUD_LOG_RETAIN */
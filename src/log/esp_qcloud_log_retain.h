@@ -0,0 +1,99 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_qcloud_log_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief A record kept over the last reset.
+ */
+typedef struct {
+    uint32_t time;              /**< Unix time, worked out as the log task did before the reset */
+    uint16_t size;              /**< Size of the data */
+    uint8_t level : 3;          /**< esp_log_level_t */
+    uint8_t binary : 1;         /**< The data is an esp_qcloud_log_binary_t with its time set */
+    uint8_t sinks : 4;          /**< esp_qcloud_log_sink_t of the record */
+    bool flashed;               /**< Written to the flash before the reset */
+    char *data;
+} esp_qcloud_log_retained_t;
+
+/**
+ * @brief Take the records kept in RTC memory over the last reset and start a new ring.
+ *
+ * @note Records are checked one by one with their CRC, the one being written
+ *       when the chip was reset is dropped. Called before the first record.
+ *
+ * @param[out] num Number of records kept.
+ * @return
+ *     - ESP_OK: succeed, `num` may be 0
+ *     - ESP_ERR_NO_MEM: out of memory, the records are lost
+ */
+esp_err_t esp_qcloud_log_retain_init(size_t *num);
+
+/**
+ * @brief Get a record kept over the last reset, from the oldest one.
+ *
+ * @param[in]  index  Index of the record.
+ * @param[out] record Record, valid until esp_qcloud_log_retain_free().
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: no more records
+ */
+esp_err_t esp_qcloud_log_retain_get(size_t index, esp_qcloud_log_retained_t *record);
+
+/**
+ * @brief Free the records kept over the last reset.
+ */
+void esp_qcloud_log_retain_free(void);
+
+/**
+ * @brief Copy a record of the log ring to the ring in RTC memory.
+ *
+ * @note Only the position is taken in a critical section. Can be called from an ISR.
+ *
+ * @param[in] record Record, its sinks are set. Its `seq` orders the copies.
+ */
+void esp_qcloud_log_retain_write(const esp_qcloud_log_record_t *record);
+
+/**
+ * @brief Keep the calendar time of the records, only called by the log task.
+ *
+ * @param[in] timestamp esp_log_timestamp() of a record.
+ * @param[in] now       Unix time of this record.
+ */
+void esp_qcloud_log_retain_set_time(uint32_t timestamp, time_t now);
+
+/**
+ * @brief Mark the records before `seq` as written to the flash, called by the log task
+ *        and by the shutdown handler of the flash log.
+ *
+ * @param[in] seq `seq` of the oldest ring record that may not be in the flash yet.
+ */
+void esp_qcloud_log_retain_set_flashed(uint32_t seq);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -0,0 +1,242 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <string.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include "esp_qcloud_log.h"
+#include "esp_qcloud_log_ring.h"
+
+#define LOG_RING_ALIGN          (8)     /**< Records start aligned, a header always fits before the end */
+#define LOG_RECORD_COMMITTED    (0x5a)
+#define LOG_RECORD_PADDING      (0xa5)  /**< The rest of the ring is skipped, a record did not fit there */
+
+/**
+ * @brief `head` and `tail` run freely and wrap at 2^32, the offset in the ring
+ *        is the position masked by the size. Producers move `head` in the
+ *        critical section, the single consumer moves `tail` without a lock.
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t mask;
+    uint32_t head;
+    volatile uint32_t tail;
+    uint32_t used_peak;
+    uint32_t written;
+    uint32_t dropped;
+    portMUX_TYPE lock;
+} esp_qcloud_log_ring_t;
+
+static esp_qcloud_log_ring_t g_log_ring[portNUM_PROCESSORS];
+static uint32_t g_log_ring_seq = 0;     /**< Taken in the critical section of a ring, so it grows along each ring */
+
+/**
+ * @brief Bytes taken by a record, the text is followed by '\0'.
+ */
+static inline uint32_t esp_qcloud_log_record_span(size_t size)
+{
+    return (sizeof(esp_qcloud_log_record_t) + size + 1 + LOG_RING_ALIGN - 1) & ~(LOG_RING_ALIGN - 1);
+}
+
+esp_err_t esp_qcloud_log_ring_init(size_t size)
+{
+    size_t ring_size = LOG_RING_ALIGN;
+
+    while (ring_size * 2 <= size) {
+        ring_size *= 2;
+    }
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_qcloud_log_ring_t *ring = &g_log_ring[i];
+
+        memset(ring, 0, sizeof(esp_qcloud_log_ring_t));
+        ring->buf  = ESP_QCLOUD_LOG_MALLOC(ring_size);
+        ring->mask = ring_size - 1;
+        portMUX_INITIALIZE(&ring->lock);
+
+        if (!ring->buf) {
+            esp_qcloud_log_ring_deinit();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+void esp_qcloud_log_ring_deinit(void)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        ESP_QCLOUD_LOG_FREE(g_log_ring[i].buf);
+        g_log_ring[i].buf = NULL;
+    }
+}
+
+esp_qcloud_log_record_t *esp_qcloud_log_ring_reserve(size_t size, uint8_t level)
+{
+    esp_qcloud_log_ring_t *ring = &g_log_ring[xPortGetCoreID()];
+    esp_qcloud_log_record_t *record = NULL;
+    uint32_t span = esp_qcloud_log_record_span(size);
+
+    if (!ring->buf || size > UINT16_MAX) {
+        return NULL;
+    }
+
+    portENTER_CRITICAL_SAFE(&ring->lock);
+
+    uint32_t offset     = ring->head & ring->mask;
+    uint32_t contiguous = ring->mask + 1 - offset;
+    uint32_t need       = contiguous < span ? contiguous + span : span;
+    uint32_t used       = ring->head - ring->tail;
+
+    if (used + need > ring->mask + 1) {
+        ring->dropped++;
+    } else {
+        /**< A record is never split, the end of the ring is skipped instead */
+        if (contiguous < span) {
+            esp_qcloud_log_record_t *padding = (esp_qcloud_log_record_t *)(ring->buf + offset);
+            padding->state = LOG_RECORD_PADDING;
+            offset = 0;
+        }
+
+        record = (esp_qcloud_log_record_t *)(ring->buf + offset);
+        record->timestamp = esp_log_timestamp();
+        record->size      = size;
+        record->level     = level;
+        record->binary    = false;
+        record->sinks     = 0;
+        record->state     = 0;
+        record->seq       = __sync_fetch_and_add(&g_log_ring_seq, 1);
+
+        ring->head     += need;
+        ring->written++;
+        ring->used_peak = MAX(ring->used_peak, used + need);
+    }
+
+    portEXIT_CRITICAL_SAFE(&ring->lock);
+
+    return record;
+}
+
+void esp_qcloud_log_ring_commit(esp_qcloud_log_record_t *record)
+{
+    /**< The text must be visible before the state on the other core */
+    __sync_synchronize();
+    record->state = LOG_RECORD_COMMITTED;
+}
+
+/**
+ * @brief Skip the padding at the tail, return the record there if committed.
+ */
+static esp_qcloud_log_record_t *esp_qcloud_log_ring_front(esp_qcloud_log_ring_t *ring)
+{
+    while (ring->buf && ring->tail != ring->head) {
+        esp_qcloud_log_record_t *record = (esp_qcloud_log_record_t *)(ring->buf + (ring->tail & ring->mask));
+
+        if (record->state == LOG_RECORD_PADDING) {
+            ring->tail += ring->mask + 1 - (ring->tail & ring->mask);
+            continue;
+        }
+
+        /**< Records after one still being written wait for it, to keep the order */
+        if (record->state != LOG_RECORD_COMMITTED) {
+            return NULL;
+        }
+
+        __sync_synchronize();
+        return record;
+    }
+
+    return NULL;
+}
+
+esp_qcloud_log_record_t *esp_qcloud_log_ring_peek(void)
+{
+    esp_qcloud_log_record_t *oldest = NULL;
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_qcloud_log_record_t *record = esp_qcloud_log_ring_front(&g_log_ring[i]);
+
+        if (record && (!oldest || (int32_t)(record->timestamp - oldest->timestamp) < 0)) {
+            oldest = record;
+        }
+    }
+
+    return oldest;
+}
+
+void esp_qcloud_log_ring_release(esp_qcloud_log_record_t *record)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_qcloud_log_ring_t *ring = &g_log_ring[i];
+
+        if ((uint8_t *)record >= ring->buf && (uint8_t *)record <= ring->buf + ring->mask) {
+            record->state = 0;
+            __sync_synchronize();
+            ring->tail += esp_qcloud_log_record_span(record->size);
+            return;
+        }
+    }
+}
+
+uint32_t esp_qcloud_log_ring_pending_seq(void)
+{
+    /**< Read first, a record reserved after it has a larger `seq` */
+    uint32_t pending = __sync_fetch_and_add(&g_log_ring_seq, 0);
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_qcloud_log_ring_t *ring = &g_log_ring[i];
+
+        portENTER_CRITICAL_SAFE(&ring->lock);
+
+        uint32_t tail = ring->tail;
+
+        while (ring->buf && tail != ring->head) {
+            esp_qcloud_log_record_t *record = (esp_qcloud_log_record_t *)(ring->buf + (tail & ring->mask));
+
+            if (record->state == LOG_RECORD_PADDING) {
+                tail += ring->mask + 1 - (tail & ring->mask);
+                continue;
+            }
+
+            if ((int32_t)(record->seq - pending) < 0) {
+                pending = record->seq;
+            }
+
+            break;
+        }
+
+        portEXIT_CRITICAL_SAFE(&ring->lock);
+    }
+
+    return pending;
+}
+
+void esp_qcloud_log_ring_get_stats(esp_qcloud_log_ring_stats_t *stats)
+{
+    memset(stats, 0, sizeof(esp_qcloud_log_ring_stats_t));
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_qcloud_log_ring_t *ring = &g_log_ring[i];
+
+        stats->size     += ring->buf ? ring->mask + 1 : 0;
+        stats->used_peak = MAX(stats->used_peak, ring->used_peak);
+        stats->written  += ring->written;
+        stats->dropped  += ring->dropped;
+    }
+}
@@ -0,0 +1,128 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Sinks served by the log task.
+ */
+typedef enum {
+    QCLOUD_LOG_SINK_FLASH  = 1 << 0,
+    QCLOUD_LOG_SINK_IOTHUB = 1 << 1,
+    QCLOUD_LOG_SINK_LOCAL  = 1 << 2,
+} esp_qcloud_log_sink_t;
+
+/**
+ * @brief Header of a log record, the text follows it in the ring.
+ */
+typedef struct {
+    uint32_t timestamp;         /**< esp_log_timestamp() when written, ms since boot */
+    uint16_t size;              /**< Size of the text */
+    uint8_t level : 3;          /**< esp_log_level_t */
+    uint8_t binary : 1;         /**< The data is an esp_qcloud_log_binary_t, not text */
+    uint8_t sinks : 4;          /**< esp_qcloud_log_sink_t the record goes to, chosen when written */
+    volatile uint8_t state;     /**< Set last by esp_qcloud_log_ring_commit() */
+    uint32_t seq;               /**< Order of reservation over all the rings */
+    char data[];
+} esp_qcloud_log_record_t;
+
+/**
+ * @brief Counters of the log rings.
+ */
+typedef struct {
+    uint32_t size;              /**< Size of the rings of all the cores */
+    uint32_t used_peak;         /**< Most bytes used at once in a ring */
+    uint32_t written;           /**< Records written */
+    uint32_t dropped;           /**< Records dropped as the ring was full */
+} esp_qcloud_log_ring_stats_t;
+
+/**
+ * @brief Allocate one ring per core.
+ *
+ * @param[in] size Size of each ring, rounded down to a power of 2.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NO_MEM: out of memory
+ */
+esp_err_t esp_qcloud_log_ring_init(size_t size);
+
+/**
+ * @brief Free the rings, the records not consumed are lost.
+ */
+void esp_qcloud_log_ring_deinit(void);
+
+/**
+ * @brief Reserve a record in the ring of the current core.
+ *
+ * @note Only the reservation is done in a critical section, the caller then
+ *       writes the text and its '\0' in place and calls esp_qcloud_log_ring_commit().
+ *       Can be called from an ISR.
+ *
+ * @param[in] size  Size of the text.
+ * @param[in] level Level of the record.
+ * @return The record, NULL if the ring is full, counted as dropped
+ */
+esp_qcloud_log_record_t *esp_qcloud_log_ring_reserve(size_t size, uint8_t level);
+
+/**
+ * @brief Make a reserved record visible to the consumer.
+ *
+ * @param[in] record Record returned by esp_qcloud_log_ring_reserve().
+ */
+void esp_qcloud_log_ring_commit(esp_qcloud_log_record_t *record);
+
+/**
+ * @brief Get the oldest committed record of all the rings, only called by the consumer.
+ *
+ * @return The record, NULL if none
+ */
+esp_qcloud_log_record_t *esp_qcloud_log_ring_peek(void);
+
+/**
+ * @brief Free the record returned by esp_qcloud_log_ring_peek().
+ *
+ * @param[in] record Record to free.
+ */
+void esp_qcloud_log_ring_release(esp_qcloud_log_record_t *record);
+
+/**
+ * @brief Get the `seq` of the oldest record not released yet, reserved or
+ *        committed, only called by the consumer.
+ *
+ * @note The records with a smaller `seq` have all been released.
+ *
+ * @return The `seq`, that of the next record to reserve if the rings are empty
+ */
+uint32_t esp_qcloud_log_ring_pending_seq(void);
+
+/**
+ * @brief Get the counters of the rings.
+ *
+ * @param[out] stats Counters.
+ */
+void esp_qcloud_log_ring_get_stats(esp_qcloud_log_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -14,90 +14,285 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <mqtt_client.h>
 
 #include <esp_qcloud_mqtt.h>
+#include "esp_qcloud_backoff.h"
+#include "esp_qcloud_mqtt_queue.h"
+#include "esp_qcloud_mqtt_sub.h"
 
 static const char *TAG = "esp_qcloud_mqtt";
 
-#define MAX_MQTT_SUBSCRIPTIONS      6
-
+#define MAX_MQTT_STATE_CALLBACKS    4
+#define MAX_MQTT_TOPIC_LEN          256 /**< Longest topic passed to the subscribe callbacks */
+#define MAX_MQTT_SUBSCRIBE_HITS     8   /**< Most filters a message is dispatched to */
+#define MAX_MQTT_SUBSCRIBE_BATCH    16  /**< Most filters in one SUBSCRIBE packet */
+#define MAX_MQTT_SUBSCRIBE_BYTES    768 /**< Most bytes of filters in one SUBSCRIBE packet, below the esp-mqtt buffer */
+#define MQTT_READY_TIMEOUT_MS       10000
+
+/**
+ * @brief Pending filters copied out of the table, so that the SUBSCRIBE is
+ *        sent without holding the lock of the table.
+ */
 typedef struct {
-    char *topic;
-    esp_qcloud_mqtt_subscribe_cb_t cb;
-    void *priv;
-} esp_qcloud_mqtt_subscription_t;
+    char topic[MAX_MQTT_SUBSCRIBE_BYTES];   /**< NULL separated filters */
+    size_t len;
+    int num;
+    int left;                               /**< Pending filters that did not fit */
+} esp_qcloud_mqtt_subscribe_batch_t;
 
 typedef struct {
     esp_mqtt_client_handle_t mqtt_client;
     esp_qcloud_mqtt_config_t *config;
-    esp_qcloud_mqtt_subscription_t *subscriptions[MAX_MQTT_SUBSCRIPTIONS];
+    esp_timer_handle_t reconnect_timer;
+    esp_qcloud_backoff_t reconnect_backoff;
+    bool started;
+    SemaphoreHandle_t subscriptions_lock;
+    esp_qcloud_mqtt_sub_table_t subscriptions;
 } esp_qcloud_mqtt_data_t;
 esp_qcloud_mqtt_data_t *mqtt_data;
 
 const int MQTT_CONNECTED_EVENT = BIT1;
+const int MQTT_READY_EVENT     = BIT2;
 static EventGroupHandle_t mqtt_event_group;
+static bool mqtt_connected = false;
 
-static void esp_qcloud_mqtt_subscribe_callback(const char *topic, int topic_len, const char *data, int data_len)
+/**< Guarded by subscriptions_lock */
+static bool mqtt_ready = false;
+static int mqtt_subscribe_outstanding = 0;
+static TickType_t mqtt_connect_tick = 0;
+static esp_qcloud_mqtt_connect_stats_t mqtt_connect_stats = {0};
+static esp_qcloud_mqtt_state_cb_t mqtt_state_cbs[MAX_MQTT_STATE_CALLBACKS];
+
+static void esp_qcloud_mqtt_notify_state(esp_qcloud_mqtt_state_t state, uint32_t backoff_ms)
 {
-    esp_qcloud_mqtt_subscription_t **subscriptions = mqtt_data->subscriptions;
-    int i;
-
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if (strncmp(topic, subscriptions[i]->topic, topic_len) == 0) {
-                subscriptions[i]->cb(subscriptions[i]->topic, (void *)data, data_len, subscriptions[i]->priv);
-            }
+    if (state == QCLOUD_MQTT_STATE_CONNECTED || state == QCLOUD_MQTT_STATE_DISCONNECTED) {
+        mqtt_connected = state == QCLOUD_MQTT_STATE_CONNECTED;
+    }
+
+    for (int i = 0; i < MAX_MQTT_STATE_CALLBACKS; i++) {
+        if (mqtt_state_cbs[i]) {
+            mqtt_state_cbs[i](state, backoff_ms);
         }
     }
 }
 
-esp_err_t esp_qcloud_mqtt_subscribe(const char *topic, esp_qcloud_mqtt_subscribe_cb_t cb, void *priv_data)
+esp_err_t esp_qcloud_mqtt_register_state_cb(esp_qcloud_mqtt_state_cb_t cb)
 {
-    if (!mqtt_data || !topic || !cb) {
+    if (!cb) {
         return ESP_FAIL;
     }
 
-    int i;
+    for (int i = 0; i < MAX_MQTT_STATE_CALLBACKS; i++) {
+        if (!mqtt_state_cbs[i] || mqtt_state_cbs[i] == cb) {
+            mqtt_state_cbs[i] = cb;
+            return ESP_OK;
+        }
+    }
 
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (!mqtt_data->subscriptions[i]) {
-            esp_qcloud_mqtt_subscription_t *subscription = calloc(1, sizeof(esp_qcloud_mqtt_subscription_t));
+    return ESP_FAIL;
+}
 
-            if (!subscription) {
-                return ESP_FAIL;
-            }
+bool esp_qcloud_mqtt_is_connected(void)
+{
+    return mqtt_connected;
+}
 
-            subscription->topic = strdup(topic);
+static void esp_qcloud_mqtt_subscribe_callback(const char *topic, int topic_len, const char *data, int data_len)
+{
+    char topic_str[MAX_MQTT_TOPIC_LEN];
+    esp_qcloud_mqtt_sub_hit_t hit[MAX_MQTT_SUBSCRIBE_HITS];
 
-            if (!subscription->topic) {
-                free(subscription);
-                return ESP_FAIL;
-            }
+    if (topic_len >= sizeof(topic_str)) {
+        ESP_LOGW(TAG, "Topic too long, len: %d, topic: %.*s", topic_len, topic_len, topic);
+        return;
+    }
 
-            int ret = esp_mqtt_client_subscribe(mqtt_data->mqtt_client, subscription->topic, 1);
+    /**
+     * @brief The callbacks are copied out and called without the lock, so that
+     *        they can subscribe or unsubscribe.
+     */
+    xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+    size_t hit_num = esp_qcloud_mqtt_sub_match(&mqtt_data->subscriptions, topic, topic_len, hit, MAX_MQTT_SUBSCRIBE_HITS);
+    xSemaphoreGive(mqtt_data->subscriptions_lock);
 
-            if (ret < 0) {
-                free(subscription->topic);
-                free(subscription);
-                return ESP_FAIL;
-            }
+    if (!hit_num) {
+        ESP_LOGW(TAG, "No subscription matches the topic: %.*s", topic_len, topic);
+        return;
+    }
 
-            subscription->priv = priv_data;
-            subscription->cb = cb;
-            mqtt_data->subscriptions[i] = subscription;
-            ESP_LOGD(TAG, "Subscribed to topic: %s", topic);
-            return ESP_OK;
+    if (hit_num > MAX_MQTT_SUBSCRIBE_HITS) {
+        ESP_LOGW(TAG, "%d subscriptions match the topic: %.*s, only the first %d are called",
+                 hit_num, topic_len, topic, MAX_MQTT_SUBSCRIBE_HITS);
+        hit_num = MAX_MQTT_SUBSCRIBE_HITS;
+    }
+
+    memcpy(topic_str, topic, topic_len);
+    topic_str[topic_len] = '\0';
+
+    for (int i = 0; i < hit_num; i++) {
+        hit[i].cb(topic_str, (void *)data, data_len, hit[i].priv);
+    }
+}
+
+static void esp_qcloud_mqtt_subscribe_batch_add(esp_qcloud_mqtt_sub_t *sub, void *arg)
+{
+    esp_qcloud_mqtt_subscribe_batch_t *batch = arg;
+
+    if (!sub->pending) {
+        return;
+    }
+
+    if (batch->num >= MAX_MQTT_SUBSCRIBE_BATCH || batch->len + sub->topic_len + 1 > sizeof(batch->topic)) {
+        batch->left++;
+        return;
+    }
+
+    memcpy(batch->topic + batch->len, sub->topic, sub->topic_len + 1);
+    batch->len += sub->topic_len + 1;
+    batch->num++;
+    sub->pending = false;
+}
+
+static void esp_qcloud_mqtt_subscribe_mark_pending(esp_qcloud_mqtt_sub_t *sub, void *arg)
+{
+    sub->pending = true;
+}
+
+/**
+ * @brief Send the batch, return the number of SUBSCRIBE packets or -1.
+ */
+static int esp_qcloud_mqtt_subscribe_batch_send(const esp_qcloud_mqtt_subscribe_batch_t *batch)
+{
+    const char *topic = batch->topic;
+
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0))
+    esp_mqtt_topic_t topic_list[MAX_MQTT_SUBSCRIBE_BATCH];
+
+    for (int i = 0; i < batch->num; i++, topic += strlen(topic) + 1) {
+        topic_list[i].filter = topic;
+        topic_list[i].qos    = 1;
+    }
+
+    return esp_mqtt_client_subscribe_multiple(mqtt_data->mqtt_client, topic_list, batch->num) < 0 ? -1 : 1;
+#else
+    /**< esp-mqtt before IDF v5.1 sends one filter per SUBSCRIBE, they are written back to back */
+    for (int i = 0; i < batch->num; i++, topic += strlen(topic) + 1) {
+        if (esp_mqtt_client_subscribe(mqtt_data->mqtt_client, topic, 1) < 0) {
+            return -1;
         }
     }
 
-    return ESP_FAIL;
+    return batch->num;
+#endif
+}
+
+static void esp_qcloud_mqtt_set_ready(void)
+{
+    uint32_t ready_ms = (xTaskGetTickCount() - mqtt_connect_tick) * portTICK_PERIOD_MS;
+
+    mqtt_connect_stats.ready_ms     = ready_ms;
+    mqtt_connect_stats.ready_max_ms = MAX(mqtt_connect_stats.ready_max_ms, ready_ms);
+    xEventGroupSetBits(mqtt_event_group, MQTT_READY_EVENT);
+
+    ESP_LOGI(TAG, "MQTT ready in %u ms", (unsigned)ready_ms);
+}
+
+/**
+ * @brief Send all the pending filters, as few SUBSCRIBE packets as possible.
+ */
+static esp_err_t esp_qcloud_mqtt_subscribe_flush(void)
+{
+    esp_qcloud_mqtt_subscribe_batch_t batch;
+
+    do {
+        batch.len  = 0;
+        batch.num  = 0;
+        batch.left = 0;
+
+        xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+        esp_qcloud_mqtt_sub_foreach(&mqtt_data->subscriptions, esp_qcloud_mqtt_subscribe_batch_add, &batch);
+        xSemaphoreGive(mqtt_data->subscriptions_lock);
+
+        if (!batch.num) {
+            break;
+        }
+
+        int packet_num = esp_qcloud_mqtt_subscribe_batch_send(&batch);
+
+        xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+
+        if (packet_num < 0) {
+            /**< Sent again on the next flush or reconnect, a repeated SUBSCRIBE is harmless */
+            esp_qcloud_mqtt_sub_foreach(&mqtt_data->subscriptions, esp_qcloud_mqtt_subscribe_mark_pending, NULL);
+            xSemaphoreGive(mqtt_data->subscriptions_lock);
+            ESP_LOGW(TAG, "Could not subscribe to %d topics", batch.num);
+            return ESP_FAIL;
+        }
+
+        mqtt_subscribe_outstanding          += packet_num;
+        mqtt_connect_stats.subscribe_packets += packet_num;
+        mqtt_connect_stats.subscribe_topics  += batch.num;
+        xSemaphoreGive(mqtt_data->subscriptions_lock);
+
+        ESP_LOGD(TAG, "Subscribed to %d topics in %d packets", batch.num, packet_num);
+    } while (batch.left);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_mqtt_get_connect_stats(esp_qcloud_mqtt_connect_stats_t *stats)
+{
+    if (!mqtt_data || !stats) {
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+    *stats = mqtt_connect_stats;
+    xSemaphoreGive(mqtt_data->subscriptions_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_mqtt_subscribe(const char *topic, esp_qcloud_mqtt_subscribe_cb_t cb, void *priv_data)
+{
+    if (!mqtt_data || !topic || !cb || strlen(topic) >= MAX_MQTT_TOPIC_LEN) {
+        return ESP_FAIL;
+    }
+
+    bool added = false;
+
+    xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+    esp_err_t err = esp_qcloud_mqtt_sub_add(&mqtt_data->subscriptions, topic, cb, priv_data, &added);
+    xSemaphoreGive(mqtt_data->subscriptions_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not add the subscription, err: %s, topic: %s", esp_err_to_name(err), topic);
+        return err;
+    }
+
+    /**< While disconnected the topic is subscribed with the others once connected */
+    if (mqtt_connected && esp_qcloud_mqtt_subscribe_flush() != ESP_OK) {
+        if (added) {
+            xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+            esp_qcloud_mqtt_sub_remove(&mqtt_data->subscriptions, topic);
+            xSemaphoreGive(mqtt_data->subscriptions_lock);
+        }
+
+        return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Subscribed to topic: %s", topic);
+    return ESP_OK;
 }
 
 esp_err_t esp_qcloud_mqtt_unsubscribe(const char *topic)
@@ -112,21 +307,11 @@ esp_err_t esp_qcloud_mqtt_unsubscribe(const char *topic)
         ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", topic);
     }
 
-    esp_qcloud_mqtt_subscription_t **subscriptions = mqtt_data->subscriptions;
-    int i;
+    xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+    esp_err_t err = esp_qcloud_mqtt_sub_remove(&mqtt_data->subscriptions, topic);
+    xSemaphoreGive(mqtt_data->subscriptions_lock);
 
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if (strncmp(topic, subscriptions[i]->topic, strlen(topic)) == 0) {
-                free(subscriptions[i]->topic);
-                free(subscriptions[i]);
-                subscriptions[i] = NULL;
-                return ESP_OK;
-            }
-        }
-    }
-
-    return ESP_FAIL;
+    return err == ESP_OK ? ESP_OK : ESP_FAIL;
 }
 
 esp_err_t esp_qcloud_mqtt_publish(const char *topic, void *data, size_t data_len)
@@ -136,39 +321,111 @@ esp_err_t esp_qcloud_mqtt_publish(const char *topic, void *data, size_t data_len
     }
 
     ESP_LOGD(TAG, "Publishing to %s", topic);
-    int ret = esp_mqtt_client_publish(mqtt_data->mqtt_client, topic, data, data_len, 1, 0);
+    esp_err_t err = esp_qcloud_mqtt_publish_async(topic, data, data_len, QCLOUD_MQTT_PRIO_REPORT, NULL, NULL);
 
-    if (ret < 0) {
+    if (err != ESP_OK) {
         ESP_LOGE(TAG, "MQTT Publish failed");
-        return ESP_FAIL;
+        return err;
     }
 
     return ESP_OK;
 }
 
 
+static void esp_qcloud_mqtt_reconnect_timer_cb(void *arg)
+{
+    if (mqtt_data->started && esp_mqtt_client_reconnect(mqtt_data->mqtt_client) != ESP_OK) {
+        ESP_LOGW(TAG, "esp_mqtt_client_reconnect failed");
+    }
+}
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
     switch (event->event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        ESP_LOGD(TAG, "MQTT_EVENT_BEFORE_CONNECT");
+        esp_qcloud_mqtt_notify_state(QCLOUD_MQTT_STATE_CONNECTING, 0);
+        break;
+
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT Connected");
 
-        /* Resubscribe to all topics after reconnection */
-        for (int i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-            if (mqtt_data->subscriptions[i]) {
-                esp_mqtt_client_subscribe(event->client, mqtt_data->subscriptions[i]->topic, 1);
-            }
+        /* Resubscribe to all topics after reconnection, in one SUBSCRIBE */
+        xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+        mqtt_connected             = true;  /**< Topics subscribed from now on are flushed by the caller */
+        mqtt_ready                 = false;
+        mqtt_subscribe_outstanding = 0;
+        mqtt_connect_tick          = xTaskGetTickCount();
+        mqtt_connect_stats.connected++;
+        esp_qcloud_backoff_connected(&mqtt_data->reconnect_backoff, esp_timer_get_time() / 1000);
+
+#ifdef CONFIG_QCLOUD_MQTT_PERSISTENT_SESSION
+
+        /**< The broker kept the subscriptions, only the new ones are sent */
+        if (event->session_present) {
+            mqtt_connect_stats.session_resumed++;
+        } else
+#endif
+        {
+            esp_qcloud_mqtt_sub_foreach(&mqtt_data->subscriptions, esp_qcloud_mqtt_subscribe_mark_pending, NULL);
+        }
+
+        xSemaphoreGive(mqtt_data->subscriptions_lock);
+
+#ifdef CONFIG_QCLOUD_MQTT_PERSISTENT_SESSION
+        ESP_LOGI(TAG, "Session present: %d", event->session_present);
+        esp_qcloud_mqtt_queue_pause(false);
+#endif
+
+        esp_qcloud_mqtt_subscribe_flush();
+
+        xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+
+        if (!mqtt_subscribe_outstanding) {
+            mqtt_ready = true;
+            esp_qcloud_mqtt_set_ready();
         }
 
+        xSemaphoreGive(mqtt_data->subscriptions_lock);
+
         xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_EVENT);
+        esp_qcloud_mqtt_notify_state(QCLOUD_MQTT_STATE_CONNECTED, 0);
         break;
 
     case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGW(TAG, "MQTT Disconnected. Will try reconnecting in a while...");
+        xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_EVENT | MQTT_READY_EVENT);
+#ifdef CONFIG_QCLOUD_MQTT_PERSISTENT_SESSION
+        esp_qcloud_mqtt_queue_pause(true);
+#endif
+
+        /**< Also posted after every failed attempt, only a lost connection is reported */
+        if (mqtt_connected) {
+            esp_qcloud_mqtt_notify_state(QCLOUD_MQTT_STATE_DISCONNECTED, 0);
+        }
+
+        /**< Auto reconnect of esp-mqtt is disabled, it retries at a fixed interval */
+        if (mqtt_data->started) {
+            uint32_t delay_ms = esp_qcloud_backoff_next(&mqtt_data->reconnect_backoff, esp_timer_get_time() / 1000);
+            ESP_LOGW(TAG, "MQTT Disconnected. Will try reconnecting in %u ms...", (unsigned)delay_ms);
+            esp_timer_stop(mqtt_data->reconnect_timer);
+            esp_timer_start_once(mqtt_data->reconnect_timer, delay_ms * 1000ULL);
+            esp_qcloud_mqtt_notify_state(QCLOUD_MQTT_STATE_BACKOFF, delay_ms);
+        }
+
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGD(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+
+        /**< Ready once every SUBSCRIBE sent since the CONNACK is acknowledged */
+        xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+
+        if (mqtt_subscribe_outstanding > 0 && --mqtt_subscribe_outstanding == 0 && !mqtt_ready) {
+            mqtt_ready = true;
+            esp_qcloud_mqtt_set_ready();
+        }
+
+        xSemaphoreGive(mqtt_data->subscriptions_lock);
         break;
 
     case MQTT_EVENT_UNSUBSCRIBED:
@@ -177,8 +434,17 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        esp_qcloud_mqtt_queue_complete(event->msg_id, ESP_OK);
         break;
 
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0))
+    case MQTT_EVENT_DELETED:
+        /**< Expired in the outbox, MQTT_REPORT_DELETED_MESSAGES is selected by the component */
+        ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+        esp_qcloud_mqtt_queue_complete(event->msg_id, ESP_ERR_TIMEOUT);
+        break;
+#endif
+
     case MQTT_EVENT_DATA:
         ESP_LOGD(TAG, "MQTT_EVENT_DATA");
         ESP_LOGD(TAG, "TOPIC=%.*s\r\n", event->topic_len, event->topic);
@@ -205,39 +471,67 @@ static void new_event_handler(void *handler_args, esp_event_base_t base, int32_t
 }
 #endif
 
-esp_err_t esp_qcloud_mqtt_connect(void)
+esp_err_t esp_qcloud_mqtt_connect_async(void)
 {
     if (!mqtt_data) {
         return ESP_FAIL;
     }
 
+    if (mqtt_data->started) {
+        return ESP_OK;
+    }
+
     ESP_LOGI(TAG, "Connecting to %s", mqtt_data->config->host);
-    mqtt_event_group = xEventGroupCreate();
+    mqtt_data->started = true;
+    esp_qcloud_backoff_reset(&mqtt_data->reconnect_backoff);
     esp_err_t ret = esp_mqtt_client_start(mqtt_data->mqtt_client);
 
     if (ret != ESP_OK) {
+        mqtt_data->started = false;
         ESP_LOGE(TAG, "esp_mqtt_client_start() failed with err = %d", ret);
         return ret;
     }
 
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_mqtt_connect(void)
+{
+    esp_err_t ret = esp_qcloud_mqtt_connect_async();
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
     ESP_LOGI(TAG, "Waiting for MQTT connection. This may take time.");
     xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED_EVENT, false, true, portMAX_DELAY);
+
+    /**< The topics subscribed before connecting are acknowledged before returning */
+    if (!(xEventGroupWaitBits(mqtt_event_group, MQTT_READY_EVENT, false, true,
+                              pdMS_TO_TICKS(MQTT_READY_TIMEOUT_MS)) & MQTT_READY_EVENT)) {
+        ESP_LOGW(TAG, "Subscriptions not acknowledged within %d ms", MQTT_READY_TIMEOUT_MS);
+    }
+
     return ESP_OK;
 }
 
+static void esp_qcloud_mqtt_unsubscribe_one(esp_qcloud_mqtt_sub_t *sub, void *client)
+{
+    if (esp_mqtt_client_unsubscribe(client, sub->topic) < 0) {
+        ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", sub->topic);
+    }
+}
+
 static void esp_qcloud_mqtt_unsubscribe_all()
 {
     if (!mqtt_data) {
         return;
     }
 
-    int i;
-
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (mqtt_data->subscriptions[i]) {
-            esp_qcloud_mqtt_unsubscribe(mqtt_data->subscriptions[i]->topic);
-        }
-    }
+    xSemaphoreTake(mqtt_data->subscriptions_lock, portMAX_DELAY);
+    esp_qcloud_mqtt_sub_foreach(&mqtt_data->subscriptions, esp_qcloud_mqtt_unsubscribe_one, mqtt_data->mqtt_client);
+    esp_qcloud_mqtt_sub_clear(&mqtt_data->subscriptions);
+    xSemaphoreGive(mqtt_data->subscriptions_lock);
 }
 
 esp_err_t esp_qcloud_mqtt_disconnect(void)
@@ -247,12 +541,19 @@ esp_err_t esp_qcloud_mqtt_disconnect(void)
     }
 
     esp_qcloud_mqtt_unsubscribe_all();
+    mqtt_data->started = false;
+    esp_timer_stop(mqtt_data->reconnect_timer);
     esp_err_t err = esp_mqtt_client_stop(mqtt_data->mqtt_client);
 
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to disconnect from MQTT");
     } else {
         ESP_LOGI(TAG, "MQTT Disconnected.");
+        xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_EVENT | MQTT_READY_EVENT);
+
+        if (mqtt_connected) {
+            esp_qcloud_mqtt_notify_state(QCLOUD_MQTT_STATE_DISCONNECTED, 0);
+        }
     }
 
     return err;
@@ -272,6 +573,44 @@ esp_err_t esp_qcloud_mqtt_init(esp_qcloud_mqtt_config_t *config)
         return ESP_FAIL;
     }
 
+    mqtt_data->subscriptions_lock = xSemaphoreCreateMutex();
+
+    if (!mqtt_data->subscriptions_lock) {
+        free(mqtt_data);
+        mqtt_data = NULL;
+        return ESP_FAIL;
+    }
+
+    mqtt_event_group = xEventGroupCreate();
+
+    if (!mqtt_event_group) {
+        vSemaphoreDelete(mqtt_data->subscriptions_lock);
+        free(mqtt_data);
+        mqtt_data = NULL;
+        return ESP_FAIL;
+    }
+
+    const esp_qcloud_backoff_config_t backoff_config = {
+        .base_ms   = CONFIG_QCLOUD_RECONNECT_BASE_MS,
+        .cap_ms    = CONFIG_QCLOUD_RECONNECT_CAP_MS,
+        .stable_ms = CONFIG_QCLOUD_RECONNECT_STABLE_MS,
+    };
+    esp_qcloud_backoff_init(&mqtt_data->reconnect_backoff, &backoff_config);
+
+    const esp_timer_create_args_t timer_cfg = {
+        .name     = "mqtt_reconnect",
+        .callback = esp_qcloud_mqtt_reconnect_timer_cb,
+    };
+
+    if (esp_timer_create(&timer_cfg, &mqtt_data->reconnect_timer) != ESP_OK) {
+        vEventGroupDelete(mqtt_event_group);
+        mqtt_event_group = NULL;
+        vSemaphoreDelete(mqtt_data->subscriptions_lock);
+        free(mqtt_data);
+        mqtt_data = NULL;
+        return ESP_FAIL;
+    }
+
     mqtt_data->config = malloc(sizeof(esp_qcloud_mqtt_config_t));
     *mqtt_data->config = *config;
     const esp_mqtt_client_config_t mqtt_client_cfg = {
@@ -285,6 +624,10 @@ esp_err_t esp_qcloud_mqtt_init(esp_qcloud_mqtt_config_t *config)
         .credentials.authentication.certificate = config->client_cert,
         .credentials.authentication.key = config->client_key,
         .session.keepalive = 15,
+        .network.disable_auto_reconnect = true,
+#ifdef CONFIG_QCLOUD_MQTT_PERSISTENT_SESSION
+        .session.disable_clean_session = true,
+#endif
 #else
         .username  = config->username,
         .password  = config->password,
@@ -294,12 +637,31 @@ esp_err_t esp_qcloud_mqtt_init(esp_qcloud_mqtt_config_t *config)
         .client_cert_pem = config->client_cert,
         .client_key_pem  = config->client_key,
         .keepalive       = 15,
+        .disable_auto_reconnect = true,
+#ifdef CONFIG_QCLOUD_MQTT_PERSISTENT_SESSION
+        .disable_clean_session = true,
+#endif
         .event_handle    = mqtt_event_handler,
 #endif
 
     };
     mqtt_data->mqtt_client = esp_mqtt_client_init(&mqtt_client_cfg);
 
+    esp_err_t err = esp_qcloud_mqtt_queue_init(mqtt_data->mqtt_client);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_qcloud_mqtt_queue_init() failed with err = %d", err);
+        esp_mqtt_client_destroy(mqtt_data->mqtt_client);
+        esp_timer_delete(mqtt_data->reconnect_timer);
+        free(mqtt_data->config);
+        vEventGroupDelete(mqtt_event_group);
+        mqtt_event_group = NULL;
+        vSemaphoreDelete(mqtt_data->subscriptions_lock);
+        free(mqtt_data);
+        mqtt_data = NULL;
+        return err;
+    }
+
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
     esp_mqtt_client_register_event(mqtt_data->mqtt_client, ESP_EVENT_ANY_ID, new_event_handler, NULL);
 #endif
@@ -0,0 +1,447 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <esp_log.h>
+#include <esp_idf_version.h>
+
+#include "esp_qcloud_utils.h"
+#include "esp_qcloud_mem.h"
+#include "esp_qcloud_mqtt_queue.h"
+
+#define QCLOUD_MQTT_PUBLISH_TASK_STACK    (3 * 1024)
+#define QCLOUD_MQTT_PUBLISH_TASK_PRIO     (5)
+#define QCLOUD_MQTT_SWEEP_INTERVAL_MS     (1000)  /**< Interval of the check for unacknowledged messages */
+#define QCLOUD_MQTT_EARLY_MAX             (4)     /**< Completions kept while a message is enqueued */
+
+/**
+ * @brief A slot is freed when its message leaves the outbox of esp-mqtt, with the
+ *        PUBACK or with MQTT_EVENT_DELETED once expired. Before IDF v4.4 the
+ *        deletions are not reported, the slots are freed by a timeout instead.
+ */
+#if (ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0))
+#define QCLOUD_MQTT_PUBLISH_SWEEP
+#endif
+
+/**
+ * @brief A queued message, the payload is followed by the topic in the same allocation.
+ */
+typedef struct {
+    esp_qcloud_mqtt_publish_cb_t cb;
+    void *priv_data;
+    TickType_t submit_tick;
+    int data_len;
+    const char *topic;
+    char data[0];
+} esp_qcloud_mqtt_message_t;
+
+/**
+ * @brief A message handed to esp-mqtt and waiting for the PUBACK.
+ *
+ * @note The slot is reserved with msg_id -1 before esp_mqtt_client_enqueue() is
+ *       called, so the publish task never hands more messages than it can track.
+ */
+typedef struct {
+    bool used;
+    int msg_id;
+    esp_qcloud_mqtt_publish_cb_t cb;
+    void *priv_data;
+    TickType_t submit_tick;
+    TickType_t deadline_tick;   /**< Completed with ESP_ERR_TIMEOUT after this tick, before IDF v4.4 */
+} esp_qcloud_mqtt_inflight_t;
+
+/**
+ * @brief A completion of a msg_id not recorded in a slot yet.
+ */
+typedef struct {
+    int msg_id;
+    esp_err_t result;
+} esp_qcloud_mqtt_early_t;
+
+static const char *TAG = "esp_qcloud_mqtt_queue";
+
+static esp_mqtt_client_handle_t g_mqtt_client = NULL;
+static TaskHandle_t g_publish_task            = NULL;
+static QueueHandle_t g_publish_queue[QCLOUD_MQTT_PRIO_MAX] = {NULL};
+
+/**< Guarded by g_queue_lock, shared by the publish task, the MQTT task and the callers */
+static portMUX_TYPE g_queue_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_qcloud_mqtt_inflight_t g_inflight[CONFIG_QCLOUD_MQTT_INFLIGHT_MAX];
+static esp_qcloud_mqtt_publish_stats_t g_publish_stats = {0};
+static uint32_t g_handed_count        = 0;
+static uint64_t g_queue_latency_total = 0;
+static uint64_t g_ack_latency_total   = 0;
+static bool g_offline                 = false;  /**< The PUBACK timeouts are paused */
+static TickType_t g_offline_tick      = 0;
+
+/**
+ * @brief The MQTT task may send the message and get the PUBACK before
+ *        esp_mqtt_client_enqueue() returns the msg_id to the publish task.
+ *        Completions of unknown msg_ids are kept while a message is enqueued
+ *        and settled when its slot is filled in.
+ */
+static bool g_enqueuing               = false;
+static size_t g_early_num             = 0;
+static esp_qcloud_mqtt_early_t g_early[QCLOUD_MQTT_EARLY_MAX];
+
+static uint32_t esp_qcloud_mqtt_elapsed_ms(TickType_t tick)
+{
+    return (xTaskGetTickCount() - tick) * portTICK_PERIOD_MS;
+}
+
+static esp_qcloud_mqtt_message_t *esp_qcloud_mqtt_queue_pop(void)
+{
+    esp_qcloud_mqtt_message_t *message = NULL;
+
+    for (int prio = 0; prio < QCLOUD_MQTT_PRIO_MAX; ++prio) {
+        if (xQueueReceive(g_publish_queue[prio], &message, 0) == pdTRUE) {
+            return message;
+        }
+    }
+
+    return NULL;
+}
+
+static esp_qcloud_mqtt_inflight_t *esp_qcloud_mqtt_inflight_reserve(void)
+{
+    esp_qcloud_mqtt_inflight_t *slot = NULL;
+
+    portENTER_CRITICAL(&g_queue_lock);
+
+    for (int i = 0; i < CONFIG_QCLOUD_MQTT_INFLIGHT_MAX; ++i) {
+        if (!g_inflight[i].used) {
+            slot         = g_inflight + i;
+            slot->used   = true;
+            slot->msg_id = -1;
+            g_enqueuing  = true;
+            g_early_num  = 0;
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_queue_lock);
+
+    return slot;
+}
+
+/**
+ * @brief Count a completed message in the stats, called with g_queue_lock held.
+ */
+static void esp_qcloud_mqtt_inflight_settle(const esp_qcloud_mqtt_inflight_t *inflight, esp_err_t result)
+{
+    if (result == ESP_OK) {
+        uint32_t ack_latency = esp_qcloud_mqtt_elapsed_ms(inflight->submit_tick);
+
+        g_publish_stats.published++;
+        g_ack_latency_total += ack_latency;
+        g_publish_stats.ack_latency_max_ms = MAX(g_publish_stats.ack_latency_max_ms, ack_latency);
+    } else {
+        g_publish_stats.failed++;
+    }
+}
+
+/**
+ * @brief Hand the queued messages to esp-mqtt while there are free in-flight slots.
+ */
+static void esp_qcloud_mqtt_queue_feed(void)
+{
+    for (;;) {
+        esp_qcloud_mqtt_inflight_t *slot = esp_qcloud_mqtt_inflight_reserve();
+
+        if (!slot) {
+            return;
+        }
+
+        esp_qcloud_mqtt_message_t *message = esp_qcloud_mqtt_queue_pop();
+
+        if (!message) {
+            portENTER_CRITICAL(&g_queue_lock);
+            slot->used  = false;
+            g_enqueuing = false;
+            portEXIT_CRITICAL(&g_queue_lock);
+            return;
+        }
+
+        int msg_id = esp_mqtt_client_enqueue(g_mqtt_client, message->topic, message->data,
+                                             message->data_len, 1, 0, true);
+        uint32_t queue_latency = esp_qcloud_mqtt_elapsed_ms(message->submit_tick);
+        esp_qcloud_mqtt_inflight_t early = {0};
+        esp_err_t early_result = ESP_OK;
+
+        portENTER_CRITICAL(&g_queue_lock);
+
+        g_enqueuing = false;
+
+        if (msg_id < 0) {
+            slot->used = false;
+            g_publish_stats.failed++;
+        } else {
+            slot->msg_id      = msg_id;
+            slot->cb          = message->cb;
+            slot->priv_data   = message->priv_data;
+            slot->submit_tick = message->submit_tick;
+            slot->deadline_tick = message->submit_tick + pdMS_TO_TICKS(CONFIG_QCLOUD_MQTT_PUBLISH_TIMEOUT_MS);
+            g_handed_count++;
+            g_queue_latency_total += queue_latency;
+            g_publish_stats.queue_latency_max_ms = MAX(g_publish_stats.queue_latency_max_ms, queue_latency);
+
+            for (size_t i = 0; i < g_early_num; ++i) {
+                if (g_early[i].msg_id == msg_id) {
+                    early        = *slot;
+                    early_result = g_early[i].result;
+                    slot->used   = false;
+                    esp_qcloud_mqtt_inflight_settle(&early, early_result);
+                    break;
+                }
+            }
+        }
+
+        g_early_num = 0;
+
+        portEXIT_CRITICAL(&g_queue_lock);
+
+        if (msg_id < 0) {
+            ESP_LOGW(TAG, "esp_mqtt_client_enqueue, topic: %s", message->topic);
+
+            if (message->cb) {
+                message->cb(-1, ESP_FAIL, message->priv_data);
+            }
+        }
+
+        if (early.used && early.cb) {
+            early.cb(msg_id, early_result, early.priv_data);
+        }
+
+        ESP_QCLOUD_FREE(message);
+    }
+}
+
+#ifdef QCLOUD_MQTT_PUBLISH_SWEEP
+/**
+ * @brief Complete the messages that waited too long for the PUBACK.
+ */
+static void esp_qcloud_mqtt_queue_sweep(void)
+{
+    esp_qcloud_mqtt_inflight_t expired[CONFIG_QCLOUD_MQTT_INFLIGHT_MAX];
+    size_t expired_num = 0;
+
+    TickType_t now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&g_queue_lock);
+
+    for (int i = 0; i < CONFIG_QCLOUD_MQTT_INFLIGHT_MAX && !g_offline; ++i) {
+        if (g_inflight[i].used && g_inflight[i].msg_id >= 0
+                && (int32_t)(now - g_inflight[i].deadline_tick) > 0) {
+            expired[expired_num++] = g_inflight[i];
+            g_inflight[i].used = false;
+            g_publish_stats.failed++;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_queue_lock);
+
+    for (size_t i = 0; i < expired_num; ++i) {
+        ESP_LOGW(TAG, "Publish timeout, msg_id: %d", expired[i].msg_id);
+
+        if (expired[i].cb) {
+            expired[i].cb(expired[i].msg_id, ESP_ERR_TIMEOUT, expired[i].priv_data);
+        }
+    }
+}
+#endif /**< QCLOUD_MQTT_PUBLISH_SWEEP */
+
+static void esp_qcloud_mqtt_publish_task(void *arg)
+{
+    for (;;) {
+#ifdef QCLOUD_MQTT_PUBLISH_SWEEP
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(QCLOUD_MQTT_SWEEP_INTERVAL_MS));
+        esp_qcloud_mqtt_queue_sweep();
+#else
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
+
+        esp_qcloud_mqtt_queue_feed();
+    }
+
+    vTaskDelete(NULL);
+}
+
+void esp_qcloud_mqtt_queue_pause(bool pause)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&g_queue_lock);
+
+    if (pause && !g_offline) {
+        g_offline      = true;
+        g_offline_tick = now;
+    } else if (!pause && g_offline) {
+        /**< The time spent offline does not count toward the timeout */
+        for (int i = 0; i < CONFIG_QCLOUD_MQTT_INFLIGHT_MAX; ++i) {
+            g_inflight[i].deadline_tick += now - g_offline_tick;
+        }
+
+        g_offline = false;
+    }
+
+    portEXIT_CRITICAL(&g_queue_lock);
+}
+
+void esp_qcloud_mqtt_queue_complete(int msg_id, esp_err_t result)
+{
+    esp_qcloud_mqtt_inflight_t inflight = {0};
+
+    portENTER_CRITICAL(&g_queue_lock);
+
+    for (int i = 0; i < CONFIG_QCLOUD_MQTT_INFLIGHT_MAX; ++i) {
+        if (g_inflight[i].used && g_inflight[i].msg_id == msg_id) {
+            inflight = g_inflight[i];
+            g_inflight[i].used = false;
+            break;
+        }
+    }
+
+    if (inflight.used) {
+        esp_qcloud_mqtt_inflight_settle(&inflight, result);
+    } else if (g_enqueuing) {
+        /**< The oldest one is dropped, it belongs to a message no longer tracked */
+        if (g_early_num == QCLOUD_MQTT_EARLY_MAX) {
+            memmove(g_early, g_early + 1, sizeof(g_early) - sizeof(g_early[0]));
+            g_early_num--;
+        }
+
+        g_early[g_early_num].msg_id = msg_id;
+        g_early[g_early_num].result = result;
+        g_early_num++;
+    }
+
+    portEXIT_CRITICAL(&g_queue_lock);
+
+    /**< Unknown msg_id, e.g. a message being enqueued */
+    if (!inflight.used) {
+        return;
+    }
+
+    if (inflight.cb) {
+        inflight.cb(msg_id, result, inflight.priv_data);
+    }
+
+    /**< A slot is free, feed the next message */
+    xTaskNotifyGive(g_publish_task);
+}
+
+esp_err_t esp_qcloud_mqtt_queue_init(esp_mqtt_client_handle_t client)
+{
+    ESP_QCLOUD_PARAM_CHECK(client);
+
+    if (g_publish_task) {
+        return ESP_OK;
+    }
+
+    g_mqtt_client = client;
+
+    for (int prio = 0; prio < QCLOUD_MQTT_PRIO_MAX; ++prio) {
+        g_publish_queue[prio] = xQueueCreate(CONFIG_QCLOUD_MQTT_PUBLISH_QUEUE_DEPTH, sizeof(esp_qcloud_mqtt_message_t *));
+        ESP_QCLOUD_ERROR_GOTO(!g_publish_queue[prio], EXIT, "Create the publish queue, prio: %d", prio);
+    }
+
+    BaseType_t ret = xTaskCreate(esp_qcloud_mqtt_publish_task, "qcloud_publish", QCLOUD_MQTT_PUBLISH_TASK_STACK,
+                                 NULL, QCLOUD_MQTT_PUBLISH_TASK_PRIO, &g_publish_task);
+    ESP_QCLOUD_ERROR_GOTO(ret != pdPASS, EXIT, "Create the publish task");
+
+    return ESP_OK;
+
+EXIT:
+
+    for (int prio = 0; prio < QCLOUD_MQTT_PRIO_MAX; ++prio) {
+        if (g_publish_queue[prio]) {
+            vQueueDelete(g_publish_queue[prio]);
+            g_publish_queue[prio] = NULL;
+        }
+    }
+
+    g_publish_task = NULL;
+    g_mqtt_client  = NULL;
+
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_qcloud_mqtt_publish_async(const char *topic, const void *data, size_t data_len,
+                                        esp_qcloud_mqtt_prio_t prio, esp_qcloud_mqtt_publish_cb_t cb, void *priv_data)
+{
+    ESP_QCLOUD_PARAM_CHECK(topic);
+    ESP_QCLOUD_PARAM_CHECK(data);
+    ESP_QCLOUD_PARAM_CHECK(prio < QCLOUD_MQTT_PRIO_MAX);
+    ESP_QCLOUD_ERROR_CHECK(!g_publish_task, ESP_ERR_INVALID_STATE, "MQTT is not initialised");
+
+    size_t topic_size = strlen(topic) + 1;
+    esp_qcloud_mqtt_message_t *message = ESP_QCLOUD_MALLOC(sizeof(esp_qcloud_mqtt_message_t) + data_len + topic_size);
+    ESP_QCLOUD_ERROR_CHECK(!message, ESP_ERR_NO_MEM, "Allocate the message, size: %d", data_len);
+
+    message->cb          = cb;
+    message->priv_data   = priv_data;
+    message->submit_tick = xTaskGetTickCount();
+    message->data_len    = data_len;
+    message->topic       = message->data + data_len;
+    memcpy(message->data, data, data_len);
+    memcpy(message->data + data_len, topic, topic_size);
+
+    if (xQueueSend(g_publish_queue[prio], &message, 0) != pdTRUE) {
+        ESP_QCLOUD_FREE(message);
+
+        portENTER_CRITICAL(&g_queue_lock);
+        g_publish_stats.rejected++;
+        portEXIT_CRITICAL(&g_queue_lock);
+
+        ESP_LOGW(TAG, "The publish queue is full, prio: %d, topic: %s", prio, topic);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&g_queue_lock);
+    g_publish_stats.submitted++;
+    portEXIT_CRITICAL(&g_queue_lock);
+
+    xTaskNotifyGive(g_publish_task);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_mqtt_get_publish_stats(esp_qcloud_mqtt_publish_stats_t *stats)
+{
+    ESP_QCLOUD_PARAM_CHECK(stats);
+
+    portENTER_CRITICAL(&g_queue_lock);
+
+    *stats = g_publish_stats;
+    stats->queue_latency_avg_ms = g_handed_count ? g_queue_latency_total / g_handed_count : 0;
+    stats->ack_latency_avg_ms   = g_publish_stats.published ? g_ack_latency_total / g_publish_stats.published : 0;
+
+    for (int i = 0; i < CONFIG_QCLOUD_MQTT_INFLIGHT_MAX; ++i) {
+        stats->inflight += g_inflight[i].used;
+    }
+
+    portEXIT_CRITICAL(&g_queue_lock);
+
+    for (int prio = 0; prio < QCLOUD_MQTT_PRIO_MAX; ++prio) {
+        stats->queued[prio] = g_publish_queue[prio] ? uxQueueMessagesWaiting(g_publish_queue[prio]) : 0;
+    }
+
+    return ESP_OK;
+}
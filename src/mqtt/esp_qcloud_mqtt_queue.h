@@ -0,0 +1,57 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <mqtt_client.h>
+
+#include "esp_qcloud_mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Create the publish queues and the publish task.
+ *
+ * @param[in] client esp-mqtt client the messages are handed to.
+ * @return
+ *     - ESP_OK: succeed
+ *     - others: fail
+ */
+esp_err_t esp_qcloud_mqtt_queue_init(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Pause the PUBACK timeouts of the in-flight messages, only used before IDF v4.4.
+ *
+ * @note Used with a persistent session, the broker and the esp-mqtt outbox
+ *       keep the messages across a disconnection, so they are not failed
+ *       and published again by the callers.
+ *
+ * @param[in] pause true when disconnected, false when connected again.
+ */
+void esp_qcloud_mqtt_queue_pause(bool pause);
+
+/**
+ * @brief Complete a message handed to esp-mqtt, called from the MQTT event handler.
+ *
+ * @param[in] msg_id Message id of MQTT_EVENT_PUBLISHED or MQTT_EVENT_DELETED.
+ * @param[in] result ESP_OK if acknowledged by the broker, ESP_ERR_TIMEOUT if
+ *                   dropped from the outbox of esp-mqtt.
+ */
+void esp_qcloud_mqtt_queue_complete(int msg_id, esp_err_t result);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -0,0 +1,286 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_qcloud_mqtt_sub.h"
+
+#define QCLOUD_MQTT_SUB_BUCKET_MIN  (8)
+
+/**
+ * @brief FNV-1a, same as esp_qcloud_hash_str(). Kept here so that the table
+ *        has no dependency on FreeRTOS and can be built on the host.
+ */
+static uint32_t esp_qcloud_mqtt_sub_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief '#' must be the last level and '+' a whole level.
+ */
+static bool esp_qcloud_mqtt_sub_filter_valid(const char *filter, bool *wildcard)
+{
+    *wildcard = false;
+
+    for (const char *p = filter; *p; ++p) {
+        if (*p != '+' && *p != '#') {
+            continue;
+        }
+
+        if ((p != filter && p[-1] != '/') || (*p == '#' && p[1] != '\0') || (*p == '+' && p[1] != '\0' && p[1] != '/')) {
+            return false;
+        }
+
+        *wildcard = true;
+    }
+
+    return *filter != '\0';
+}
+
+bool esp_qcloud_mqtt_sub_filter_match(const char *filter, const char *topic, size_t topic_len)
+{
+    const char *end = topic + topic_len;
+
+    /**< Topics starting with '$' are not matched by a leading wildcard */
+    if (topic_len && *topic == '$' && (*filter == '+' || *filter == '#')) {
+        return false;
+    }
+
+    while (*filter) {
+        if (*filter == '#') {
+            return true;
+        }
+
+        if (*filter == '+') {
+            while (topic < end && *topic != '/') {
+                ++topic;
+            }
+
+            ++filter;
+        } else {
+            if (topic == end || *filter != *topic) {
+                /**< "a/#" also matches "a" */
+                return topic == end && filter[0] == '/' && filter[1] == '#' && filter[2] == '\0';
+            }
+
+            ++filter;
+            ++topic;
+        }
+    }
+
+    return topic == end;
+}
+
+static esp_err_t esp_qcloud_mqtt_sub_grow(esp_qcloud_mqtt_sub_table_t *table)
+{
+    uint16_t bucket_num = table->bucket_num ? table->bucket_num << 1 : QCLOUD_MQTT_SUB_BUCKET_MIN;
+    esp_qcloud_mqtt_sub_t **bucket = calloc(bucket_num, sizeof(esp_qcloud_mqtt_sub_t *));
+
+    if (!bucket) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < table->bucket_num; ++i) {
+        for (esp_qcloud_mqtt_sub_t *sub = table->bucket[i], *next = NULL; sub; sub = next) {
+            next = sub->next;
+            sub->next = bucket[sub->hash & (bucket_num - 1)];
+            bucket[sub->hash & (bucket_num - 1)] = sub;
+        }
+    }
+
+    free(table->bucket);
+    table->bucket     = bucket;
+    table->bucket_num = bucket_num;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Return the link pointing to the filter, or to the end of its list.
+ */
+static esp_qcloud_mqtt_sub_t **esp_qcloud_mqtt_sub_find(esp_qcloud_mqtt_sub_table_t *table, const char *topic,
+        size_t topic_len, uint32_t hash, bool wildcard)
+{
+    esp_qcloud_mqtt_sub_t **link = wildcard ? &table->wildcard
+                                   : table->bucket_num ? &table->bucket[hash & (table->bucket_num - 1)] : NULL;
+
+    for (; link && *link; link = &(*link)->next) {
+        if ((*link)->hash == hash && (*link)->topic_len == topic_len && !memcmp((*link)->topic, topic, topic_len)) {
+            break;
+        }
+    }
+
+    return link;
+}
+
+esp_err_t esp_qcloud_mqtt_sub_add(esp_qcloud_mqtt_sub_table_t *table, const char *topic,
+                                  esp_qcloud_mqtt_subscribe_cb_t cb, void *priv, bool *added)
+{
+    bool wildcard    = false;
+    size_t topic_len = topic ? strlen(topic) : 0;
+
+    if (!table || !topic || !cb || topic_len > UINT16_MAX || !esp_qcloud_mqtt_sub_filter_valid(topic, &wildcard)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t hash = wildcard ? 0 : esp_qcloud_mqtt_sub_hash(topic, topic_len);
+    esp_qcloud_mqtt_sub_t **link = esp_qcloud_mqtt_sub_find(table, topic, topic_len, hash, wildcard);
+
+    if (link && *link) {
+        (*link)->cb   = cb;
+        (*link)->priv = priv;
+        *added = false;
+        return ESP_OK;
+    }
+
+    if (!wildcard && table->exact_num >= table->bucket_num) {
+        if (esp_qcloud_mqtt_sub_grow(table) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        link = esp_qcloud_mqtt_sub_find(table, topic, topic_len, hash, wildcard);
+    }
+
+    esp_qcloud_mqtt_sub_t *sub = malloc(sizeof(esp_qcloud_mqtt_sub_t) + topic_len + 1);
+
+    if (!sub) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    sub->next      = NULL;
+    sub->hash      = hash;
+    sub->topic_len = topic_len;
+    sub->pending   = true;
+    sub->cb        = cb;
+    sub->priv      = priv;
+    memcpy(sub->topic, topic, topic_len + 1);
+
+    /**< Appended, filters are matched in the order they are subscribed */
+    *link = sub;
+
+    if (wildcard) {
+        table->wildcard_num++;
+    } else {
+        table->exact_num++;
+    }
+
+    *added = true;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_mqtt_sub_remove(esp_qcloud_mqtt_sub_table_t *table, const char *topic)
+{
+    bool wildcard    = false;
+    size_t topic_len = topic ? strlen(topic) : 0;
+
+    if (!table || !topic || !esp_qcloud_mqtt_sub_filter_valid(topic, &wildcard)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t hash = wildcard ? 0 : esp_qcloud_mqtt_sub_hash(topic, topic_len);
+    esp_qcloud_mqtt_sub_t **link = esp_qcloud_mqtt_sub_find(table, topic, topic_len, hash, wildcard);
+
+    if (!link || !*link) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_qcloud_mqtt_sub_t *sub = *link;
+    *link = sub->next;
+    free(sub);
+
+    if (wildcard) {
+        table->wildcard_num--;
+    } else {
+        table->exact_num--;
+    }
+
+    return ESP_OK;
+}
+
+size_t esp_qcloud_mqtt_sub_match(const esp_qcloud_mqtt_sub_table_t *table, const char *topic, size_t topic_len,
+                                 esp_qcloud_mqtt_sub_hit_t *hit, size_t hit_max)
+{
+    size_t hit_num = 0;
+
+    if (table->exact_num) {
+        uint32_t hash = esp_qcloud_mqtt_sub_hash(topic, topic_len);
+
+        for (const esp_qcloud_mqtt_sub_t *sub = table->bucket[hash & (table->bucket_num - 1)]; sub; sub = sub->next) {
+            if (sub->hash == hash && sub->topic_len == topic_len && !memcmp(sub->topic, topic, topic_len)) {
+                if (hit_num < hit_max) {
+                    hit[hit_num].cb   = sub->cb;
+                    hit[hit_num].priv = sub->priv;
+                }
+
+                hit_num++;
+                break;
+            }
+        }
+    }
+
+    for (const esp_qcloud_mqtt_sub_t *sub = table->wildcard; sub; sub = sub->next) {
+        if (esp_qcloud_mqtt_sub_filter_match(sub->topic, topic, topic_len)) {
+            if (hit_num < hit_max) {
+                hit[hit_num].cb   = sub->cb;
+                hit[hit_num].priv = sub->priv;
+            }
+
+            hit_num++;
+        }
+    }
+
+    return hit_num;
+}
+
+void esp_qcloud_mqtt_sub_foreach(const esp_qcloud_mqtt_sub_table_t *table,
+                                 void (*fn)(esp_qcloud_mqtt_sub_t *sub, void *arg), void *arg)
+{
+    for (int i = 0; i < table->bucket_num; ++i) {
+        for (esp_qcloud_mqtt_sub_t *sub = table->bucket[i]; sub; sub = sub->next) {
+            fn(sub, arg);
+        }
+    }
+
+    for (esp_qcloud_mqtt_sub_t *sub = table->wildcard; sub; sub = sub->next) {
+        fn(sub, arg);
+    }
+}
+
+void esp_qcloud_mqtt_sub_clear(esp_qcloud_mqtt_sub_table_t *table)
+{
+    for (int i = 0; i < table->bucket_num; ++i) {
+        for (esp_qcloud_mqtt_sub_t *sub = table->bucket[i], *next = NULL; sub; sub = next) {
+            next = sub->next;
+            free(sub);
+        }
+    }
+
+    for (esp_qcloud_mqtt_sub_t *sub = table->wildcard, *next = NULL; sub; sub = next) {
+        next = sub->next;
+        free(sub);
+    }
+
+    free(table->bucket);
+    memset(table, 0, sizeof(esp_qcloud_mqtt_sub_table_t));
+}
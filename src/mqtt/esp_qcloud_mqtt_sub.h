@@ -0,0 +1,130 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+#include "esp_qcloud_mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief A subscribed topic filter.
+ */
+typedef struct esp_qcloud_mqtt_sub {
+    struct esp_qcloud_mqtt_sub *next;   /**< Next in the bucket, or in the wildcard list */
+    uint32_t hash;                      /**< esp_qcloud_hash_str() of the filter, 0 for a wildcard filter */
+    uint16_t topic_len;
+    bool pending;                       /**< Not sent to the broker yet */
+    esp_qcloud_mqtt_subscribe_cb_t cb;
+    void *priv;
+    char topic[];                       /**< NULL terminated filter */
+} esp_qcloud_mqtt_sub_t;
+
+/**
+ * @brief Subscription table.
+ *
+ * @note Filters without wildcards are found by hash and exact length, only the
+ *       filters with '+' or '#' are matched one by one. The table is not locked,
+ *       the caller serializes the access.
+ */
+typedef struct {
+    esp_qcloud_mqtt_sub_t **bucket;
+    uint16_t bucket_num;                /**< Power of 2, grows with the filters */
+    uint16_t exact_num;
+    uint16_t wildcard_num;
+    esp_qcloud_mqtt_sub_t *wildcard;
+} esp_qcloud_mqtt_sub_table_t;
+
+/**
+ * @brief A callback of a matching filter, copied out of the table.
+ */
+typedef struct {
+    esp_qcloud_mqtt_subscribe_cb_t cb;
+    void *priv;
+} esp_qcloud_mqtt_sub_hit_t;
+
+/**
+ * @brief Add a filter, the callback of an existing filter is replaced.
+ *
+ * @note A new filter is marked as pending.
+ *
+ * @param[in] table Subscription table.
+ * @param[in] topic Topic filter, may contain '+' and '#'.
+ * @param[in] cb    Callback of the messages matching the filter.
+ * @param[in] priv  Private data passed to the callback.
+ * @param[out] added true if the filter is new.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_INVALID_ARG: the filter is not valid
+ *     - ESP_ERR_NO_MEM: out of memory
+ */
+esp_err_t esp_qcloud_mqtt_sub_add(esp_qcloud_mqtt_sub_table_t *table, const char *topic,
+                                  esp_qcloud_mqtt_subscribe_cb_t cb, void *priv, bool *added);
+
+/**
+ * @brief Remove a filter.
+ *
+ * @param[in] table Subscription table.
+ * @param[in] topic Topic filter as subscribed.
+ * @return
+ *     - ESP_OK: succeed
+ *     - ESP_ERR_NOT_FOUND: the filter is not subscribed
+ */
+esp_err_t esp_qcloud_mqtt_sub_remove(esp_qcloud_mqtt_sub_table_t *table, const char *topic);
+
+/**
+ * @brief Find the filters matching a topic.
+ *
+ * @param[in] table     Subscription table.
+ * @param[in] topic     Topic of the message, not NULL terminated.
+ * @param[in] topic_len Length of the topic.
+ * @param[out] hit      Callbacks of the matching filters.
+ * @param[in] hit_max   Size of `hit`.
+ * @return Number of the matching filters, may exceed `hit_max`
+ */
+size_t esp_qcloud_mqtt_sub_match(const esp_qcloud_mqtt_sub_table_t *table, const char *topic, size_t topic_len,
+                                 esp_qcloud_mqtt_sub_hit_t *hit, size_t hit_max);
+
+/**
+ * @brief Whether a topic matches a filter with MQTT wildcards.
+ *
+ * @param[in] filter    NULL terminated filter.
+ * @param[in] topic     Topic, not NULL terminated.
+ * @param[in] topic_len Length of the topic.
+ * @return true if the topic matches
+ */
+bool esp_qcloud_mqtt_sub_filter_match(const char *filter, const char *topic, size_t topic_len);
+
+/**
+ * @brief Call `fn` on every filter, `fn` may only change `pending`.
+ */
+void esp_qcloud_mqtt_sub_foreach(const esp_qcloud_mqtt_sub_table_t *table,
+                                 void (*fn)(esp_qcloud_mqtt_sub_t *sub, void *arg), void *arg);
+
+/**
+ * @brief Remove all the filters and free the table.
+ */
+void esp_qcloud_mqtt_sub_clear(esp_qcloud_mqtt_sub_table_t *table);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
@@ -19,6 +19,7 @@
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -27,11 +28,19 @@
 
 #include "esp_qcloud_storage.h"
 #include "esp_qcloud_utils.h"
+#include "esp_qcloud_backoff.h"
 
 #define QCLOUD_PROV_EVENT_STA_CONNECTED  BIT0
 
 static const char *TAG  = "esp_qcloud_wifi";
 static EventGroupHandle_t s_wifi_event_group = NULL;
+static esp_timer_handle_t s_reconnect_timer  = NULL;
+static esp_qcloud_backoff_t s_reconnect_backoff;
+
+static void reconnect_timer_cb(void *arg)
+{
+    esp_wifi_connect();
+}
 
 /* Event handler for catching system events */
 static void event_handler(void *arg, esp_event_base_t event_base,
@@ -42,6 +51,7 @@ static void event_handler(void *arg, esp_event_base_t event_base,
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
         ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
+        esp_qcloud_backoff_connected(&s_reconnect_backoff, esp_timer_get_time() / 1000);
         /* Signal main application to continue execution */
         xEventGroupSetBits(s_wifi_event_group, QCLOUD_PROV_EVENT_STA_CONNECTED);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
@@ -51,8 +61,11 @@ static void event_handler(void *arg, esp_event_base_t event_base,
             ESP_LOGE(TAG, "wrong password");
             return;
         }
-        ESP_LOGI(TAG, "Disconnected. Connecting to the AP again...");
-        esp_wifi_connect();
+
+        uint32_t delay_ms = esp_qcloud_backoff_next(&s_reconnect_backoff, esp_timer_get_time() / 1000);
+        ESP_LOGI(TAG, "Disconnected. Connecting to the AP again in %u ms...", (unsigned)delay_ms);
+        esp_timer_stop(s_reconnect_timer);
+        esp_timer_start_once(s_reconnect_timer, delay_ms * 1000ULL);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED) {
         ESP_LOGI(TAG, "STA Connecting to the AP again...");
     }
@@ -66,6 +79,19 @@ esp_err_t esp_qcloud_wifi_init(void)
 
     s_wifi_event_group = xEventGroupCreate();
 
+    const esp_qcloud_backoff_config_t backoff_config = {
+        .base_ms   = CONFIG_QCLOUD_RECONNECT_BASE_MS,
+        .cap_ms    = CONFIG_QCLOUD_RECONNECT_CAP_MS,
+        .stable_ms = CONFIG_QCLOUD_RECONNECT_STABLE_MS,
+    };
+    esp_qcloud_backoff_init(&s_reconnect_backoff, &backoff_config);
+
+    const esp_timer_create_args_t timer_cfg = {
+        .name     = "wifi_reconnect",
+        .callback = reconnect_timer_cb,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_cfg, &s_reconnect_timer));
+
     esp_netif_init();
 
     esp_event_loop_create_default();
@@ -0,0 +1,67 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/param.h>
+
+#include <esp_idf_version.h>
+
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0))
+#include <esp_random.h>
+#else
+#include <esp_system.h>
+#endif
+
+#include "esp_qcloud_backoff.h"
+
+void esp_qcloud_backoff_init(esp_qcloud_backoff_t *backoff, const esp_qcloud_backoff_config_t *config)
+{
+    backoff->config = *config;
+    esp_qcloud_backoff_reset(backoff);
+}
+
+void esp_qcloud_backoff_reset(esp_qcloud_backoff_t *backoff)
+{
+    backoff->delay_ms     = 0;
+    backoff->attempt      = 0;
+    backoff->connected_ms = 0;
+    backoff->connected    = false;
+}
+
+void esp_qcloud_backoff_connected(esp_qcloud_backoff_t *backoff, uint32_t now_ms)
+{
+    backoff->connected    = true;
+    backoff->connected_ms = now_ms;
+}
+
+uint32_t esp_qcloud_backoff_next(esp_qcloud_backoff_t *backoff, uint32_t now_ms)
+{
+    const esp_qcloud_backoff_config_t *config = &backoff->config;
+
+    if (backoff->connected) {
+        backoff->connected = false;
+
+        if (now_ms - backoff->connected_ms >= config->stable_ms) {
+            backoff->delay_ms = 0;
+            backoff->attempt  = 0;
+        }
+    }
+
+    uint32_t base  = MIN(config->base_ms, config->cap_ms);
+    uint64_t upper = MIN((uint64_t)MAX(backoff->delay_ms, base) * 3, config->cap_ms);
+
+    backoff->delay_ms = base + esp_random() % (uint32_t)(upper - base + 1);
+    backoff->attempt++;
+
+    return backoff->delay_ms;
+}
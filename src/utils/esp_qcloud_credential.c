@@ -0,0 +1,254 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <string.h>
+
+#include "mbedtls/version.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/sha256.h"
+
+#include "esp_qcloud_utils.h"
+#include "esp_qcloud_credential.h"
+
+#define HMAC_BLOCK_SIZE         (64)    /**< Same for SHA1 and SHA256 */
+#define HMAC_IPAD               (0x36)
+#define HMAC_OPAD               (0x5c)
+#define DEVICE_PSK_MAX_SIZE     (48)
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define SHA1_STARTS(ctx)                mbedtls_sha1_starts(ctx)
+#define SHA1_UPDATE(ctx, data, size)    mbedtls_sha1_update(ctx, data, size)
+#define SHA1_FINISH(ctx, digest)        mbedtls_sha1_finish(ctx, digest)
+#define SHA256_STARTS(ctx)              mbedtls_sha256_starts(ctx, 0)
+#define SHA256_UPDATE(ctx, data, size)  mbedtls_sha256_update(ctx, data, size)
+#define SHA256_FINISH(ctx, digest)      mbedtls_sha256_finish(ctx, digest)
+#define SHA1(data, size, digest)        mbedtls_sha1(data, size, digest)
+#define SHA256(data, size, digest)      mbedtls_sha256(data, size, digest, 0)
+#else
+#define SHA1_STARTS(ctx)                mbedtls_sha1_starts_ret(ctx)
+#define SHA1_UPDATE(ctx, data, size)    mbedtls_sha1_update_ret(ctx, data, size)
+#define SHA1_FINISH(ctx, digest)        mbedtls_sha1_finish_ret(ctx, digest)
+#define SHA256_STARTS(ctx)              mbedtls_sha256_starts_ret(ctx, 0)
+#define SHA256_UPDATE(ctx, data, size)  mbedtls_sha256_update_ret(ctx, data, size)
+#define SHA256_FINISH(ctx, digest)      mbedtls_sha256_finish_ret(ctx, digest)
+#define SHA1(data, size, digest)        mbedtls_sha1_ret(data, size, digest)
+#define SHA256(data, size, digest)      mbedtls_sha256_ret(data, size, digest, 0)
+#endif
+
+/**
+ * @brief Hash states after absorbing `key ^ ipad` and `key ^ opad`.
+ */
+typedef struct {
+    bool ready;
+    bool is_sha256;
+    union {
+        struct {
+            mbedtls_sha1_context inner;
+            mbedtls_sha1_context outer;
+        } sha1;
+        struct {
+            mbedtls_sha256_context inner;
+            mbedtls_sha256_context outer;
+        } sha256;
+    };
+} esp_qcloud_hmac_t;
+
+static const char *TAG = "esp_qcloud_credential";
+static esp_qcloud_hmac_t g_credential_hmac[QCLOUD_CREDENTIAL_MAX];
+
+/**
+ * @brief Hash one block in a temporary context and keep a clone of it. The
+ *        clone is a software state, so freeing the temporary context releases
+ *        the SHA engine on the targets whose contexts hold it.
+ */
+static int esp_qcloud_sha1_absorb(mbedtls_sha1_context *state, const uint8_t *block)
+{
+    int ret = 0;
+    mbedtls_sha1_context ctx;
+
+    mbedtls_sha1_init(&ctx);
+    ret = SHA1_STARTS(&ctx);
+    ret = ret ? ret : SHA1_UPDATE(&ctx, block, HMAC_BLOCK_SIZE);
+    mbedtls_sha1_init(state);
+    mbedtls_sha1_clone(state, &ctx);
+    mbedtls_sha1_free(&ctx);
+
+    return ret;
+}
+
+static int esp_qcloud_sha256_absorb(mbedtls_sha256_context *state, const uint8_t *block)
+{
+    int ret = 0;
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    ret = SHA256_STARTS(&ctx);
+    ret = ret ? ret : SHA256_UPDATE(&ctx, block, HMAC_BLOCK_SIZE);
+    mbedtls_sha256_init(state);
+    mbedtls_sha256_clone(state, &ctx);
+    mbedtls_sha256_free(&ctx);
+
+    return ret;
+}
+
+static int esp_qcloud_hmac_prepare(esp_qcloud_hmac_t *hmac, bool sha256, const uint8_t *key, size_t key_len)
+{
+    int ret = 0;
+    uint8_t pad[HMAC_BLOCK_SIZE] = {0};
+
+    hmac->ready     = false;
+    hmac->is_sha256 = sha256;
+
+    /**< Keys longer than a block are hashed first, as defined by RFC 2104 */
+    if (key_len > HMAC_BLOCK_SIZE) {
+        ret = sha256 ? SHA256(key, key_len, pad) : SHA1(key, key_len, pad);
+    } else {
+        memcpy(pad, key, key_len);
+    }
+
+    for (int i = 0; i < HMAC_BLOCK_SIZE; i++) {
+        pad[i] ^= HMAC_IPAD;
+    }
+
+    if (!ret) {
+        ret = sha256 ? esp_qcloud_sha256_absorb(&hmac->sha256.inner, pad)
+              : esp_qcloud_sha1_absorb(&hmac->sha1.inner, pad);
+    }
+
+    for (int i = 0; i < HMAC_BLOCK_SIZE; i++) {
+        pad[i] ^= HMAC_IPAD ^ HMAC_OPAD;
+    }
+
+    if (!ret) {
+        ret = sha256 ? esp_qcloud_sha256_absorb(&hmac->sha256.outer, pad)
+              : esp_qcloud_sha1_absorb(&hmac->sha1.outer, pad);
+    }
+
+    memset(pad, 0, sizeof(pad));
+    hmac->ready = (ret == 0);
+
+    return ret;
+}
+
+/**
+ * @brief Continue from copies of the prepared states, which stay untouched.
+ */
+static int esp_qcloud_hmac_sign(const esp_qcloud_hmac_t *hmac, const void *data, size_t size, uint8_t *digest)
+{
+    int ret = 0;
+
+    if (hmac->is_sha256) {
+        mbedtls_sha256_context ctx;
+
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_clone(&ctx, &hmac->sha256.inner);
+        ret = ret ? ret : SHA256_UPDATE(&ctx, data, size);
+        ret = ret ? ret : SHA256_FINISH(&ctx, digest);
+        mbedtls_sha256_clone(&ctx, &hmac->sha256.outer);
+        ret = ret ? ret : SHA256_UPDATE(&ctx, digest, 32);
+        ret = ret ? ret : SHA256_FINISH(&ctx, digest);
+        mbedtls_sha256_free(&ctx);
+    } else {
+        mbedtls_sha1_context ctx;
+
+        mbedtls_sha1_init(&ctx);
+        mbedtls_sha1_clone(&ctx, &hmac->sha1.inner);
+        ret = ret ? ret : SHA1_UPDATE(&ctx, data, size);
+        ret = ret ? ret : SHA1_FINISH(&ctx, digest);
+        mbedtls_sha1_clone(&ctx, &hmac->sha1.outer);
+        ret = ret ? ret : SHA1_UPDATE(&ctx, digest, 20);
+        ret = ret ? ret : SHA1_FINISH(&ctx, digest);
+        mbedtls_sha1_free(&ctx);
+    }
+
+    return ret;
+}
+
+esp_err_t esp_qcloud_credential_init(const char *device_secret)
+{
+    ESP_QCLOUD_PARAM_CHECK(device_secret);
+
+    int ret = 0;
+    size_t psk_len = 0;
+    uint8_t psk[DEVICE_PSK_MAX_SIZE] = {0};
+
+    /**< The log server checks a signature keyed with the secret string itself */
+    ret = esp_qcloud_hmac_prepare(&g_credential_hmac[QCLOUD_CREDENTIAL_LOG], false,
+                                  (const uint8_t *)device_secret, strlen(device_secret));
+    ESP_QCLOUD_ERROR_CHECK(ret != 0, ESP_FAIL, "Prepare the log key, ret: -0x%04x", -ret);
+
+    g_credential_hmac[QCLOUD_CREDENTIAL_MQTT].ready = false;
+    ret = mbedtls_base64_decode(psk, sizeof(psk), &psk_len, (const uint8_t *)device_secret, strlen(device_secret));
+    ESP_QCLOUD_ERROR_CHECK(ret != 0 || !psk_len, ESP_ERR_INVALID_ARG, "Decode the device secret, ret: -0x%04x", -ret);
+
+    ret = esp_qcloud_hmac_prepare(&g_credential_hmac[QCLOUD_CREDENTIAL_MQTT], true, psk, psk_len);
+    memset(psk, 0, sizeof(psk));
+    ESP_QCLOUD_ERROR_CHECK(ret != 0, ESP_FAIL, "Prepare the MQTT key, ret: -0x%04x", -ret);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_credential_sign(esp_qcloud_credential_key_t key, const void *data, size_t size,
+                                     uint8_t *digest, size_t *digest_size)
+{
+    ESP_QCLOUD_PARAM_CHECK(key < QCLOUD_CREDENTIAL_MAX);
+    ESP_QCLOUD_PARAM_CHECK(data || !size);
+    ESP_QCLOUD_PARAM_CHECK(digest);
+
+    const esp_qcloud_hmac_t *hmac = &g_credential_hmac[key];
+
+    if (!hmac->ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int ret = esp_qcloud_hmac_sign(hmac, data, size, digest);
+    ESP_QCLOUD_ERROR_CHECK(ret != 0, ESP_FAIL, "Sign, ret: -0x%04x", -ret);
+
+    if (digest_size) {
+        *digest_size = hmac->is_sha256 ? 32 : 20;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_qcloud_credential_sign_hex(esp_qcloud_credential_key_t key, const void *data, size_t size,
+                                         char *hex, size_t hex_size)
+{
+    ESP_QCLOUD_PARAM_CHECK(hex);
+
+    static const char hex_char[] = "0123456789abcdef";
+    uint8_t digest[QCLOUD_CREDENTIAL_DIGEST_MAX_SIZE] = {0};
+    size_t digest_size = 0;
+
+    esp_err_t err = esp_qcloud_credential_sign(key, data, size, digest, &digest_size);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (hex_size < digest_size * 2 + 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (int i = 0; i < digest_size; i++) {
+        hex[i * 2]     = hex_char[digest[i] >> 4];
+        hex[i * 2 + 1] = hex_char[digest[i] & 0x0f];
+    }
+
+    hex[digest_size * 2] = '\0';
+
+    return ESP_OK;
+}
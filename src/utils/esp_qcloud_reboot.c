@@ -182,3 +182,29 @@ bool esp_qcloud_reboot_is_exception(bool erase_coredump)
 
     return true;
 }
+
+esp_reset_reason_t esp_qcloud_reboot_reason(const char **name)
+{
+    static const char *reason_name[] = {
+        [ESP_RST_UNKNOWN]   = "unknown",
+        [ESP_RST_POWERON]   = "power on",
+        [ESP_RST_EXT]       = "external pin",
+        [ESP_RST_SW]        = "esp_restart",
+        [ESP_RST_PANIC]     = "panic",
+        [ESP_RST_INT_WDT]   = "interrupt watchdog",
+        [ESP_RST_TASK_WDT]  = "task watchdog",
+        [ESP_RST_WDT]       = "watchdog",
+        [ESP_RST_DEEPSLEEP] = "deep sleep",
+        [ESP_RST_BROWNOUT]  = "brownout",
+        [ESP_RST_SDIO]      = "sdio",
+    };
+
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    if (name) {
+        *name = reason < sizeof(reason_name) / sizeof(reason_name[0]) && reason_name[reason]
+                ? reason_name[reason] : "unknown";
+    }
+
+    return reason;
+}
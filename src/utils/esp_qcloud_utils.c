@@ -58,3 +58,15 @@ void esp_qcloud_print_system_info(uint32_t interval_ms)
                                        true, NULL, show_system_info_timercb);
     xTimerStart(timer, 0);
 }
+
+uint32_t esp_qcloud_hash_str(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,311 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Generate the static tables of a QCloud data template.
+
+The JSON exported by the QCloud console is turned into `<name>.c` and
+`<name>.h`, defining `const esp_qcloud_data_template_t <name>`. Everything is
+const so the ids and the property index are placed in flash, pass it to
+esp_qcloud_device_add_data_template().
+
+usage: data_template_gen.py [--name NAME] [--output-dir DIR] template.json
+"""
+
+from __future__ import print_function
+
+import argparse
+import io
+import json
+import os
+import re
+import sys
+
+HASH_INDEX_MIN_SIZE = 8  # QCLOUD_HASH_INDEX_MIN_SIZE in esp_qcloud_device.c
+
+INT32_MIN = -2147483648
+INT32_MAX = 2147483647
+STRING_MAX = 2048
+
+VAL_TYPES = {
+    'bool': 'QCLOUD_VAL_TYPE_BOOLEAN',
+    'int': 'QCLOUD_VAL_TYPE_INTEGER',
+    'float': 'QCLOUD_VAL_TYPE_FLOAT',
+    'string': 'QCLOUD_VAL_TYPE_STRING',
+    'stringenum': 'QCLOUD_VAL_TYPE_STRING',
+    'struct': 'QCLOUD_VAL_TYPE_STRUCT',
+    'enum': 'QCLOUD_VAL_TYPE_ENUM',
+    'timestamp': 'QCLOUD_VAL_TYPE_TIME',
+}
+
+EVENT_TYPES = {
+    'info': 'QCLOUD_REPORT_EVENT_TYPE_INFO',
+    'alert': 'QCLOUD_REPORT_EVENT_TYPE_ALERT',
+    'fault': 'QCLOUD_REPORT_EVENT_TYPE_FAULT',
+}
+
+
+def hash_str(string):
+    """Same as esp_qcloud_hash_str(), 32-bit FNV-1a"""
+    value = 2166136261
+
+    for byte in bytearray(string.encode('utf-8')):
+        value ^= byte
+        value = (value * 16777619) & 0xffffffff
+
+    return value
+
+
+def hash_index(hashes):
+    """Build the open addressed index the same way as esp_qcloud_hash_index_insert()"""
+    size = HASH_INDEX_MIN_SIZE
+
+    while size < len(hashes) * 2:
+        size <<= 1
+
+    if size > 0xffff:
+        raise ValueError('Too many properties: %d' % len(hashes))
+
+    slot = [0] * size
+
+    for pos, value in enumerate(hashes):
+        i = value & (size - 1)
+
+        while slot[i]:
+            i = (i + 1) & (size - 1)
+
+        slot[i] = pos + 1
+
+    return slot
+
+
+def c_string(string):
+    return '"%s"' % string.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def c_number(value):
+    return repr(float(value))
+
+
+def c_identifier(string):
+    return re.sub(r'\W', '_', string)
+
+
+class Generator(object):
+    def __init__(self, name, template):
+        self.name = name
+        self.template = template
+        self.tables = []
+
+    def schema(self, prefix, item, writable):
+        """Return the initializer of an esp_qcloud_property_schema_t"""
+        define = item.get('define', {})
+        data_type = define.get('type')
+
+        if data_type not in VAL_TYPES:
+            raise ValueError('%s: unsupported type "%s"' % (item.get('id'), data_type))
+
+        val_type = VAL_TYPES[data_type]
+        min_value, max_value = 0, 0
+        enum_value, enum_num = 'NULL', 0
+
+        if data_type == 'bool':
+            max_value = 1
+        elif data_type in ('int', 'float'):
+            min_value = float(define.get('min', INT32_MIN))
+            max_value = float(define.get('max', INT32_MAX))
+        elif data_type == 'timestamp':
+            min_value, max_value = 0, 0xffffffff
+        elif data_type == 'string':
+            min_value = int(define.get('min', 0))
+            max_value = int(define.get('max', STRING_MAX))
+        elif data_type == 'stringenum':
+            max_value = max([len(key) for key in define.get('mapping', {'': ''})])
+        elif data_type == 'enum':
+            values = sorted([int(key) for key in define.get('mapping', {})])
+            enum_value = '%s_%s_enum' % (prefix, c_identifier(item['id']))
+            enum_num = len(values)
+            self.tables.append('static const int32_t %s[] = {%s};' % (
+                enum_value, ', '.join([str(value) for value in values])))
+
+        return '{%s, 0x%08x, %s, %s, %s, %s, %s, %d}' % (
+            c_string(item['id']), hash_str(item['id']), val_type,
+            'true' if writable else 'false',
+            c_number(min_value), c_number(max_value), enum_value, enum_num)
+
+    def schema_table(self, table, items, writable):
+        """Emit a table of schemas, return its name and size as initializers"""
+        if not items:
+            return 'NULL', 0
+
+        lines = ['static const esp_qcloud_property_schema_t %s[] = {' % table]
+
+        for item in items:
+            lines.append('    %s,' % self.schema(table, item, writable))
+
+        lines.append('};')
+        self.tables.append('\n'.join(lines))
+
+        return table, len(items)
+
+    def source(self):
+        prefix = 's_' + self.name
+        properties = self.template.get('properties', [])
+        actions = self.template.get('actions', [])
+        events = self.template.get('events', [])
+        ids = [item['id'] for item in properties]
+
+        if len(set(ids)) != len(ids):
+            raise ValueError('Duplicate property id')
+
+        property_table = 'NULL'
+
+        if properties:
+            property_table = prefix + '_property'
+            lines = ['static const esp_qcloud_property_schema_t %s[] = {' % property_table]
+
+            for item in properties:
+                lines.append('    %s,' % self.schema(property_table, item, item.get('mode', 'rw') == 'rw'))
+
+            lines.append('};')
+            self.tables.append('\n'.join(lines))
+
+        slot = hash_index([hash_str(item) for item in ids])
+        self.tables.append('static const uint16_t %s_property_slot[] = {%s};' % (
+            prefix, ', '.join([str(value) for value in slot])))
+
+        action_table = 'NULL'
+
+        if actions:
+            lines = []
+
+            for item in actions:
+                name = '%s_action_%s' % (prefix, c_identifier(item['id']))
+                input_table = self.schema_table(name + '_input', item.get('input', []), True)
+                output_table = self.schema_table(name + '_output', item.get('output', []), False)
+                lines.append('    {%s, 0x%08x, %s, %d, %s, %d},' % (
+                    c_string(item['id']), hash_str(item['id']),
+                    input_table[0], input_table[1], output_table[0], output_table[1]))
+
+            action_table = prefix + '_action'
+            self.tables.append('\n'.join(['static const esp_qcloud_action_schema_t %s[] = {' % action_table]
+                                         + lines + ['};']))
+
+        event_table = 'NULL'
+
+        if events:
+            lines = []
+
+            for item in events:
+                if item.get('type') not in EVENT_TYPES:
+                    raise ValueError('%s: unsupported event type "%s"' % (item.get('id'), item.get('type')))
+
+                name = '%s_event_%s' % (prefix, c_identifier(item['id']))
+                param_table = self.schema_table(name + '_param', item.get('params', []), False)
+                lines.append('    {%s, 0x%08x, %s, %s, %d},' % (
+                    c_string(item['id']), hash_str(item['id']), EVENT_TYPES[item['type']],
+                    param_table[0], param_table[1]))
+
+            event_table = prefix + '_event'
+            self.tables.append('\n'.join(['static const esp_qcloud_event_schema_t %s[] = {' % event_table]
+                                         + lines + ['};']))
+
+        product_id = self.template.get('profile', {}).get('ProductId')
+
+        return '\n'.join([
+            '/* Generated by data_template_gen.py, do not edit */',
+            '',
+            '#include "%s.h"' % self.name,
+            '',
+            '\n\n'.join(self.tables),
+            '',
+            'const esp_qcloud_data_template_t %s = {' % self.name,
+            '    .product_id    = %s,' % (c_string(product_id) if product_id else 'NULL'),
+            '    .property      = %s,' % property_table,
+            '    .property_num  = %d,' % len(properties),
+            '    .property_slot = %s_property_slot,' % prefix,
+            '    .property_mask = %d,' % (len(slot) - 1),
+            '    .action        = %s,' % action_table,
+            '    .action_num    = %d,' % len(actions),
+            '    .event         = %s,' % event_table,
+            '    .event_num     = %d,' % len(events),
+            '};',
+            '',
+        ])
+
+    def header(self):
+        return '\n'.join([
+            '/* Generated by data_template_gen.py, do not edit */',
+            '',
+            '#pragma once',
+            '',
+            '#include "esp_qcloud_data_template.h"',
+            '',
+            '#ifdef __cplusplus',
+            'extern "C" {',
+            '#endif',
+            '',
+            'extern const esp_qcloud_data_template_t %s;' % self.name,
+            '',
+            '#ifdef __cplusplus',
+            '}',
+            '#endif',
+            '',
+        ])
+
+
+def write_if_changed(path, content):
+    """Keep the timestamp when nothing changes to avoid rebuilding the users"""
+    if os.path.exists(path):
+        with io.open(path, 'r', encoding='utf-8') as f:
+            if f.read() == content:
+                return
+
+    with io.open(path, 'w', encoding='utf-8') as f:
+        f.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the static tables of a QCloud data template')
+    parser.add_argument('template', help='Data template JSON exported by the QCloud console')
+    parser.add_argument('--name', help='Name of the generated files and variable, the file name by default')
+    parser.add_argument('--output-dir', default='.', help='Directory of the generated files')
+    args = parser.parse_args()
+
+    name = c_identifier(args.name or os.path.splitext(os.path.basename(args.template))[0])
+
+    with io.open(args.template, 'r', encoding='utf-8') as f:
+        template = json.load(f)
+
+    generator = Generator(name, template)
+
+    try:
+        source = generator.source()
+    except (KeyError, ValueError) as e:
+        print('%s: %s' % (args.template, e), file=sys.stderr)
+        return 1
+
+    if not os.path.isdir(args.output_dir):
+        os.makedirs(args.output_dir)
+
+    write_if_changed(os.path.join(args.output_dir, name + '.c'), source)
+    write_if_changed(os.path.join(args.output_dir, name + '.h'), generator.header())
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
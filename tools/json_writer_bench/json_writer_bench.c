@@ -0,0 +1,238 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Compare the heap allocations and the throughput of the payload
+ *        encoding of a publish with the streaming writer and with cJSON.
+ *
+ * @note Both paths do what esp_qcloud_iothub_publish() does for a property
+ *       report and an event: format the topic and the clientToken, encode
+ *       the payload and free what was allocated. The cJSON path is the one
+ *       used before the writer. Allocations are counted by replacing the
+ *       malloc() of glibc, which also sees those of asprintf().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_qcloud_json.h"
+
+#ifdef BENCH_CJSON
+#include "cJSON.h"
+#endif
+
+#define BENCH_PUBLISH_NUM       (200000)
+#define BENCH_PAYLOAD_MAX_SIZE  (2048)  /**< CONFIG_QCLOUD_IOTHUB_PAYLOAD_MAX_SIZE */
+#define BENCH_PRODUCT_ID        "PRODUCT001"
+#define BENCH_DEVICE_NAME       "device_0"
+
+typedef size_t (*bench_publish_t)(bool event);
+
+static size_t g_alloc_count = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    g_alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+    g_alloc_count++;
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    g_alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif /**< __GLIBC__ */
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief The properties of a light, as the examples report them
+ */
+static esp_err_t bench_write_property(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_json_add_int(writer, "power_switch", 1);
+    esp_qcloud_json_add_int(writer, "brightness", 87);
+    esp_qcloud_json_add_int(writer, "color_mode", 2);
+    esp_qcloud_json_add_int(writer, "color_temp", 4500);
+    esp_qcloud_json_add_float(writer, "hue", 212.5f);
+    esp_qcloud_json_add_float(writer, "saturation", 0.75f);
+    esp_qcloud_json_add_string(writer, "name", "living room");
+    esp_qcloud_json_add_int(writer, "work_mode", 3);
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_write_event(esp_qcloud_json_writer_t *writer, void *arg)
+{
+    esp_qcloud_json_add_int(writer, "status", 1);
+    esp_qcloud_json_add_string(writer, "message", "over temperature, \"fan\" started");
+
+    return ESP_OK;
+}
+
+static size_t bench_writer_publish(bool event)
+{
+    char publish_topic[96] = {0};
+    char *publish_data = malloc(BENCH_PAYLOAD_MAX_SIZE);
+    char token[40] = {0};
+    esp_qcloud_json_writer_t writer = {0};
+
+    snprintf(publish_topic, sizeof(publish_topic), "$thing/up/%s/%s/%s",
+             event ? "event" : "property", BENCH_PRODUCT_ID, BENCH_DEVICE_NAME);
+
+    esp_qcloud_json_writer_init(&writer, publish_data, BENCH_PAYLOAD_MAX_SIZE);
+    esp_qcloud_json_add_string(&writer, "method", event ? "event_post" : "report");
+    snprintf(token, sizeof(token), "%s-%05d", BENCH_DEVICE_NAME, rand() % 100000);
+    esp_qcloud_json_add_string(&writer, "clientToken", token);
+
+    if (event) {
+        esp_qcloud_json_add_string(&writer, "type", "alert");
+        esp_qcloud_json_add_string(&writer, "eventId", "over_heat");
+        esp_qcloud_json_add_string(&writer, "version", "1.0");
+    }
+
+    esp_qcloud_json_add_double(&writer, "timestamp", 1600000000123.0);
+    esp_qcloud_json_add_object(&writer, "params", event ? bench_write_event : bench_write_property, NULL);
+
+    if (esp_qcloud_json_writer_finish(&writer) != ESP_OK) {
+        printf("FAIL: the payload exceeds %d bytes\n", BENCH_PAYLOAD_MAX_SIZE);
+        exit(1);
+    }
+
+    free(publish_data);
+
+    return writer.len + strlen(publish_topic);
+}
+
+#ifdef BENCH_CJSON
+/**
+ * @brief The encoding before the streaming writer
+ */
+static size_t bench_cjson_publish(bool event)
+{
+    char *publish_topic = NULL;
+    char *token         = NULL;
+
+    asprintf(&publish_topic, "$thing/up/%s/%s/%s",
+             event ? "event" : "property", BENCH_PRODUCT_ID, BENCH_DEVICE_NAME);
+
+    cJSON *params = cJSON_CreateObject();
+
+    if (event) {
+        cJSON_AddNumberToObject(params, "status", 1);
+        cJSON_AddStringToObject(params, "message", "over temperature, \"fan\" started");
+    } else {
+        cJSON_AddNumberToObject(params, "power_switch", 1);
+        cJSON_AddNumberToObject(params, "brightness", 87);
+        cJSON_AddNumberToObject(params, "color_mode", 2);
+        cJSON_AddNumberToObject(params, "color_temp", 4500);
+        cJSON_AddNumberToObject(params, "hue", 212.5f);
+        cJSON_AddNumberToObject(params, "saturation", 0.75f);
+        cJSON_AddStringToObject(params, "name", "living room");
+        cJSON_AddNumberToObject(params, "work_mode", 3);
+    }
+
+    cJSON *json_publish_data = cJSON_CreateObject();
+    cJSON_AddStringToObject(json_publish_data, "method", event ? "event_post" : "report");
+    asprintf(&token, "%s-%05d", BENCH_DEVICE_NAME, rand() % 100000);
+    cJSON_AddStringToObject(json_publish_data, "clientToken", token);
+    free(token);
+    cJSON_AddItemReferenceToObject(json_publish_data, "params", params);
+
+    if (event) {
+        cJSON_AddStringToObject(json_publish_data, "type", "alert");
+        cJSON_AddStringToObject(json_publish_data, "eventId", "over_heat");
+        cJSON_AddStringToObject(json_publish_data, "version", "1.0");
+    }
+
+    cJSON_AddNumberToObject(json_publish_data, "timestamp", 1600000000123.0);
+
+    char *publish_data = cJSON_PrintUnformatted(json_publish_data);
+    cJSON_Delete(json_publish_data);
+    cJSON_Delete(params);
+
+    size_t size = strlen(publish_data) + strlen(publish_topic);
+    free(publish_data);
+    free(publish_topic);
+
+    return size;
+}
+#endif /**< BENCH_CJSON */
+
+static void bench_run(const char *name, bench_publish_t publish, bool event)
+{
+    size_t bytes = 0;
+
+    g_alloc_count = 0;
+    double start = bench_now_ns();
+
+    for (int i = 0; i < BENCH_PUBLISH_NUM; ++i) {
+        bytes += publish(event);
+    }
+
+    double elapsed_ns = bench_now_ns() - start;
+
+#ifdef __GLIBC__
+    printf("%-8s %-10s %10zu %16.1f %14.1f %12.1f\n", name, event ? "event" : "report", bytes / BENCH_PUBLISH_NUM,
+           (double)g_alloc_count / BENCH_PUBLISH_NUM, elapsed_ns / BENCH_PUBLISH_NUM, bytes / elapsed_ns * 1e3);
+#else
+    printf("%-8s %-10s %10zu %16s %14.1f %12.1f\n", name, event ? "event" : "report", bytes / BENCH_PUBLISH_NUM,
+           "n/a", elapsed_ns / BENCH_PUBLISH_NUM, bytes / elapsed_ns * 1e3);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    srand(1);
+
+    printf("%-8s %-10s %10s %16s %14s %12s\n", "encoder", "payload", "bytes", "allocs/publish", "ns/publish", "MB/s");
+
+    for (int event = 0; event < 2; ++event) {
+        bench_run("writer", bench_writer_publish, event);
+#ifdef BENCH_CJSON
+        bench_run("cJSON", bench_cjson_publish, event);
+#endif
+    }
+
+#ifndef BENCH_CJSON
+    printf("cJSON is not built, set CJSON_DIR to the directory of cJSON.c\n");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Compression ratio and cost of the flash log blocks for each size of
+ *        the staging buffer (CONFIG_QCLOUD_LOG_FLASH_STAGE_SIZE).
+ *
+ * @note The log is the text printed by `log -r` or a serial capture, a
+ *       synthetic log of the component is used without a file. The blocks
+ *       are cut at line ends as the staging buffer does, each line being a
+ *       record with its 16 bytes header. The cost on the device is printed
+ *       by `log -s`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_qcloud_log_lz.h"
+
+#define BENCH_RECORD_HEADER_SIZE    (16)    /**< log_flash_record_t */
+#define BENCH_ROUNDS                (20)
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char *bench_log_generate(size_t *size)
+{
+    static const char *tags[] = {"esp_qcloud_iothub", "esp_qcloud_mqtt", "esp_qcloud_prov", "app_main", "wifi"};
+    size_t capacity = 256 * 1024;
+    char *log = malloc(capacity);
+    size_t len = 0;
+
+    srand(1);
+
+    for (uint32_t i = 0; len + 256 < capacity; ++i) {
+        uint32_t ms = 1000 + i * 37;
+
+        switch (rand() % 4) {
+            case 0:
+                len += sprintf(log + len, "I (%u) %s: <esp_qcloud_mqtt_publish, 312> topic: $thing/up/property/PRODUCT001/device_%d, "
+                               "data: {\"method\":\"report\",\"clientToken\":\"device_%d-%u\",\"params\":{\"power_switch\":%d,\"brightness\":%d}}\n",
+                               ms, tags[1], rand() % 4, rand() % 4, i, rand() % 2, rand() % 100);
+                break;
+
+            case 1:
+                len += sprintf(log + len, "I (%u) %s: property report_reply, code: 0, status: success, token: device_0-%u\n",
+                               ms, tags[0], i);
+                break;
+
+            case 2:
+                len += sprintf(log + len, "W (%u) %s: <%s, %d> free heap: %d, minimum: %d\n",
+                               ms, tags[rand() % 5], "esp_qcloud_device_report", 100 + rand() % 300, 100000 + rand() % 5000, 90000);
+                break;
+
+            default:
+                len += sprintf(log + len, "D (%u) %s: rssi: %d, channel: %d, ip: 192.168.%d.%d\n",
+                               ms, tags[4], -40 - rand() % 40, 1 + rand() % 13, rand() % 4, rand() % 255);
+                break;
+        }
+    }
+
+    *size = len;
+    return log;
+}
+
+static char *bench_log_read(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *log = malloc(*size + 1);
+    *size = fread(log, 1, *size, file);
+    fclose(file);
+
+    return log;
+}
+
+/**
+ * @brief Cut the log into blocks of whole records, as the staging buffer does
+ */
+static size_t bench_block_next(const char *log, size_t log_size, size_t pos, size_t block_size,
+                               uint8_t *block, size_t *consumed)
+{
+    size_t size = 0;
+    size_t end  = pos;
+
+    while (end < log_size) {
+        const char *line = memchr(log + end, '\n', log_size - end);
+        size_t line_size = line ? line - (log + end) + 1 : log_size - end;
+        size_t record_size = (BENCH_RECORD_HEADER_SIZE + line_size + 3) & ~3;
+
+        if (size + record_size > block_size) {
+            break;
+        }
+
+        /**< The headers of a block differ in the time and the CRC */
+        memset(block + size, 0, BENCH_RECORD_HEADER_SIZE);
+        block[size]     = 0x52;
+        block[size + 1] = 0x4c;
+        block[size + 2] = 3;
+        block[size + 4] = line_size & 0xff;
+        block[size + 5] = line_size >> 8;
+        *(uint32_t *)(block + size + 8)  = 1600000000 + (uint32_t)end / 64;
+        *(uint32_t *)(block + size + 12) = rand();
+        memcpy(block + size + BENCH_RECORD_HEADER_SIZE, log + end, line_size);
+        memset(block + size + BENCH_RECORD_HEADER_SIZE + line_size, 0xff, record_size - BENCH_RECORD_HEADER_SIZE - line_size);
+
+        size += record_size;
+        end  += line_size;
+    }
+
+    *consumed = end - pos;
+    return size;
+}
+
+static void bench_run(const char *log, size_t log_size, size_t block_size)
+{
+    static esp_qcloud_log_lz_t lz;
+    uint8_t *block = malloc(block_size);
+    uint8_t *compressed = malloc(block_size);
+    uint8_t *back = malloc(block_size);
+    size_t raw_total = 0, compressed_total = 0, stored = 0, blocks = 0;
+    double compress_ns = 0, decompress_ns = 0;
+
+    for (size_t pos = 0, consumed = 0; pos < log_size; pos += consumed) {
+        size_t size = bench_block_next(log, log_size, pos, block_size, block, &consumed);
+
+        if (!size) {
+            break;
+        }
+
+        double start = bench_now_ns();
+        size_t compressed_size = 0;
+
+        for (int i = 0; i < BENCH_ROUNDS; ++i) {
+            compressed_size = esp_qcloud_log_lz_compress(&lz, block, size, compressed, size - BENCH_RECORD_HEADER_SIZE - 4);
+        }
+
+        compress_ns += (bench_now_ns() - start) / BENCH_ROUNDS;
+        raw_total   += size;
+        blocks++;
+
+        /**< A block that does not shrink is written as it is */
+        if (!compressed_size) {
+            compressed_total += size;
+            continue;
+        }
+
+        start = bench_now_ns();
+
+        for (int i = 0; i < BENCH_ROUNDS; ++i) {
+            if (esp_qcloud_log_lz_decompress(compressed, compressed_size, back, block_size) != size
+                    || memcmp(back, block, size)) {
+                printf("FAIL: block %zu does not decompress\n", blocks);
+                exit(1);
+            }
+        }
+
+        decompress_ns += (bench_now_ns() - start) / BENCH_ROUNDS;
+        compressed_total += (BENCH_RECORD_HEADER_SIZE + compressed_size + 3) & ~3;
+        stored++;
+    }
+
+    printf("%8zu %8zu %10zu %12zu %8.2f %14.1f %16.1f\n", block_size, blocks, raw_total, compressed_total,
+           (double)raw_total / compressed_total, compress_ns / 1000 / (raw_total / 1024.0),
+           decompress_ns / 1000 / (raw_total / 1024.0));
+
+    free(block);
+    free(compressed);
+    free(back);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t block_size[] = {256, 512, 1024, 2048, 4096};
+    size_t log_size = 0;
+    char *log = argc > 1 ? bench_log_read(argv[1], &log_size) : bench_log_generate(&log_size);
+
+    if (!log) {
+        printf("Failed to read %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("log: %s, %zu bytes\n", argc > 1 ? argv[1] : "synthetic", log_size);
+    printf("%8s %8s %10s %12s %8s %14s %16s\n", "block", "blocks", "raw", "compressed", "ratio",
+           "compress(us/KB)", "decompress(us/KB)");
+
+    for (size_t i = 0; i < sizeof(block_size) / sizeof(block_size[0]); i++) {
+        bench_run(log, log_size, block_size[i]);
+    }
+
+    free(log);
+    return 0;
+}
@@ -0,0 +1,480 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Turn the flash log written with CONFIG_QCLOUD_LOG_BINARY back into text.
+
+Binary records (esp_qcloud_log_binary_t in src/log/esp_qcloud_log_binary.h)
+hold the address of their format and a copy of the arguments, the formats are
+read from the ELF of the firmware that wrote them. The lines kept as text are
+copied as they are. A segment keeps the first bytes of the SHA256 of the ELF
+that opened it, the binary records of the segments of another firmware are
+skipped, as the firmware does.
+
+The input is either the output of `log -r` (-t b64) or a dump of the log
+partition (-t raw), e.g. from `parttool.py read_partition`. The segments of
+a dump are read the same way as esp_qcloud_log_flash_read() does, --from,
+--to and --level skip the segments by their index the same way as
+esp_qcloud_log_flash_read_range() does, --index prints the indexes. The
+blocks written with CONFIG_QCLOUD_LOG_FLASH_COMPRESS are decompressed.
+
+usage: log_decoder.py [-t {raw,b64}] [--utc] [--from TIME] [--to TIME]
+                      [--level LEVEL] [--index] input elf
+"""
+
+from __future__ import print_function
+
+import argparse
+import base64
+import calendar
+import hashlib
+import io
+import re
+import struct
+import sys
+import time
+import zlib
+
+BINARY_MAGIC = 0x00     # QCLOUD_LOG_BINARY_MAGIC
+BINARY_HEADER = struct.Struct('<BBHII')
+ERASED = 0xff
+
+# src/log/esp_qcloud_log_flash.c
+SEGMENT_MAGIC = 0x334C4451
+SEGMENT_HEADER = struct.Struct('<III8s')        # magic, seq, size, image
+SEGMENT_INDEX = struct.Struct('<II6HI')         # time_min, time_max, level_num, crc
+SEGMENT_INDEX_ERASED = b'\xff' * SEGMENT_INDEX.size
+SEGMENT_ALIGN = 4096
+RECORD_MAGIC = 0x4C52
+RECORD_HEADER = struct.Struct('<HBBHHII')       # magic, level, flags, size, block_size, time, crc
+RECORD_BINARY = 0x01
+RECORD_BLOCK = 0x02
+
+# src/log/esp_qcloud_log_lz.c
+LZ_MATCH_MIN = 3
+LZ_MATCH_SHORT_MAX = LZ_MATCH_MIN + 14
+
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+
+# %[flags][width][.precision][length]conversion, same as esp_qcloud_log_spec_next()
+SPEC_RE = re.compile(r'%([-+ #0]*)(\*|\d*)(?:\.(\*|\d*))?(hh|h|ll|l|z|j|t|L)?([diouxXceEfFgGaAsp%])')
+
+# Size of the argument captured for each length, the firmware is ILP32
+LENGTH_SIZE = {None: 4, 'hh': 4, 'h': 4, 'l': 4, 'z': 4, 't': 4, 'll': 8, 'j': 8}
+# Bits the conversion keeps of the integer
+LENGTH_BITS = {'hh': 8, 'h': 16}
+
+LEVELS = ['N', 'E', 'W', 'I', 'D', 'V']   # esp_log_level_t
+
+
+class Elf(object):
+    """The allocated sections of an ELF file, enough to read the formats"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF':
+            raise ValueError('%s is not an ELF file' % path)
+
+        # esp_app_desc_t.app_elf_sha256, QCLOUD_LOG_BINARY_IMAGE_SIZE bytes of it
+        self.image = hashlib.sha256(self.data).digest()[:8]
+
+        is_64 = bytearray(self.data)[4] == 2
+        endian = '<' if bytearray(self.data)[5] == 1 else '>'
+
+        if is_64:
+            shoff, = struct.unpack_from(endian + 'Q', self.data, 0x28)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x3a)
+            section = struct.Struct(endian + 'IIQQQQIIQQ')
+        else:
+            shoff, = struct.unpack_from(endian + 'I', self.data, 0x20)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x2e)
+            section = struct.Struct(endian + 'IIIIIIIIII')
+
+        self.sections = []
+
+        for i in range(shnum):
+            _, sh_type, sh_flags, sh_addr, sh_offset, sh_size = section.unpack_from(
+                self.data, shoff + i * shentsize)[:6]
+
+            if sh_flags & SHF_ALLOC and sh_type != SHT_NOBITS and sh_size:
+                self.sections.append((sh_addr, sh_size, sh_offset))
+
+    def string(self, addr):
+        for sh_addr, sh_size, sh_offset in self.sections:
+            if sh_addr <= addr < sh_addr + sh_size:
+                start = sh_offset + addr - sh_addr
+                end = self.data.index(b'\0', start, sh_offset + sh_size)
+                return self.data[start:end].decode('utf-8', 'replace')
+
+        return None
+
+
+class Args(object):
+    """Reader of the arguments captured by esp_qcloud_log_binary_encode()"""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def integer(self, size, signed):
+        value = struct.unpack_from('<' + {4: 'I', 8: 'Q'}[size], self.data, self.pos)[0]
+        self.pos += size
+
+        if signed and value >> (size * 8 - 1):
+            value -= 1 << (size * 8)
+
+        return value
+
+    def double(self):
+        value, = struct.unpack_from('<d', self.data, self.pos)
+        self.pos += 8
+        return value
+
+    def string(self):
+        end = self.data.index(b'\0', self.pos)
+        value = self.data[self.pos:end].decode('utf-8', 'replace')
+        self.pos = end + 1
+        return value
+
+
+def format_conversion(match, args):
+    """Format one conversion, the '*' are replaced by their values first"""
+    flags, width, precision, length, conv = match.groups()
+
+    if conv == '%':
+        return '%'
+
+    if width == '*':
+        width = args.integer(4, True)
+
+        if width < 0:
+            flags, width = flags + '-', -width
+
+        width = str(width)
+
+    if precision == '*':
+        precision = args.integer(4, True)
+        precision = None if precision < 0 else str(precision)
+
+    spec = '%' + flags + width + ('.' + precision if precision is not None else '')
+
+    if conv in 'diouxXc':
+        if length == 'L':
+            raise ValueError('long double')
+
+        signed = conv in 'di'
+        value = args.integer(LENGTH_SIZE[length], signed)
+        bits = LENGTH_BITS.get(length)
+
+        if bits:
+            value &= (1 << bits) - 1
+
+            if signed and value >> (bits - 1):
+                value -= 1 << bits
+
+        if conv == 'c':
+            return (spec + 's') % chr(value & 0xff)
+
+        text = (spec + {'i': 'd', 'u': 'd'}.get(conv, conv)) % value
+
+        # Python writes "%#o" as "0o..."
+        return text.replace('0o', '0', 1) if conv == 'o' and '#' in flags else text
+
+    if conv in 'eEfFgGaA':
+        value = args.double()
+
+        if conv in 'aA':
+            text = float.hex(value)
+            return (spec + 's') % (text.upper() if conv == 'A' else text)
+
+        return (spec + conv) % value
+
+    if conv == 's':
+        return (spec + 's') % args.string()
+
+    # 'p', newlib prints it as "0x%x"
+    return (spec + 's') % ('0x%x' % args.integer(4, False))
+
+
+def format_record(fmt, data):
+    args = Args(data)
+    return SPEC_RE.sub(lambda match: format_conversion(match, args), fmt)
+
+
+def lz_decompress(src, size):
+    """Same as esp_qcloud_log_lz_decompress(), None if the block is malformed"""
+    src = bytearray(src)
+    dst = bytearray()
+    pos = 0
+
+    while pos < len(src):
+        flag = src[pos]
+        pos += 1
+
+        for item in range(8):
+            if pos >= len(src):
+                break
+
+            if not flag & (1 << item):
+                dst.append(src[pos])
+                pos += 1
+                continue
+
+            if pos + 2 > len(src):
+                return None
+
+            offset = (src[pos] | (src[pos + 1] >> 4) << 8) + 1
+            length = (src[pos + 1] & 0x0f) + LZ_MATCH_MIN
+            pos += 2
+
+            if length == LZ_MATCH_SHORT_MAX + 1:
+                if pos >= len(src):
+                    return None
+
+                length += src[pos]
+                pos += 1
+
+            if offset > len(dst):
+                return None
+
+            # Byte by byte, a match may overlap what it copies
+            for _ in range(length):
+                dst.append(dst[-offset])
+
+    return bytes(dst) if len(dst) == size else None
+
+
+def read_records(data, start, end):
+    """Records between `start` and `end`, the ones of a block in place of the block"""
+    offset = start
+
+    while offset + RECORD_HEADER.size <= end:
+        magic, level, flags, size, block_size, log_time, crc = RECORD_HEADER.unpack_from(data, offset)
+        record_end = offset + RECORD_HEADER.size + size
+
+        if magic != RECORD_MAGIC or record_end > end:
+            break
+
+        record = bytes(data[offset + RECORD_HEADER.size:record_end])
+        offset += (RECORD_HEADER.size + size + 3) & ~3
+
+        if not flags & RECORD_BLOCK:
+            yield level, flags, log_time, crc, record
+            continue
+
+        # A block that cannot be read is skipped as a whole, as log_flash_block_load() does
+        if zlib.crc32(record) & 0xffffffff != crc:
+            continue
+
+        block = lz_decompress(record, block_size)
+
+        if block is not None:
+            for inner in read_records(block, 0, len(block)):
+                yield inner
+
+
+def read_index(data, offset):
+    """Index of a closed segment, None for the one being written or a cut one"""
+    raw = data[offset:offset + SEGMENT_INDEX.size]
+
+    if raw == SEGMENT_INDEX_ERASED:
+        return None
+
+    fields = SEGMENT_INDEX.unpack(raw)
+
+    if zlib.crc32(raw[:-4]) & 0xffffffff != fields[-1]:
+        return None
+
+    return fields[0], fields[1], fields[2:-1]
+
+
+def index_match(index, time_start, time_end, level):
+    """Same as log_flash_index_match()"""
+    if index is None:
+        return True
+
+    time_min, time_max, level_num = index
+
+    if time_max < time_start or (time_end and time_min >= time_end):
+        return False
+
+    return any(level_num[:level + 1])
+
+
+def read_partition(data, image, utc, time_start=0, time_end=0, level=len(LEVELS) - 1, show_index=False):
+    """Records of all the segments from the oldest one, as `log -r` prints them"""
+    localtime = time.gmtime if utc else time.localtime
+    segments = []
+    foreign_num = 0
+
+    for offset in range(0, len(data) - SEGMENT_HEADER.size + 1, SEGMENT_ALIGN):
+        magic, seq, size, segment_image = SEGMENT_HEADER.unpack_from(data, offset)
+
+        if magic == SEGMENT_MAGIC and 0 < seq < 0xffffffff and offset + size <= len(data):
+            segments.append((seq, offset, size, segment_image != image))
+
+    stream = []
+    line_start = True
+
+    for seq, start, size, foreign in sorted(segments):
+        index = read_index(data, start + SEGMENT_HEADER.size)
+
+        if show_index:
+            if index is None:
+                print('segment %d at 0x%x: no index' % (seq, start), file=sys.stderr)
+            else:
+                print('segment %d at 0x%x: time %d - %d, %s' % (
+                    seq, start, index[0], index[1],
+                    ', '.join('%s: %d' % (name, num) for name, num in zip(LEVELS[1:], index[2][1:]))),
+                    file=sys.stderr)
+
+        if not index_match(index, time_start, time_end, level):
+            continue
+
+        for record_level, flags, log_time, crc, record in read_records(
+                data, start + SEGMENT_HEADER.size + SEGMENT_INDEX.size, start + size):
+            if record_level > level or log_time < time_start or (time_end and log_time >= time_end):
+                continue
+
+            if zlib.crc32(record) & 0xffffffff != crc:
+                continue
+
+            if flags & RECORD_BINARY:
+                if foreign:
+                    foreign_num += 1
+                else:
+                    stream.append(record)
+                continue
+
+            if line_start:
+                stream.append(time.strftime('[%Y-%m-%d %H:%M:%S] ', localtime(log_time)).encode())
+
+            stream.append(record)
+            line_start = record.endswith(b'\n')
+
+    if foreign_num:
+        print('%d binary records of another firmware skipped' % foreign_num, file=sys.stderr)
+
+    return b''.join(stream)
+
+
+def parse_time(string, utc):
+    """A unix time or 'YYYY-MM-DD HH:MM[:SS]'"""
+    if string.isdigit():
+        return int(string)
+
+    for fmt in ('%Y-%m-%d %H:%M:%S', '%Y-%m-%d %H:%M'):
+        try:
+            tm = time.strptime(string, fmt)
+        except ValueError:
+            continue
+
+        return int(calendar.timegm(tm) if utc else time.mktime(tm))
+
+    raise argparse.ArgumentTypeError('invalid time: %s' % string)
+
+
+def decode(data, elf, utc, out):
+    data = bytearray(data)
+    pos = 0
+    line_start = True
+    localtime = time.gmtime if utc else time.localtime
+
+    while pos < len(data):
+        if data[pos] == ERASED:
+            pos += 1
+            continue
+
+        if data[pos] == BINARY_MAGIC:
+            if pos + BINARY_HEADER.size > len(data):
+                break
+
+            _, level, args_size, fmt_addr, log_time = BINARY_HEADER.unpack_from(data, pos)
+            args = bytes(data[pos + BINARY_HEADER.size:pos + BINARY_HEADER.size + args_size])
+            pos += BINARY_HEADER.size + args_size
+
+            fmt = elf.string(fmt_addr)
+            stamp = time.strftime('[%Y-%m-%d %H:%M:%S] ', localtime(log_time))
+
+            if fmt is None:
+                text = '<format 0x%08x not found in the ELF, level: %d>\n' % (fmt_addr, level)
+            else:
+                try:
+                    text = format_record(fmt, args)
+                except (ValueError, IndexError, struct.error) as e:
+                    text = '<bad record of format 0x%08x "%s": %s>\n' % (fmt_addr, fmt.strip(), e)
+
+            out.write(('' if line_start else '\n') + stamp + text)
+            line_start = text.endswith('\n')
+            continue
+
+        end = pos
+
+        while end < len(data) and data[end] not in (ERASED, BINARY_MAGIC):
+            end += 1
+
+        text = bytes(data[pos:end]).decode('utf-8', 'replace')
+        out.write(text)
+        line_start = text.endswith('\n')
+        pos = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Turn the binary flash log back into text')
+    parser.add_argument('input', help='Output of `log -r` or dump of the log partition')
+    parser.add_argument('elf', help='ELF of the firmware that wrote the log')
+    parser.add_argument('-t', '--type', choices=['raw', 'b64'], default='raw',
+                        help='b64: base64 lines printed by `log -r`, raw: partition dump')
+    parser.add_argument('--utc', action='store_true', help='Print the time in UTC instead of the local time')
+    parser.add_argument('--from', dest='time_from', default='0',
+                        help='raw: records from this time, unix time or "YYYY-MM-DD HH:MM[:SS]"')
+    parser.add_argument('--to', dest='time_to', default='0',
+                        help='raw: records before this time, unix time or "YYYY-MM-DD HH:MM[:SS]"')
+    parser.add_argument('--level', choices=LEVELS[1:], default=LEVELS[-1],
+                        help='raw: records of this level or more severe')
+    parser.add_argument('--index', action='store_true', help='raw: print the index of the segments to stderr')
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    if args.type == 'raw':
+        try:
+            time_start = parse_time(args.time_from, args.utc)
+            time_end = parse_time(args.time_to, args.utc)
+        except argparse.ArgumentTypeError as e:
+            parser.error(str(e))
+
+        data = read_partition(data, elf.image, args.utc, time_start, time_end, LEVELS.index(args.level), args.index)
+    else:
+        # Each line is encoded on its own, anything else printed by the console is skipped
+        lines = re.findall(br'^[A-Za-z0-9+/]+={0,2}\s*$', data, re.M)
+        data = b''.join(base64.b64decode(line.strip()) for line in lines)
+
+    out = io.open(sys.stdout.fileno(), 'w', encoding='utf-8', errors='replace', closefd=False)
+    decode(data, elf, args.utc, out)
+    out.flush()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,149 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Local stand-in of the device log server, to test the iothub log uploads.
+
+Point CONFIG_QCLOUD_LOG_UPLOAD_URL to http://<host>:<port>/cgi-bin/report-log.
+Every request is inflated when sent with Content-Encoding: deflate, its
+signature is checked when the device secret is given, and the lines of the
+batch are printed with the counters of the request and of the connection.
+
+usage: log_upload_server.py [--port PORT] [--secret SECRET] [--quiet]
+"""
+
+from __future__ import print_function
+
+import argparse
+import hashlib
+import hmac
+import re
+import sys
+import zlib
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+
+SIGNATURE_SIZE = 40
+HEADER_SIZE = SIGNATURE_SIZE + 4 + 10 + 48 + 10  # esp_qcloud_log_iothub_header_t
+LINE_START = re.compile(br'(DIS|ERR|WRN|INF|DBG|VRB)\|\d{4}-\d\d-\d\d \d\d:\d\d:\d\d\|')
+
+
+class Totals(object):
+    requests = 0
+    lines = 0
+    body_bytes = 0
+    sent_bytes = 0
+    connections = 0
+
+
+def split_lines(batch):
+    """Each line is the level and the time in fixed width fields followed by the text"""
+    starts = [match.start() for match in LINE_START.finditer(batch, HEADER_SIZE)]
+    return [batch[start:end] for start, end in zip(starts, starts[1:] + [len(batch)])]
+
+
+class LogUploadHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'  # Keep the connections alive like the real server
+
+    def setup(self):
+        BaseHTTPRequestHandler.setup(self)
+        self.connection_requests = 0
+        Totals.connections += 1
+
+    def reply(self, status, message):
+        body = message.encode('utf-8')
+        self.send_response(status)
+        self.send_header('Content-Type', 'text/plain')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        sent = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        batch = sent
+
+        if self.headers.get('Content-Encoding') == 'deflate':
+            try:
+                batch = zlib.decompress(sent)
+            except zlib.error as e:
+                return self.reply(400, 'inflate: %s' % e)
+
+        if len(batch) < HEADER_SIZE:
+            return self.reply(400, 'short request')
+
+        if self.server.secret:
+            expected = hmac.new(self.server.secret, batch[SIGNATURE_SIZE:], hashlib.sha1).hexdigest()
+
+            if expected.encode('ascii') != batch[:SIGNATURE_SIZE]:
+                return self.reply(403, 'bad signature')
+
+        lines = split_lines(batch)
+        self.connection_requests += 1
+        Totals.requests += 1
+        Totals.lines += len(lines)
+        Totals.body_bytes += len(batch)
+        Totals.sent_bytes += len(sent)
+
+        print('request %d (connection %d, request %d on it): %d lines, %d bytes, %d sent' % (
+            Totals.requests, Totals.connections, self.connection_requests, len(lines), len(batch), len(sent)))
+
+        if not self.server.quiet:
+            for line in lines:
+                print('    ' + line.decode('utf-8', 'replace').rstrip())
+
+        print('total: %d lines in %d requests, %.1f lines/request, %d connections, %d of %d bytes sent' % (
+            Totals.lines, Totals.requests, float(Totals.lines) / Totals.requests, Totals.connections,
+            Totals.sent_bytes, Totals.body_bytes))
+        sys.stdout.flush()
+
+        self.reply(200, 'OK')
+
+    def log_message(self, format, *args):
+        pass
+
+
+class LogUploadServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local stand-in of the device log server')
+    parser.add_argument('--port', type=int, default=8080, help='Port to listen on')
+    parser.add_argument('--secret', help='Device secret, the signatures are checked when given')
+    parser.add_argument('--quiet', action='store_true', help='Only print the counters, not the lines')
+    args = parser.parse_args()
+
+    server = LogUploadServer(('', args.port), LogUploadHandler)
+    server.secret = args.secret.encode('utf-8') if args.secret else None
+    server.quiet = args.quiet
+
+    print('Listening on port %d' % args.port)
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,162 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Compare the cost of dispatching a message with the previous linear
+ *        strncmp() scan and with the hashed subscription table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_qcloud_mqtt_sub.h"
+
+#define BENCH_DISPATCH_NUM  (200000)
+
+static volatile size_t g_called = 0;
+
+static void bench_cb(const char *topic, void *payload, size_t payload_len, void *priv_data)
+{
+    g_called++;
+}
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief The dispatch before the subscription table: strncmp() over every slot.
+ */
+static void bench_linear_dispatch(char **topics, size_t topic_num, const char *topic, size_t topic_len)
+{
+    for (size_t i = 0; i < topic_num; i++) {
+        if (strncmp(topic, topics[i], topic_len) == 0) {
+            bench_cb(topics[i], NULL, 0, NULL);
+        }
+    }
+}
+
+static void bench_run(size_t topic_num, size_t wildcard_num)
+{
+    esp_qcloud_mqtt_sub_table_t table = {0};
+    esp_qcloud_mqtt_sub_hit_t hit[8];
+    char **topics = calloc(topic_num, sizeof(char *));
+    size_t *topic_len = calloc(topic_num, sizeof(size_t));
+    bool added = false;
+    char filter[64];
+
+    for (size_t i = 0; i < topic_num; i++) {
+        topics[i] = malloc(64);
+        topic_len[i] = snprintf(topics[i], 64, "$thing/down/property/PRODUCT%03zu/device_%zu", i % 7, i);
+        esp_qcloud_mqtt_sub_add(&table, topics[i], bench_cb, NULL, &added);
+    }
+
+    for (size_t i = 0; i < wildcard_num; i++) {
+        snprintf(filter, sizeof(filter), "$thing/down/+/PRODUCT%03zu/#", 100 + i);
+        esp_qcloud_mqtt_sub_add(&table, filter, bench_cb, NULL, &added);
+    }
+
+    srand(1);
+    size_t *order = malloc(BENCH_DISPATCH_NUM * sizeof(size_t));
+
+    for (size_t i = 0; i < BENCH_DISPATCH_NUM; i++) {
+        order[i] = rand() % topic_num;
+    }
+
+    double start = bench_now_ns();
+
+    for (size_t i = 0; i < BENCH_DISPATCH_NUM; i++) {
+        bench_linear_dispatch(topics, topic_num, topics[order[i]], topic_len[order[i]]);
+    }
+
+    double linear_ns = (bench_now_ns() - start) / BENCH_DISPATCH_NUM;
+
+    start = bench_now_ns();
+
+    for (size_t i = 0; i < BENCH_DISPATCH_NUM; i++) {
+        size_t hit_num = esp_qcloud_mqtt_sub_match(&table, topics[order[i]], topic_len[order[i]], hit, 8);
+
+        for (size_t j = 0; j < hit_num && j < 8; j++) {
+            hit[j].cb(topics[order[i]], NULL, 0, hit[j].priv);
+        }
+    }
+
+    double table_ns = (bench_now_ns() - start) / BENCH_DISPATCH_NUM;
+
+    printf("%8zu %9zu %12.1f %12.1f\n", topic_num, wildcard_num, linear_ns, table_ns);
+
+    esp_qcloud_mqtt_sub_clear(&table);
+
+    for (size_t i = 0; i < topic_num; i++) {
+        free(topics[i]);
+    }
+
+    free(topics);
+    free(topic_len);
+    free(order);
+}
+
+static int bench_check(void)
+{
+    static const struct {
+        const char *filter;
+        const char *topic;
+        bool match;
+    } cases[] = {
+        {"a/b/c",   "a/b/c",    true},
+        {"a/+/c",   "a/b/c",    true},
+        {"a/+/c",   "a/b/d",    false},
+        {"a/+",     "a/b/c",    false},
+        {"a/+",     "a/",       true},
+        {"a/#",     "a",        true},
+        {"a/#",     "a/b/c",    true},
+        {"#",       "a/b",      true},
+        {"#",       "$sys/a",   false},
+        {"+/b",     "$sys/b",   false},
+        {"a/b",     "a/bc",     false},
+    };
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (esp_qcloud_mqtt_sub_filter_match(cases[i].filter, cases[i].topic, strlen(cases[i].topic)) != cases[i].match) {
+            printf("FAIL: filter: %s, topic: %s\n", cases[i].filter, cases[i].topic);
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    static const size_t topic_num[] = {6, 16, 64, 256, 1024};
+
+    if (bench_check()) {
+        return 1;
+    }
+
+    printf("%8s %9s %12s %12s\n", "topics", "wildcards", "linear(ns)", "table(ns)");
+
+    for (size_t i = 0; i < sizeof(topic_num) / sizeof(topic_num[0]); i++) {
+        bench_run(topic_num[i], 0);
+        bench_run(topic_num[i], 2);
+    }
+
+    return 0;
+}
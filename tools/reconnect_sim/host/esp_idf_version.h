@@ -0,0 +1,6 @@
+/* Minimal esp_idf_version.h to build the reconnect policy on the host */
+
+#pragma once
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) ((major << 16) | (minor << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5, 1, 0)
@@ -0,0 +1,11 @@
+/* esp_random() on the host, seeded by srand() */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static inline uint32_t esp_random(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
@@ -0,0 +1,190 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Simulate a fleet of devices reconnecting after a broker outage.
+ *
+ * All the devices lose the connection at the same moment, the broker comes
+ * back after the outage and accepts a limited number of connections per
+ * second, the attempts above that are refused. The peak connect rate seen by
+ * the broker and the time until the whole fleet is back are compared for a
+ * fixed retry interval (the esp-mqtt default), a plain exponential backoff
+ * and esp_qcloud_backoff_next().
+ *
+ * usage: reconnect_sim [devices] [outage_s] [capacity_per_s]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_qcloud_backoff.h"
+
+#define SIM_BASE_MS             (1000)
+#define SIM_CAP_MS              (60000)
+#define SIM_STABLE_MS           (60000)
+#define SIM_FIXED_MS            (10000)     /**< reconnect_timeout_ms of esp-mqtt */
+#define SIM_HORIZON_S           (3600)
+
+typedef enum {
+    SIM_POLICY_FIXED,
+    SIM_POLICY_EXPONENTIAL,
+    SIM_POLICY_DECORRELATED,
+} sim_policy_t;
+
+typedef struct {
+    uint32_t time_ms;
+    uint32_t device;
+} sim_event_t;
+
+typedef struct {
+    sim_event_t *event;
+    size_t num;
+} sim_heap_t;
+
+static void sim_heap_push(sim_heap_t *heap, sim_event_t event)
+{
+    size_t i = heap->num++;
+
+    for (; i && heap->event[(i - 1) / 2].time_ms > event.time_ms; i = (i - 1) / 2) {
+        heap->event[i] = heap->event[(i - 1) / 2];
+    }
+
+    heap->event[i] = event;
+}
+
+static sim_event_t sim_heap_pop(sim_heap_t *heap)
+{
+    sim_event_t top  = heap->event[0];
+    sim_event_t last = heap->event[--heap->num];
+    size_t i = 0;
+
+    for (size_t child = 1; child < heap->num; i = child, child = 2 * i + 1) {
+        if (child + 1 < heap->num && heap->event[child + 1].time_ms < heap->event[child].time_ms) {
+            child++;
+        }
+
+        if (heap->event[child].time_ms >= last.time_ms) {
+            break;
+        }
+
+        heap->event[i] = heap->event[child];
+    }
+
+    heap->event[i] = last;
+
+    return top;
+}
+
+static uint32_t sim_delay(sim_policy_t policy, esp_qcloud_backoff_t *backoff, uint32_t now_ms)
+{
+    switch (policy) {
+    case SIM_POLICY_FIXED:
+        return SIM_FIXED_MS;
+
+    case SIM_POLICY_EXPONENTIAL: {
+        uint32_t delay = SIM_BASE_MS << (backoff->attempt < 16 ? backoff->attempt : 16);
+        backoff->attempt++;
+        return delay < SIM_CAP_MS ? delay : SIM_CAP_MS;
+    }
+
+    default:
+        return esp_qcloud_backoff_next(backoff, now_ms);
+    }
+}
+
+static void sim_run(const char *name, sim_policy_t policy, uint32_t device_num, uint32_t outage_s, uint32_t capacity)
+{
+    const esp_qcloud_backoff_config_t config = {
+        .base_ms   = SIM_BASE_MS,
+        .cap_ms    = SIM_CAP_MS,
+        .stable_ms = SIM_STABLE_MS,
+    };
+    esp_qcloud_backoff_t *backoff = calloc(device_num, sizeof(esp_qcloud_backoff_t));
+    uint32_t *attempts = calloc(SIM_HORIZON_S, sizeof(uint32_t));
+    sim_heap_t heap = {.event = calloc(device_num, sizeof(sim_event_t))};
+    uint32_t connected = 0;
+    uint32_t done_ms   = 0;
+    uint64_t total     = 0;
+
+    srand(1);
+
+    /**< Every device sees the disconnection at t = 0 */
+    for (uint32_t i = 0; i < device_num; i++) {
+        esp_qcloud_backoff_init(backoff + i, &config);
+        sim_heap_push(&heap, (sim_event_t) {
+            sim_delay(policy, backoff + i, 0), i
+        });
+    }
+
+    while (heap.num) {
+        sim_event_t event = sim_heap_pop(&heap);
+        uint32_t second   = event.time_ms / 1000;
+
+        if (second >= SIM_HORIZON_S) {
+            break;
+        }
+
+        attempts[second]++;
+        total++;
+
+        if (event.time_ms >= outage_s * 1000 && attempts[second] <= capacity) {
+            connected++;
+            done_ms = event.time_ms;
+            continue;
+        }
+
+        event.time_ms += sim_delay(policy, backoff + event.device, event.time_ms);
+        sim_heap_push(&heap, event);
+    }
+
+    uint32_t peak = 0;
+    uint32_t peak_recovery = 0;
+
+    for (uint32_t i = 0; i < SIM_HORIZON_S; i++) {
+        peak = attempts[i] > peak ? attempts[i] : peak;
+
+        if (i >= outage_s) {
+            peak_recovery = attempts[i] > peak_recovery ? attempts[i] : peak_recovery;
+        }
+    }
+
+    printf("%-14s %10u %16u %12llu %10u", name, peak, peak_recovery, (unsigned long long)total, connected);
+
+    if (connected == device_num) {
+        printf(" %12.1f\n", done_ms / 1000.0);
+    } else {
+        printf(" %12s\n", "-");
+    }
+
+    free(backoff);
+    free(attempts);
+    free(heap.event);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t device_num = argc > 1 ? atoi(argv[1]) : 10000;
+    uint32_t outage_s   = argc > 2 ? atoi(argv[2]) : 60;
+    uint32_t capacity   = argc > 3 ? atoi(argv[3]) : 500;
+
+    printf("devices: %u, outage: %u s, broker capacity: %u connects/s\n\n", device_num, outage_s, capacity);
+    printf("%-14s %10s %16s %12s %10s %12s\n", "policy", "peak/s", "peak/s recovery", "attempts", "connected", "all back (s)");
+
+    sim_run("fixed 10s", SIM_POLICY_FIXED, device_num, outage_s, capacity);
+    sim_run("exponential", SIM_POLICY_EXPONENTIAL, device_num, outage_s, capacity);
+    sim_run("decorrelated", SIM_POLICY_DECORRELATED, device_num, outage_s, capacity);
+
+    return 0;
+}